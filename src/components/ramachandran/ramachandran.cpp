@@ -1291,7 +1291,12 @@ struct Ramachandran : viamd::EventHandler {
         user_data->frame_stride = frame_stride;
         user_data->sigma = blur_sigma;
 
-        task_system::ID id = task_system::pool_enqueue(STR_LIT("Rama density"), [](void* user_data) {
+        // The sums are handed to the upload on the main thread, rather than written to the representation while it is in use
+        struct Result {
+            float den_sum[4];
+        };
+
+        task_system::ID id = task_system::pool_enqueue_with_result<Result>(STR_LIT("Rama density"), [](Result* result, void* user_data) {
             UserData* data = (UserData*)user_data;
             const float angle_to_coord_scale = 1.0f / (2.0f * PI);
             const float angle_to_coord_offset = 0.5f;
@@ -1328,20 +1333,19 @@ struct Ramachandran : viamd::EventHandler {
 
             blur_density_gaussian(data->density_tex, density_tex_dim, data->sigma);
 
-            data->rep->den_sum[0] = (float)sum[0];
-            data->rep->den_sum[1] = (float)sum[1];
-            data->rep->den_sum[2] = (float)sum[2];
-            data->rep->den_sum[3] = (float)sum[3];
-            }, user_data);
-
-        task_system::main_enqueue(STR_LIT("##Update rama texture"), [](void* user_data) {
+            result->den_sum[0] = (float)sum[0];
+            result->den_sum[1] = (float)sum[1];
+            result->den_sum[2] = (float)sum[2];
+            result->den_sum[3] = (float)sum[3];
+            }, [](Result* result, void* user_data) {
             UserData* data = (UserData*)user_data;
+            MEMCPY(data->rep->den_sum, result->den_sum, sizeof(data->rep->den_sum));
             glBindTexture(GL_TEXTURE_2D, data->rep->den_tex);
             glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, density_tex_dim, density_tex_dim, GL_RGBA, GL_FLOAT, data->density_tex);
             glBindTexture(GL_TEXTURE_2D, 0);
 
             md_free(md_get_heap_allocator(), data, data->alloc_size);
-            }, user_data, id);
+            }, user_data, 0, 0, task_system::Priority::Interactive);
 
         return id;
     }
@@ -411,7 +411,10 @@ struct VeloxChem : viamd::EventHandler {
             payload->pgtos   = orb.pgtos;
             payload->tex_id  = *data.dst_texture;
 
-            orb.compute_volume_task = task_system::pool_enqueue(STR_LIT("Evaluate Orbital"), 0, num_blocks, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+            // Number of blocks evaluated, which is less than the total if the evaluation was interrupted
+            using Result = std::atomic_uint32_t;
+
+            orb.compute_volume_task = task_system::pool_enqueue_with_result<Result>(STR_LIT("Evaluate Orbital"), 0, num_blocks, [](uint32_t range_beg, uint32_t range_end, Result* result, void* user_data, task_system::Token* token) {
                 Payload* data = (Payload*)user_data;
 
                 // Number of NxNxN blocks in each dimension
@@ -435,7 +438,7 @@ struct VeloxChem : viamd::EventHandler {
                     .stepsize = {step.x, step.y, step.z},
                 };
 
-                for (uint32_t i = range_beg; i < range_end; ++i) {
+                for (uint32_t i = range_beg; i < range_end && !task_system::token_cancelled(token); ++i) {
                     // Determine block index
                     int blk_x =  i % num_blk[0];
                     int blk_y = (i / num_blk[0]) % num_blk[1];
@@ -450,15 +453,16 @@ struct VeloxChem : viamd::EventHandler {
                     }
 
                     md_gto_grid_evaluate_sub(&grid, off_idx, len_idx, data->pgtos, md_array_size(data->pgtos), eval_mode);
+                    task_system::token_progress(token);
+                    result->fetch_add(1);
                 }
-            }, payload);
-
-            // Launch task for main (render) thread to update the volume texture
-            task_system::main_enqueue(STR_LIT("Update Volume"), [](void* user_data) {
+            }, [](Result* result, void* user_data) {
+                // Update the volume texture on the main (render) thread
                 Payload* data = (Payload*)user_data;
+                MD_LOG_DEBUG("Evaluated %u blocks of orbital %i", result->load(), data->mo_idx);
                 gl::set_texture_3D_data(data->tex_id, data->vol->data, GL_R32F);
                 md_free(md_get_heap_allocator(), data, sizeof(Payload));
-            }, payload, orb.compute_volume_task);
+            }, payload, 0, 0, task_system::Priority::Interactive);
         }
     }
 
@@ -521,7 +525,10 @@ struct VeloxChem : viamd::EventHandler {
             // We evaluate the in parallel over smaller NxNxN blocks
             uint32_t num_blocks = (orb.vol.dim[0] / BLK_DIM) * (orb.vol.dim[1] / BLK_DIM) * (orb.vol.dim[2] / BLK_DIM);
 
-            orb.compute_volume_task = task_system::pool_enqueue(STR_LIT("Compute Volume"), 0, num_blocks, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+            // Number of blocks evaluated, which is less than the total if the evaluation was interrupted
+            using Result = std::atomic_uint32_t;
+
+            orb.compute_volume_task = task_system::pool_enqueue_with_result<Result>(STR_LIT("Compute Volume"), 0, num_blocks, [](uint32_t range_beg, uint32_t range_end, Result* result, void* user_data, task_system::Token* token) {
                 Orb* orb = (Orb*)user_data;
 
                 // Number of NxNxN blocks in each dimension
@@ -545,7 +552,7 @@ struct VeloxChem : viamd::EventHandler {
                     .stepsize = {step.x, step.y, step.z},
                 };
 
-                for (uint32_t i = range_beg; i < range_end; ++i) {
+                for (uint32_t i = range_beg; i < range_end && !task_system::token_cancelled(token); ++i) {
                     // Determine block index
                     int blk_x =  i % num_blk[0];
                     int blk_y = (i / num_blk[0]) % num_blk[1];
@@ -556,15 +563,16 @@ struct VeloxChem : viamd::EventHandler {
 
                     md_gto_eval_mode_t eval_mode = vol_mode == 0 ? MD_GTO_EVAL_MODE_PSI : MD_GTO_EVAL_MODE_PSI_SQUARED;
                     md_gto_grid_evaluate_sub(&grid, off_idx, len_idx, orb->pgtos, md_array_size(orb->pgtos), eval_mode);
+                    task_system::token_progress(token);
+                    result->fetch_add(1);
                 }
-            }, &this->orb);
-
-            // Launch task for main (render) thread to update the volume texture
-            task_system::main_enqueue(STR_LIT("Update Volume"), [](void* user_data) {
+            }, [](Result* result, void* user_data) {
+                // Update the volume texture on the main (render) thread
                 Orb* orb = (Orb*)user_data;
+                MD_LOG_DEBUG("Evaluated %u blocks of orbital %i", result->load(), orb->mo_idx);
                 gl::init_texture_3D(&orb->vol_texture, orb->vol.dim[0], orb->vol.dim[1], orb->vol.dim[2], GL_R16F);
                 gl::set_texture_3D_data(orb->vol_texture, orb->vol.data, GL_R32F);
-            }, &this->orb, orb.compute_volume_task);
+            }, &this->orb, 0, 0, task_system::Priority::Interactive);
         }
     }
 
@@ -0,0 +1,287 @@
+#include "gpu_profiler.h"
+
+#include <gfx/gl.h>
+#include <profiler.h>
+
+#include <core/md_common.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+
+#include <string.h>
+
+namespace gpu_profiler {
+
+// Number of query sets, the queries of a frame are read back once they are available. Drivers may queue several frames (vsync off, software
+// rasterizers), a frame whose results are still not available when its set is about to be reused is skipped rather than waited for.
+constexpr uint32_t NUM_FRAMES = 4;
+constexpr uint32_t MAX_DEPTH  = 32;
+constexpr uint32_t MAX_STATS  = 256;
+constexpr uint32_t AVG_WINDOW = 64;
+
+struct Section {
+    char label[GPU_PROFILER_LABEL_SIZE];
+    uint64_t key;       // Hash of the label and the labels of the enclosing sections
+    uint32_t depth;
+    bool ended;
+};
+
+// Order in which the timestamps were issued, to replay the sections as begin/end events
+struct Marker {
+    uint32_t section;
+    bool end;
+};
+
+struct Frame {
+    Section sections[GPU_PROFILER_MAX_SECTIONS];
+    Marker  markers[GPU_PROFILER_MAX_SECTIONS * 2];
+    GLuint  queries[GPU_PROFILER_MAX_SECTIONS * 2];
+    uint32_t num_sections;
+    uint32_t num_markers;
+    // Reference points of the GPU and CPU clocks, for placing the sections on the timeline of the profiler
+    int64_t gpu_ref;
+    int64_t cpu_ref;
+    bool synced;
+    bool pending;
+};
+
+struct Stat {
+    uint64_t key;
+    float samples[AVG_WINDOW];
+    uint32_t count;
+};
+
+static struct {
+    Frame frames[NUM_FRAMES] = {};
+    uint32_t frame_idx = 0;
+    bool frame_active = false;
+    bool enabled = false;
+    bool initialized = false;
+
+    int32_t stack[MAX_DEPTH] = {};  // Section indices, -1 for sections which are not timed
+    uint32_t stack_size = 0;        // May exceed MAX_DEPTH, sections beyond it are not timed
+
+    Stat stats[MAX_STATS] = {};
+    uint32_t num_stats = 0;
+
+    FrameStats last = {};
+    bool has_last = false;
+
+    double seconds_per_tick = 0;
+} gpu;
+
+static inline uint64_t hash_label(uint64_t seed, const char* str) {
+    uint64_t h = seed ^ 14695981039346656037ULL;
+    for (const char* c = str; *c; ++c) {
+        h = (h ^ (uint8_t)*c) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static float update_average(uint64_t key, float time_ms) {
+    Stat* stat = 0;
+    for (uint32_t i = 0; i < gpu.num_stats; ++i) {
+        if (gpu.stats[i].key == key) {
+            stat = &gpu.stats[i];
+            break;
+        }
+    }
+    if (!stat) {
+        if (gpu.num_stats == MAX_STATS) return time_ms;
+        stat = &gpu.stats[gpu.num_stats++];
+        stat->key = key;
+        stat->count = 0;
+    }
+
+    stat->samples[stat->count % AVG_WINDOW] = time_ms;
+    stat->count += 1;
+
+    const uint32_t n = MIN(stat->count, AVG_WINDOW);
+    float sum = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        sum += stat->samples[i];
+    }
+    return sum / (float)n;
+}
+
+static inline int64_t gpu_to_cpu_time(const Frame& frame, uint64_t gpu_time) {
+    const double seconds = (double)((int64_t)gpu_time - frame.gpu_ref) * 1.0e-9;
+    return frame.cpu_ref + (int64_t)(seconds / gpu.seconds_per_tick);
+}
+
+// Timestamps complete in the order they were issued, so the results of a frame are available once its last query is
+static bool frame_available(const Frame& frame) {
+    if (frame.num_markers == 0) return true;
+    const Marker& m = frame.markers[frame.num_markers - 1];
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(frame.queries[m.section * 2 + (m.end ? 1 : 0)], GL_QUERY_RESULT_AVAILABLE, &available);
+    return available == GL_TRUE;
+}
+
+static void resolve_frame(Frame& frame) {
+    if (!frame.pending) return;
+    frame.pending = false;
+
+    // Only called once the results are available, so this does not stall
+    uint64_t times[GPU_PROFILER_MAX_SECTIONS * 2];
+    for (uint32_t i = 0; i < frame.num_sections; ++i) {
+        if (!frame.sections[i].ended) continue;
+        glGetQueryObjectui64v(frame.queries[i * 2 + 0], GL_QUERY_RESULT, &times[i * 2 + 0]);
+        glGetQueryObjectui64v(frame.queries[i * 2 + 1], GL_QUERY_RESULT, &times[i * 2 + 1]);
+    }
+
+    FrameStats& last = gpu.last;
+    last.num_sections = 0;
+    last.total_ms = 0;
+    for (uint32_t i = 0; i < frame.num_sections; ++i) {
+        const Section& sec = frame.sections[i];
+        if (!sec.ended) continue;
+        const float time_ms = (float)((double)(times[i * 2 + 1] - times[i * 2 + 0]) * 1.0e-6);
+        SectionStats& out = last.sections[last.num_sections++];
+        MEMCPY(out.label, sec.label, sizeof(out.label));
+        out.depth = sec.depth;
+        out.time_ms = time_ms;
+        out.avg_ms = update_average(sec.key, time_ms);
+        if (sec.depth == 0) {
+            last.total_ms += time_ms;
+        }
+    }
+    gpu.has_last = true;
+
+    if (frame.synced && profiler::is_recording()) {
+        for (uint32_t i = 0; i < frame.num_markers; ++i) {
+            const Marker& m = frame.markers[i];
+            const Section& sec = frame.sections[m.section];
+            if (!sec.ended) continue;
+            const int64_t t = gpu_to_cpu_time(frame, times[m.section * 2 + (m.end ? 1 : 0)]);
+            if (m.end) {
+                profiler::gpu_section_end(t);
+            } else {
+                profiler::gpu_section_begin(sec.label, t);
+            }
+        }
+    }
+}
+
+void initialize() {
+    if (!glQueryCounter) {
+        MD_LOG_INFO("Timer queries are not supported, GPU sections will not be timed");
+        return;
+    }
+    for (uint32_t i = 0; i < NUM_FRAMES; ++i) {
+        glGenQueries((GLsizei)ARRAY_SIZE(gpu.frames[i].queries), gpu.frames[i].queries);
+    }
+    gpu.seconds_per_tick = md_time_as_seconds(1);
+    gpu.initialized = true;
+}
+
+void shutdown() {
+    if (!gpu.initialized) return;
+    for (uint32_t i = 0; i < NUM_FRAMES; ++i) {
+        glDeleteQueries((GLsizei)ARRAY_SIZE(gpu.frames[i].queries), gpu.frames[i].queries);
+    }
+    gpu.initialized = false;
+    gpu.enabled = false;
+}
+
+bool is_enabled() {
+    return gpu.enabled;
+}
+
+void set_enabled(bool enable) {
+    if (!gpu.initialized) return;
+    if (!enable) {
+        // Results which have not been read back would be stale once enabled again
+        for (uint32_t i = 0; i < NUM_FRAMES; ++i) {
+            gpu.frames[i].pending = false;
+        }
+        gpu.frame_active = false;
+        gpu.num_stats = 0;
+        gpu.has_last = false;
+    }
+    gpu.enabled = enable;
+}
+
+void new_frame() {
+    gpu.frame_active = false;
+    gpu.stack_size = 0;
+    if (!gpu.enabled) return;
+
+    gpu.frame_idx = (gpu.frame_idx + 1) % NUM_FRAMES;
+    // Oldest first, so the sections are handed to the profiler in order
+    for (uint32_t i = 0; i < NUM_FRAMES; ++i) {
+        Frame& pending = gpu.frames[(gpu.frame_idx + i) % NUM_FRAMES];
+        if (!pending.pending) continue;
+        if (!frame_available(pending)) break;
+        resolve_frame(pending);
+    }
+
+    Frame& frame = gpu.frames[gpu.frame_idx];
+    // Still in flight, its queries are reissued below
+    frame.pending = false;
+
+    frame.num_sections = 0;
+    frame.num_markers = 0;
+    frame.synced = false;
+    if (profiler::is_recording()) {
+        glGetInteger64v(GL_TIMESTAMP, &frame.gpu_ref);
+        frame.cpu_ref = md_time_current();
+        frame.synced = true;
+    }
+    gpu.frame_active = true;
+}
+
+void push_section(const char* label) {
+    if (glPushDebugGroup) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, GL_KHR_debug, -1, label);
+
+    if (gpu.stack_size >= MAX_DEPTH) {
+        gpu.stack_size += 1;
+        return;
+    }
+
+    int32_t idx = -1;
+    Frame& frame = gpu.frames[gpu.frame_idx];
+    if (gpu.frame_active && frame.num_sections < GPU_PROFILER_MAX_SECTIONS) {
+        idx = (int32_t)frame.num_sections++;
+        Section& sec = frame.sections[idx];
+        const size_t len = MIN(strlen(label), sizeof(sec.label) - 1);
+        MEMCPY(sec.label, label, len);
+        sec.label[len] = '\0';
+        sec.depth = 0;
+        uint64_t parent_key = 0;
+        for (uint32_t i = 0; i < gpu.stack_size; ++i) {
+            if (gpu.stack[i] != -1) {
+                parent_key = frame.sections[gpu.stack[i]].key;
+                sec.depth += 1;
+            }
+        }
+        sec.key = hash_label(parent_key, sec.label);
+        sec.ended = false;
+        frame.markers[frame.num_markers++] = {(uint32_t)idx, false};
+        glQueryCounter(frame.queries[idx * 2 + 0], GL_TIMESTAMP);
+    }
+    gpu.stack[gpu.stack_size++] = idx;
+}
+
+void pop_section() {
+    if (glPopDebugGroup) glPopDebugGroup();
+
+    if (gpu.stack_size == 0) return;
+    if (--gpu.stack_size >= MAX_DEPTH) return;
+    const int32_t idx = gpu.stack[gpu.stack_size];
+    if (idx == -1 || !gpu.frame_active) return;
+
+    Frame& frame = gpu.frames[gpu.frame_idx];
+    glQueryCounter(frame.queries[idx * 2 + 1], GL_TIMESTAMP);
+    frame.markers[frame.num_markers++] = {(uint32_t)idx, true};
+    frame.sections[idx].ended = true;
+    frame.pending = true;
+}
+
+bool get_frame_stats(FrameStats* stats) {
+    ASSERT(stats);
+    if (!gpu.enabled || !gpu.has_last) return false;
+    MEMCPY(stats, &gpu.last, sizeof(FrameStats));
+    return true;
+}
+
+}  // namespace gpu_profiler
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// GPU timings of the sections marked with PUSH_GPU_SECTION / POP_GPU_SECTION.
+// Sections are bracketed by timestamp queries which are read back once they are available, so the CPU never waits on the GPU for them.
+// Frames whose results take longer than the number of query sets to arrive are skipped.
+// Sections may be nested. When timing is disabled the sections are only debug groups (visible in RenderDoc, apitrace etc.).
+
+#define PUSH_GPU_SECTION(lbl) { gpu_profiler::push_section(lbl); }
+#define POP_GPU_SECTION()     { gpu_profiler::pop_section(); }
+
+#define GPU_PROFILER_MAX_SECTIONS 128
+#define GPU_PROFILER_LABEL_SIZE 48
+
+namespace gpu_profiler {
+
+struct SectionStats {
+    char label[GPU_PROFILER_LABEL_SIZE];
+    uint32_t depth;
+    float time_ms;      // Time of the last resolved frame
+    float avg_ms;       // Rolling average over the last frames the section was part of
+};
+
+struct FrameStats {
+    uint32_t num_sections;
+    float total_ms;     // Sum of the top level sections
+    SectionStats sections[GPU_PROFILER_MAX_SECTIONS];   // In the order they were pushed
+};
+
+// Requires a current GL context
+void initialize();
+void shutdown();
+
+bool is_enabled();
+void set_enabled(bool enable);
+
+// Call once per frame before any section is pushed.
+// Resolves the timings of the previous frames which are available, when the profiler is recording they are also handed over to it.
+void new_frame();
+
+void push_section(const char* label);
+void pop_section();
+
+// Timings of the most recently resolved frame
+bool get_frame_stats(FrameStats* stats);
+
+}  // namespace gpu_profiler
@@ -32,6 +32,7 @@
 #include <core/md_hash.h>
 
 #include <gfx/gl_utils.h>
+#include <gfx/gpu_profiler.h>
 
 #include <stdio.h>
 #include <string.h>
@@ -39,15 +40,6 @@
 
 #include <shaders.inl>
 
-#define PUSH_GPU_SECTION(lbl)                                                                       \
-    {                                                                                               \
-        if (glPushDebugGroup) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, GL_KHR_debug, -1, lbl); \
-    }
-#define POP_GPU_SECTION()                       \
-    {                                           \
-        if (glPopDebugGroup) glPopDebugGroup(); \
-    }
-
 namespace postprocessing {
 
 // @TODO: Use half-res render targets for SSAO
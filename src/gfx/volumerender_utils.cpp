@@ -2,6 +2,7 @@
 
 #include <gfx/gl.h>
 #include <gfx/gl_utils.h>
+#include <gfx/gpu_profiler.h>
 #include <gfx/postprocessing_utils.h>
 #include <color_utils.h>
 
@@ -14,15 +15,6 @@
 
 #include <shaders.inl>
 
-#define PUSH_GPU_SECTION(lbl)                                                                       \
-    {                                                                                               \
-        if (glPushDebugGroup) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, GL_KHR_debug, -1, lbl); \
-    }
-#define POP_GPU_SECTION()                       \
-    {                                           \
-        if (glPopDebugGroup) glPopDebugGroup(); \
-    }
-
 static constexpr str_t v_shader_src_fs_quad = STR_LIT(
     R"(
 #version 150 core
@@ -306,6 +306,31 @@ bool DeleteButton(const char* label, const ImVec2& size) {
     return res;
 }
 
+void IndeterminateProgressBar(const ImVec2& size_arg, const char* overlay) {
+    ImGuiWindow* window = GetCurrentWindow();
+    if (window->SkipItems) return;
+
+    ImGuiContext& g = *GImGui;
+    const ImGuiStyle& style = g.Style;
+    const ImVec2 pos = window->DC.CursorPos;
+    const ImVec2 size = CalcItemSize(size_arg, CalcItemWidth(), g.FontSize + style.FramePadding.y * 2.0f);
+    const ImRect bb(pos, pos + size);
+    ItemSize(size, style.FramePadding.y);
+    if (!ItemAdd(bb, 0)) return;
+
+    RenderFrame(bb.Min, bb.Max, GetColorU32(ImGuiCol_FrameBg), true, style.FrameRounding);
+    const ImRect inner(bb.Min + ImVec2(style.FrameBorderSize, style.FrameBorderSize), bb.Max - ImVec2(style.FrameBorderSize, style.FrameBorderSize));
+    const float width = 0.25f;
+    const float t = ImFmod((float)g.Time * 0.75f, 2.0f);
+    const float beg = (t < 1.0f ? t : 2.0f - t) * (1.0f - width);
+    RenderRectFilledRangeH(window->DrawList, inner, GetColorU32(ImGuiCol_PlotHistogram), beg, beg + width, style.FrameRounding);
+
+    if (overlay) {
+        const ImVec2 overlay_size = CalcTextSize(overlay, NULL);
+        RenderTextClipped(bb.Min, bb.Max, overlay, NULL, &overlay_size, ImVec2(0.5f, 0.5f), &bb);
+    }
+}
+
 void PushDisabled() {
     ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
     ImGui::PushStyleVar(ImGuiStyleVar_Alpha, ImGui::GetStyle().Alpha * 0.5f);
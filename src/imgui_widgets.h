@@ -19,6 +19,8 @@ IMGUI_API bool RangeSliderFloat(const char* label, float* v1, float* v2, float v
 
 // custom ImGui procedures
 bool DeleteButton(const char* label, const ImVec2& size = ImVec2(0, 0));
+// Progress bar for work which does not know how far it has come, a segment sweeps back and forth across the bar
+void IndeterminateProgressBar(const ImVec2& size_arg, const char* overlay = NULL);
 void CreateDockspace();
 void BeginCanvas(const char* id, bool allow_inputs = false);
 void EndCanvas();
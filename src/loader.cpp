@@ -7,6 +7,9 @@
 #include <core/md_bitfield.h>
 #include <core/md_os.h>
 #include <core/md_parse.h>
+#include <core/md_platform.h>
+#include <core/md_intrinsics.h>
+#include <md_molecule.h>
 #include <md_pdb.h>
 #include <md_gro.h>
 #include <md_xtc.h>
@@ -14,17 +17,26 @@
 #include <md_xyz.h>
 #include <md_mmcif.h>
 #include <md_lammps.h>
-//#include <md_dcd.h>
 #include <md_trajectory.h>
-#include <md_frame_cache.h>
 #include <md_util.h>
 #if MD_VLX
 #include <md_vlx.h>
 #endif
 
-#include <string.h>
+#include <stdio.h>
+#include <atomic>
 
-#include "task_system.h"
+#if MD_PLATFORM_OSX
+#include <mach/mach.h>
+#include <unistd.h>
+#endif
+
+#include "loader/loader_internal.h"
+
+#define CACHE_AUTO_BUDGET_INTERVAL_IN_SECONDS 2.0
+
+// Decoded frames kept in the primary cache when the compressed tier is in use
+#define PACKED_WORKING_SET_FRAMES 32
 
 enum mol_loader_t {
     MOL_LOADER_UNKNOWN,
@@ -82,6 +94,8 @@ enum traj_loader_t {
     TRAJ_LOADER_TRR,
     TRAJ_LOADER_XYZ,
     TRAJ_LOADER_LAMMPSTRJ,
+    TRAJ_LOADER_VTRAJ,
+    TRAJ_LOADER_DCD,
     TRAJ_LOADER_COUNT,
 };
 
@@ -92,6 +106,8 @@ static str_t traj_loader_name[] {
 	STR_LIT("Gromacs Lossless Trajectory (trr)"),
 	STR_LIT("XYZ"),
     STR_LIT("Lammps Trajectory [ASCII] (lammpstrj)"),
+    STR_LIT("VIAMD Trajectory (vtraj)"),
+    STR_LIT("CHARMM/NAMD Trajectory (dcd)"),
 };
 
 static str_t traj_loader_ext[] {
@@ -101,6 +117,8 @@ static str_t traj_loader_ext[] {
 	STR_LIT("trr"),
 	STR_LIT("xyz;xmol;arc"),
 	STR_LIT("lammpstrj"),
+	STR_LIT("vtraj"),
+	STR_LIT("dcd"),
 };
 
 static md_trajectory_loader_i* traj_loader_api[] = {
@@ -110,6 +128,8 @@ static md_trajectory_loader_i* traj_loader_api[] = {
 	md_trr_trajectory_loader(),
 	md_xyz_trajectory_loader(),
     md_lammps_trajectory_loader(),
+    native_loader(),
+    dcd_loader(),
 };
 
 struct LoadedMolecule {
@@ -117,22 +137,11 @@ struct LoadedMolecule {
     md_allocator_i* alloc;
 };
 
-struct LoadedTrajectory {
-    uint64_t key;
-    const md_molecule_t* mol;
-    md_trajectory_loader_i* loader;
-    md_trajectory_i* traj;
-    md_frame_cache_t cache;
-    md_allocator_i*  alloc;
-
-    md_array(int32_t) recenter_indices;
-};
-
 static LoadedMolecule loaded_molecules[8] = {};
 static int64_t num_loaded_molecules = 0;
 
-static LoadedTrajectory loaded_trajectories[8] = {};
-static int64_t num_loaded_trajectories = 0;
+LoadedTrajectory loaded_trajectories[8] = {};
+int64_t num_loaded_trajectories = 0;
 
 static inline LoadedMolecule* find_loaded_molecule(uint64_t key) {
     for (int64_t i = 0; i < num_loaded_molecules; ++i) {
@@ -157,13 +166,6 @@ static inline void remove_loaded_molecule(uint64_t key) {
     ASSERT(false);
 }
 
-static inline LoadedTrajectory* find_loaded_trajectory(uint64_t key) {
-    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
-        if (loaded_trajectories[i].key == key) return &loaded_trajectories[i];
-    }
-    return nullptr;
-}
-
 static inline LoadedTrajectory* alloc_loaded_trajectory(uint64_t key) {
     ASSERT(find_loaded_trajectory(key) == NULL);
     ASSERT(num_loaded_trajectories < (int64_t)ARRAY_SIZE(loaded_trajectories));
@@ -176,7 +178,25 @@ static inline LoadedTrajectory* alloc_loaded_trajectory(uint64_t key) {
 static inline void remove_loaded_trajectory(uint64_t key) {
     for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
         if (loaded_trajectories[i].key == key) {
-            md_frame_cache_free(&loaded_trajectories[i].cache);
+            frame_cache_free(loaded_trajectories[i].cache, loaded_trajectories[i].alloc);
+            packed_cache_free(loaded_trajectories[i].packed, loaded_trajectories[i].alloc);
+            spill_cache_free(loaded_trajectories[i].spill, loaded_trajectories[i].alloc);
+            frame_streams_free(loaded_trajectories[i].streams, loaded_trajectories[i].alloc);
+            md_free(loaded_trajectories[i].alloc, loaded_trajectories[i].streams, sizeof(FrameStream) * STREAM_MAX_COUNT);
+            md_free(loaded_trajectories[i].alloc, loaded_trajectories[i].recenter_trans, sizeof(vec3_t) * loaded_trajectories[i].frame_capacity);
+            md_free(loaded_trajectories[i].alloc, loaded_trajectories[i].recenter_trans_gen, sizeof(std::atomic_uint32_t) * loaded_trajectories[i].frame_capacity);
+            md_free(loaded_trajectories[i].alloc, loaded_trajectories[i].resident_bits, sizeof(std::atomic_uint64_t) * resident_words(loaded_trajectories[i].frame_capacity));
+            follow_state_free(loaded_trajectories[i].follow, loaded_trajectories[i].alloc);
+            md_array_free(loaded_trajectories[i].recenter_indices, loaded_trajectories[i].alloc);
+            md_array_free(loaded_trajectories[i].frame_times, loaded_trajectories[i].alloc);
+            for (size_t j = 0; j < md_array_size(loaded_trajectories[i].retired_frame_times); ++j) {
+                md_array_free(loaded_trajectories[i].retired_frame_times[j], loaded_trajectories[i].alloc);
+            }
+            md_array_free(loaded_trajectories[i].retired_frame_times, loaded_trajectories[i].alloc);
+            md_free(loaded_trajectories[i].alloc, loaded_trajectories[i].counters, sizeof(CacheCounters));
+            md_free(loaded_trajectories[i].alloc, loaded_trajectories[i].rebuild_budget, sizeof(std::atomic_size_t));
+            md_semaphore_destroy(loaded_trajectories[i].cache_sema);
+            md_free(loaded_trajectories[i].alloc, loaded_trajectories[i].cache_sema, sizeof(md_semaphore_t));
             loaded_trajectories[i].loader->destroy(loaded_trajectories[i].traj);
             // Swap back and pop
             loaded_trajectories[i] = loaded_trajectories[--num_loaded_trajectories];
@@ -186,6 +206,520 @@ static inline void remove_loaded_trajectory(uint64_t key) {
     ASSERT(false);
 }
 
+static struct {
+    size_t bytes = MEGABYTES(VIAMD_FRAME_CACHE_SIZE);   // 0 = Automatic
+    md_timestamp_t last_update = 0;
+} cache_budget;
+
+static struct {
+    bool  enabled   = false;
+    float precision = 0.01f;    // Ångström, corresponds to the default precision of xtc
+} cache_compression;
+
+// Physical memory which is currently available to the process (without swapping)
+static size_t os_available_ram() {
+#if MD_PLATFORM_WINDOWS
+    MEMORYSTATUSEX status = {};
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status)) {
+        return (size_t)status.ullAvailPhys;
+    }
+#elif MD_PLATFORM_OSX
+    vm_statistics64_data_t vm_stat;
+    mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+    if (host_statistics64(mach_host_self(), HOST_VM_INFO64, (host_info64_t)&vm_stat, &count) == KERN_SUCCESS) {
+        return (size_t)(vm_stat.free_count + vm_stat.inactive_count) * (size_t)sysconf(_SC_PAGESIZE);
+    }
+#elif MD_PLATFORM_UNIX
+    FILE* file = fopen("/proc/meminfo", "r");
+    if (file) {
+        char line[256];
+        unsigned long long kb = 0;
+        while (fgets(line, sizeof(line), file)) {
+            if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) break;
+        }
+        fclose(file);
+        if (kb) return (size_t)kb * 1024;
+    }
+#endif
+    // Fallback: assume the same fraction as the default budget
+    return md_os_physical_ram() / 4;
+}
+
+static size_t cache_bytes_in_use() {
+    size_t bytes = 0;
+    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
+        bytes += frame_cache_num_slots(loaded_trajectories[i].cache) * loaded_trajectories[i].frame_bytes;
+        if (loaded_trajectories[i].packed) {
+            bytes += loaded_trajectories[i].packed->bytes;
+        }
+    }
+    return bytes;
+}
+
+static size_t effective_cache_budget() {
+    const size_t phys_ram = md_os_physical_ram();
+    if (cache_budget.bytes) {
+        return CLAMP(cache_budget.bytes, MEGABYTES(4), phys_ram - phys_ram / 8);
+    }
+    // Automatic: Half of what is available, including what is currently held by the caches
+    const size_t avail = os_available_ram() + cache_bytes_in_use();
+    return CLAMP(avail / 2, MEGABYTES(64), phys_ram / 2);
+}
+
+static inline size_t compute_num_cache_frames(size_t budget, size_t frame_bytes, size_t num_traj_frames) {
+    // Always keep a few frames, interpolation requires up to four frames to be resident
+    return MIN(num_traj_frames, MAX(4, budget / frame_bytes));
+}
+
+// Splits the budget between the primary cache and the compressed tier (packed_bytes = 0 -> no compressed tier)
+// The compressed tier is only used if the trajectory does not fit uncompressed, then the primary cache only holds a small working set of decoded frames
+static void compute_cache_layout(size_t budget, size_t frame_bytes, size_t num_traj_frames, size_t* num_frames, size_t* packed_bytes) {
+    const size_t num_full_frames = compute_num_cache_frames(budget, frame_bytes, num_traj_frames);
+    if (!cache_compression.enabled || num_full_frames == num_traj_frames) {
+        *num_frames   = num_full_frames;
+        *packed_bytes = 0;
+        return;
+    }
+    *num_frames   = MIN(num_full_frames, MAX(4, MIN(PACKED_WORKING_SET_FRAMES, num_full_frames / 8)));
+    *packed_bytes = budget - MIN(budget, *num_frames * frame_bytes);
+}
+
+// Slots of a primary cache holding num_frames, with headroom for the automatic budget to grow it without rebuilding the cache
+static inline size_t frame_cache_capacity(size_t num_frames, size_t num_traj_frames) {
+    return MIN(num_traj_frames, MAX(num_frames * 2, (size_t)4));
+}
+
+// Adjusts the cache tiers of a trajectory to budget without blocking loads, by changing the limits of the primary cache and the compressed tier.
+// Frames beyond the limits are evicted on the insert path. Returns false if the tiers have to be rebuilt instead (rebuild_frame_cache).
+// Must not be called while a rebuild is pending
+static bool adjust_frame_cache(LoadedTrajectory* traj, size_t budget) {
+    ASSERT(*traj->rebuild_budget == 0);
+    // Sized for the capacity, so a trajectory which grows in follow mode does not reinitialize the cache on every new frame
+    const size_t num_traj_frames = traj->frame_capacity;
+    size_t num_frames, packed_bytes;
+    compute_cache_layout(budget, traj->frame_bytes, num_traj_frames, &num_frames, &packed_bytes);
+
+    if (traj->uncached) {
+        traj->budget = budget;
+        return true;
+    }
+
+    const float packed_scale = 1.0f / cache_compression.precision;
+    if (num_frames > traj->cache->num_slots) return false;
+    if (packed_bytes ? (!traj->packed || traj->packed->scale != packed_scale) : traj->packed != NULL) return false;
+    if (!traj->spill && num_frames < num_traj_frames && spill_settings.max_bytes) return false;
+
+    const size_t cur_frames = frame_cache_num_slots(traj->cache);
+    if (num_frames != cur_frames) {
+        MD_LOG_DEBUG("Adjusting frame cache from %i to %i frames.", (int)cur_frames, (int)num_frames);
+        traj->cache->limit = num_frames;
+    }
+    if (traj->packed) {
+        traj->packed->max_bytes = packed_bytes;
+    }
+    traj->budget = budget;
+    return true;
+}
+
+// Rebuilds the cache tiers of a trajectory for budget, resident frames are kept as far as they fit
+// Takes exclusive access, so this is run on the thread pool (apply_cache_budget)
+static void rebuild_frame_cache(LoadedTrajectory* traj, size_t budget) {
+    cache_lock_exclusive(traj);
+    const size_t num_traj_frames = traj->frame_capacity;
+    size_t num_frames, packed_bytes;
+    compute_cache_layout(budget, traj->frame_bytes, num_traj_frames, &num_frames, &packed_bytes);
+
+    const float packed_scale = 1.0f / cache_compression.precision;
+    if (num_frames > traj->cache->num_slots) {
+        MD_LOG_DEBUG("Rebuilding frame cache with %i frames.", (int)num_frames);
+        FrameCache* cache = frame_cache_create(frame_cache_capacity(num_frames, num_traj_frames), num_frames, traj->mol->atom.count, num_traj_frames, traj->alloc);
+        cache->playhead = traj->cache->playhead.load();
+        cache->fps      = traj->cache->fps.load();
+        // Keep what is resident, the budget is adjusted while the cache is in use (automatic mode) and should not start over cold
+        frame_cache_migrate(cache, traj->cache, traj->alloc);
+        frame_cache_free(traj->cache, traj->alloc);
+        traj->cache = cache;
+    } else {
+        traj->cache->limit = num_frames;
+    }
+
+    if (traj->packed && (!packed_bytes || traj->packed->scale != packed_scale)) {
+        packed_cache_free(traj->packed, traj->alloc);
+        traj->packed = NULL;
+    }
+    if (packed_bytes) {
+        if (traj->packed) {
+            packed_cache_shrink(traj->packed, packed_bytes, traj->cache->playhead.load(), traj->cache->fps.load());
+        } else {
+            traj->packed = packed_cache_create(num_traj_frames, cache_compression.precision, packed_bytes, traj->alloc);
+        }
+    }
+
+    if (!traj->spill && num_frames < num_traj_frames) {
+        traj->spill = spill_cache_create(traj->key, traj->mol->atom.count, num_traj_frames, traj->alloc);
+    }
+    traj->budget = budget;
+    cache_unlock_exclusive(traj);
+}
+
+// Single task which runs the pending rebuilds, one trajectory at a time
+static task_system::ID cache_rebuild_task = task_system::INVALID_ID;
+
+static void launch_cache_rebuilds() {
+    if (task_system::task_is_running(cache_rebuild_task)) return;
+    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
+        LoadedTrajectory* traj = &loaded_trajectories[i];
+        if (*traj->rebuild_budget == 0) continue;
+        cache_rebuild_task = task_system::pool_enqueue(STR_LIT("##Rebuild Frame Cache"), [](void* user_data) {
+            LoadedTrajectory* traj = (LoadedTrajectory*)user_data;
+            // The budget may change again while the tiers are rebuilt
+            size_t budget = *traj->rebuild_budget;
+            do {
+                rebuild_frame_cache(traj, budget);
+            } while (!traj->rebuild_budget->compare_exchange_strong(budget, 0));
+        }, traj);
+        return;
+    }
+}
+
+// Applies budget to the cache tiers of a trajectory, lazily if possible and otherwise by a rebuild on the thread pool
+// Never takes exclusive access on the calling thread, so it can be called from the frame loop
+void apply_cache_budget(LoadedTrajectory* traj, size_t budget) {
+    // While a rebuild is pending the tiers may be swapped at any time, the rebuild picks up the new budget instead
+    size_t pending = *traj->rebuild_budget;
+    while (pending != 0) {
+        if (traj->rebuild_budget->compare_exchange_weak(pending, budget)) return;
+    }
+    if (!adjust_frame_cache(traj, budget)) {
+        *traj->rebuild_budget = budget;
+        launch_cache_rebuilds();
+    }
+}
+
+// Makes room for frames which have been appended to the trajectory, the capacity grows geometrically to keep reallocations rare
+// Requires exclusive access to the cache
+void grow_frame_capacity(LoadedTrajectory* traj, size_t num_frames) {
+    const size_t old_cap = traj->frame_capacity;
+    if (num_frames <= old_cap) return;
+    const size_t new_cap = MAX(num_frames, old_cap + old_cap / 2);
+
+    frame_cache_grow(traj->cache, new_cap, traj->alloc);
+    traj->recenter_trans = (vec3_t*)md_realloc(traj->alloc, traj->recenter_trans, sizeof(vec3_t) * old_cap, sizeof(vec3_t) * new_cap);
+    traj->recenter_trans_gen = (std::atomic_uint32_t*)md_realloc(traj->alloc, traj->recenter_trans_gen, sizeof(std::atomic_uint32_t) * old_cap, sizeof(std::atomic_uint32_t) * new_cap);
+    MEMSET(traj->recenter_trans_gen + old_cap, 0, sizeof(std::atomic_uint32_t) * (new_cap - old_cap));
+    const size_t old_words = resident_words(old_cap);
+    const size_t new_words = resident_words(new_cap);
+    traj->resident_bits = (std::atomic_uint64_t*)md_realloc(traj->alloc, traj->resident_bits, sizeof(std::atomic_uint64_t) * old_words, sizeof(std::atomic_uint64_t) * new_words);
+    MEMSET(traj->resident_bits + old_words, 0, sizeof(std::atomic_uint64_t) * (new_words - old_words));
+    packed_cache_grow(traj->packed, new_cap, traj->alloc);
+    traj->frame_capacity = new_cap;
+
+    // The frame times are handed out by get_header and used without any lock, so they are copied to a larger array rather than reallocated.
+    // The old array stays valid until the trajectory is closed, the retired arrays are smaller than the live one due to the geometric growth.
+    if (traj->frame_times) {
+        md_array(double) frame_times = 0;
+        md_array_ensure(frame_times, new_cap, traj->alloc);
+        md_array_push_array(frame_times, traj->frame_times, md_array_size(traj->frame_times), traj->alloc);
+        md_array_push(traj->retired_frame_times, traj->frame_times, traj->alloc);
+        traj->frame_times = frame_times;
+    }
+}
+
+// Raw frame data of a frame of the internal trajectory, frames appended after it was indexed are read from the followed file
+size_t fetch_source_frame_data(LoadedTrajectory* traj, int64_t src_idx, void* data_ptr) {
+    FollowState* follow = traj->follow;
+    if (!follow || src_idx < follow->num_indexed) {
+        const size_t size = md_trajectory_fetch_frame_data(traj->traj, src_idx, data_ptr);
+        if (data_ptr) traj->counters->bytes_read += size;
+        return size;
+    }
+
+    const int64_t i = src_idx - follow->num_indexed;
+    ASSERT(i + 1 < (int64_t)md_array_size(follow->offsets));
+    const int64_t offset = follow->offsets[i];
+    const size_t  size   = (size_t)(follow->offsets[i + 1] - offset);
+    if (data_ptr) {
+        md_mutex_lock(&follow->mutex);
+        const bool result = md_file_seek(follow->file, offset, MD_FILE_BEG) && md_file_read(follow->file, data_ptr, size) == size;
+        md_mutex_unlock(&follow->mutex);
+        if (!result) return 0;
+        traj->counters->bytes_read += size;
+    }
+    return size;
+}
+
+// Loads a frame of the internal trajectory, frames appended after it was indexed are read from the followed file and decoded here
+static bool load_source_frame(LoadedTrajectory* traj, int64_t src_idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    FollowState* follow = traj->follow;
+    const bool followed = follow && src_idx >= follow->num_indexed;
+    if (traj->uncached && !followed) {
+        // Copied straight out of the memory mapped file, which is neither a read nor a decode (direct_loads)
+        return md_trajectory_load_frame(traj->traj, src_idx, header, x, y, z);
+    }
+
+    // The raw data is read and decoded in two steps, so the time spent on each is known
+    CacheCounters* counters = traj->counters;
+    const md_timestamp_t fetch_beg = md_time_current();
+    const size_t size = followed ? fetch_source_frame_data(traj, src_idx, NULL) : md_trajectory_fetch_frame_data(traj->traj, src_idx, NULL);
+    if (size == 0) {
+        if (followed) return false;
+        // The loader does not expose the raw frame data, reading it cannot be told apart from decoding it
+        const bool result = md_trajectory_load_frame(traj->traj, src_idx, header, x, y, z);
+        if (result) record_decode(counters, md_time_current() - fetch_beg);
+        return result;
+    }
+
+    md_allocator_i* alloc = md_get_heap_allocator();
+    void* data = md_alloc(alloc, size);
+    const size_t bytes = followed ? fetch_source_frame_data(traj, src_idx, data) : md_trajectory_fetch_frame_data(traj->traj, src_idx, data);
+    const md_timestamp_t decode_beg = md_time_current();
+    counters->fetched++;
+    counters->fetch_ticks += (uint64_t)(decode_beg - fetch_beg);
+    counters->bytes_read += bytes;
+
+    const bool result = bytes == size && md_trajectory_decode_frame_data(traj->traj, data, size, header, x, y, z);
+    if (result) record_decode(counters, md_time_current() - decode_beg);
+    md_free(alloc, data, size);
+    return result;
+}
+
+// Is the frame held by a cache tier? Then there is no point in reading it from the file.
+bool frame_resident(LoadedTrajectory* traj, int64_t idx) {
+    if (traj->packed && traj->packed->frames[idx].load(std::memory_order_relaxed)) return true;
+    if (frame_cache_contains(traj->cache, idx)) return true;
+    return spill_cache_contains(traj->spill, idx);
+}
+
+static inline void mark_resident(LoadedTrajectory* traj, int64_t idx) {
+    traj->resident_bits[idx / 64].fetch_or(1ULL << (idx % 64));
+}
+
+// Last frame <= idx with its bit set, -1 if there is none
+static int64_t prev_resident_bit(const LoadedTrajectory* traj, int64_t idx) {
+    if (idx < 0) return -1;
+    int64_t w = idx / 64;
+    uint64_t bits = traj->resident_bits[w].load(std::memory_order_relaxed) & (~0ULL >> (63 - idx % 64));
+    while (!bits) {
+        if (--w < 0) return -1;
+        bits = traj->resident_bits[w].load(std::memory_order_relaxed);
+    }
+    return w * 64 + 63 - (int64_t)clz64(bits);
+}
+
+// First frame >= idx with its bit set, -1 if there is none
+static int64_t next_resident_bit(const LoadedTrajectory* traj, int64_t idx) {
+    const int64_t num_frames = (int64_t)traj->num_frames;
+    if (idx >= num_frames) return -1;
+    const int64_t num_words = (int64_t)resident_words(num_frames);
+    int64_t w = idx / 64;
+    uint64_t bits = traj->resident_bits[w].load(std::memory_order_relaxed) & (~0ULL << (idx % 64));
+    while (!bits) {
+        if (++w >= num_words) return -1;
+        bits = traj->resident_bits[w].load(std::memory_order_relaxed);
+    }
+    const int64_t result = w * 64 + (int64_t)ctz64(bits);
+    return result < num_frames ? result : -1;
+}
+
+// Verifies a set bit against the tiers, a stale bit is cleared. A frame which was loaded concurrently sets its bit again after it is resident,
+// so it is checked again after clearing it to not lose it.
+static bool verify_resident(LoadedTrajectory* traj, int64_t idx) {
+    if (frame_resident(traj, idx)) return true;
+    const uint64_t bit = 1ULL << (idx % 64);
+    traj->resident_bits[idx / 64].fetch_and(~bit);
+    if (frame_resident(traj, idx)) {
+        traj->resident_bits[idx / 64].fetch_or(bit);
+        return true;
+    }
+    return false;
+}
+
+// Closest resident frame to idx, ties go to the earlier frame
+// Only the set bits are visited, each of which is either resident or cleared on the way, so this does not scale with the number of frames which are not cached.
+// Must be called with shared access held
+static int64_t nearest_resident_frame(LoadedTrajectory* traj, int64_t idx) {
+    int64_t lo = prev_resident_bit(traj, idx);
+    int64_t hi = next_resident_bit(traj, idx + 1);
+    while (lo != -1 || hi != -1) {
+        if (lo != -1 && (hi == -1 || idx - lo <= hi - idx)) {
+            if (verify_resident(traj, lo)) return lo;
+            lo = prev_resident_bit(traj, lo - 1);
+        } else {
+            if (verify_resident(traj, hi)) return hi;
+            hi = next_resident_bit(traj, hi + 1);
+        }
+    }
+    return -1;
+}
+
+// Translation which moves the center of mass of the recenter target to the center of the unit cell
+static vec3_t compute_recenter_translation(const LoadedTrajectory* traj, const md_unit_cell_t* cell, const float* x, const float* y, const float* z) {
+    const md_molecule_t* mol = traj->mol;
+
+    const size_t count = md_array_size(traj->recenter_indices);
+    const int32_t* indices = traj->recenter_indices;
+
+    vec3_t com = {0};
+    if (count == 1) {
+        const int32_t i = indices[0];
+        com = vec3_set(x[i], y[i], z[i]);
+    } else {
+        com = md_util_com_compute(x, y, z, mol->atom.mass, indices, count, &mol->unit_cell);
+        md_util_pbc(&com.x, &com.y, &com.z, 0, 1, cell);
+    }
+
+    const vec3_t center = cell->flags ? cell->basis * vec3_set1(0.5f) : vec3_zero();
+    return center - com;
+}
+
+// Copy with translation fused into a single pass (vectorized by the compiler)
+static inline void copy_translate(float* dst, const float* src, size_t count, float t) {
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = src[i] + t;
+    }
+}
+
+// Internal trajectory of an atom subset view
+// Frames are read from the internal trajectory of the parent and only the coordinates of the subset are kept,
+// the view is then wrapped like any other trajectory so it gets its own (smaller) cache tiers.
+struct SubsetTrajectory {
+    md_trajectory_i* src;       // Internal trajectory of the parent
+    md_allocator_i*  alloc;
+    md_array(int32_t) indices;  // Atom indices of the subset within the parent
+    size_t  src_num_atoms;
+    size_t  num_frames;
+    int64_t frame_beg;
+    int64_t frame_stride;
+    md_array(double) frame_times;
+};
+
+static bool subset_get_header(struct md_trajectory_o* inst, md_trajectory_header_t* header) {
+    SubsetTrajectory* sub = (SubsetTrajectory*)inst;
+    if (!md_trajectory_get_header(sub->src, header)) return false;
+    header->num_atoms  = md_array_size(sub->indices);
+    header->num_frames = sub->num_frames;
+    if (sub->frame_times) header->frame_times = sub->frame_times;
+    return true;
+}
+
+// Loads (or decodes) the full frame into scratch memory and gathers the subset
+static bool subset_load_or_decode(SubsetTrajectory* sub, int64_t src_idx, const void* data_ptr, size_t data_size, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    bool result = false;
+    if (x && y && z) {
+        md_allocator_i* alloc = md_get_heap_allocator();
+        const size_t bytes = sizeof(float) * sub->src_num_atoms * 3;
+        float* coords = (float*)md_alloc(alloc, bytes);
+        float* src_x = coords + sub->src_num_atoms * 0;
+        float* src_y = coords + sub->src_num_atoms * 1;
+        float* src_z = coords + sub->src_num_atoms * 2;
+        result = data_ptr ? md_trajectory_decode_frame_data(sub->src, data_ptr, data_size, header, src_x, src_y, src_z)
+                          : md_trajectory_load_frame(sub->src, src_idx, header, src_x, src_y, src_z);
+        if (result) {
+            const size_t count = md_array_size(sub->indices);
+            subset_gather(x, src_x, sub->indices, count);
+            subset_gather(y, src_y, sub->indices, count);
+            subset_gather(z, src_z, sub->indices, count);
+        }
+        md_free(alloc, coords, bytes);
+    } else {
+        result = data_ptr ? md_trajectory_decode_frame_data(sub->src, data_ptr, data_size, header, 0, 0, 0)
+                          : md_trajectory_load_frame(sub->src, src_idx, header, 0, 0, 0);
+    }
+    if (result && header) {
+        header->num_atoms = md_array_size(sub->indices);
+    }
+    return result;
+}
+
+static bool subset_load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    SubsetTrajectory* sub = (SubsetTrajectory*)inst;
+    return subset_load_or_decode(sub, sub->frame_beg + idx * sub->frame_stride, NULL, 0, header, x, y, z);
+}
+
+static size_t subset_fetch_frame_data(struct md_trajectory_o* inst, int64_t idx, void* data_ptr) {
+    SubsetTrajectory* sub = (SubsetTrajectory*)inst;
+    return md_trajectory_fetch_frame_data(sub->src, sub->frame_beg + idx * sub->frame_stride, data_ptr);
+}
+
+static bool subset_decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, size_t data_size, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    SubsetTrajectory* sub = (SubsetTrajectory*)inst;
+    return subset_load_or_decode(sub, -1, data_ptr, data_size, header, x, y, z);
+}
+
+static void subset_destroy(md_trajectory_i* traj) {
+    SubsetTrajectory* sub = (SubsetTrajectory*)traj->inst;
+    md_allocator_i* alloc = sub->alloc;
+    md_array_free(sub->indices, alloc);
+    md_array_free(sub->frame_times, alloc);
+    md_free(alloc, sub, sizeof(SubsetTrajectory));
+    md_free(alloc, traj, sizeof(md_trajectory_i));
+}
+
+static md_trajectory_loader_i* subset_loader() {
+    // Only used for destroying the internal trajectory of a view
+    static md_trajectory_loader_i loader = {};
+    loader.destroy = subset_destroy;
+    return &loader;
+}
+
+// Compacted copy of the atoms in indices (sorted) along with their residues and chains
+// Bonds, backbone and structures are recomputed for the subset
+static void extract_molecule_subset(md_molecule_t* dst, const md_molecule_t* src, const int32_t* indices, size_t count, md_allocator_i* alloc) {
+    MEMSET(dst, 0, sizeof(md_molecule_t));
+    dst->unit_cell = src->unit_cell;
+
+    int32_t last_res   = -1;
+    int32_t last_chain = -1;
+    for (size_t n = 0; n < count; ++n) {
+        const int32_t i = indices[n];
+        md_array_push(dst->atom.x, src->atom.x[i], alloc);
+        md_array_push(dst->atom.y, src->atom.y[i], alloc);
+        md_array_push(dst->atom.z, src->atom.z[i], alloc);
+        if (src->atom.radius)  md_array_push(dst->atom.radius,  src->atom.radius[i],  alloc);
+        if (src->atom.mass)    md_array_push(dst->atom.mass,    src->atom.mass[i],    alloc);
+        if (src->atom.element) md_array_push(dst->atom.element, src->atom.element[i], alloc);
+        if (src->atom.type)    md_array_push(dst->atom.type,    src->atom.type[i],    alloc);
+        if (src->atom.flags)   md_array_push(dst->atom.flags,   src->atom.flags[i],   alloc);
+
+        if (src->atom.res_idx) {
+            const int32_t res = src->atom.res_idx[i];
+            if (res != -1 && res != last_res) {
+                auto range = src->residue.atom_range[res];
+                range.beg = (int32_t)n;
+                md_array_push(dst->residue.atom_range, range, alloc);
+                md_array_push(dst->residue.name, src->residue.name[res], alloc);
+                md_array_push(dst->residue.id,   src->residue.id[res],   alloc);
+                dst->residue.count += 1;
+                last_res = res;
+            }
+            if (res != -1) {
+                dst->residue.atom_range[dst->residue.count - 1].end = (int32_t)n + 1;
+            }
+            md_array_push(dst->atom.res_idx, res != -1 ? (int32_t)dst->residue.count - 1 : -1, alloc);
+        }
+
+        if (src->atom.chain_idx) {
+            const int32_t chain = src->atom.chain_idx[i];
+            if (chain != -1 && chain != last_chain) {
+                auto range = src->chain.atom_range[chain];
+                range.beg = (int32_t)n;
+                md_array_push(dst->chain.atom_range, range, alloc);
+                md_array_push(dst->chain.id, src->chain.id[chain], alloc);
+                dst->chain.count += 1;
+                last_chain = chain;
+            }
+            if (chain != -1) {
+                dst->chain.atom_range[dst->chain.count - 1].end = (int32_t)n + 1;
+            }
+            md_array_push(dst->atom.chain_idx, chain != -1 ? (int32_t)dst->chain.count - 1 : -1, alloc);
+        }
+    }
+    dst->atom.count = count;
+
+    md_util_molecule_postprocess(dst, alloc, MD_UTIL_POSTPROCESS_ALL);
+}
+
 // In here each loader gets a chance to do a precheck with the file to be loaded
 static void mol_loader_preload_check(load::LoaderState* state, mol_loader_t loader, str_t file_path, md_allocator_i* alloc) {
     switch (loader) {
@@ -213,9 +747,26 @@ static void traj_loader_preload_check(load::LoaderState*, traj_loader_t, str_t,
     return;
 }
 
+// Creates the internal trajectory of a file, large text trajectories are indexed in parallel and then use the text loader
+// Progress is only reported by the parallel indexer, the loaders index their files without reporting
+md_trajectory_i* create_internal_trajectory(str_t filename, md_trajectory_loader_i** loader, md_allocator_i* alloc, uint32_t flags, load::traj::PrepareProgress* progress) {
+    md_trajectory_i* traj = text_create(filename, *loader, alloc, flags, progress);
+    if (traj) {
+        *loader = text_loader();
+        return traj;
+    }
+    // Chunks may have been reported before the text loader gave up on the file
+    if (progress) {
+        if (progress->cancel) return NULL;
+        progress->total = 0;
+        progress->completed = 0;
+    }
+    return (*loader)->create(filename, alloc, flags & ~LoadTrajectoryFlag_Progressive);
+}
+
 namespace load {
 
-#define NUM_ENTRIES 11
+#define NUM_ENTRIES 13
 struct table_entry_t {
     str_t name[NUM_ENTRIES];
     str_t ext[NUM_ENTRIES];
@@ -241,7 +792,8 @@ static const table_entry_t table = {
         STR_LIT("PDBx/mmCIF (cif)"),
         STR_LIT("LAMMPS (data)"),
         STR_LIT("LAMMPS Trajectory (lammpstrj)"),
-        //STR_LIT("DCD Trajectory (dcd)"),
+        STR_LIT("VIAMD Trajectory (vtraj)"),
+        STR_LIT("CHARMM/NAMD Trajectory (dcd)"),
 #if MD_VLX
         STR_LIT("Veloxchem (out)")
 #endif
@@ -257,7 +809,8 @@ static const table_entry_t table = {
         STR_LIT("cif"),
         STR_LIT("data"),
         STR_LIT("lammpstrj"),
-        //STR_LIT("dcd"),
+        STR_LIT("vtraj"),
+        STR_LIT("dcd"),
 #if MD_VLX
         STR_LIT("out")
 #endif
@@ -273,7 +826,8 @@ static const table_entry_t table = {
         md_mmcif_molecule_api(),
         md_lammps_molecule_api(),
         NULL,
-        //NULL,
+        NULL,
+        NULL,
 #if MD_VLX
         md_vlx_molecule_api(),
 #endif
@@ -289,7 +843,8 @@ static const table_entry_t table = {
     	NULL,
         NULL,
         md_lammps_trajectory_loader(),
-        //md_dcd_trajectory_loader(),
+        native_loader(),
+        dcd_loader(),
 #if MD_VLX
         NULL,
 #endif
@@ -406,159 +961,139 @@ md_trajectory_loader_i* loader_from_ext(str_t ext) {
 
 bool get_header(struct md_trajectory_o* inst, md_trajectory_header_t* header) {
     LoadedTrajectory* loaded_traj = (LoadedTrajectory*)inst;
-    return md_trajectory_get_header(loaded_traj->traj, header);
-}
-
-#if 0
-size_t fetch_frame_data(struct md_trajectory_o*, int64_t idx, void* data_ptr) {
-    if (data_ptr) {
-        *((int64_t*)data_ptr) = idx;
+    if (!md_trajectory_get_header(loaded_traj->traj, header)) return false;
+    if (loaded_traj->frame_times) {
+        header->num_frames  = loaded_traj->num_frames;
+        header->frame_times = loaded_traj->frame_times;
     }
-    return sizeof(int64_t);
+    return true;
 }
 
-bool decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, [[maybe_unused]] size_t data_size, md_trajectory_frame_header_t* header, float* out_x, float* out_y, float* out_z) {
-    LoadedTrajectory* loaded_traj = (LoadedTrajectory*)inst;
-    ASSERT(loaded_traj);
-    ASSERT(data_size == sizeof(int64_t));
-
-    int64_t idx = *((int64_t*)data_ptr);
-    ASSERT(0 <= idx && idx < (int64_t)md_trajectory_num_frames(loaded_traj->traj));
-
-    md_frame_data_t* frame_data;
-    md_frame_cache_lock_t* lock = 0;
-    bool result = true;
-    bool in_cache = md_frame_cache_find_or_reserve(&loaded_traj->cache, idx, &frame_data, &lock);
-    if (!in_cache) {
-        md_allocator_i* alloc = md_get_heap_allocator();
-        size_t frame_data_size = md_trajectory_fetch_frame_data(loaded_traj->traj, idx, 0);
-        void*  frame_data_ptr  = md_alloc(alloc, frame_data_size);
-        md_trajectory_fetch_frame_data(loaded_traj->traj, idx, frame_data_ptr);
-        result = md_trajectory_decode_frame_data(loaded_traj->traj, frame_data_ptr, frame_data_size, &frame_data->header, frame_data->x, frame_data->y, frame_data->z);
-
-        if (result) {
-            const md_unit_cell_t* cell = &frame_data->header.unit_cell;
-            const md_molecule_t* mol = loaded_traj->mol;
-            float* x = frame_data->x;
-            float* y = frame_data->y;
-            float* z = frame_data->z;
-            const size_t num_atoms = frame_data->header.num_atoms;
-
-            // If we have a recenter target, then compute the com and apply that transformation
-            if (md_array_size(loaded_traj->recenter_indices) > 0) {
-                size_t count = md_array_size(loaded_traj->recenter_indices);
-                const int32_t* indices = loaded_traj->recenter_indices;
-
-                vec3_t com = {0};
-                if (count == 1) {
-                    const int32_t i = indices[0];
-					com = vec3_set(x[i], y[i], z[i]);
-				} else {
-					com = md_util_com_compute(x, y, z, mol->atom.mass, indices, count, &mol->unit_cell);
-                    md_util_pbc(&com.x, &com.y, &com.z, 0, 1, cell);
-                }
+static inline void record_load(CacheCounters* counters, md_timestamp_t beg) {
+    const md_timestamp_t ticks = md_time_current() - beg;
+    counters->loads++;
+    counters->load_ticks += (uint64_t)ticks;
+    histogram_add(counters->load_histogram, ticks);
+}
 
-                // Translate all
-                const vec3_t center = cell->flags ? cell->basis * vec3_set1(0.5f) : vec3_zero();
-                const vec3_t trans  = center - com;
-                vec3_batch_translate_inplace(x, y, z, num_atoms, trans);
-            }
+// Loads the frame from the trajectory into the supplied buffers, bypassing the cache tiers
+// Must be called with shared access held
+static bool load_frame_direct(LoadedTrajectory* loaded_traj, int64_t idx, md_trajectory_frame_header_t* out_header, float* out_x, float* out_y, float* out_z) {
+    md_trajectory_frame_header_t header;
+    if (!load_source_frame(loaded_traj, source_frame(loaded_traj, idx), &header, out_x, out_y, out_z)) return false;
+    if (out_header) *out_header = header;
+    if (out_x && out_y && out_z && md_array_size(loaded_traj->recenter_indices) > 0) {
+        const md_timestamp_t recenter_beg = md_time_current();
+        if (loaded_traj->recenter_trans_gen[idx] != loaded_traj->recenter_generation) {
+            loaded_traj->recenter_trans[idx] = compute_recenter_translation(loaded_traj, &header.unit_cell, out_x, out_y, out_z);
+            loaded_traj->recenter_trans_gen[idx] = loaded_traj->recenter_generation;
         }
-
-        md_free(alloc, frame_data_ptr, frame_data_size);
-    }
-
-    if (result) {
-        const int64_t num_atoms = frame_data->header.num_atoms;
-        if (header) *header = frame_data->header;
-        if (out_x) MEMCPY(out_x, frame_data->x, sizeof(float) * num_atoms);
-        if (out_y) MEMCPY(out_y, frame_data->y, sizeof(float) * num_atoms);
-        if (out_z) MEMCPY(out_z, frame_data->z, sizeof(float) * num_atoms);
-    }
-
-    if (lock) {
-        md_frame_cache_frame_lock_release(lock);
+        const vec3_t trans = loaded_traj->recenter_trans[idx];
+        copy_translate(out_x, out_x, header.num_atoms, trans.x);
+        copy_translate(out_y, out_y, header.num_atoms, trans.y);
+        copy_translate(out_z, out_z, header.num_atoms, trans.z);
+        loaded_traj->counters->recenter_ticks += (uint64_t)(md_time_current() - recenter_beg);
     }
-
-    return result;
+    return true;
 }
-#endif
 
 bool load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* out_header, float* out_x, float* out_y, float* out_z) {
     ASSERT(inst);
     LoadedTrajectory* loaded_traj = (LoadedTrajectory*)inst;
-    ASSERT(0 <= idx && idx < (int64_t)md_trajectory_num_frames(loaded_traj->traj));
+    ASSERT(0 <= idx && idx < (int64_t)loaded_traj->num_frames);
 
     if ((out_x || out_y || out_z) && !(out_x && out_y && out_z))  {
         MD_LOG_ERROR("One coordinate stream (x,y,z) was null, when attempting to read out coordinates");
         return false;
     }
 
-    md_frame_data_t* frame_data;
-    md_frame_cache_lock_t* lock = 0;
-    bool result = true;
-    bool in_cache = md_frame_cache_find_or_reserve(&loaded_traj->cache, idx, &frame_data, &lock);
-    if (!in_cache) {
-        //md_allocator_i* alloc = md_get_heap_allocator();
-        //size_t frame_data_size = md_trajectory_fetch_frame_data(loaded_traj->traj, idx, 0);
-        //void*  frame_data_ptr  = md_alloc(alloc, frame_data_size);
-        //md_trajectory_fetch_frame_data(loaded_traj->traj, idx, frame_data_ptr);
-        //result = md_trajectory_decode_frame_data(loaded_traj->traj, frame_data_ptr, frame_data_size, &frame_data->header, frame_data->x, frame_data->y, frame_data->z);
-        result = md_trajectory_load_frame(loaded_traj->traj, idx, &frame_data->header, frame_data->x, frame_data->y, frame_data->z);
+    const md_timestamp_t load_beg = md_time_current();
+    cache_lock_shared(loaded_traj);
 
-        if (result) {
-            const md_unit_cell_t* cell = &frame_data->header.unit_cell;
-            const md_molecule_t* mol = loaded_traj->mol;
-            float* x = frame_data->x;
-            float* y = frame_data->y;
-            float* z = frame_data->z;
-            const size_t num_atoms = frame_data->header.num_atoms;
-
-            // If we have a recenter target, then compute the com and apply that transformation
-            if (md_array_size(loaded_traj->recenter_indices) > 0) {
-                size_t count = md_array_size(loaded_traj->recenter_indices);
-                const int32_t* indices = loaded_traj->recenter_indices;
-
-                vec3_t com = {0};
-                if (count == 1) {
-                    const int32_t i = indices[0];
-                    com = vec3_set(x[i], y[i], z[i]);
-                } else {
-                    com = md_util_com_compute(x, y, z, mol->atom.mass, indices, count, &mol->unit_cell);
-                    md_util_pbc(&com.x, &com.y, &com.z, 0, 1, cell);
-                }
+    if (loaded_traj->uncached) {
+        const bool result = load_frame_direct(loaded_traj, idx, out_header, out_x, out_y, out_z);
+        if (result) loaded_traj->counters->direct_loads++;
+        cache_unlock_shared(loaded_traj);
+        record_load(loaded_traj->counters, load_beg);
+        return result;
+    }
 
-                // Translate all
-                const vec3_t center = cell->flags ? cell->basis * vec3_set1(0.5f) : vec3_zero();
-                const vec3_t trans  = center - com;
-                vec3_batch_translate_inplace(x, y, z, num_atoms, trans);
-            }
+    CacheSlot* slot = 0;
+    bool result = true;
+    bool in_cache = frame_cache_find_or_reserve(loaded_traj->cache, idx, &slot, loaded_traj->counters);
+    if (!slot) {
+        // No slot could be had, the frame is decoded directly into the supplied buffers
+        loaded_traj->counters->misses++;
+        result = load_frame_direct(loaded_traj, idx, out_header, out_x, out_y, out_z);
+        cache_unlock_shared(loaded_traj);
+        record_load(loaded_traj->counters, load_beg);
+        return result;
+    }
+    const double playhead = loaded_traj->cache->playhead.load(std::memory_order_relaxed);
+    const double fps      = loaded_traj->cache->fps.load(std::memory_order_relaxed);
+    if (in_cache) {
+        loaded_traj->counters->mem_hits++;
+    } else if (packed_cache_read(loaded_traj->packed, idx, &slot->header, slot->x, slot->y, slot->z)) {
+        loaded_traj->counters->packed_hits++;
+    } else if (spill_cache_read(loaded_traj->spill, idx, &slot->header, slot->x, slot->y, slot->z)) {
+        loaded_traj->counters->disk_hits++;
+        packed_cache_write(loaded_traj->packed, idx, &slot->header, slot->x, slot->y, slot->z, playhead, fps);
+    } else {
+        loaded_traj->counters->misses++;
+        // Prefer raw data which has already been read by a frame stream, that only leaves the decoding to us
+        if (!frame_streams_decode(loaded_traj, idx, &slot->header, slot->x, slot->y, slot->z)) {
+            result = load_source_frame(loaded_traj, source_frame(loaded_traj, idx), &slot->header, slot->x, slot->y, slot->z);
         }
 
-        //md_free(alloc, frame_data_ptr, frame_data_size);
+        if (result) {
+            packed_cache_write(loaded_traj->packed, idx, &slot->header, slot->x, slot->y, slot->z, playhead, fps);
+            spill_cache_write(loaded_traj->spill, idx, &slot->header, slot->x, slot->y, slot->z);
+        }
     }
 
     if (result) {
-        const size_t num_bytes = frame_data->header.num_atoms * sizeof(float);
-        if (out_header) *out_header = frame_data->header;
+        mark_resident(loaded_traj, idx);
+        const size_t num_bytes = slot->header.num_atoms * sizeof(float);
+        if (out_header) *out_header = slot->header;
         if (out_x && out_y && out_z) {
-            MEMCPY(out_x, frame_data->x, num_bytes);
-            MEMCPY(out_y, frame_data->y, num_bytes);
-            MEMCPY(out_z, frame_data->z, num_bytes);
+            if (md_array_size(loaded_traj->recenter_indices) > 0) {
+                const md_timestamp_t recenter_beg = md_time_current();
+                // The translation is computed once per frame and recenter target
+                if (loaded_traj->recenter_trans_gen[idx] != loaded_traj->recenter_generation) {
+                    loaded_traj->recenter_trans[idx] = compute_recenter_translation(loaded_traj, &slot->header.unit_cell, slot->x, slot->y, slot->z);
+                    loaded_traj->recenter_trans_gen[idx] = loaded_traj->recenter_generation;
+                }
+                const vec3_t trans = loaded_traj->recenter_trans[idx];
+                copy_translate(out_x, slot->x, slot->header.num_atoms, trans.x);
+                copy_translate(out_y, slot->y, slot->header.num_atoms, trans.y);
+                copy_translate(out_z, slot->z, slot->header.num_atoms, trans.z);
+                loaded_traj->counters->recenter_ticks += (uint64_t)(md_time_current() - recenter_beg);
+            } else {
+                MEMCPY(out_x, slot->x, num_bytes);
+                MEMCPY(out_y, slot->y, num_bytes);
+                MEMCPY(out_z, slot->z, num_bytes);
+            }
         }
+        frame_cache_release(slot);
+    } else {
+        frame_cache_invalidate(loaded_traj->cache, slot);
     }
 
-    if (lock) {
-        md_frame_cache_frame_lock_release(lock);
-    }
+    cache_unlock_shared(loaded_traj);
+    record_load(loaded_traj->counters, load_beg);
 
     return result;
 }
 
-md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, LoadTrajectoryFlags flags) {
-    ASSERT(mol);
-    ASSERT(alloc);
+static md_trajectory_i* wrap_trajectory(md_trajectory_i* internal_traj, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, const FrameRange* range);
 
+struct PreparedTrajectory {
+    md_trajectory_i* internal_traj;
+    md_trajectory_loader_i* loader;
+    md_allocator_i* alloc;
+};
+
+static md_trajectory_loader_i* resolve_loader(str_t filename, md_trajectory_loader_i* loader) {
     if (!loader) {
         str_t ext;
         if (extract_ext(&ext, filename)) {
@@ -567,20 +1102,102 @@ md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const
     }
     if (!loader) {
         MD_LOG_ERROR("Unsupported file extension: '%.*s'", filename.len, filename.ptr);
+    }
+    return loader;
+}
+
+md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, LoadTrajectoryFlags flags, const FrameRange* range) {
+    ASSERT(mol);
+    ASSERT(alloc);
+
+    PreparedTrajectory* prepared = prepare_file(filename, loader, alloc, flags);
+    if (!prepared) {
+        return NULL;
+    }
+    return finalize_file(prepared, mol, range);
+}
+
+PreparedTrajectory* prepare_file(str_t filename, md_trajectory_loader_i* loader, md_allocator_i* alloc, LoadTrajectoryFlags flags, PrepareProgress* progress) {
+    ASSERT(alloc);
+
+    loader = resolve_loader(filename, loader);
+    if (!loader) {
         return NULL;
     }
 
-    md_trajectory_i* internal_traj = loader->create(filename, alloc, flags);
+    // This is where the loader scans the file to index its frames
+    // A part of a split trajectory is opened together with the other parts as one trajectory
+    md_trajectory_i* internal_traj = NULL;
+    str_t stem, ext;
+    int first_part, width;
+    const size_t num_parts = find_trajectory_parts(filename, &stem, &ext, &first_part, &width);
+    if (num_parts > 1) {
+        internal_traj = concat_create(stem, ext, first_part, width, num_parts, loader, alloc, flags, progress);
+        loader = concat_loader();
+    } else {
+        internal_traj = create_internal_trajectory(filename, &loader, alloc, flags, progress);
+    }
     if (!internal_traj) {
         return NULL;
     }
-    
+
+    PreparedTrajectory* prepared = (PreparedTrajectory*)md_alloc(alloc, sizeof(PreparedTrajectory));
+    prepared->internal_traj = internal_traj;
+    prepared->loader = loader;
+    prepared->alloc = alloc;
+    return prepared;
+}
+
+md_trajectory_i* finalize_file(PreparedTrajectory* prepared, const md_molecule_t* mol, const FrameRange* range) {
+    ASSERT(prepared);
+    ASSERT(mol);
+
+    md_trajectory_i* internal_traj = prepared->internal_traj;
+    md_trajectory_loader_i* loader = prepared->loader;
+    md_allocator_i* alloc = prepared->alloc;
+    md_free(alloc, prepared, sizeof(PreparedTrajectory));
+
     if (md_trajectory_num_atoms(internal_traj) != mol->atom.count) {
         MD_LOG_ERROR("Trajectory is not compatible with the loaded molecule.");
         loader->destroy(internal_traj);
         return NULL;
     }
 
+    return wrap_trajectory(internal_traj, loader, mol, alloc, range);
+}
+
+void discard_prepared(PreparedTrajectory* prepared) {
+    if (!prepared) return;
+    prepared->loader->destroy(prepared->internal_traj);
+    md_free(prepared->alloc, prepared, sizeof(PreparedTrajectory));
+}
+
+// Wraps an internal trajectory with the cache tiers, takes ownership of the internal trajectory
+static md_trajectory_i* wrap_trajectory(md_trajectory_i* internal_traj, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, const FrameRange* range) {
+    const int64_t num_src_frames = (int64_t)md_trajectory_num_frames(internal_traj);
+    int64_t frame_beg = 0;
+    int64_t frame_end = num_src_frames;
+    int64_t frame_stride = 1;
+    const double* src_times = NULL;
+    if (range) {
+        md_trajectory_header_t src_header;
+        if (md_trajectory_get_header(internal_traj, &src_header)) {
+            src_times = src_header.frame_times;
+        }
+        if (src_times) {
+            while (frame_beg < frame_end && src_times[frame_beg] < range->beg_time) ++frame_beg;
+            if (range->end_time > range->beg_time) {
+                while (frame_end > frame_beg && src_times[frame_end - 1] > range->end_time) --frame_end;
+            }
+        }
+        frame_stride = MAX(1, (int64_t)range->stride);
+    }
+    if (frame_beg >= frame_end) {
+        MD_LOG_ERROR("Trajectory has no frames within the requested time range.");
+        loader->destroy(internal_traj);
+        return NULL;
+    }
+
     md_trajectory_i* traj = (md_trajectory_i*)md_alloc(alloc, sizeof(md_trajectory_i));
     MEMSET(traj, 0, sizeof(md_trajectory_i));
 
@@ -588,33 +1205,140 @@ md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const
     inst->mol = mol;
     inst->loader = loader;
     inst->traj = internal_traj;
-    inst->cache = {0};
     inst->recenter_indices = 0;
+    inst->recenter_generation = 1;
     inst->alloc = alloc;
-    
-    const size_t num_traj_frames      = md_trajectory_num_frames(internal_traj);
-    const size_t frame_cache_size     = CLAMP(MEGABYTES(VIAMD_FRAME_CACHE_SIZE), MEGABYTES(4), md_os_physical_ram() / 4);
-    const size_t approx_frame_size    = mol->atom.count * 3 * sizeof(float);
-    const size_t max_num_cache_frames = frame_cache_size / approx_frame_size;
-
-    const size_t  num_cache_frames    = MIN(num_traj_frames, max_num_cache_frames);
-    
+    inst->frame_bytes = mol->atom.count * 3 * sizeof(float);
+    inst->frame_beg = frame_beg;
+    inst->frame_stride = frame_stride;
+    inst->num_frames = (size_t)((frame_end - frame_beg + frame_stride - 1) / frame_stride);
+    inst->frame_capacity = inst->num_frames;
+    inst->frame_times = 0;
+
+    if (inst->num_frames != (size_t)num_src_frames) {
+        md_array_resize(inst->frame_times, inst->num_frames, alloc);
+        for (size_t i = 0; i < inst->num_frames; ++i) {
+            inst->frame_times[i] = src_times ? src_times[source_frame(inst, i)] : (double)source_frame(inst, i);
+        }
+        MD_LOG_INFO("Exposing %i of %i trajectory frames (frames %i to %i, stride %i).", (int)inst->num_frames, (int)num_src_frames, (int)frame_beg, (int)(frame_end - 1), (int)frame_stride);
+    }
+
+    inst->budget = effective_cache_budget();
+
+    const size_t num_traj_frames = inst->num_frames;
+    size_t num_cache_frames, packed_bytes;
+    compute_cache_layout(inst->budget, inst->frame_bytes, num_traj_frames, &num_cache_frames, &packed_bytes);
+
+    // The page cache of the operating system already holds the frames of a memory mapped trajectory
+    inst->uncached = loader == native_loader() || loader == dcd_loader();
+    if (inst->uncached) {
+        num_cache_frames = MIN(num_traj_frames, 4);
+        packed_bytes = 0;
+    }
+
     MD_LOG_DEBUG("Initializing frame cache with %i frames.", (int)num_cache_frames);
-    md_frame_cache_init(&inst->cache, inst->traj, alloc, num_cache_frames);
+    inst->cache = frame_cache_create(inst->uncached ? num_cache_frames : frame_cache_capacity(num_cache_frames, num_traj_frames), num_cache_frames, mol->atom.count, num_traj_frames, alloc);
+
+    if (packed_bytes) {
+        inst->packed = packed_cache_create(num_traj_frames, cache_compression.precision, packed_bytes, alloc);
+    }
+
+    // Only spill if the primary cache cannot hold the entire trajectory
+    if (num_cache_frames < num_traj_frames && !inst->uncached) {
+        inst->spill = spill_cache_create(inst->key, mol->atom.count, num_traj_frames, alloc);
+    }
+
+    inst->counters = (CacheCounters*)md_alloc(alloc, sizeof(CacheCounters));
+    MEMSET(inst->counters, 0, sizeof(CacheCounters));
+
+    inst->rebuild_budget = (std::atomic_size_t*)md_alloc(alloc, sizeof(std::atomic_size_t));
+    MEMSET(inst->rebuild_budget, 0, sizeof(std::atomic_size_t));
+
+    inst->cache_sema = (md_semaphore_t*)md_alloc(alloc, sizeof(md_semaphore_t));
+    md_semaphore_init(inst->cache_sema, CACHE_SEMAPHORE_MAX_COUNT);
+
+    inst->recenter_trans = (vec3_t*)md_alloc(alloc, sizeof(vec3_t) * num_traj_frames);
+    inst->recenter_trans_gen = (std::atomic_uint32_t*)md_alloc(alloc, sizeof(std::atomic_uint32_t) * num_traj_frames);
+    MEMSET(inst->recenter_trans_gen, 0, sizeof(std::atomic_uint32_t) * num_traj_frames);
+    inst->resident_bits = (std::atomic_uint64_t*)md_alloc(alloc, sizeof(std::atomic_uint64_t) * resident_words(num_traj_frames));
+    MEMSET(inst->resident_bits, 0, sizeof(std::atomic_uint64_t) * resident_words(num_traj_frames));
+
+    inst->streams = (FrameStream*)md_alloc(alloc, sizeof(FrameStream) * STREAM_MAX_COUNT);
+    MEMSET(inst->streams, 0, sizeof(FrameStream) * STREAM_MAX_COUNT);
+    frame_streams_init(inst->streams, internal_traj);
 
     // We only overload load frame and decode frame data to apply PBC upon loading data
     traj->inst = (md_trajectory_o*)inst;
     traj->get_header = get_header;
     traj->load_frame = load_frame;
-    
+
     return traj;
 }
 
+md_trajectory_i* open_view(md_trajectory_i* traj, const md_bitfield_t* atom_mask, md_molecule_t* out_mol, md_allocator_i* mol_alloc, md_allocator_i* alloc) {
+    ASSERT(traj);
+    ASSERT(atom_mask);
+    ASSERT(out_mol);
+    ASSERT(mol_alloc);
+    ASSERT(alloc);
+
+    LoadedTrajectory* parent = find_loaded_trajectory((uint64_t)traj);
+    if (!parent) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return NULL;
+    }
+
+    const size_t count = md_bitfield_popcount(atom_mask);
+    if (count == 0) {
+        MD_LOG_ERROR("Cannot create a trajectory view of an empty atom subset");
+        return NULL;
+    }
+
+    SubsetTrajectory* sub = (SubsetTrajectory*)md_alloc(alloc, sizeof(SubsetTrajectory));
+    MEMSET(sub, 0, sizeof(SubsetTrajectory));
+    sub->src = parent->traj;
+    sub->alloc = alloc;
+    sub->src_num_atoms = parent->mol->atom.count;
+    sub->num_frames = parent->num_frames;
+    sub->frame_beg = parent->frame_beg;
+    sub->frame_stride = parent->frame_stride;
+    if (parent->follow) {
+        // The view reads from the internal trajectory, which only knows of the frames it indexed
+        const int64_t num_indexed = parent->follow->num_indexed;
+        sub->num_frames = MIN(sub->num_frames, (size_t)((num_indexed - sub->frame_beg + sub->frame_stride - 1) / sub->frame_stride));
+    }
+    if (parent->frame_times) {
+        md_array_push_array(sub->frame_times, parent->frame_times, sub->num_frames, alloc);
+    }
+    md_array_resize(sub->indices, count, alloc);
+    md_bitfield_iter_extract_indices(sub->indices, count, md_bitfield_iter_create(atom_mask));
+
+    extract_molecule_subset(out_mol, parent->mol, sub->indices, count, mol_alloc);
+
+    md_trajectory_i* internal_traj = (md_trajectory_i*)md_alloc(alloc, sizeof(md_trajectory_i));
+    MEMSET(internal_traj, 0, sizeof(md_trajectory_i));
+    internal_traj->inst = (md_trajectory_o*)sub;
+    internal_traj->get_header = subset_get_header;
+    internal_traj->load_frame = subset_load_frame;
+    internal_traj->fetch_frame_data  = subset_fetch_frame_data;
+    internal_traj->decode_frame_data = subset_decode_frame_data;
+
+    MD_LOG_DEBUG("Created trajectory view of %i out of %i atoms.", (int)count, (int)sub->src_num_atoms);
+    return wrap_trajectory(internal_traj, subset_loader(), out_mol, alloc, NULL);
+}
+
 bool close(md_trajectory_i* traj) {
     ASSERT(traj);
 
     LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
     if (loaded_traj) {
+        if (loaded_traj->loader == text_loader()) {
+            TextTrajectory* text = (TextTrajectory*)loaded_traj->traj->inst;
+            text->index_cancel = true;
+            task_system::task_wait_for(text->index_task);
+        }
+        // The rebuild task refers to its trajectory by address, which changes for the last trajectory when one is removed
+        task_system::task_wait_for(cache_rebuild_task);
         remove_loaded_trajectory(loaded_traj->key);
         MEMSET(traj, 0, sizeof(md_trajectory_i));
         return true;
@@ -629,6 +1353,8 @@ bool set_recenter_target(md_trajectory_i* traj, const md_bitfield_t* atom_mask)
 
     LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
     if (loaded_traj) {
+        // Cached frames are unaffected, only the per frame translations are invalidated through the generation
+        cache_lock_exclusive(loaded_traj);
         if (atom_mask) {
             size_t count = md_bitfield_popcount(atom_mask);
             md_array_resize(loaded_traj->recenter_indices, count, loaded_traj->alloc);
@@ -637,6 +1363,8 @@ bool set_recenter_target(md_trajectory_i* traj, const md_bitfield_t* atom_mask)
         else {
             md_array_shrink(loaded_traj->recenter_indices, 0);
         }
+        loaded_traj->recenter_generation += 1;
+        cache_unlock_exclusive(loaded_traj);
         return true;
     }
     MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
@@ -648,7 +1376,13 @@ bool clear_cache(md_trajectory_i* traj) {
 
     LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
     if (loaded_traj) {
-        md_frame_cache_clear(&loaded_traj->cache);
+        // Exclusive, frames of the compressed tier are freed
+        cache_lock_exclusive(loaded_traj);
+        frame_cache_clear(loaded_traj->cache);
+        packed_cache_clear(loaded_traj->packed);
+        spill_cache_clear(loaded_traj->spill);
+        MEMSET(loaded_traj->resident_bits, 0, sizeof(std::atomic_uint64_t) * resident_words(loaded_traj->frame_capacity));
+        cache_unlock_exclusive(loaded_traj);
         return true;
     }
     MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
@@ -660,12 +1394,157 @@ size_t num_cache_frames(md_trajectory_i* traj) {
 
     LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
     if (loaded_traj) {
-        return md_frame_cache_num_frames(&loaded_traj->cache);
+        cache_lock_shared(loaded_traj);
+        size_t num_frames = frame_cache_num_slots(loaded_traj->cache);
+        cache_unlock_shared(loaded_traj);
+        return num_frames;
     }
     MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
     return 0;
 }
 
+bool frame_cached(md_trajectory_i* traj, int64_t idx) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        if (idx < 0 || idx >= (int64_t)loaded_traj->num_frames) return false;
+        if (loaded_traj->uncached) return true;
+        cache_lock_shared(loaded_traj);
+        const bool result = frame_resident(loaded_traj, idx);
+        cache_unlock_shared(loaded_traj);
+        return result;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return false;
+}
+
+int64_t nearest_cached_frame(md_trajectory_i* traj, int64_t idx) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        const int64_t num_frames = (int64_t)loaded_traj->num_frames;
+        if (num_frames == 0) return -1;
+        idx = CLAMP(idx, (int64_t)0, num_frames - 1);
+        if (loaded_traj->uncached) return idx;
+
+        cache_lock_shared(loaded_traj);
+        const int64_t result = nearest_resident_frame(loaded_traj, idx);
+        cache_unlock_shared(loaded_traj);
+        return result;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return -1;
+}
+
+void set_playhead(md_trajectory_i* traj, double frame, double fps) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        cache_lock_shared(loaded_traj);
+        loaded_traj->cache->playhead.store(frame, std::memory_order_relaxed);
+        loaded_traj->cache->fps.store(fps, std::memory_order_relaxed);
+        cache_unlock_shared(loaded_traj);
+        return;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+}
+
+bool get_cache_stats(md_trajectory_i* traj, CacheStats* stats) {
+    ASSERT(traj);
+    ASSERT(stats);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        cache_lock_shared(loaded_traj);
+        stats->mem_frames    = frame_cache_num_slots(loaded_traj->cache);
+        stats->packed_frames = loaded_traj->packed ? loaded_traj->packed->count.load() : 0;
+        stats->packed_bytes  = loaded_traj->packed ? loaded_traj->packed->bytes.load() : 0;
+        cache_unlock_shared(loaded_traj);
+        stats->disk_frames   = loaded_traj->spill ? loaded_traj->spill->num_slots : 0;
+        stats->frame_bytes   = loaded_traj->frame_bytes;
+        stats->mem_hits      = loaded_traj->counters->mem_hits;
+        stats->packed_hits   = loaded_traj->counters->packed_hits;
+        stats->disk_hits     = loaded_traj->counters->disk_hits;
+        stats->misses        = loaded_traj->counters->misses;
+        stats->direct_loads  = loaded_traj->counters->direct_loads;
+        stats->fetched       = loaded_traj->counters->fetched;
+        stats->fetch_time    = md_time_as_seconds((md_timestamp_t)loaded_traj->counters->fetch_ticks.load());
+        stats->decoded       = loaded_traj->counters->decoded;
+        stats->decode_time   = md_time_as_seconds((md_timestamp_t)loaded_traj->counters->decode_ticks.load());
+        stats->evictions     = loaded_traj->counters->evictions;
+        stats->bytes_read    = loaded_traj->counters->bytes_read;
+        stats->loads         = loaded_traj->counters->loads;
+        stats->load_time     = md_time_as_seconds((md_timestamp_t)loaded_traj->counters->load_ticks.load());
+        stats->recenter_time = md_time_as_seconds((md_timestamp_t)loaded_traj->counters->recenter_ticks.load());
+        for (int i = 0; i < CACHE_HISTOGRAM_NUM_BUCKETS; ++i) {
+            stats->load_histogram[i]   = loaded_traj->counters->load_histogram[i];
+            stats->decode_histogram[i] = loaded_traj->counters->decode_histogram[i];
+        }
+        return true;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return false;
+}
+
+void set_cache_budget(size_t bytes) {
+    cache_budget.bytes = bytes;
+    const size_t budget = effective_cache_budget();
+    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
+        apply_cache_budget(&loaded_trajectories[i], budget);
+    }
+    cache_budget.last_update = md_time_current();
+}
+
+size_t get_cache_budget() {
+    return cache_budget.bytes;
+}
+
+size_t get_effective_cache_budget() {
+    return effective_cache_budget();
+}
+
+void update_cache_budget() {
+    // Rebuilds which are pending behind the one which has just completed
+    launch_cache_rebuilds();
+    if (cache_budget.bytes != 0 || num_loaded_trajectories == 0) return;
+
+    const md_timestamp_t now = md_time_current();
+    if (md_time_as_seconds(now - cache_budget.last_update) < CACHE_AUTO_BUDGET_INTERVAL_IN_SECONDS) return;
+    cache_budget.last_update = now;
+
+    const size_t budget = effective_cache_budget();
+    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
+        LoadedTrajectory* loaded_traj = &loaded_trajectories[i];
+        if (*loaded_traj->rebuild_budget != 0) {
+            // Picks up the budget once it has been rebuilt
+            continue;
+        }
+        const size_t cur = loaded_traj->budget;
+
+        // Some hysteresis to avoid thrashing the cache on small fluctuations in available memory
+        if (budget < cur - cur / 8 || budget > cur + cur / 4) {
+            apply_cache_budget(loaded_traj, budget);
+        }
+    }
+}
+
+void set_cache_compression(bool enabled, float precision) {
+    cache_compression.enabled   = enabled;
+    cache_compression.precision = CLAMP(precision, 0.0001f, 1.0f);
+    const size_t budget = effective_cache_budget();
+    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
+        apply_cache_budget(&loaded_trajectories[i], budget);
+    }
+}
+
+bool get_cache_compression(float* precision) {
+    if (precision) *precision = cache_compression.precision;
+    return cache_compression.enabled;
+}
+
 }  // namespace traj
 
 }  // namespace load
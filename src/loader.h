@@ -2,12 +2,22 @@
 
 #include <core/md_str.h>
 
+#include "task_system.h"
+
 struct md_allocator_i;
 struct md_molecule_t;
 struct md_molecule_loader_i;
 struct md_trajectory_i;
 struct md_trajectory_loader_i;
 struct md_bitfield_t;
+struct FrameStream;
+struct BondJob;
+struct NativeExport;
+
+#define CACHE_HISTOGRAM_NUM_BUCKETS 24
+
+// Molecules with fewer atoms get their bonds from md_util_molecule_postprocess on the main thread
+#define PARALLEL_BONDS_MIN_ATOMS 100000
 
 // @NOTE(Robin): This API is currently a mess.
 
@@ -19,10 +29,17 @@ enum LoaderStateFlag_ {
 enum LoadTrajectoryFlag_ {
     LoadTrajectoryFlag_None = 0,
     LoadTrajectoryFlag_DisableCacheWrite = 1,
+    LoadTrajectoryFlag_Progressive = 2,         // Large text trajectories are finalized once the beginning of the file is indexed (see index_remaining)
+};
+
+enum LoadMoleculeFlag_ {
+    LoadMoleculeFlag_None = 0,
+    LoadMoleculeFlag_DisableCacheWrite = 1,
 };
 
 typedef uint32_t LoaderStateFlags;
 typedef uint32_t LoadTrajectoryFlags;
+typedef uint32_t LoadMoleculeFlags;
 
 namespace load {
     // This represents a loader state with arguments to load a molecule or trajectory from a file
@@ -45,18 +62,177 @@ namespace load {
 
 namespace mol {
     md_molecule_loader_i* loader_from_ext(str_t ext);
+
+    // Binary snapshot of a parsed and postprocessed molecule, stored next to the file (<file>.vtop).
+    // It is keyed by the size, modification time and content hash of the file and the postprocess flags it was processed with.
+    // The snapshot holds atoms, residues, chains and bonds, postprocess the loaded molecule without MD_UTIL_POSTPROCESS_BOND_BIT to derive the rest.
+    bool load_topology_cache(md_molecule_t* mol, str_t filename, uint32_t postprocess_flags, md_allocator_i* alloc);
+    bool write_topology_cache(const md_molecule_t* mol, str_t filename, uint32_t postprocess_flags);
+
+    // Parses the atom records of large pdb and gro files in line aligned chunks on the thread pool.
+    // Returns false if the loader or file is not suited for it (other formats or small files), then load the file with the loader as usual.
+    // Only files which the loader reads the same way are parsed, anything else is left to the loader (returns false):
+    // CONECT records, alternate locations, insertion codes, hybrid-36 numbers, more than one model and atom records which are too short,
+    // as well as gro files with non-standard coordinate fields.
+    bool init_from_file_parallel(md_molecule_t* mol, str_t filename, md_molecule_loader_i* loader, md_allocator_i* alloc);
+
+    // Parses a pdb or gro file with both the parallel parser and the loader and compares the atoms, residues, chains and unit cell.
+    // Returns false and logs the first difference if they do not match. Files which the parallel parser leaves to the loader pass.
+    bool verify_parse(str_t filename);
+
+    // Compares the throughput of the parallel parser against the serial gro loader on a synthetic file of num_atoms atoms.
+    // The benchmark fails unless both give the same molecule.
+    // The file is written to the spill directory (or the temp directory) and removed afterwards, the results are logged.
+    void benchmark_parse(size_t num_atoms);
+
+    // Bonds, connectivity and structures of large molecules computed on the thread pool with md_util_molecule_postprocess (the bond related bits of postprocess_flags).
+    // The job copies the coordinates of the molecule, which can be animated while it runs. It cannot be interrupted once launched.
+    // create_bond_job returns NULL if the molecule is too small for it to pay off, then postprocess the molecule as usual.
+    // Once complete, finish_bond_job moves the results into the molecule and returns the allocator that holds them, which the caller then owns.
+    BondJob*        create_bond_job(const md_molecule_t* mol, uint32_t postprocess_flags);
+    task_system::ID launch_bond_job(BondJob* job);
+    bool            bond_job_complete(const BondJob* job);
+    md_allocator_i* finish_bond_job(BondJob* job, md_molecule_t* mol);
+    void            free_bond_job(BondJob* job);
 }
 
 namespace traj {
     md_trajectory_loader_i* loader_from_ext(str_t ext);
 
-    md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, LoadTrajectoryFlags flags = LoadTrajectoryFlag_None);
+    // Subset of the trajectory frames to expose: Every stride frame with a time within [beg_time, end_time].
+    // Times are in the time unit of the trajectory (ps for xtc and trr), an end_time <= beg_time means until the last frame.
+    // Everything downstream (num_frames, frame times, loading frames) only sees the subsampled trajectory.
+    struct FrameRange {
+        double   beg_time = 0;
+        double   end_time = 0;
+        uint32_t stride   = 1;
+    };
+
+    md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, LoadTrajectoryFlags flags = LoadTrajectoryFlag_None, const FrameRange* range = NULL);
+
+    // Opening split in two steps, so the expensive part can run asynchronously:
+    // prepare_file lets the loader scan the file to index its frames and is safe to call from any thread.
+    // If the file is a part of a split trajectory (<name>.part0001.xtc, <name>.part0002.xtc, ...), all consecutive parts are indexed in parallel
+    // and opened as one trajectory. Frames which overlap in time at the boundaries are taken from the later part.
+    // Large lammpstrj, xyz (xmol, arc) and multi-model pdb files are indexed in parallel, the index is stored next to the file (<file>.vidx).
+    // finalize_file (or discard_prepared) must then be called from the thread which uses the rest of this interface.
+    // The parallel indexers report the parts or megabytes they have completed through progress, total remains 0 if the loader indexes the file on its own.
+    // Setting cancel stops the parallel indexers at their next part or window of the file, prepare_file then returns NULL.
+    // A loader which indexes the file on its own cannot be interrupted.
+    struct PrepareProgress {
+        std::atomic_uint32_t completed {0};
+        std::atomic_uint32_t total {0};
+        std::atomic_bool     cancel {false};
+    };
+    struct PreparedTrajectory;
+    PreparedTrajectory* prepare_file(str_t filename, md_trajectory_loader_i* loader, md_allocator_i* alloc, LoadTrajectoryFlags flags = LoadTrajectoryFlag_None, PrepareProgress* progress = NULL);
+    md_trajectory_i* finalize_file(PreparedTrajectory* prepared, const md_molecule_t* mol, const FrameRange* range = NULL);
+    void discard_prepared(PreparedTrajectory* prepared);
+
+    // With LoadTrajectoryFlag_Progressive, prepare_file only indexes the beginning of a large text trajectory, which is then finalized with those frames.
+    // index_remaining indexes the rest of the file on the thread pool and returns the id of the task, INVALID_ID if there is nothing left to index.
+    // The frames are appended to the trajectory by follow_update as they are indexed, poll it while is_indexing returns true.
+    // The task stops early if progress->cancel is set, the frames which have been indexed remain. progress must remain valid until the task has completed.
+    // Closing the trajectory stops the task and waits for it. Requires the frame range to extend to the end of the file.
+    task_system::ID index_remaining(md_trajectory_i* traj, PrepareProgress* progress);
+    bool            is_indexing(md_trajectory_i* traj);
     bool close(md_trajectory_i* traj);
 
+    // Trajectory view of a subset of atoms, frames only hold (and cache) the coordinates of the atoms within the mask.
+    // out_mol is filled with a compacted molecule of the subset (allocated with mol_alloc) which matches the view and has to outlive it.
+    // The view reads directly from the file of traj, it is closed with close() and must be closed before traj.
+    md_trajectory_i* open_view(md_trajectory_i* traj, const md_bitfield_t* atom_mask, md_molecule_t* out_mol, md_allocator_i* mol_alloc, md_allocator_i* alloc);
+
+    // The translation is applied to frames as they are read out of the cache, so changing the target does not require clearing it.
     bool set_recenter_target(md_trajectory_i* traj, const md_bitfield_t* atom_mask);
 
     bool clear_cache(md_trajectory_i* traj);
     size_t num_cache_frames(md_trajectory_i* traj);
+
+    // Is the frame held by one of the cache tiers, so loading it does not require reading and decoding it from the file?
+    bool frame_cached(md_trajectory_i* traj, int64_t idx);
+    // Closest frame to idx which is held by a cache tier, -1 if there is none
+    int64_t nearest_cached_frame(md_trajectory_i* traj, int64_t idx);
+
+    // Position of playback (in frames), which the primary cache uses to pick frames to evict: Frames behind the playhead go first.
+    // fps is negative when playing backwards and 0 when not playing, then frames are evicted by their distance to the playhead.
+    void set_playhead(md_trajectory_i* traj, double frame, double fps);
+
+    // Memory budget in bytes for the frame cache of each open trajectory, 0 = Automatic (tracks available system memory).
+    // Open trajectories have the limits of their caches adjusted immediately, frames beyond them are evicted as new frames are loaded.
+    // Caches which have to grow past their capacity (or change compression) are rebuilt on the thread pool, loads are never blocked by the caller.
+    void   set_cache_budget(size_t bytes);
+    size_t get_cache_budget();
+    size_t get_effective_cache_budget();
+
+    // Call periodically (once per frame) to let the automatic budget follow the available system memory and to launch pending rebuilds.
+    void   update_cache_budget();
+
+    // Keep frames which do not fit in the budget uncompressed in a compressed (quantized) form in memory instead.
+    // Precision is the quantization step in Ångström, 0.01 corresponds to the default precision of xtc.
+    void set_cache_compression(bool enabled, float precision);
+    bool get_cache_compression(float* precision);
+
+    // Secondary cache tier which holds decoded frames in a memory mapped scratch file (preferably on a local fast disk).
+    // Applies to trajectories opened after the call. An empty directory or a size of zero disables the tier.
+    void set_spill_settings(str_t scratch_dir, size_t max_bytes);
+
+    struct CacheStats {
+        size_t mem_frames;      // Capacity of the RAM tier in frames
+        size_t packed_frames;   // Resident frames in the compressed tier
+        size_t packed_bytes;    // Memory held by the compressed tier
+        size_t disk_frames;     // Capacity of the spill tier in frames
+        size_t frame_bytes;     // Size of an uncompressed frame
+        size_t mem_hits;
+        size_t packed_hits;
+        size_t disk_hits;
+        size_t misses;
+        size_t direct_loads;    // Frames copied straight out of a memory mapped trajectory (vtraj, dcd), which has no cache tiers
+        size_t fetched;         // Frames whose raw data was read from the trajectory file
+        double fetch_time;      // Accumulated time in seconds spent reading it (summed over threads)
+        size_t decoded;         // Frames decoded from the trajectory file
+        double decode_time;     // Accumulated time in seconds spent decoding them, excluding the read unless the loader does both at once
+        size_t evictions;       // Frames evicted from the RAM tier
+        size_t bytes_read;      // Raw frame data read from the trajectory file
+        size_t loads;           // Calls to md_trajectory_load_frame
+        double load_time;       // Accumulated time in seconds spent in md_trajectory_load_frame
+        double recenter_time;   // Accumulated time in seconds spent applying the recenter translation
+        // Latency of load_frame calls and of decoding, bucket 0 holds durations below 1 us,
+        // bucket i > 0 holds durations in [2^(i-1), 2^i) us and the last bucket everything above.
+        size_t load_histogram[CACHE_HISTOGRAM_NUM_BUCKETS];
+        size_t decode_histogram[CACHE_HISTOGRAM_NUM_BUCKETS];
+    };
+
+    bool get_cache_stats(md_trajectory_i* traj, CacheStats* stats);
+
+    // Pipelined loading of a range of frames [beg, end)
+    // Raw frame data is read sequentially in file order by one thread at a time and the threads which load the frames only decode it.
+    // Consumers claim the frames in order with stream_next, load them as usual with md_trajectory_load_frame and then release them.
+    // Returns NULL if the trajectory loader does not support it, then just load the frames directly.
+    FrameStream* stream_begin(md_trajectory_i* traj, size_t beg, size_t end);
+    bool stream_next(FrameStream* stream, size_t max_count, size_t* beg, size_t* end);
+    void stream_release(FrameStream* stream, size_t beg, size_t end);
+    void stream_end(FrameStream* stream);
+
+    // Follow mode for trajectories which are still being written by a running simulation (xtc, trr and lammpstrj).
+    // follow_update scans the file from the end of the last complete frame and appends the new frames to the trajectory without reopening it,
+    // it returns the number of frames which were added. Only new data is read, so it is cheap enough to poll every few seconds.
+    // Requires the loaded frame range to extend to the end of the file. Appended frames remain loadable after follow_end.
+    // Frames of a trajectory which is still being indexed (index_remaining) are appended by follow_update as well, the file is only scanned once it has been indexed.
+    bool   follow_begin(md_trajectory_i* traj, str_t filename);
+    void   follow_end(md_trajectory_i* traj);
+    bool   is_following(md_trajectory_i* traj);
+    size_t follow_update(md_trajectory_i* traj);
+
+    // Export to the native trajectory format (vtraj), which holds decoded frames in fixed size records and is memory mapped when opened,
+    // so it opens instantly and frames are loaded without decoding. Every stride frame of the trajectory is exported, either all atoms or the atoms in atom_mask
+    // (which then needs a matching topology when opened). Frames are written as they are loaded, i.e. with the current recenter target applied.
+    // export_native_write is thread safe for disjoint ranges of [0, export_native_num_frames). The file is only valid (and otherwise removed) if
+    // every frame was written when export_native_end is called.
+    NativeExport* export_native_begin(md_trajectory_i* traj, str_t filename, const md_bitfield_t* atom_mask = NULL, uint32_t stride = 1);
+    size_t export_native_num_frames(const NativeExport* exp);
+    bool   export_native_write(NativeExport* exp, size_t beg, size_t end);
+    bool   export_native_end(NativeExport* exp);
 }
 
 }  // namespace load
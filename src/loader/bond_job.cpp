@@ -0,0 +1,88 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_arena_allocator.h>
+#include <md_util.h>
+
+// Bonds, connectivity and structures of large molecules, computed with md_util_molecule_postprocess on the thread pool so the result is the
+// same as that of the serial path. The job works on a shallow copy of the molecule with its own copy of the coordinates, since the molecule
+// is animated while it runs. Its results are allocated from an arena of the job, which is handed over along with them.
+struct BondJob {
+    md_molecule_t mol;
+    md_allocator_i* arena;
+    uint32_t postprocess_flags;
+    std::atomic_bool complete;
+};
+
+namespace load {
+
+namespace mol {
+
+BondJob* create_bond_job(const md_molecule_t* mol, uint32_t postprocess_flags) {
+    ASSERT(mol);
+    if (mol->atom.count < PARALLEL_BONDS_MIN_ATOMS) return NULL;
+
+    md_allocator_i* alloc = md_get_heap_allocator();
+    BondJob* job = (BondJob*)md_alloc(alloc, sizeof(BondJob));
+    MEMSET(job, 0, sizeof(BondJob));
+    job->arena = md_arena_allocator_create(alloc, MEGABYTES(16));
+    job->postprocess_flags = postprocess_flags;
+    job->mol = *mol;
+    MEMSET(&job->mol.bond, 0, sizeof(job->mol.bond));
+    MEMSET(&job->mol.conn, 0, sizeof(job->mol.conn));
+    MEMSET(&job->mol.structures, 0, sizeof(job->mol.structures));
+    MEMSET(&job->mol.rings, 0, sizeof(job->mol.rings));
+
+    const size_t num_atoms = mol->atom.count;
+    job->mol.atom.x = 0;
+    job->mol.atom.y = 0;
+    job->mol.atom.z = 0;
+    md_array_push_array(job->mol.atom.x, mol->atom.x, num_atoms, job->arena);
+    md_array_push_array(job->mol.atom.y, mol->atom.y, num_atoms, job->arena);
+    md_array_push_array(job->mol.atom.z, mol->atom.z, num_atoms, job->arena);
+    return job;
+}
+
+task_system::ID launch_bond_job(BondJob* job) {
+    ASSERT(job);
+    // md_util_molecule_postprocess cannot be interrupted, the job runs to completion once started
+    return task_system::pool_enqueue(STR_LIT("Computing Bonds"), [](void* user_data) {
+        BondJob* job = (BondJob*)user_data;
+        md_util_molecule_postprocess(&job->mol, job->arena, (md_util_postprocess_flags_t)job->postprocess_flags);
+        job->complete = true;
+    }, job);
+}
+
+bool bond_job_complete(const BondJob* job) {
+    ASSERT(job);
+    return job->complete;
+}
+
+md_allocator_i* finish_bond_job(BondJob* job, md_molecule_t* mol) {
+    ASSERT(job);
+    ASSERT(mol);
+    ASSERT(bond_job_complete(job));
+
+    // The previous arrays (if any) belong to the allocator of the molecule and are released with it
+    mol->bond       = job->mol.bond;
+    mol->conn       = job->mol.conn;
+    mol->structures = job->mol.structures;
+    mol->rings      = job->mol.rings;
+
+    md_allocator_i* arena = job->arena;
+    job->arena = NULL;
+    return arena;
+}
+
+void free_bond_job(BondJob* job) {
+    if (job) {
+        if (job->arena) {
+            md_arena_allocator_destroy(job->arena);
+        }
+        md_free(md_get_heap_allocator(), job, sizeof(BondJob));
+    }
+}
+
+}  // namespace mol
+
+}  // namespace load
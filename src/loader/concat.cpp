@@ -0,0 +1,300 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <core/md_parse.h>
+
+#include <stdio.h>
+
+// Frame data fetched from a concatenated trajectory is prefixed with the index of the frame, so it can be decoded by the right part
+#define CONCAT_DATA_PREFIX 8
+// Frames of consecutive parts closer in time than this are considered the same frame
+#define CONCAT_TIME_EPSILON 1.0e-3
+#define CONCAT_MAX_PARTS 10000
+
+// Internal trajectory which concatenates the parts of a split run (traj.part0001.xtc, traj.part0002.xtc, ...)
+// Every part is an internal trajectory of the loader of the file type. Where consecutive parts overlap in time (a run continued
+// from a checkpoint), the frames at the end of the earlier part are dropped in favour of the later part. A part whose time
+// restarts is shifted to continue after the previous part. The concatenation is wrapped as one trajectory, so the parts share its cache.
+struct ConcatPart {
+    md_trajectory_i* traj;
+    md_trajectory_loader_i* loader;
+    int64_t frame_offset;       // Index of the first frame of the part within the concatenation
+    int64_t num_frames;         // Number of leading frames of the part which are used
+    double  time_offset;
+};
+
+struct ConcatTrajectory {
+    md_allocator_i* alloc;
+    ConcatPart* parts;
+    size_t num_parts;
+    size_t num_atoms;
+    size_t num_frames;
+    md_array(double) frame_times;
+};
+
+struct ConcatOpen {
+    char (*paths)[1024];
+    md_trajectory_i** trajs;
+    md_trajectory_loader_i** loaders;   // Loader of the file type, replaced by the loader which created the part
+    uint32_t flags;
+    load::traj::PrepareProgress* progress;  // Completed parts, may be NULL
+};
+
+// Finds the consecutive parts of a split trajectory (<stem>.part<number><ext>) around filename.
+// Returns the number of parts and writes the first part number and the width of the number, less than 2 if there are no other parts.
+size_t find_trajectory_parts(str_t filename, str_t* stem, str_t* ext, int* first, int* width) {
+    const str_t tag = STR_LIT(".part");
+    int64_t pos = -1;
+    for (int64_t i = (int64_t)filename.len - (int64_t)tag.len; i >= 0; --i) {
+        if (strncmp(filename.ptr + i, tag.ptr, tag.len) == 0) {
+            pos = i;
+            break;
+        }
+    }
+    if (pos < 0) return 0;
+
+    const size_t num_beg = (size_t)pos + tag.len;
+    size_t num_end = num_beg;
+    while (num_end < filename.len && '0' <= filename.ptr[num_end] && filename.ptr[num_end] <= '9') ++num_end;
+    if (num_end == num_beg || num_end - num_beg > 8 || num_end == filename.len || filename.ptr[num_end] != '.') return 0;
+
+    *stem  = str_t{filename.ptr, num_beg};
+    *ext   = str_t{filename.ptr + num_end, filename.len - num_end};
+    *width = (int)(num_end - num_beg);
+    const int number = (int)parse_int(str_t{filename.ptr + num_beg, num_end - num_beg});
+
+    char path[1024];
+    auto exists = [&](int n) {
+        snprintf(path, sizeof(path), "%.*s%0*d%.*s", (int)stem->len, stem->ptr, *width, n, (int)ext->len, ext->ptr);
+        return md_path_is_valid(str_from_cstr(path));
+    };
+    int beg = number;
+    int end = number + 1;
+    while (beg > 0 && end - beg < CONCAT_MAX_PARTS && exists(beg - 1)) --beg;
+    while (end - beg < CONCAT_MAX_PARTS && exists(end)) ++end;
+    *first = beg;
+    return (size_t)(end - beg);
+}
+
+static inline double concat_part_time(const ConcatTrajectory* concat, size_t part, int64_t idx) {
+    md_trajectory_header_t header;
+    if (md_trajectory_get_header(concat->parts[part].traj, &header) && header.frame_times) {
+        return header.frame_times[idx];
+    }
+    return (double)idx;
+}
+
+// Part which holds the frame, parts without any used frames share their offset with the next part and are skipped
+static inline const ConcatPart* concat_find_part(const ConcatTrajectory* concat, int64_t idx) {
+    size_t lo = 0;
+    size_t hi = concat->num_parts;
+    while (hi - lo > 1) {
+        const size_t mid = (lo + hi) / 2;
+        if (concat->parts[mid].frame_offset <= idx) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return &concat->parts[lo];
+}
+
+static inline void concat_fix_header(const ConcatTrajectory* concat, int64_t idx, md_trajectory_frame_header_t* header) {
+    if (header) {
+        header->index     = idx;
+        header->timestamp = concat->frame_times[idx];
+    }
+}
+
+static bool concat_get_header(struct md_trajectory_o* inst, md_trajectory_header_t* header) {
+    ConcatTrajectory* concat = (ConcatTrajectory*)inst;
+    if (!md_trajectory_get_header(concat->parts[0].traj, header)) return false;
+    header->num_atoms   = concat->num_atoms;
+    header->num_frames  = concat->num_frames;
+    header->frame_times = concat->frame_times;
+    return true;
+}
+
+static bool concat_load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    ConcatTrajectory* concat = (ConcatTrajectory*)inst;
+    ASSERT(0 <= idx && idx < (int64_t)concat->num_frames);
+    const ConcatPart* part = concat_find_part(concat, idx);
+    if (!md_trajectory_load_frame(part->traj, idx - part->frame_offset, header, x, y, z)) return false;
+    concat_fix_header(concat, idx, header);
+    return true;
+}
+
+static size_t concat_fetch_frame_data(struct md_trajectory_o* inst, int64_t idx, void* data_ptr) {
+    ConcatTrajectory* concat = (ConcatTrajectory*)inst;
+    ASSERT(0 <= idx && idx < (int64_t)concat->num_frames);
+    const ConcatPart* part = concat_find_part(concat, idx);
+    const size_t size = md_trajectory_fetch_frame_data(part->traj, idx - part->frame_offset, data_ptr ? (char*)data_ptr + CONCAT_DATA_PREFIX : NULL);
+    if (size == 0) return 0;
+    if (data_ptr) {
+        MEMCPY(data_ptr, &idx, sizeof(idx));
+    }
+    return size + CONCAT_DATA_PREFIX;
+}
+
+static bool concat_decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, size_t data_size, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    ConcatTrajectory* concat = (ConcatTrajectory*)inst;
+    if (data_size <= CONCAT_DATA_PREFIX) return false;
+    int64_t idx;
+    MEMCPY(&idx, data_ptr, sizeof(idx));
+    if (idx < 0 || idx >= (int64_t)concat->num_frames) return false;
+    const ConcatPart* part = concat_find_part(concat, idx);
+    if (!md_trajectory_decode_frame_data(part->traj, (const char*)data_ptr + CONCAT_DATA_PREFIX, data_size - CONCAT_DATA_PREFIX, header, x, y, z)) return false;
+    concat_fix_header(concat, idx, header);
+    return true;
+}
+
+static void concat_free(ConcatTrajectory* concat) {
+    md_allocator_i* alloc = concat->alloc;
+    for (size_t i = 0; i < concat->num_parts; ++i) {
+        if (concat->parts[i].traj) {
+            concat->parts[i].loader->destroy(concat->parts[i].traj);
+        }
+    }
+    md_free(alloc, concat->parts, sizeof(ConcatPart) * concat->num_parts);
+    md_array_free(concat->frame_times, alloc);
+    md_free(alloc, concat, sizeof(ConcatTrajectory));
+}
+
+static void concat_destroy(md_trajectory_i* traj) {
+    md_allocator_i* alloc = ((ConcatTrajectory*)traj->inst)->alloc;
+    concat_free((ConcatTrajectory*)traj->inst);
+    md_free(alloc, traj, sizeof(md_trajectory_i));
+}
+
+md_trajectory_loader_i* concat_loader() {
+    // Only used for destroying the concatenation, the parts are created by the loader of their file type
+    static md_trajectory_loader_i loader = {};
+    loader.destroy = concat_destroy;
+    return &loader;
+}
+
+// The parts are indexed in parallel on the thread pool. They are created with the heap allocator, as this may run on any thread.
+md_trajectory_i* concat_create(str_t stem, str_t ext, int first, int width, size_t num_parts, md_trajectory_loader_i* loader, md_allocator_i* alloc, uint32_t flags, load::traj::PrepareProgress* progress) {
+    md_allocator_i* temp_alloc = md_get_heap_allocator();
+    ConcatOpen open = {};
+    open.paths  = (char (*)[1024])md_alloc(temp_alloc, sizeof(*open.paths) * num_parts);
+    open.trajs  = (md_trajectory_i**)md_alloc(temp_alloc, sizeof(md_trajectory_i*) * num_parts);
+    open.loaders = (md_trajectory_loader_i**)md_alloc(temp_alloc, sizeof(md_trajectory_loader_i*) * num_parts);
+    // The parts are fully indexed, only a single file is indexed progressively
+    open.flags  = flags & ~LoadTrajectoryFlag_Progressive;
+    open.progress = progress;
+    if (progress) progress->total = (uint32_t)num_parts;
+    for (size_t i = 0; i < num_parts; ++i) {
+        snprintf(open.paths[i], sizeof(open.paths[i]), "%.*s%0*d%.*s", (int)stem.len, stem.ptr, width, first + (int)i, (int)ext.len, ext.ptr);
+        open.trajs[i] = NULL;
+        open.loaders[i] = loader;
+    }
+
+    task_system::ID index_task = task_system::pool_enqueue(STR_LIT("##Index Parts"), 0, (uint32_t)num_parts, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        ConcatOpen* open = (ConcatOpen*)user_data;
+        for (uint32_t i = range_beg; i < range_end; ++i) {
+            if (open->progress && open->progress->cancel) break;
+            open->trajs[i] = create_internal_trajectory(str_from_cstr(open->paths[i]), &open->loaders[i], md_get_heap_allocator(), open->flags);
+            if (open->progress) open->progress->completed++;
+        }
+    }, &open);
+    task_system::task_wait_for(index_task);
+
+    if (progress && progress->cancel) {
+        for (size_t i = 0; i < num_parts; ++i) {
+            if (open.trajs[i]) open.loaders[i]->destroy(open.trajs[i]);
+        }
+        md_free(temp_alloc, open.paths, sizeof(*open.paths) * num_parts);
+        md_free(temp_alloc, open.trajs, sizeof(md_trajectory_i*) * num_parts);
+        md_free(temp_alloc, open.loaders, sizeof(md_trajectory_loader_i*) * num_parts);
+        return NULL;
+    }
+
+    ConcatTrajectory* concat = (ConcatTrajectory*)md_alloc(alloc, sizeof(ConcatTrajectory));
+    MEMSET(concat, 0, sizeof(ConcatTrajectory));
+    concat->alloc = alloc;
+    concat->num_parts = num_parts;
+    concat->parts = (ConcatPart*)md_alloc(alloc, sizeof(ConcatPart) * num_parts);
+    MEMSET(concat->parts, 0, sizeof(ConcatPart) * num_parts);
+    for (size_t i = 0; i < num_parts; ++i) {
+        concat->parts[i].traj = open.trajs[i];
+        concat->parts[i].loader = open.loaders[i];
+    }
+
+    const char* error = NULL;
+    size_t error_part = 0;
+    for (size_t i = 0; i < num_parts && !error; ++i) {
+        if (!concat->parts[i].traj) {
+            error = "Failed to open part";
+        } else if (md_trajectory_num_frames(concat->parts[i].traj) == 0) {
+            error = "Part has no frames";
+        } else if (md_trajectory_num_atoms(concat->parts[i].traj) != md_trajectory_num_atoms(concat->parts[0].traj)) {
+            error = "Part has a different number of atoms";
+        }
+        error_part = i;
+    }
+
+    if (!error) {
+        concat->num_atoms = md_trajectory_num_atoms(concat->parts[0].traj);
+        concat->parts[0].num_frames = (int64_t)md_trajectory_num_frames(concat->parts[0].traj);
+        for (size_t i = 1; i < num_parts; ++i) {
+            ConcatPart* prev = &concat->parts[i - 1];
+            ConcatPart* part = &concat->parts[i];
+            part->num_frames = (int64_t)md_trajectory_num_frames(part->traj);
+
+            // Assume the part continues the time of the previous part
+            const double t0 = concat_part_time(concat, i, 0);
+            const double prev_beg = concat_part_time(concat, i - 1, 0) + prev->time_offset;
+            double offset = prev->time_offset;
+            if (t0 + offset <= prev_beg) {
+                // The time restarts, continue after the last frame of the previous part
+                const double prev_end = concat_part_time(concat, i - 1, prev->num_frames - 1) + prev->time_offset;
+                double dt = 1.0;
+                if (part->num_frames > 1) {
+                    dt = concat_part_time(concat, i, 1) - t0;
+                } else if (prev->num_frames > 1) {
+                    dt = prev_end - (concat_part_time(concat, i - 1, prev->num_frames - 2) + prev->time_offset);
+                }
+                offset = prev_end + dt - t0;
+            } else {
+                // Overlap, the frames of the later part take precedence
+                while (prev->num_frames > 0 && concat_part_time(concat, i - 1, prev->num_frames - 1) + prev->time_offset >= t0 + offset - CONCAT_TIME_EPSILON) {
+                    prev->num_frames -= 1;
+                }
+            }
+            part->time_offset = offset;
+        }
+
+        int64_t frame_offset = 0;
+        for (size_t i = 0; i < num_parts; ++i) {
+            ConcatPart* part = &concat->parts[i];
+            part->frame_offset = frame_offset;
+            frame_offset += part->num_frames;
+            for (int64_t j = 0; j < part->num_frames; ++j) {
+                md_array_push(concat->frame_times, concat_part_time(concat, i, j) + part->time_offset, alloc);
+            }
+        }
+        concat->num_frames = (size_t)frame_offset;
+    }
+
+    md_trajectory_i* traj = NULL;
+    if (error) {
+        MD_LOG_ERROR("Failed to concatenate trajectory parts, '%s': %s", open.paths[error_part], error);
+        concat_free(concat);
+    } else {
+        MD_LOG_INFO("Concatenated %i trajectory parts with a total of %i frames.", (int)num_parts, (int)concat->num_frames);
+        traj = (md_trajectory_i*)md_alloc(alloc, sizeof(md_trajectory_i));
+        MEMSET(traj, 0, sizeof(md_trajectory_i));
+        traj->inst = (md_trajectory_o*)concat;
+        traj->get_header = concat_get_header;
+        traj->load_frame = concat_load_frame;
+        traj->fetch_frame_data  = concat_fetch_frame_data;
+        traj->decode_frame_data = concat_decode_frame_data;
+    }
+
+    md_free(temp_alloc, open.paths, sizeof(*open.paths) * num_parts);
+    md_free(temp_alloc, open.trajs, sizeof(md_trajectory_i*) * num_parts);
+    md_free(temp_alloc, open.loaders, sizeof(md_trajectory_loader_i*) * num_parts);
+    return traj;
+}
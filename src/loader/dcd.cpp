@@ -0,0 +1,251 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <md_util.h>
+
+// CHARMM/NAMD DCD trajectory
+// Every frame record has the same size, so frames are located arithmetically from the header and the file size without scanning,
+// and the coordinates are converted straight out of the memory mapped file. Frames are Fortran unformatted records:
+// [unit cell (6 doubles)] [x (N floats)] [y (N floats)] [z (N floats)] [w (N floats, 4D only)], each enclosed by 4 byte size markers.
+struct DcdTrajectory {
+    MappedFile file;
+    md_allocator_i* alloc;
+    size_t  num_atoms;
+    size_t  num_frames;
+    size_t  frames_offset;
+    size_t  frame_bytes;
+    bool    has_cell;
+    bool    swap;               // File has the opposite endianness
+    md_array(double) frame_times;
+};
+
+static inline uint32_t dcd_u32(const uint8_t* p, bool swap) {
+    uint32_t v;
+    MEMCPY(&v, p, sizeof(v));
+    return swap ? ((v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24)) : v;
+}
+
+static inline double dcd_f64(const uint8_t* p, bool swap) {
+    uint64_t v = ((uint64_t)dcd_u32(p + (swap ? 0 : 4), swap) << 32) | (uint64_t)dcd_u32(p + (swap ? 4 : 0), swap);
+    double d;
+    MEMCPY(&d, &v, sizeof(d));
+    return d;
+}
+
+static inline float dcd_f32(const uint8_t* p, bool swap) {
+    const uint32_t v = dcd_u32(p, swap);
+    float f;
+    MEMCPY(&f, &v, sizeof(f));
+    return f;
+}
+
+static void dcd_read_coords(float* dst, const uint8_t* src, size_t count, bool swap) {
+    if (!swap) {
+        MEMCPY(dst, src, count * sizeof(float));
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = dcd_f32(src + i * sizeof(float), true);
+    }
+}
+
+// Cell record: A, gamma, B, beta, alpha, C. Newer NAMD versions store the cosines of the angles instead of degrees.
+// Unit cell from the lengths of the cell vectors and the cosines of the angles between them
+md_unit_cell_t unit_cell_from_lengths_and_cosines(double a, double b, double c, double cos_alpha, double cos_beta, double cos_gamma) {
+    md_unit_cell_t cell = md_util_unit_cell_from_extent(a, b, c);
+    const double eps = 1.0e-6;
+    if (fabs(cos_alpha) > eps || fabs(cos_beta) > eps || fabs(cos_gamma) > eps) {
+        const double sin_gamma = sqrt(1.0 - cos_gamma * cos_gamma);
+        const double cx = cos_beta;
+        const double cy = (cos_alpha - cos_beta * cos_gamma) / sin_gamma;
+        const double cz = sqrt(MAX(0.0, 1.0 - cx * cx - cy * cy));
+        cell.basis[0][0] = (float)a;
+        cell.basis[0][1] = 0.0f;
+        cell.basis[0][2] = 0.0f;
+        cell.basis[1][0] = (float)(b * cos_gamma);
+        cell.basis[1][1] = (float)(b * sin_gamma);
+        cell.basis[1][2] = 0.0f;
+        cell.basis[2][0] = (float)(c * cx);
+        cell.basis[2][1] = (float)(c * cy);
+        cell.basis[2][2] = (float)(c * cz);
+        cell.inv_basis = mat3_inverse(cell.basis);
+        cell.flags = (cell.flags & ~MD_UNIT_CELL_FLAG_ORTHO) | MD_UNIT_CELL_FLAG_TRICLINIC;
+    }
+    return cell;
+}
+
+static md_unit_cell_t dcd_unit_cell(const uint8_t* p, bool swap) {
+    const double a = dcd_f64(p + 0 * 8, swap);
+    const double b = dcd_f64(p + 2 * 8, swap);
+    const double c = dcd_f64(p + 5 * 8, swap);
+    double cos_gamma = dcd_f64(p + 1 * 8, swap);
+    double cos_beta  = dcd_f64(p + 3 * 8, swap);
+    double cos_alpha = dcd_f64(p + 4 * 8, swap);
+    if (fabs(cos_alpha) > 1.0 || fabs(cos_beta) > 1.0 || fabs(cos_gamma) > 1.0) {
+        const double deg_to_rad = 3.14159265358979323846 / 180.0;
+        cos_alpha = cos(cos_alpha * deg_to_rad);
+        cos_beta  = cos(cos_beta  * deg_to_rad);
+        cos_gamma = cos(cos_gamma * deg_to_rad);
+    }
+    return unit_cell_from_lengths_and_cosines(a, b, c, cos_alpha, cos_beta, cos_gamma);
+}
+
+static bool dcd_get_header(struct md_trajectory_o* inst, md_trajectory_header_t* header) {
+    DcdTrajectory* dcd = (DcdTrajectory*)inst;
+    MEMSET(header, 0, sizeof(md_trajectory_header_t));
+    header->num_frames  = dcd->num_frames;
+    header->num_atoms   = dcd->num_atoms;
+    header->frame_times = dcd->frame_times;
+    return true;
+}
+
+static bool dcd_load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    DcdTrajectory* dcd = (DcdTrajectory*)inst;
+    ASSERT(0 <= idx && idx < (int64_t)dcd->num_frames);
+    const uint8_t* frame = (const uint8_t*)dcd->file.ptr + dcd->frames_offset + (size_t)idx * dcd->frame_bytes;
+    const uint8_t* coords = frame + (dcd->has_cell ? 4 + 48 + 4 : 0);
+    if (header) {
+        MEMSET(header, 0, sizeof(md_trajectory_frame_header_t));
+        header->num_atoms = dcd->num_atoms;
+        header->index     = idx;
+        header->timestamp = dcd->frame_times[idx];
+        if (dcd->has_cell) {
+            header->unit_cell = dcd_unit_cell(frame + 4, dcd->swap);
+        }
+    }
+    if (x && y && z) {
+        const size_t record_bytes = 4 + dcd->num_atoms * sizeof(float) + 4;
+        dcd_read_coords(x, coords + record_bytes * 0 + 4, dcd->num_atoms, dcd->swap);
+        dcd_read_coords(y, coords + record_bytes * 1 + 4, dcd->num_atoms, dcd->swap);
+        dcd_read_coords(z, coords + record_bytes * 2 + 4, dcd->num_atoms, dcd->swap);
+    }
+    return true;
+}
+
+// Frames are read straight from the mapping, there is no raw data to stage
+static size_t dcd_fetch_frame_data(struct md_trajectory_o*, int64_t, void*) {
+    return 0;
+}
+
+static bool dcd_decode_frame_data(struct md_trajectory_o*, const void*, size_t, md_trajectory_frame_header_t*, float*, float*, float*) {
+    return false;
+}
+
+static md_trajectory_i* dcd_create(str_t filename, md_allocator_i* alloc, uint32_t flags) {
+    (void)flags;
+    DcdTrajectory* dcd = (DcdTrajectory*)md_alloc(alloc, sizeof(DcdTrajectory));
+    MEMSET(dcd, 0, sizeof(DcdTrajectory));
+    dcd->file = MappedFile();
+    dcd->alloc = alloc;
+    if (!mapped_file_create(&dcd->file, filename, 0, MAPPED_FILE_READ)) {
+        MD_LOG_ERROR("Failed to open DCD trajectory '%.*s'", (int)filename.len, filename.ptr);
+        md_free(alloc, dcd, sizeof(DcdTrajectory));
+        return NULL;
+    }
+
+    const uint8_t* base = (const uint8_t*)dcd->file.ptr;
+    const size_t size = dcd->file.size;
+    const char* error = NULL;
+    size_t offset = 0;
+
+    // First record: 'CORD' followed by 20 control integers, its size marker tells the endianness
+    bool swap = false;
+    if (size < 92) {
+        error = "File is too small";
+    } else if (dcd_u32(base, false) == 84) {
+        swap = false;
+    } else if (dcd_u32(base, true) == 84) {
+        swap = true;
+    } else {
+        error = "Unrecognized header";
+    }
+    if (!error && memcmp(base + 4, "CORD", 4) != 0) {
+        error = "Unrecognized header";
+    }
+
+    uint32_t icntrl[20] = {0};
+    if (!error) {
+        for (int i = 0; i < 20; ++i) {
+            icntrl[i] = dcd_u32(base + 8 + i * 4, swap);
+        }
+        offset = 4 + 84 + 4;
+
+        // Title record
+        if (offset + 4 > size) {
+            error = "Truncated header";
+        } else {
+            offset += 4 + dcd_u32(base + offset, swap) + 4;
+        }
+    }
+    if (!error) {
+        // Atom count record
+        if (offset + 12 > size || dcd_u32(base + offset, swap) != 4) {
+            error = "Truncated header";
+        } else {
+            dcd->num_atoms = dcd_u32(base + offset + 4, swap);
+            offset += 12;
+        }
+    }
+
+    const bool charmm = icntrl[19] != 0;
+    if (!error && icntrl[8] != 0) {
+        // Fixed atoms are only stored in the first frame, which breaks the fixed record size
+        error = "Fixed atoms are not supported";
+    }
+
+    if (!error) {
+        dcd->has_cell = charmm && icntrl[10] != 0;
+        dcd->swap = swap;
+        dcd->frames_offset = offset;
+        const size_t record_bytes = 4 + dcd->num_atoms * sizeof(float) + 4;
+        dcd->frame_bytes = (dcd->has_cell ? 4 + 48 + 4 : 0) + record_bytes * ((charmm && icntrl[11]) ? 4 : 3);
+        // The frame count of the header is not updated if the writer was interrupted, trust the file size instead
+        dcd->num_frames = (size - offset) / dcd->frame_bytes;
+        if (dcd->num_frames == 0) {
+            error = "File has no complete frames";
+        }
+    }
+
+    if (error) {
+        MD_LOG_ERROR("Failed to open DCD trajectory '%.*s': %s", (int)filename.len, filename.ptr, error);
+        mapped_file_close(&dcd->file);
+        md_free(alloc, dcd, sizeof(DcdTrajectory));
+        return NULL;
+    }
+
+    // Time step in AKMA units (48.88821 fs), stored as a float by CHARMM and as a double by X-PLOR
+    const double delta  = charmm ? (double)dcd_f32(base + 8 + 9 * 4, swap) : dcd_f64(base + 8 + 9 * 4, swap);
+    const double istart = (double)(int32_t)icntrl[1];
+    const double nsavc  = (double)(int32_t)icntrl[2];
+    const double akma_to_ps = 0.04888821;
+    md_array_resize(dcd->frame_times, dcd->num_frames, alloc);
+    for (size_t i = 0; i < dcd->num_frames; ++i) {
+        dcd->frame_times[i] = (nsavc > 0 && delta > 0) ? (istart + (double)i * nsavc) * delta * akma_to_ps : (double)i;
+    }
+
+    md_trajectory_i* traj = (md_trajectory_i*)md_alloc(alloc, sizeof(md_trajectory_i));
+    MEMSET(traj, 0, sizeof(md_trajectory_i));
+    traj->inst = (md_trajectory_o*)dcd;
+    traj->get_header = dcd_get_header;
+    traj->load_frame = dcd_load_frame;
+    traj->fetch_frame_data  = dcd_fetch_frame_data;
+    traj->decode_frame_data = dcd_decode_frame_data;
+    return traj;
+}
+
+static void dcd_destroy(md_trajectory_i* traj) {
+    DcdTrajectory* dcd = (DcdTrajectory*)traj->inst;
+    md_allocator_i* alloc = dcd->alloc;
+    mapped_file_close(&dcd->file);
+    md_array_free(dcd->frame_times, alloc);
+    md_free(alloc, dcd, sizeof(DcdTrajectory));
+    md_free(alloc, traj, sizeof(md_trajectory_i));
+}
+
+md_trajectory_loader_i* dcd_loader() {
+    static md_trajectory_loader_i loader = {};
+    loader.create  = dcd_create;
+    loader.destroy = dcd_destroy;
+    return &loader;
+}
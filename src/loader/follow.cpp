@@ -0,0 +1,410 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <core/md_parse.h>
+#include <md_xtc.h>
+#include <md_trr.h>
+#include <md_lammps.h>
+
+// Initial size of the window which is read when scanning text trajectories for appended frames
+#define FOLLOW_SCAN_WINDOW_BYTES MEGABYTES(4)
+
+enum {
+    FOLLOW_FORMAT_NONE = -1,        // The file cannot be scanned, frames are only appended while the file is indexed (index_remaining)
+    FOLLOW_FORMAT_XTC = 0,
+    FOLLOW_FORMAT_TRR,
+    FOLLOW_FORMAT_LAMMPSTRJ,
+};
+
+void follow_state_free(FollowState* follow, md_allocator_i* alloc) {
+    if (!follow) return;
+    md_file_close(follow->file);
+    md_mutex_destroy(&follow->mutex);
+    md_array_free(follow->offsets, alloc);
+    md_array_free(follow->times, alloc);
+    md_free(alloc, follow, sizeof(FollowState));
+}
+
+static inline int32_t xdr_int(const uint8_t* p) {
+    return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
+
+static inline float xdr_float(const uint8_t* p) {
+    const int32_t bits = xdr_int(p);
+    float val;
+    MEMCPY(&val, &bits, sizeof(val));
+    return val;
+}
+
+static inline double xdr_double(const uint8_t* p) {
+    const uint64_t bits = ((uint64_t)(uint32_t)xdr_int(p) << 32) | (uint64_t)(uint32_t)xdr_int(p + 4);
+    double val;
+    MEMCPY(&val, &bits, sizeof(val));
+    return val;
+}
+
+// The frame size functions return the size of the frame which starts at buf, 0 if the frame is incomplete and -1 if it is not a frame
+
+static int64_t xtc_frame_size(const uint8_t* buf, size_t len, double* time) {
+    // magic, natoms, step, time, box[3][3], natoms, then the coordinates. Only a handful of atoms are stored uncompressed.
+    if (len < 56) return 0;
+    if (xdr_int(buf) != 1995) return -1;
+    const int32_t num_atoms = xdr_int(buf + 4);
+    *time = xdr_float(buf + 12);
+    if (num_atoms <= 9) return 56 + (int64_t)num_atoms * 12;
+    // precision, minint[3], maxint[3], smallidx, byte count, followed by the compressed coordinates padded to 4 bytes
+    if (len < 92) return 0;
+    return 92 + ALIGN_TO((int64_t)xdr_int(buf + 88), 4);
+}
+
+static int64_t trr_frame_size(const uint8_t* buf, size_t len, double* time) {
+    // magic, version string, the sizes of the blocks of the frame, natoms, step, nre, t and lambda (float or double)
+    if (len < 12) return 0;
+    if (xdr_int(buf) != 1993) return -1;
+    const int32_t str_len = xdr_int(buf + 8);
+    if (str_len < 0 || str_len > 128) return -1;
+    const size_t p = 12 + ALIGN_TO((size_t)str_len, 4);
+    if (len < p + 13 * 4) return 0;
+
+    int64_t block_bytes = 0;
+    for (int i = 0; i < 10; ++i) {
+        block_bytes += xdr_int(buf + p + i * 4);
+    }
+    const int32_t box_size  = xdr_int(buf + p + 2 * 4);
+    const int32_t x_size    = xdr_int(buf + p + 7 * 4);
+    const int32_t v_size    = xdr_int(buf + p + 8 * 4);
+    const int32_t f_size    = xdr_int(buf + p + 9 * 4);
+    const int32_t num_atoms = xdr_int(buf + p + 10 * 4);
+
+    size_t real_size = sizeof(float);
+    if (box_size) {
+        real_size = box_size / 9;
+    } else if (num_atoms > 0) {
+        const int32_t vec_size = x_size ? x_size : v_size ? v_size : f_size;
+        if (vec_size) real_size = vec_size / (num_atoms * 3);
+    }
+    if (real_size != sizeof(float) && real_size != sizeof(double)) return -1;
+
+    const size_t header_size = p + 13 * 4 + 2 * real_size;
+    if (len < header_size) return 0;
+    const uint8_t* t = buf + p + 13 * 4;
+    *time = real_size == sizeof(double) ? xdr_double(t) : (double)xdr_float(t);
+    return (int64_t)header_size + block_bytes;
+}
+
+// Offset after the line which starts at pos, 0 if the line is not terminated (yet)
+static inline size_t next_line(const char* buf, size_t len, size_t pos) {
+    const char* nl = (const char*)memchr(buf + pos, '\n', len - pos);
+    return nl ? (size_t)(nl - buf) + 1 : 0;
+}
+
+int64_t lammps_frame_size(const char* buf, size_t len, double* time) {
+    const str_t timestep_item = STR_LIT("ITEM: TIMESTEP");
+    size_t pos = 0;
+    size_t end = next_line(buf, len, pos);
+    if (!end) return 0;
+    if (!str_begins_with(str_t{buf, end}, timestep_item)) return -1;
+
+    pos = end;
+    end = next_line(buf, len, pos);
+    if (!end) return 0;
+    *time = parse_float(str_trim(str_t{buf + pos, end - pos}));
+    pos = end;
+
+    int64_t num_atoms = -1;
+    while ((end = next_line(buf, len, pos)) != 0) {
+        const str_t line = {buf + pos, end - pos};
+        pos = end;
+        if (str_begins_with(line, STR_LIT("ITEM: NUMBER OF ATOMS"))) {
+            end = next_line(buf, len, pos);
+            if (!end) return 0;
+            num_atoms = parse_int(str_trim(str_t{buf + pos, end - pos}));
+            pos = end;
+        } else if (str_begins_with(line, STR_LIT("ITEM: ATOMS"))) {
+            if (num_atoms < 0) return -1;
+            for (int64_t i = 0; i < num_atoms; ++i) {
+                end = next_line(buf, len, pos);
+                if (!end) return 0;
+                pos = end;
+            }
+            return (int64_t)pos;
+        } else if (str_begins_with(line, timestep_item)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Scans the file from the end of the last complete frame, appends the end offsets and times of the frames which have been completed since
+// Only the headers of binary frames are read, so the cost is proportional to the number of new frames and not the size of the file
+// Must be called with the follow mutex held
+static void follow_scan(FollowState* follow, md_array(int64_t)* end_offsets, md_array(double)* times, md_allocator_i* alloc) {
+    const int64_t file_size = (int64_t)md_file_size(follow->file);
+    int64_t offset = follow->offsets[md_array_size(follow->offsets) - 1];
+
+    if (follow->format == FOLLOW_FORMAT_LAMMPSTRJ) {
+        size_t cap = FOLLOW_SCAN_WINDOW_BYTES;
+        char* buf = (char*)md_alloc(alloc, cap);
+        while (offset < file_size) {
+            const size_t len = (size_t)MIN((int64_t)cap, file_size - offset);
+            if (!md_file_seek(follow->file, offset, MD_FILE_BEG) || md_file_read(follow->file, buf, len) != len) break;
+
+            size_t pos = 0;
+            int64_t size = 0;
+            double time = 0;
+            while (pos < len && (size = lammps_frame_size(buf + pos, len - pos, &time)) > 0) {
+                pos += (size_t)size;
+                md_array_push(*end_offsets, offset + (int64_t)pos, alloc);
+                md_array_push(*times, time, alloc);
+            }
+            if (size < 0) {
+                MD_LOG_ERROR("Unexpected data in followed trajectory at offset %lli", (long long)(offset + pos));
+                follow->active = false;
+                break;
+            }
+            if (pos == 0) {
+                // The window could not hold a single frame, the frame is either incomplete or larger than the window
+                if (len < cap) break;
+                md_free(alloc, buf, cap);
+                cap *= 2;
+                buf = (char*)md_alloc(alloc, cap);
+                continue;
+            }
+            offset += (int64_t)pos;
+        }
+        md_free(alloc, buf, cap);
+        return;
+    }
+
+    uint8_t header[256];
+    while (offset < file_size) {
+        const size_t len = (size_t)MIN((int64_t)sizeof(header), file_size - offset);
+        if (!md_file_seek(follow->file, offset, MD_FILE_BEG) || md_file_read(follow->file, header, len) != len) break;
+
+        double time = 0;
+        const int64_t size = follow->format == FOLLOW_FORMAT_XTC ? xtc_frame_size(header, len, &time) : trr_frame_size(header, len, &time);
+        if (size < 0) {
+            MD_LOG_ERROR("Unexpected data in followed trajectory at offset %lli", (long long)offset);
+            follow->active = false;
+            break;
+        }
+        // The frame is still being written
+        if (size == 0 || offset + size > file_size) break;
+
+        offset += size;
+        md_array_push(*end_offsets, offset, alloc);
+        md_array_push(*times, time, alloc);
+    }
+}
+
+// Follow state for the frames which are appended after the num_indexed frames of the internal trajectory, the first of them starts at end_offset
+// Takes exclusive access to the cache
+bool follow_state_create(LoadedTrajectory* loaded_traj, str_t filename, int format, int64_t num_indexed, int64_t end_offset) {
+    md_file_o* file = md_file_open(filename, MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open trajectory file '%.*s' for following", (int)filename.len, filename.ptr);
+        return false;
+    }
+
+    FollowState* follow = (FollowState*)md_alloc(loaded_traj->alloc, sizeof(FollowState));
+    MEMSET(follow, 0, sizeof(FollowState));
+    follow->file = file;
+    follow->mutex = md_mutex_create();
+    follow->format = format;
+    follow->num_indexed = num_indexed;
+    md_array_push(follow->offsets, end_offset, loaded_traj->alloc);
+
+    cache_lock_exclusive(loaded_traj);
+    // The exposed frame times diverge from the internal trajectory as soon as frames are appended
+    if (!loaded_traj->frame_times) {
+        md_trajectory_header_t header;
+        md_trajectory_get_header(loaded_traj->traj, &header);
+        // Appended frame times must fit without reallocating until the capacity grows
+        md_array_ensure(loaded_traj->frame_times, loaded_traj->frame_capacity, loaded_traj->alloc);
+        md_array_resize(loaded_traj->frame_times, loaded_traj->num_frames, loaded_traj->alloc);
+        for (size_t i = 0; i < loaded_traj->num_frames; ++i) {
+            loaded_traj->frame_times[i] = header.frame_times ? header.frame_times[source_frame(loaded_traj, i)] : (double)source_frame(loaded_traj, i);
+        }
+    }
+    loaded_traj->follow = follow;
+    cache_unlock_exclusive(loaded_traj);
+    return true;
+}
+
+// End of the last of the num_indexed frames in the file, the loaders do not expose the file offsets of their frames.
+// The frames are stored back to back after the first frame, which is located by its data as the file may start with a header.
+// The data of the last frame is then compared to the file, so a file which does not have this layout is never followed from a wrong offset.
+static bool find_indexed_end(md_trajectory_i* traj, str_t filename, int64_t num_indexed, int64_t* end_offset) {
+    if (num_indexed == 0) return false;
+    int64_t frames_bytes = 0;
+    size_t max_size = 0;
+    for (int64_t i = 0; i < num_indexed; ++i) {
+        const size_t size = md_trajectory_fetch_frame_data(traj, i, NULL);
+        if (size == 0) return false;
+        frames_bytes += (int64_t)size;
+        max_size = MAX(max_size, size);
+    }
+
+    md_file_o* file = md_file_open(filename, MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) return false;
+    md_allocator_i* alloc = md_get_heap_allocator();
+    const size_t probe_bytes = FOLLOW_SCAN_WINDOW_BYTES;
+    char* frame = (char*)md_alloc(alloc, max_size);
+    char* buf   = (char*)md_alloc(alloc, MAX(max_size, probe_bytes));
+
+    bool found = false;
+    const size_t first_size = md_trajectory_fetch_frame_data(traj, 0, frame);
+    const size_t head = md_file_read(file, buf, MIN(probe_bytes, (size_t)md_file_size(file)));
+    for (size_t pos = 0; pos + first_size <= head; ++pos) {
+        if (memcmp(buf + pos, frame, first_size) == 0) {
+            *end_offset = (int64_t)pos + frames_bytes;
+            found = true;
+            break;
+        }
+    }
+    if (found) {
+        const size_t last_size = md_trajectory_fetch_frame_data(traj, num_indexed - 1, frame);
+        found = md_file_seek(file, *end_offset - (int64_t)last_size, MD_FILE_BEG) && md_file_read(file, buf, last_size) == last_size && memcmp(buf, frame, last_size) == 0;
+    }
+
+    md_free(alloc, frame, max_size);
+    md_free(alloc, buf, MAX(max_size, probe_bytes));
+    md_file_close(file);
+    return found;
+}
+
+int follow_format(const LoadedTrajectory* loaded_traj) {
+    if (loaded_traj->loader == md_xtc_trajectory_loader()) return FOLLOW_FORMAT_XTC;
+    if (loaded_traj->loader == md_trr_trajectory_loader()) return FOLLOW_FORMAT_TRR;
+    if (loaded_traj->loader == md_lammps_trajectory_loader() ||
+       (loaded_traj->loader == text_loader() && ((TextTrajectory*)loaded_traj->traj->inst)->format == TEXT_TRAJ_LAMMPS)) {
+        return FOLLOW_FORMAT_LAMMPSTRJ;
+    }
+    return FOLLOW_FORMAT_NONE;
+}
+
+namespace load {
+
+namespace traj {
+
+bool follow_begin(md_trajectory_i* traj, str_t filename) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+
+    const int format = follow_format(loaded_traj);
+    if (format == FOLLOW_FORMAT_NONE) {
+        MD_LOG_ERROR("Follow mode is only supported for xtc, trr and lammpstrj trajectories");
+        return false;
+    }
+
+    // A follow state exists if follow mode has been enabled before, or if the trajectory is being indexed
+    if (loaded_traj->follow) {
+        loaded_traj->follow->active = true;
+        return true;
+    }
+
+    // New frames can only be exposed if the frame range extends to the end of the file
+    const int64_t num_indexed = (int64_t)md_trajectory_num_frames(loaded_traj->traj);
+    if (source_frame(loaded_traj, loaded_traj->num_frames) < num_indexed) {
+        MD_LOG_ERROR("Follow mode requires the loaded frame range to extend to the end of the trajectory");
+        return false;
+    }
+
+    int64_t end_offset = 0;
+    if (loaded_traj->loader == text_loader()) {
+        end_offset = ((TextTrajectory*)loaded_traj->traj->inst)->offsets[num_indexed];
+    } else if (!find_indexed_end(loaded_traj->traj, filename, num_indexed, &end_offset)) {
+        MD_LOG_ERROR("Failed to locate the end of the last frame of '%.*s', follow mode is not supported for it", (int)filename.len, filename.ptr);
+        return false;
+    }
+
+    if (!follow_state_create(loaded_traj, filename, format, num_indexed, end_offset)) {
+        return false;
+    }
+    loaded_traj->follow->active = true;
+
+    MD_LOG_INFO("Following trajectory '%.*s' from frame %i.", (int)filename.len, filename.ptr, (int)num_indexed);
+    return true;
+}
+
+void follow_end(md_trajectory_i* traj) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj && loaded_traj->follow) {
+        loaded_traj->follow->active = false;
+    }
+}
+
+bool is_following(md_trajectory_i* traj) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    return loaded_traj && loaded_traj->follow && loaded_traj->follow->active;
+}
+
+size_t follow_update(md_trajectory_i* traj) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj || !loaded_traj->follow) return 0;
+    FollowState* follow = loaded_traj->follow;
+    md_allocator_i* alloc = loaded_traj->alloc;
+
+    md_array(int64_t) end_offsets = 0;
+    md_array(double)  times = 0;
+    bool indexing = false;
+    if (loaded_traj->loader == text_loader()) {
+        // Frames indexed since the last update, the indexer has to complete before the file is scanned
+        TextTrajectory* text = (TextTrajectory*)loaded_traj->traj->inst;
+        indexing = task_system::task_is_running(text->index_task);
+        md_mutex_lock(&text->pending_mutex);
+        md_array_push_array(end_offsets, text->pending_offsets, md_array_size(text->pending_offsets), md_get_heap_allocator());
+        md_array_push_array(times, text->pending_times, md_array_size(text->pending_times), md_get_heap_allocator());
+        md_array_shrink(text->pending_offsets, 0);
+        md_array_shrink(text->pending_times, 0);
+        md_mutex_unlock(&text->pending_mutex);
+    }
+    if (!indexing && follow->active && md_array_size(end_offsets) == 0) {
+        // The scan only reads the file, the frames are added under exclusive access afterwards
+        md_mutex_lock(&follow->mutex);
+        follow_scan(follow, &end_offsets, &times, md_get_heap_allocator());
+        md_mutex_unlock(&follow->mutex);
+    }
+
+    const size_t num_new = md_array_size(end_offsets);
+    const size_t old_num_frames = loaded_traj->num_frames;
+    if (num_new > 0) {
+        cache_lock_exclusive(loaded_traj);
+        md_array_push_array(follow->offsets, end_offsets, num_new, alloc);
+        md_array_push_array(follow->times, times, num_new, alloc);
+
+        const int64_t num_src_frames = follow->num_indexed + (int64_t)md_array_size(follow->times);
+        const size_t num_frames = (size_t)((num_src_frames - loaded_traj->frame_beg + loaded_traj->frame_stride - 1) / loaded_traj->frame_stride);
+        grow_frame_capacity(loaded_traj, num_frames);
+        for (size_t i = old_num_frames; i < num_frames; ++i) {
+            const int64_t src_idx = source_frame(loaded_traj, i);
+            ASSERT(src_idx >= follow->num_indexed);
+            md_array_push(loaded_traj->frame_times, follow->times[src_idx - follow->num_indexed], alloc);
+        }
+        loaded_traj->num_frames = num_frames;
+        cache_unlock_exclusive(loaded_traj);
+
+        // The tiers are sized for the capacity, this is a no-op unless the capacity grew
+        apply_cache_budget(loaded_traj, loaded_traj->budget);
+    }
+
+    md_array_free(end_offsets, md_get_heap_allocator());
+    md_array_free(times, md_get_heap_allocator());
+    return loaded_traj->num_frames - old_num_frames;
+}
+
+}  // namespace traj
+
+}  // namespace load
@@ -0,0 +1,223 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+
+#include <stdlib.h>
+
+// Number of slots sampled when picking a victim in the primary cache
+#define CACHE_EVICTION_SAMPLES 16
+
+// The coordinates of a slot are allocated when it first receives a frame, from the heap as this happens concurrently
+static void frame_cache_slot_alloc(FrameCache* cache, CacheSlot* slot) {
+    if (slot->x) return;
+    slot->x = (float*)md_alloc(md_get_heap_allocator(), sizeof(float) * cache->coord_stride * 3);
+    slot->y = slot->x + cache->coord_stride;
+    slot->z = slot->y + cache->coord_stride;
+}
+
+static void frame_cache_slot_release(FrameCache* cache, CacheSlot* slot) {
+    if (!slot->x) return;
+    md_free(md_get_heap_allocator(), slot->x, sizeof(float) * cache->coord_stride * 3);
+    slot->x = slot->y = slot->z = NULL;
+}
+
+FrameCache* frame_cache_create(size_t num_slots, size_t limit, size_t num_atoms, size_t num_frames, md_allocator_i* alloc) {
+    ASSERT(limit <= num_slots);
+    FrameCache* cache = (FrameCache*)md_alloc(alloc, sizeof(FrameCache));
+    MEMSET(cache, 0, sizeof(FrameCache));
+    cache->num_slots    = num_slots;
+    cache->limit        = limit;
+    cache->coord_stride = ALIGN_TO(num_atoms, 16);
+    cache->slots  = (CacheSlot*)md_alloc(alloc, sizeof(CacheSlot) * num_slots);
+    for (size_t i = 0; i < num_slots; ++i) {
+        CacheSlot* slot = &cache->slots[i];
+        MEMSET(slot, 0, sizeof(CacheSlot));
+        slot->mutex = md_mutex_create();
+        slot->frame = -1;
+    }
+    cache->num_frames = num_frames;
+    cache->frame_slot = (std::atomic_int32_t*)md_alloc(alloc, sizeof(std::atomic_int32_t) * num_frames);
+    MEMSET(cache->frame_slot, 0xFF, sizeof(std::atomic_int32_t) * num_frames);
+    cache->map_mutex = md_mutex_create();
+    return cache;
+}
+
+void frame_cache_free(FrameCache* cache, md_allocator_i* alloc) {
+    if (!cache) return;
+    for (size_t i = 0; i < cache->num_slots; ++i) {
+        frame_cache_slot_release(cache, &cache->slots[i]);
+        md_mutex_destroy(&cache->slots[i].mutex);
+    }
+    md_mutex_destroy(&cache->map_mutex);
+    md_free(alloc, cache->slots, sizeof(CacheSlot) * cache->num_slots);
+    md_free(alloc, cache->frame_slot, sizeof(std::atomic_int32_t) * cache->num_frames);
+    md_free(alloc, cache, sizeof(FrameCache));
+}
+
+// Requires exclusive access to the cache
+void frame_cache_clear(FrameCache* cache) {
+    for (size_t i = 0; i < cache->num_slots; ++i) {
+        cache->slots[i].frame = -1;
+    }
+    MEMSET(cache->frame_slot, 0xFF, sizeof(std::atomic_int32_t) * cache->num_frames);
+}
+
+// Requires exclusive access to the cache
+void frame_cache_grow(FrameCache* cache, size_t num_frames, md_allocator_i* alloc) {
+    if (!cache || num_frames <= cache->num_frames) return;
+    cache->frame_slot = (std::atomic_int32_t*)md_realloc(alloc, cache->frame_slot, sizeof(std::atomic_int32_t) * cache->num_frames, sizeof(std::atomic_int32_t) * num_frames);
+    MEMSET(cache->frame_slot + cache->num_frames, 0xFF, sizeof(std::atomic_int32_t) * (num_frames - cache->num_frames));
+    cache->num_frames = num_frames;
+}
+
+struct SlotScore {
+    double score;
+    size_t slot;
+};
+
+static int slot_score_cmp(const void* a, const void* b) {
+    const SlotScore* sa = (const SlotScore*)a;
+    const SlotScore* sb = (const SlotScore*)b;
+    if (sa->score != sb->score) return sa->score < sb->score ? -1 : 1;
+    return 0;
+}
+
+// Moves the resident frames of src into dst, if dst has a lower limit the frames nearest the playhead are kept
+// Requires exclusive access to both caches
+void frame_cache_migrate(FrameCache* dst, const FrameCache* src, md_allocator_i* alloc) {
+    ASSERT(dst->coord_stride == src->coord_stride);
+    const double playhead = src->playhead.load(std::memory_order_relaxed);
+    const double fps      = src->fps.load(std::memory_order_relaxed);
+
+    SlotScore* resident = (SlotScore*)md_alloc(alloc, sizeof(SlotScore) * src->num_slots);
+    size_t num_resident = 0;
+    for (size_t i = 0; i < src->num_slots; ++i) {
+        const int64_t frame = src->slots[i].frame;
+        if (frame < 0 || frame >= (int64_t)dst->num_frames) continue;
+        resident[num_resident++] = {eviction_score(frame, playhead, fps), i};
+    }
+    const size_t dst_limit = dst->limit.load(std::memory_order_relaxed);
+    if (num_resident > dst_limit) {
+        qsort(resident, num_resident, sizeof(SlotScore), slot_score_cmp);
+        num_resident = dst_limit;
+    }
+
+    const size_t coord_bytes = sizeof(float) * src->coord_stride;
+    for (size_t i = 0; i < num_resident; ++i) {
+        const CacheSlot* from = &src->slots[resident[i].slot];
+        CacheSlot* to = &dst->slots[i];
+        frame_cache_slot_alloc(dst, to);
+        to->frame  = from->frame;
+        to->header = from->header;
+        MEMCPY(to->x, from->x, coord_bytes);
+        MEMCPY(to->y, from->y, coord_bytes);
+        MEMCPY(to->z, from->z, coord_bytes);
+        dst->frame_slot[to->frame] = (int32_t)i;
+    }
+    dst->num_allocated = num_resident;
+    md_free(alloc, resident, sizeof(SlotScore) * src->num_slots);
+}
+
+static inline uint32_t frame_cache_rand() {
+    static thread_local uint32_t state = 0x9E3779B9u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Picks a victim slot and locks it, returns -1 if every sampled slot was busy
+// Must be called with the map mutex held
+static int64_t frame_cache_pick_victim(FrameCache* cache) {
+    const double playhead = cache->playhead.load(std::memory_order_relaxed);
+    const double fps      = cache->fps.load(std::memory_order_relaxed);
+    const size_t limit = cache->limit.load(std::memory_order_relaxed);
+    const size_t num_samples = MIN(CACHE_EVICTION_SAMPLES, limit);
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        int64_t best_slot  = -1;
+        double  best_score = -1.0;
+        for (size_t i = 0; i < num_samples; ++i) {
+            const size_t s = num_samples == limit ? i : frame_cache_rand() % limit;
+            const double score = eviction_score(cache->slots[s].frame, playhead, fps);
+            if (score > best_score) {
+                best_score = score;
+                best_slot  = (int64_t)s;
+            }
+        }
+        if (md_mutex_try_lock(&cache->slots[best_slot].mutex)) return best_slot;
+    }
+    return -1;
+}
+
+// Empties the last slot beyond the limit and releases its coordinates, unless it is held by another thread
+// Called on the insert path, so a lowered limit takes effect one slot per inserted frame
+// Must be called with the map mutex held
+static void frame_cache_trim(FrameCache* cache, CacheCounters* counters) {
+    if (cache->num_allocated <= cache->limit.load(std::memory_order_relaxed)) return;
+    CacheSlot* slot = &cache->slots[cache->num_allocated - 1];
+    if (!md_mutex_try_lock(&slot->mutex)) return;
+    if (slot->frame >= 0) {
+        cache->frame_slot[slot->frame] = -1;
+        counters->evictions++;
+    }
+    slot->frame = -1;
+    frame_cache_slot_release(cache, slot);
+    cache->num_allocated -= 1;
+    md_mutex_unlock(&slot->mutex);
+}
+
+// Returns true if the frame is resident in the cache, otherwise a slot has been reserved for it which is to be filled by the caller
+// The slot is locked in either case and must be released with frame_cache_release
+// If no slot could be reserved, out_slot is set to NULL and the caller has to load the frame without the cache
+bool frame_cache_find_or_reserve(FrameCache* cache, int64_t idx, CacheSlot** out_slot, CacheCounters* counters) {
+    ASSERT(0 <= idx && idx < (int64_t)cache->num_frames);
+    for (;;) {
+        md_mutex_lock(&cache->map_mutex);
+        const int32_t s = cache->frame_slot[idx];
+        if (s >= 0) {
+            md_mutex_unlock(&cache->map_mutex);
+            CacheSlot* slot = &cache->slots[s];
+            md_mutex_lock(&slot->mutex);
+            if (slot->frame == idx) {
+                *out_slot = slot;
+                return true;
+            }
+            // Evicted or invalidated before we got hold of it
+            md_mutex_unlock(&slot->mutex);
+            continue;
+        }
+
+        frame_cache_trim(cache, counters);
+        const int64_t v = frame_cache_pick_victim(cache);
+        if (v < 0) {
+            // The sampled slots are held by other threads, which may be decoding frames into them (a miss holds its slot until the frame is decoded).
+            // Waiting on them could take as long as decoding the frame ourselves, so nothing is reserved.
+            md_mutex_unlock(&cache->map_mutex);
+            *out_slot = NULL;
+            return false;
+        }
+        CacheSlot* slot = &cache->slots[v];
+        if (slot->frame >= 0) {
+            cache->frame_slot[slot->frame] = -1;
+            counters->evictions++;
+        }
+        slot->frame = idx;
+        cache->frame_slot[idx] = (int32_t)v;
+        cache->num_allocated = MAX(cache->num_allocated, (size_t)v + 1);
+        md_mutex_unlock(&cache->map_mutex);
+        frame_cache_slot_alloc(cache, slot);
+        *out_slot = slot;
+        return false;
+    }
+}
+
+// Called instead of release if a reserved slot could not be filled
+void frame_cache_invalidate(FrameCache* cache, CacheSlot* slot) {
+    md_mutex_lock(&cache->map_mutex);
+    if (slot->frame >= 0) {
+        cache->frame_slot[slot->frame] = -1;
+    }
+    slot->frame = -1;
+    md_mutex_unlock(&cache->map_mutex);
+    md_mutex_unlock(&slot->mutex);
+}
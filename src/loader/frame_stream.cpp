@@ -0,0 +1,234 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+
+// Number of frames the reader of a stream stays ahead of the consumers
+#define STREAM_READ_AHEAD 32
+
+enum {
+    STREAM_SLOT_FREE = 0,
+    STREAM_SLOT_FETCHING,
+    STREAM_SLOT_STAGED,
+    STREAM_SLOT_DECODING,
+};
+
+void frame_streams_init(FrameStream* streams, md_trajectory_i* traj) {
+    for (size_t i = 0; i < STREAM_MAX_COUNT; ++i) {
+        FrameStream* s = &streams[i];
+        s->traj = traj;
+        s->active = false;
+        s->fetch_mutex = md_mutex_create();
+        s->slot_mutex  = md_mutex_create();
+    }
+}
+
+// Frees the raw frame data held by the slots, slots which are being decoded are left as is
+static void frame_stream_free_slots(FrameStream* s, md_allocator_i* alloc) {
+    for (size_t i = 0; i < STREAM_MAX_SLOTS; ++i) {
+        StreamSlot* slot = &s->slots[i];
+        if (slot->state == STREAM_SLOT_DECODING) continue;
+        md_free(alloc, slot->data, slot->cap);
+        *slot = {};
+        slot->frame = -1;
+    }
+}
+
+void frame_streams_free(FrameStream* streams, md_allocator_i* alloc) {
+    for (size_t i = 0; i < STREAM_MAX_COUNT; ++i) {
+        FrameStream* s = &streams[i];
+        frame_stream_free_slots(s, alloc);
+        md_mutex_destroy(&s->fetch_mutex);
+        md_mutex_destroy(&s->slot_mutex);
+    }
+}
+
+static LoadedTrajectory* find_stream_owner(const FrameStream* stream) {
+    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
+        if (loaded_trajectories[i].streams <= stream && stream < loaded_trajectories[i].streams + STREAM_MAX_COUNT) {
+            return &loaded_trajectories[i];
+        }
+    }
+    return NULL;
+}
+
+// Reads raw frame data in file order into the slots until target is reached or there are no free slots left
+// Must be called with the fetch mutex held, which ensures there is only one reader per stream
+// The cache tiers and the follow offsets are swapped under exclusive access (resize, follow), so shared access is held for each frame
+static void frame_stream_fetch(FrameStream* s, LoadedTrajectory* traj, size_t target) {
+    md_allocator_i* alloc = traj->alloc;
+    size_t idx = s->next_fetch;
+    while (idx < target) {
+        cache_lock_shared(traj);
+        if (frame_resident(traj, idx)) {
+            cache_unlock_shared(traj);
+            s->next_fetch = ++idx;
+            continue;
+        }
+
+        StreamSlot* slot = &s->slots[idx % s->num_slots];
+        md_mutex_lock(&s->slot_mutex);
+        const bool free = slot->state == STREAM_SLOT_FREE;
+        if (free) slot->state = STREAM_SLOT_FETCHING;
+        md_mutex_unlock(&s->slot_mutex);
+
+        // Consumers are lagging behind, frames which are not staged in time are read directly by the consumer
+        if (!free) {
+            cache_unlock_shared(traj);
+            break;
+        }
+
+        const int64_t src_idx = source_frame(traj, idx);
+        size_t size = fetch_source_frame_data(traj, src_idx, NULL);
+        if (size > slot->cap) {
+            slot->data = md_realloc(alloc, slot->data, slot->cap, size);
+            slot->cap  = size;
+        }
+        if (size) {
+            size = fetch_source_frame_data(traj, src_idx, slot->data);
+        }
+        cache_unlock_shared(traj);
+
+        md_mutex_lock(&s->slot_mutex);
+        slot->frame = (int64_t)idx;
+        slot->size  = size;
+        slot->state = size ? STREAM_SLOT_STAGED : STREAM_SLOT_FREE;
+        md_mutex_unlock(&s->slot_mutex);
+
+        s->next_fetch = ++idx;
+    }
+}
+
+// Decodes the frame from raw data staged by an active stream, returns false if no stream has it staged
+bool frame_streams_decode(LoadedTrajectory* traj, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    for (size_t i = 0; i < STREAM_MAX_COUNT; ++i) {
+        FrameStream* s = &traj->streams[i];
+        if (!s->active) continue;
+
+        StreamSlot* slot = NULL;
+        md_mutex_lock(&s->slot_mutex);
+        if (s->active && s->num_slots) {
+            StreamSlot* candidate = &s->slots[idx % s->num_slots];
+            if (candidate->state == STREAM_SLOT_STAGED && candidate->frame == idx) {
+                candidate->state = STREAM_SLOT_DECODING;
+                slot = candidate;
+            }
+        }
+        md_mutex_unlock(&s->slot_mutex);
+
+        if (slot) {
+            // The stream accounts for the read
+            const md_timestamp_t decode_beg = md_time_current();
+            const bool result = md_trajectory_decode_frame_data(traj->traj, slot->data, slot->size, header, x, y, z);
+            if (result) record_decode(traj->counters, md_time_current() - decode_beg);
+            md_mutex_lock(&s->slot_mutex);
+            slot->state = STREAM_SLOT_FREE;
+            md_mutex_unlock(&s->slot_mutex);
+            return result;
+        }
+    }
+    return false;
+}
+
+namespace load {
+
+namespace traj {
+
+FrameStream* stream_begin(md_trajectory_i* traj, size_t beg, size_t end) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return NULL;
+    }
+
+    end = MIN(end, loaded_traj->num_frames);
+    if (beg >= end) return NULL;
+
+    // Not every trajectory loader supports reading raw frame data separately from decoding it
+    cache_lock_shared(loaded_traj);
+    const size_t size = fetch_source_frame_data(loaded_traj, source_frame(loaded_traj, beg), NULL);
+    cache_unlock_shared(loaded_traj);
+    if (size == 0) return NULL;
+
+    for (size_t i = 0; i < STREAM_MAX_COUNT; ++i) {
+        FrameStream* s = &loaded_traj->streams[i];
+        bool expected = false;
+        if (s->active.compare_exchange_strong(expected, true)) {
+            md_mutex_lock(&s->slot_mutex);
+            s->beg = beg;
+            s->end = end;
+            // Room for the read ahead and the frames which are claimed by consumers
+            s->num_slots  = MIN(STREAM_MAX_SLOTS, STREAM_READ_AHEAD * 2 + task_system::pool_num_threads() * 8);
+            s->next_claim = beg;
+            s->next_fetch = beg;
+            md_mutex_unlock(&s->slot_mutex);
+            return s;
+        }
+    }
+    return NULL;
+}
+
+bool stream_next(FrameStream* stream, size_t max_count, size_t* beg, size_t* end) {
+    ASSERT(stream);
+    ASSERT(beg);
+    ASSERT(end);
+
+    const size_t count = MAX(1, max_count);
+    const size_t claim_beg = stream->next_claim.fetch_add(count);
+    if (claim_beg >= stream->end) return false;
+    const size_t claim_end = MIN(claim_beg + count, stream->end);
+
+    LoadedTrajectory* loaded_traj = find_stream_owner(stream);
+    ASSERT(loaded_traj);
+
+    // Wait for the reader if the claimed frames are not staged yet, otherwise just help out with reading ahead if nobody else is
+    const size_t target = MIN(claim_end + STREAM_READ_AHEAD, stream->end);
+    if (stream->next_fetch < claim_end) {
+        md_mutex_lock(&stream->fetch_mutex);
+        frame_stream_fetch(stream, loaded_traj, target);
+        md_mutex_unlock(&stream->fetch_mutex);
+    } else if (stream->next_fetch < target && md_mutex_try_lock(&stream->fetch_mutex)) {
+        frame_stream_fetch(stream, loaded_traj, target);
+        md_mutex_unlock(&stream->fetch_mutex);
+    }
+
+    *beg = claim_beg;
+    *end = claim_end;
+    return true;
+}
+
+void stream_release(FrameStream* stream, size_t beg, size_t end) {
+    ASSERT(stream);
+    // Frames which were served by a cache tier are never decoded, free their slots
+    md_mutex_lock(&stream->slot_mutex);
+    for (size_t i = beg; i < end; ++i) {
+        StreamSlot* slot = &stream->slots[i % stream->num_slots];
+        if (slot->state == STREAM_SLOT_STAGED && slot->frame == (int64_t)i) {
+            slot->state = STREAM_SLOT_FREE;
+        }
+    }
+    md_mutex_unlock(&stream->slot_mutex);
+}
+
+void stream_end(FrameStream* stream) {
+    ASSERT(stream);
+    LoadedTrajectory* loaded_traj = find_stream_owner(stream);
+    if (!loaded_traj) {
+        // The trajectory has already been closed, which frees its streams
+        return;
+    }
+
+    md_mutex_lock(&stream->fetch_mutex);
+    md_mutex_lock(&stream->slot_mutex);
+    frame_stream_free_slots(stream, loaded_traj->alloc);
+    stream->num_slots = 0;
+    stream->active = false;
+    md_mutex_unlock(&stream->slot_mutex);
+    md_mutex_unlock(&stream->fetch_mutex);
+}
+
+}  // namespace traj
+
+}  // namespace load
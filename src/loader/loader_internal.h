@@ -0,0 +1,425 @@
+#pragma once
+
+// Internals of the loader (loader.cpp), shared with the parts of it which live in this directory
+
+#include "loader.h"
+
+#include <core/md_platform.h>
+#include <core/md_array.h>
+#include <core/md_os.h>
+#include <md_molecule.h>
+#include <md_trajectory.h>
+
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+#if MD_PLATFORM_WINDOWS
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#endif
+
+#define SPILL_NUM_LOCKS 64
+
+// Number of concurrent readers of the frame cache, resizing the cache requires all of them
+#define CACHE_SEMAPHORE_MAX_COUNT 64
+
+#define PACKED_NUM_LOCKS 64
+
+// Concurrent frame streams per trajectory
+#define STREAM_MAX_COUNT 4
+#define STREAM_MAX_SLOTS 256
+
+#define PARALLEL_PARSE_CHUNKS_PER_THREAD 4
+
+enum {
+    MAPPED_FILE_SCRATCH = 0,    // Created, removed from disk once it is unmapped
+    MAPPED_FILE_WRITE,          // Created (or truncated) and kept
+    MAPPED_FILE_READ,           // Existing file, read only
+};
+
+struct MappedFile {
+    void*  ptr  = 0;
+    size_t size = 0;
+#if MD_PLATFORM_WINDOWS
+    HANDLE file    = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#elif MD_PLATFORM_UNIX
+    int fd = -1;
+#endif
+};
+
+// Secondary cache tier
+// Decoded frames are written to a memory mapped scratch file, so a frame which has been evicted
+// from the primary (RAM) frame cache is paged in rather than decoded from the trajectory again.
+// The file is direct mapped, frame idx -> slot (idx % num_slots).
+struct SpillCache {
+    MappedFile file;
+    size_t     num_atoms;
+    size_t     num_slots;
+    size_t     slot_bytes;
+    int64_t*   slot_frame;      // Frame index held by each slot, -1 if empty
+    md_mutex_t locks[SPILL_NUM_LOCKS];
+};
+
+struct SpillSettings {
+    char   dir[1024];
+    size_t max_bytes;
+};
+
+// Compressed cache tier, sits between the primary cache and the spill tier
+// Frames are quantized to fixed point and stored bit packed in blocks of PACKED_BLOCK_SIZE consecutive atoms, each block
+// holds its minimum value and the bit width of the offsets from it (frame of reference encoding). Consecutive atoms are
+// usually spatially close, so most blocks need 10-14 bits per coordinate instead of 32.
+// Every frame is encoded independently to keep random access (scrubbing) cheap.
+struct PackedFrame {
+    md_trajectory_frame_header_t header;
+    size_t size;        // Size of the allocation, including this header
+    float  inv_scale;
+    // Followed by the encoded blocks of x, y and z
+};
+
+// Frames are evicted by their distance to the playhead (as in the primary cache), which makes the victim always one of the outermost resident frames.
+// Those are tracked by the lo and hi hints, which may lag behind (resident frames are never outside of them).
+// A frame is decoded and evicted with the lock of its stripe held, so it is not freed while it is being decoded.
+struct PackedCache {
+    std::atomic<PackedFrame*>* frames;      // One entry per trajectory frame, NULL if not resident
+    size_t num_frames;
+    float  scale;
+    std::atomic_size_t max_bytes;
+    std::atomic_size_t bytes;
+    std::atomic_size_t count;
+    std::atomic_int64_t lo;                 // No resident frame below lo
+    std::atomic_int64_t hi;                 // No resident frame above hi
+    md_mutex_t locks[PACKED_NUM_LOCKS];
+};
+
+// Primary (RAM) cache tier, holds decoded frames in a fixed number of slots
+// Victims are picked relative to the playhead rather than by recency: During playback the frames behind the playhead are evicted first,
+// then the frames furthest ahead of it. The victim is the best of a small random sample of slots, so the cost of a miss does not depend on the size of the cache.
+struct CacheSlot {
+    md_mutex_t mutex;       // Held while the frame is read from or written to the slot
+    int64_t    frame;       // -1 if empty, written with both the slot mutex and the map mutex held
+    md_trajectory_frame_header_t header;
+    float* x;
+    float* y;
+    float* z;
+};
+
+// The number of slots in use (limit) is adjusted without blocking loads: Slots beyond the limit are emptied and have their coordinates
+// released one at a time on the insert path, slots up to num_slots are taken into use as victims once the limit is raised.
+struct FrameCache {
+    CacheSlot* slots;
+    size_t     num_slots;               // Capacity, the limit can be raised up to this without rebuilding the cache
+    std::atomic_size_t limit;           // Slots in use
+    size_t     num_allocated;           // Slots [0, num_allocated) may hold coordinates, protected by the map mutex
+    size_t     coord_stride;            // Floats per coordinate stream of a slot
+    std::atomic_int32_t* frame_slot;    // Slot holding each frame, -1 if not resident
+    size_t     num_frames;
+    md_mutex_t map_mutex;               // Protects frame_slot and the frame of the slots
+    std::atomic<double> playhead;
+    std::atomic<double> fps;            // Frames per second of playback, negative when playing backwards and 0 when not playing
+};
+
+struct CacheCounters {
+    std::atomic_uint64_t mem_hits;
+    std::atomic_uint64_t packed_hits;
+    std::atomic_uint64_t disk_hits;
+    std::atomic_uint64_t misses;
+    std::atomic_uint64_t direct_loads;  // Frames copied straight out of a memory mapped trajectory, which bypass the cache tiers
+    std::atomic_uint64_t fetched;       // Frames whose raw data was read from the trajectory file
+    std::atomic_uint64_t fetch_ticks;   // Time spent reading it
+    std::atomic_uint64_t decoded;       // Frames decoded from the trajectory
+    std::atomic_uint64_t decode_ticks;  // Time spent decoding them
+    std::atomic_uint64_t evictions;     // Frames evicted from the primary cache
+    std::atomic_uint64_t bytes_read;    // Raw frame data read from the trajectory file
+    std::atomic_uint64_t loads;         // Calls to load_frame
+    std::atomic_uint64_t load_ticks;
+    std::atomic_uint64_t recenter_ticks;
+    std::atomic_uint64_t load_histogram[CACHE_HISTOGRAM_NUM_BUCKETS];
+    std::atomic_uint64_t decode_histogram[CACHE_HISTOGRAM_NUM_BUCKETS];
+};
+
+// Bucket 0 holds durations below 1 us, bucket i > 0 holds [2^(i-1), 2^i) us and the last bucket everything above
+static inline void histogram_add(std::atomic_uint64_t* histogram, md_timestamp_t ticks) {
+    const double us = md_time_as_seconds(ticks) * 1.0e6;
+    int bucket = 0;
+    if (us >= 1.0) {
+        bucket = MIN((int)log2(us) + 1, CACHE_HISTOGRAM_NUM_BUCKETS - 1);
+    }
+    histogram[bucket]++;
+}
+
+static inline void record_decode(CacheCounters* counters, md_timestamp_t ticks) {
+    counters->decoded++;
+    counters->decode_ticks += (uint64_t)ticks;
+    histogram_add(counters->decode_histogram, ticks);
+}
+
+struct StreamSlot {
+    int64_t frame;
+    int32_t state;
+    size_t  size;
+    size_t  cap;
+    void*   data;
+};
+
+// Two stage pipeline for loading a range of frames
+// Raw (compressed) frame data is read in file order by a single reader into a ring of slots (frame idx -> slot idx % num_slots),
+// the consumers claim frames in the same order and decode them in parallel within load_frame.
+// The reader role is taken by whichever consumer finds the staged frames running low, so no thread is dedicated to it.
+struct FrameStream {
+    md_trajectory_i* traj;      // Internal trajectory
+    std::atomic_bool active;
+    size_t beg;
+    size_t end;
+    size_t num_slots;
+    std::atomic_size_t next_claim;
+    std::atomic_size_t next_fetch;
+    md_mutex_t fetch_mutex;     // Held by the reader
+    md_mutex_t slot_mutex;      // Protects the state of the slots
+    StreamSlot slots[STREAM_MAX_SLOTS];
+};
+
+// Follow mode, for trajectory files which are still being written to
+// The file is scanned from the end of the last complete frame for frames which have been appended since it was indexed.
+// The internal trajectory is unaware of these frames, their raw data is read here and only decoded by the internal trajectory.
+struct FollowState {
+    md_file_o* file;
+    md_mutex_t mutex;               // Protects the file position
+    int        format;
+    bool       active;              // Scan for new frames, the appended frames stay readable when inactive
+    int64_t    num_indexed;         // Number of frames indexed by the internal trajectory
+    md_array(int64_t) offsets;      // File offsets of the appended frames, the last entry is the end of the last complete frame
+    md_array(double)  times;        // Times of the appended frames
+};
+
+struct LoadedTrajectory {
+    uint64_t key;
+    const md_molecule_t* mol;
+    md_trajectory_loader_i* loader;
+    md_trajectory_i* traj;
+    FrameCache*      cache;
+    md_allocator_i*  alloc;
+
+    // The exposed (virtual) trajectory is a strided range of the frames of the internal trajectory
+    size_t  num_frames;
+    size_t  frame_capacity;         // Allocated length of the per frame arrays, only exceeds num_frames in follow mode
+    int64_t frame_beg;
+    int64_t frame_stride;
+    md_array(double) frame_times;   // Only populated if it differs from the internal trajectory, never reallocated in place (grow_frame_capacity)
+    md_array(double*) retired_frame_times;  // Frame times which have been replaced by a larger array, freed when the trajectory is closed
+
+    PackedCache*    packed;
+    SpillCache*     spill;
+    CacheCounters*  counters;
+    md_semaphore_t* cache_sema;     // Shared access for load_frame, exclusive access for resizing the cache
+    bool            uncached;       // The internal trajectory is memory mapped (vtraj, dcd), frames are copied straight out of it
+    size_t          frame_bytes;    // Approximate size of a cached frame
+    size_t          budget;         // Budget which the cache tiers were last sized for
+    std::atomic_size_t* rebuild_budget; // Budget to rebuild the tiers for on the thread pool, 0 = None pending
+
+    FrameStream*         streams;   // STREAM_MAX_COUNT streams
+
+    // Cached frames hold the raw coordinates, the recenter translation is applied when copying out
+    md_array(int32_t)    recenter_indices;
+    uint32_t             recenter_generation;   // Incremented when the recenter target changes
+    vec3_t*              recenter_trans;        // Per frame translation
+    std::atomic_uint32_t* recenter_trans_gen;   // Per frame generation of the translation, 0 = Not computed
+
+    // One bit per frame which may be held by a cache tier, set once a frame has been loaded through the cache.
+    // Frames leave the tiers without clearing their bit, stale bits are cleared when encountered (nearest_resident_frame).
+    std::atomic_uint64_t* resident_bits;
+
+    FollowState* follow;            // NULL unless follow mode has been enabled
+};
+
+static inline size_t resident_words(size_t num_frames) {
+    return (num_frames + 63) / 64;
+}
+
+// Text trajectory indexed in parallel (text_index.cpp)
+enum {
+    TEXT_TRAJ_LAMMPS = 0,
+    TEXT_TRAJ_XYZ,
+    TEXT_TRAJ_ARC,
+    TEXT_TRAJ_PDB,
+};
+
+struct TextTrajectory {
+    MappedFile file;
+    md_allocator_i* alloc;
+    int     format;
+    size_t  num_atoms;
+    size_t  num_frames;
+    size_t  lines_per_frame;        // xyz and arc
+    md_unit_cell_t unit_cell;       // pdb: CRYST1 record before the first model
+    md_array(int64_t) offsets;      // Frame offsets, the last entry is the end of the last frame
+    md_array(double)  frame_times;
+    str_t   keyword;                // Line which starts a frame, empty if frames have a fixed number of lines
+
+    // The part of a large file which is not covered by offsets is indexed by text_index_remaining.
+    // Its frames are handed over to the loaded trajectory through pending, which follow_update drains.
+    bool    index_complete;
+    bool    write_index;
+    char    path[1024];
+    md_mutex_t pending_mutex;
+    md_array(int64_t) pending_offsets;  // End offsets of the frames
+    md_array(double)  pending_times;
+    task_system::ID   index_task;
+    std::atomic_bool  index_cancel;     // Set when the trajectory is closed
+    load::traj::PrepareProgress* index_progress;
+};
+
+extern LoadedTrajectory loaded_trajectories[8];
+extern int64_t num_loaded_trajectories;
+extern SpillSettings spill_settings;
+
+// Maps a frame index of the exposed trajectory to the internal trajectory
+static inline int64_t source_frame(const LoadedTrajectory* traj, int64_t idx) {
+    return traj->frame_beg + idx * traj->frame_stride;
+}
+
+static inline LoadedTrajectory* find_loaded_trajectory(uint64_t key) {
+    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
+        if (loaded_trajectories[i].key == key) return &loaded_trajectories[i];
+    }
+    return nullptr;
+}
+
+static inline void cache_lock_shared(LoadedTrajectory* traj) {
+    md_semaphore_aquire(traj->cache_sema);
+}
+
+static inline void cache_unlock_shared(LoadedTrajectory* traj) {
+    md_semaphore_release(traj->cache_sema);
+}
+
+static inline void cache_lock_exclusive(LoadedTrajectory* traj) {
+    // Permits are aquired one at a time, every permit held reduces the number of concurrent readers until there are none left
+    for (int i = 0; i < CACHE_SEMAPHORE_MAX_COUNT; ++i) {
+        md_semaphore_aquire(traj->cache_sema);
+    }
+}
+
+static inline void cache_unlock_exclusive(LoadedTrajectory* traj) {
+    md_semaphore_release_n(traj->cache_sema, CACHE_SEMAPHORE_MAX_COUNT);
+}
+
+static inline void subset_gather(float* dst, const float* src, const int32_t* indices, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = src[indices[i]];
+    }
+}
+
+// Higher is a better victim, shared by the primary cache and the compressed tier
+static inline double eviction_score(int64_t frame, double playhead, double fps) {
+    if (frame < 0) return 1.0e300;  // Empty
+    const double dist = (double)frame - playhead;
+    if (fps == 0.0) return fabs(dist);
+    const double ahead = fps > 0.0 ? dist : -dist;
+    // Frames behind the playhead are not needed again during playback
+    // The two frames just behind it are kept, as they are used for interpolation
+    return ahead < -2.0 ? 1.0e12 - ahead : fabs(ahead);
+}
+
+static inline size_t frame_cache_num_slots(const FrameCache* cache) {
+    return cache ? cache->limit.load(std::memory_order_relaxed) : 0;
+}
+
+static inline bool frame_cache_contains(const FrameCache* cache, int64_t idx) {
+    return cache->frame_slot[idx].load(std::memory_order_relaxed) >= 0;
+}
+
+static inline void frame_cache_release(CacheSlot* slot) {
+    md_mutex_unlock(&slot->mutex);
+}
+
+static inline const char* find_line_end(const char* ptr, const char* end) {
+    const char* nl = (const char*)memchr(ptr, '\n', end - ptr);
+    return nl ? nl : end;
+}
+
+// Trimmed fixed width column [beg, end) of a line, empty if the line is too short
+static inline str_t text_column(const char* line, size_t len, size_t beg, size_t end) {
+    if (beg >= len) return str_t{line, 0};
+    return str_trim(str_t{line + beg, MIN(end, len) - beg});
+}
+
+static inline bool pdb_atom_record(const char* line, size_t len) {
+    return len >= 6 && (strncmp(line, "ATOM  ", 6) == 0 || strncmp(line, "HETATM", 6) == 0);
+}
+
+// loader.cpp
+void apply_cache_budget(LoadedTrajectory* traj, size_t budget);
+void grow_frame_capacity(LoadedTrajectory* traj, size_t num_frames);
+size_t fetch_source_frame_data(LoadedTrajectory* traj, int64_t src_idx, void* data_ptr);
+bool frame_resident(LoadedTrajectory* traj, int64_t idx);
+md_trajectory_i* create_internal_trajectory(str_t filename, md_trajectory_loader_i** loader, md_allocator_i* alloc, uint32_t flags, load::traj::PrepareProgress* progress = NULL);
+
+// mapped_file.cpp
+bool mapped_file_create(MappedFile* mf, str_t path, size_t size, int mode = MAPPED_FILE_SCRATCH);
+void mapped_file_close(MappedFile* mf);
+bool file_stat(str_t filename, uint64_t* size, int64_t* mtime);
+
+// spill_cache.cpp
+void scratch_file_path(char* buf, size_t cap, const char* name);
+SpillCache* spill_cache_create(uint64_t key, size_t num_atoms, size_t num_frames, md_allocator_i* alloc);
+void spill_cache_free(SpillCache* spill, md_allocator_i* alloc);
+void spill_cache_clear(SpillCache* spill);
+bool spill_cache_read(SpillCache* spill, int64_t idx, md_trajectory_frame_header_t* out_header, float* out_x, float* out_y, float* out_z);
+void spill_cache_write(SpillCache* spill, int64_t idx, const md_trajectory_frame_header_t* in_header, const float* in_x, const float* in_y, const float* in_z);
+bool spill_cache_contains(SpillCache* spill, int64_t idx);
+
+// packed_cache.cpp
+PackedCache* packed_cache_create(size_t num_frames, float precision, size_t max_bytes, md_allocator_i* alloc);
+void packed_cache_free(PackedCache* packed, md_allocator_i* alloc);
+void packed_cache_clear(PackedCache* packed);
+void packed_cache_grow(PackedCache* packed, size_t num_frames, md_allocator_i* alloc);
+void packed_cache_shrink(PackedCache* packed, size_t max_bytes, double playhead, double fps);
+bool packed_cache_read(PackedCache* packed, int64_t idx, md_trajectory_frame_header_t* out_header, float* out_x, float* out_y, float* out_z);
+void packed_cache_write(PackedCache* packed, int64_t idx, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z, double playhead, double fps);
+
+// frame_cache.cpp
+FrameCache* frame_cache_create(size_t num_slots, size_t limit, size_t num_atoms, size_t num_frames, md_allocator_i* alloc);
+void frame_cache_free(FrameCache* cache, md_allocator_i* alloc);
+void frame_cache_clear(FrameCache* cache);
+void frame_cache_grow(FrameCache* cache, size_t num_frames, md_allocator_i* alloc);
+void frame_cache_migrate(FrameCache* dst, const FrameCache* src, md_allocator_i* alloc);
+bool frame_cache_find_or_reserve(FrameCache* cache, int64_t idx, CacheSlot** out_slot, CacheCounters* counters);
+void frame_cache_invalidate(FrameCache* cache, CacheSlot* slot);
+
+// frame_stream.cpp
+void frame_streams_init(FrameStream* streams, md_trajectory_i* traj);
+void frame_streams_free(FrameStream* streams, md_allocator_i* alloc);
+bool frame_streams_decode(LoadedTrajectory* traj, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z);
+
+// follow.cpp
+void follow_state_free(FollowState* follow, md_allocator_i* alloc);
+int64_t lammps_frame_size(const char* buf, size_t len, double* time);
+bool follow_state_create(LoadedTrajectory* loaded_traj, str_t filename, int format, int64_t num_indexed, int64_t end_offset);
+int follow_format(const LoadedTrajectory* loaded_traj);
+
+// concat.cpp
+size_t find_trajectory_parts(str_t filename, str_t* stem, str_t* ext, int* first, int* width);
+md_trajectory_loader_i* concat_loader();
+md_trajectory_i* concat_create(str_t stem, str_t ext, int first, int width, size_t num_parts, md_trajectory_loader_i* loader, md_allocator_i* alloc, uint32_t flags, load::traj::PrepareProgress* progress);
+
+// vtraj.cpp
+md_trajectory_loader_i* native_loader();
+
+// dcd.cpp
+md_trajectory_loader_i* dcd_loader();
+md_unit_cell_t unit_cell_from_lengths_and_cosines(double a, double b, double c, double cos_alpha, double cos_beta, double cos_gamma);
+
+// parallel_parse.cpp
+md_unit_cell_t pdb_unit_cell(const char* line, size_t len);
+
+// text_index.cpp
+md_trajectory_loader_i* text_loader();
+md_trajectory_i* text_create(str_t filename, md_trajectory_loader_i* loader, md_allocator_i* alloc, uint32_t flags, load::traj::PrepareProgress* progress);
@@ -0,0 +1,143 @@
+#include "loader_internal.h"
+
+#include <stdio.h>
+
+#if MD_PLATFORM_WINDOWS
+#include <sys/types.h>
+#include <sys/stat.h>
+#elif MD_PLATFORM_UNIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if MD_PLATFORM_UNIX
+static bool reserve_file_space(int fd, size_t size) {
+#if MD_PLATFORM_OSX
+    fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t)size, 0};
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(fd, F_PREALLOCATE, &store) == -1) return false;
+    }
+    return ftruncate(fd, (off_t)size) == 0;
+#else
+    return posix_fallocate(fd, 0, (off_t)size) == 0;
+#endif
+}
+#endif
+
+// Scratch files are removed from disk once they are unmapped
+// Read mappings map the entire (existing) file and ignore size
+// The storage of write mappings is reserved when created, creation fails if there is not enough space on the disk
+bool mapped_file_create(MappedFile* mf, str_t path, size_t size, int mode) {
+    ASSERT(mf);
+    char buf[1024];
+    int len = snprintf(buf, sizeof(buf), "%.*s", (int)path.len, path.ptr);
+    if (len <= 0 || len >= (int)sizeof(buf)) return false;
+
+#if MD_PLATFORM_WINDOWS
+    HANDLE file = INVALID_HANDLE_VALUE;
+    if (mode == MAPPED_FILE_READ) {
+        file = CreateFileA(buf, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    } else {
+        const DWORD attr = mode == MAPPED_FILE_SCRATCH ? (FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE) : FILE_ATTRIBUTE_NORMAL;
+        file = CreateFileA(buf, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, attr, NULL);
+    }
+    if (file == INVALID_HANDLE_VALUE) return false;
+    if (mode == MAPPED_FILE_READ) {
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+        size = (size_t)file_size.QuadPart;
+    } else {
+        // Extending the file allocates its clusters up front, so running out of disk space fails here rather than on a write to the view
+        LARGE_INTEGER file_size;
+        file_size.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(file, file_size, NULL, FILE_BEGIN) || !SetEndOfFile(file)) {
+            CloseHandle(file);
+            return false;
+        }
+    }
+    const DWORD protect = mode == MAPPED_FILE_READ ? PAGE_READONLY : PAGE_READWRITE;
+    HANDLE mapping = CreateFileMappingA(file, NULL, protect, (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+    void* ptr = MapViewOfFile(mapping, mode == MAPPED_FILE_READ ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!ptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    mf->file = file;
+    mf->mapping = mapping;
+#elif MD_PLATFORM_UNIX
+    int fd = -1;
+    if (mode == MAPPED_FILE_READ) {
+        fd = open(buf, O_RDONLY);
+        if (fd == -1) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        size = (size_t)st.st_size;
+    } else {
+        fd = open(buf, O_RDWR | O_CREAT | O_TRUNC, mode == MAPPED_FILE_SCRATCH ? 0600 : 0644);
+        if (fd == -1) return false;
+        if (mode == MAPPED_FILE_SCRATCH) {
+            // The file is unlinked immediately, the storage is reclaimed when the mapping is closed
+            unlink(buf);
+        }
+        // The storage is reserved up front, a sparse file would raise SIGBUS on the first write to a page which cannot be backed (full disk)
+        if (!reserve_file_space(fd, size)) {
+            close(fd);
+            return false;
+        }
+    }
+    void* ptr = mmap(NULL, size, mode == MAPPED_FILE_READ ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    mf->fd = fd;
+#else
+    return false;
+#endif
+    mf->ptr = ptr;
+    mf->size = size;
+    return true;
+}
+
+void mapped_file_close(MappedFile* mf) {
+    ASSERT(mf);
+    if (!mf->ptr) return;
+#if MD_PLATFORM_WINDOWS
+    UnmapViewOfFile(mf->ptr);
+    CloseHandle(mf->mapping);
+    CloseHandle(mf->file);
+#elif MD_PLATFORM_UNIX
+    munmap(mf->ptr, mf->size);
+    close(mf->fd);
+#endif
+    *mf = MappedFile();
+}
+
+bool file_stat(str_t filename, uint64_t* size, int64_t* mtime) {
+    char path[1024];
+    str_copy_to_char_buf(path, sizeof(path), filename);
+#if MD_PLATFORM_WINDOWS
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0) return false;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+#endif
+    *size  = (uint64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    return true;
+}
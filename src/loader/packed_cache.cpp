@@ -0,0 +1,268 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+
+#define PACKED_BLOCK_SIZE 16
+#define PACKED_PADDING 8
+// Upper bound of frames evicted to make room for a frame, a lowered budget is thereby approached gradually
+#define PACKED_EVICTIONS_PER_WRITE 8
+
+static inline uint32_t bit_width(uint32_t v) {
+    uint32_t n = 0;
+    while (v) {
+        ++n;
+        v >>= 1;
+    }
+    return n;
+}
+
+static inline void packed_block_range(const int32_t* q, size_t count, int32_t* out_min, uint32_t* out_bits) {
+    int32_t min_q = q[0];
+    int32_t max_q = q[0];
+    for (size_t i = 1; i < count; ++i) {
+        min_q = MIN(min_q, q[i]);
+        max_q = MAX(max_q, q[i]);
+    }
+    *out_min  = min_q;
+    *out_bits = bit_width((uint32_t)((int64_t)max_q - (int64_t)min_q));
+}
+
+static size_t packed_axis_size(const int32_t* q, size_t num_atoms) {
+    size_t size = 0;
+    for (size_t i = 0; i < num_atoms; i += PACKED_BLOCK_SIZE) {
+        int32_t  base;
+        uint32_t bits;
+        packed_block_range(q + i, MIN(PACKED_BLOCK_SIZE, num_atoms - i), &base, &bits);
+        size += sizeof(int32_t) + 1 + bits * PACKED_BLOCK_SIZE / 8;
+    }
+    return size;
+}
+
+static uint8_t* packed_axis_encode(uint8_t* out, const int32_t* q, size_t num_atoms) {
+    for (size_t i = 0; i < num_atoms; i += PACKED_BLOCK_SIZE) {
+        const size_t count = MIN(PACKED_BLOCK_SIZE, num_atoms - i);
+        int32_t  base;
+        uint32_t bits;
+        packed_block_range(q + i, count, &base, &bits);
+        MEMCPY(out, &base, sizeof(base));
+        out[sizeof(base)] = (uint8_t)bits;
+        out += sizeof(base) + 1;
+
+        if (bits) {
+            // Offsets of a partial block are padded with zeros
+            uint64_t acc = 0;
+            uint32_t acc_bits = 0;
+            for (size_t j = 0; j < PACKED_BLOCK_SIZE; ++j) {
+                const uint32_t d = j < count ? (uint32_t)((int64_t)q[i + j] - (int64_t)base) : 0;
+                acc |= (uint64_t)d << acc_bits;
+                acc_bits += bits;
+                while (acc_bits >= 8) {
+                    *out++ = (uint8_t)acc;
+                    acc >>= 8;
+                    acc_bits -= 8;
+                }
+            }
+        }
+    }
+    return out;
+}
+
+static const uint8_t* packed_axis_decode(float* out, const uint8_t* in, size_t num_atoms, float inv_scale) {
+    for (size_t i = 0; i < num_atoms; i += PACKED_BLOCK_SIZE) {
+        int32_t base;
+        MEMCPY(&base, in, sizeof(base));
+        const uint32_t bits = in[sizeof(base)];
+        in += sizeof(base) + 1;
+
+        // Unpack the offsets, this reads up to 8 bytes past the block which is covered by the padding of the frame allocation
+        uint32_t d[PACKED_BLOCK_SIZE] = {0};
+        if (bits) {
+            const uint64_t mask = (1ULL << bits) - 1;
+            for (uint32_t j = 0; j < PACKED_BLOCK_SIZE; ++j) {
+                const uint32_t bit = j * bits;
+                uint64_t w;
+                MEMCPY(&w, in + (bit >> 3), sizeof(w));
+                d[j] = (uint32_t)((w >> (bit & 7)) & mask);
+            }
+            in += bits * PACKED_BLOCK_SIZE / 8;
+        }
+
+        // Fixed trip count for full blocks so the conversion is vectorized
+        const size_t count = MIN(PACKED_BLOCK_SIZE, num_atoms - i);
+        if (count == PACKED_BLOCK_SIZE) {
+            for (size_t j = 0; j < PACKED_BLOCK_SIZE; ++j) {
+                out[i + j] = (float)(int32_t)((uint32_t)base + d[j]) * inv_scale;
+            }
+        } else {
+            for (size_t j = 0; j < count; ++j) {
+                out[i + j] = (float)(int32_t)((uint32_t)base + d[j]) * inv_scale;
+            }
+        }
+    }
+    return in;
+}
+
+static PackedFrame* packed_frame_encode(const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z, size_t num_atoms, float scale) {
+    md_allocator_i* alloc = md_get_heap_allocator();
+    int32_t* q = (int32_t*)md_alloc(alloc, sizeof(int32_t) * num_atoms * 3);
+    int32_t* qx = q + num_atoms * 0;
+    int32_t* qy = q + num_atoms * 1;
+    int32_t* qz = q + num_atoms * 2;
+    for (size_t i = 0; i < num_atoms; ++i) {
+        qx[i] = (int32_t)floorf(x[i] * scale + 0.5f);
+        qy[i] = (int32_t)floorf(y[i] * scale + 0.5f);
+        qz[i] = (int32_t)floorf(z[i] * scale + 0.5f);
+    }
+
+    const size_t size = sizeof(PackedFrame) + packed_axis_size(qx, num_atoms) + packed_axis_size(qy, num_atoms) + packed_axis_size(qz, num_atoms) + PACKED_PADDING;
+    PackedFrame* frame = (PackedFrame*)md_alloc(alloc, size);
+    frame->header    = *header;
+    frame->size      = size;
+    frame->inv_scale = 1.0f / scale;
+
+    uint8_t* out = (uint8_t*)(frame + 1);
+    out = packed_axis_encode(out, qx, num_atoms);
+    out = packed_axis_encode(out, qy, num_atoms);
+    out = packed_axis_encode(out, qz, num_atoms);
+    MEMSET(out, 0, PACKED_PADDING);
+
+    md_free(alloc, q, sizeof(int32_t) * num_atoms * 3);
+    return frame;
+}
+
+static void packed_frame_decode(const PackedFrame* frame, md_trajectory_frame_header_t* out_header, float* out_x, float* out_y, float* out_z) {
+    const size_t num_atoms = frame->header.num_atoms;
+    const uint8_t* in = (const uint8_t*)(frame + 1);
+    in = packed_axis_decode(out_x, in, num_atoms, frame->inv_scale);
+    in = packed_axis_decode(out_y, in, num_atoms, frame->inv_scale);
+    in = packed_axis_decode(out_z, in, num_atoms, frame->inv_scale);
+    *out_header = frame->header;
+}
+
+PackedCache* packed_cache_create(size_t num_frames, float precision, size_t max_bytes, md_allocator_i* alloc) {
+    PackedCache* packed = (PackedCache*)md_alloc(alloc, sizeof(PackedCache));
+    MEMSET(packed, 0, sizeof(PackedCache));
+    packed->frames = (std::atomic<PackedFrame*>*)md_alloc(alloc, sizeof(std::atomic<PackedFrame*>) * num_frames);
+    MEMSET(packed->frames, 0, sizeof(std::atomic<PackedFrame*>) * num_frames);
+    packed->num_frames = num_frames;
+    packed->scale      = 1.0f / precision;
+    packed->max_bytes  = max_bytes;
+    packed->lo = (int64_t)num_frames;
+    packed->hi = -1;
+    for (size_t i = 0; i < PACKED_NUM_LOCKS; ++i) {
+        packed->locks[i] = md_mutex_create();
+    }
+
+    MD_LOG_DEBUG("Initialized compressed frame cache with a budget of %i MB.", (int)(max_bytes / MEGABYTES(1)));
+    return packed;
+}
+
+// Outermost resident frame on either side, -1 if the tier is empty
+// Advances the hints past frames which are no longer resident
+static int64_t packed_cache_outermost(PackedCache* packed, bool upper) {
+    if (upper) {
+        int64_t h = packed->hi.load();
+        int64_t i = MIN(h, (int64_t)packed->num_frames - 1);
+        while (i >= 0 && !packed->frames[i].load(std::memory_order_relaxed)) --i;
+        packed->hi.compare_exchange_strong(h, i);
+        return i;
+    }
+    int64_t l = packed->lo.load();
+    int64_t i = MAX(l, (int64_t)0);
+    while (i < (int64_t)packed->num_frames && !packed->frames[i].load(std::memory_order_relaxed)) ++i;
+    packed->lo.compare_exchange_strong(l, i);
+    return i < (int64_t)packed->num_frames ? i : -1;
+}
+
+// Evicts the resident frame which is the best victim with respect to the playhead, if it is a better victim than min_score
+// Returns false if there was nothing to evict
+static bool packed_cache_evict(PackedCache* packed, double playhead, double fps, double min_score) {
+    const int64_t lo = packed_cache_outermost(packed, false);
+    const int64_t hi = packed_cache_outermost(packed, true);
+    if (lo == -1 || hi == -1) return false;
+    const double lo_score = eviction_score(lo, playhead, fps);
+    const double hi_score = eviction_score(hi, playhead, fps);
+    const int64_t victim = lo_score >= hi_score ? lo : hi;
+    if (MAX(lo_score, hi_score) <= min_score) return false;
+
+    md_mutex_t* lock = &packed->locks[victim % PACKED_NUM_LOCKS];
+    md_mutex_lock(lock);
+    PackedFrame* frame = packed->frames[victim].exchange(NULL);
+    md_mutex_unlock(lock);
+    if (frame) {
+        packed->bytes -= frame->size;
+        packed->count -= 1;
+        md_free(md_get_heap_allocator(), frame, frame->size);
+    }
+    return true;
+}
+
+// Evicts frames by their distance to the playhead until the cache fits within max_bytes
+void packed_cache_shrink(PackedCache* packed, size_t max_bytes, double playhead, double fps) {
+    if (!packed) return;
+    packed->max_bytes = max_bytes;
+    while (packed->bytes > max_bytes && packed_cache_evict(packed, playhead, fps, -1.0)) {}
+}
+
+void packed_cache_clear(PackedCache* packed) {
+    packed_cache_shrink(packed, 0, 0.0, 0.0);
+}
+
+void packed_cache_free(PackedCache* packed, md_allocator_i* alloc) {
+    if (!packed) return;
+    packed_cache_clear(packed);
+    for (size_t i = 0; i < PACKED_NUM_LOCKS; ++i) {
+        md_mutex_destroy(&packed->locks[i]);
+    }
+    md_free(alloc, packed->frames, sizeof(std::atomic<PackedFrame*>) * packed->num_frames);
+    md_free(alloc, packed, sizeof(PackedCache));
+}
+
+// Makes room for frames which have been appended to the trajectory
+void packed_cache_grow(PackedCache* packed, size_t num_frames, md_allocator_i* alloc) {
+    if (!packed || num_frames <= packed->num_frames) return;
+    packed->frames = (std::atomic<PackedFrame*>*)md_realloc(alloc, packed->frames, sizeof(std::atomic<PackedFrame*>) * packed->num_frames, sizeof(std::atomic<PackedFrame*>) * num_frames);
+    MEMSET(packed->frames + packed->num_frames, 0, sizeof(std::atomic<PackedFrame*>) * (num_frames - packed->num_frames));
+    packed->num_frames = num_frames;
+}
+
+bool packed_cache_read(PackedCache* packed, int64_t idx, md_trajectory_frame_header_t* out_header, float* out_x, float* out_y, float* out_z) {
+    if (!packed || !packed->frames[idx].load(std::memory_order_relaxed)) return false;
+    md_mutex_t* lock = &packed->locks[idx % PACKED_NUM_LOCKS];
+    md_mutex_lock(lock);
+    const PackedFrame* frame = packed->frames[idx].load(std::memory_order_acquire);
+    if (frame) {
+        packed_frame_decode(frame, out_header, out_x, out_y, out_z);
+    }
+    md_mutex_unlock(lock);
+    return frame != NULL;
+}
+
+// The frame is only encoded if there is room for it, or if room can be made by evicting frames which are further from the playhead
+// The room is estimated from the average size of the resident frames, so the budget can be exceeded by a frame or so under concurrent writes
+void packed_cache_write(PackedCache* packed, int64_t idx, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z, double playhead, double fps) {
+    if (!packed || packed->frames[idx].load(std::memory_order_relaxed)) return;
+
+    const size_t count = packed->count;
+    const size_t estimate = count ? packed->bytes / count : header->num_atoms * 3 * sizeof(float);
+    const double score = eviction_score(idx, playhead, fps);
+    for (int i = 0; packed->bytes + estimate > packed->max_bytes; ++i) {
+        // Over budget, the frame is served from the other tiers
+        if (i == PACKED_EVICTIONS_PER_WRITE || !packed_cache_evict(packed, playhead, fps, score)) return;
+    }
+
+    PackedFrame* frame = packed_frame_encode(header, x, y, z, header->num_atoms, packed->scale);
+    PackedFrame* expected = NULL;
+    if (packed->frames[idx].compare_exchange_strong(expected, frame, std::memory_order_release)) {
+        packed->bytes += frame->size;
+        packed->count += 1;
+        int64_t lo = packed->lo.load();
+        while (idx < lo && !packed->lo.compare_exchange_weak(lo, idx)) {}
+        int64_t hi = packed->hi.load();
+        while (idx > hi && !packed->hi.compare_exchange_weak(hi, idx)) {}
+    } else {
+        // Another thread got here first
+        md_free(md_get_heap_allocator(), frame, frame->size);
+    }
+}
@@ -0,0 +1,559 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <core/md_parse.h>
+#include <core/md_arena_allocator.h>
+#include <md_util.h>
+
+#include <stdio.h>
+
+// Files smaller than this are parsed by the regular (serial) loaders
+#define PARALLEL_PARSE_MIN_BYTES MEGABYTES(32)
+
+// Parallel parsing of the atom records of large text structure files (pdb and gro)
+// The file is split into line aligned chunks. First the atom records of every chunk are counted, which gives each chunk its offset
+// into the atom arrays, then the chunks are parsed in parallel straight into the arrays. Residues and chains are formed by a final
+// serial pass over the parsed atoms. Only the first model of a pdb file is parsed, the remaining models are read as a trajectory.
+// The pdb records which would make the result differ from the serial loader (CONECT records and alternate locations) are left to it.
+enum {
+    TEXT_FORMAT_PDB = 0,
+    TEXT_FORMAT_GRO,
+};
+
+struct ParseChunk {
+    const char* beg;
+    const char* end;
+    const char* cryst1;     // pdb: CRYST1 record within the chunk
+    bool   stop;            // pdb: The chunk holds the end of the first model, end has been moved to it
+    bool   element;         // pdb: Atoms with an element symbol (columns 77-78)
+    const char* serial_only;    // Reason why the file has to be left to the serial loader, NULL if there is none
+    size_t num_lines;
+    size_t line_offset;
+    size_t atom_offset;
+    size_t num_atoms;
+};
+
+struct ParallelParse {
+    int format;
+    size_t max_atoms;       // gro: Number of atoms given in the header
+    ParseChunk* chunks;
+    md_molecule_t* mol;
+    md_label_t* resname;
+    int32_t*    resid;
+    char*       chain;
+    bool        element;    // pdb: Element symbols are given, atom.element is allocated
+};
+
+static inline md_label_t label_from_str(str_t str) {
+    md_label_t lbl = {};
+    const size_t len = MIN(str.len, sizeof(lbl.buf) - 1);
+    MEMCPY(lbl.buf, str.ptr, len);
+    lbl.len = (uint8_t)len;
+    return lbl;
+}
+
+// Plain decimal numbers, hybrid-36 numbers of large files contain letters
+static inline bool decimal_column(const char* line, size_t len, size_t beg, size_t end) {
+    for (size_t i = beg; i < MIN(end, len); ++i) {
+        const char c = line[i];
+        if (c != ' ' && c != '-' && (c < '0' || c > '9')) return false;
+    }
+    return true;
+}
+
+// Atom records which the parallel parser reads the same way as the serial loader, the reason if it does not
+static inline const char* pdb_serial_only(const char* line, size_t len) {
+    if (len < 54) return "short atom records";
+    if (line[16] != ' ') return "alternate locations";
+    if (line[26] != ' ') return "insertion codes";
+    if (!decimal_column(line, len, 6, 11) || !decimal_column(line, len, 22, 26)) return "hybrid-36 numbers";
+    return NULL;
+}
+
+static inline bool pdb_element_column(const char* line, size_t len) {
+    return text_column(line, len, 76, 78).len > 0;
+}
+
+static void parse_count_chunk(ParallelParse* pp, ParseChunk* chunk) {
+    size_t num_lines = 0;
+    size_t num_atoms = 0;
+    const char* atoms_end = NULL;
+    for (const char* ptr = chunk->beg; ptr < chunk->end; ) {
+        const char* eol = find_line_end(ptr, chunk->end);
+        size_t len = eol - ptr;
+        if (len && ptr[len - 1] == '\r') --len;
+        if (pp->format == TEXT_FORMAT_PDB) {
+            // Explicit bonds are up to the serial loader, as are files with more than one model
+            if (len >= 6 && strncmp(ptr, "CONECT", 6) == 0) {
+                chunk->serial_only = "CONECT records";
+            } else if (atoms_end) {
+                if (pdb_atom_record(ptr, len) || (len >= 6 && strncmp(ptr, "MODEL ", 6) == 0)) {
+                    chunk->serial_only = "multiple models";
+                }
+            } else {
+                if (pdb_atom_record(ptr, len)) {
+                    num_atoms += 1;
+                    if (!chunk->serial_only) chunk->serial_only = pdb_serial_only(ptr, len);
+                    chunk->element |= pdb_element_column(ptr, len);
+                } else if (len >= 3 && strncmp(ptr, "END", 3) == 0) {
+                    // END or ENDMDL
+                    atoms_end = ptr;
+                } else if (len >= 6 && strncmp(ptr, "CRYST1", 6) == 0 && !chunk->cryst1) {
+                    chunk->cryst1 = ptr;
+                }
+            }
+        } else if (len < 44 && !chunk->serial_only) {
+            // Atom lines without all three coordinates, or the box of a file which holds more than one frame
+            chunk->serial_only = "short atom records";
+        }
+        if (!atoms_end) num_lines += 1;
+        ptr = eol + 1;
+    }
+    if (atoms_end) {
+        chunk->end  = atoms_end;
+        chunk->stop = true;
+    }
+    chunk->num_lines = num_lines;
+    chunk->num_atoms = num_atoms;
+}
+
+// Element symbols are upper case in pdb files
+static inline md_element_t pdb_element(const char* line, size_t len) {
+    const str_t col = text_column(line, len, 76, 78);
+    char sym[2];
+    for (size_t i = 0; i < col.len; ++i) {
+        const char c = col.ptr[i];
+        sym[i] = (i == 0) ? ((c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c) : ((c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c);
+    }
+    return col.len ? md_util_element_lookup(str_t{sym, col.len}) : 0;
+}
+
+static void parse_chunk(ParallelParse* pp, const ParseChunk* chunk) {
+    md_molecule_t* mol = pp->mol;
+    size_t i = chunk->atom_offset;
+    const size_t i_end = chunk->atom_offset + chunk->num_atoms;
+    for (const char* ptr = chunk->beg; ptr < chunk->end && i < i_end; ) {
+        const char* eol = find_line_end(ptr, chunk->end);
+        size_t len = eol - ptr;
+        if (len && ptr[len - 1] == '\r') --len;
+        if (pp->format == TEXT_FORMAT_PDB) {
+            if (pdb_atom_record(ptr, len)) {
+                mol->atom.x[i]  = (float)parse_float(text_column(ptr, len, 30, 38));
+                mol->atom.y[i]  = (float)parse_float(text_column(ptr, len, 38, 46));
+                mol->atom.z[i]  = (float)parse_float(text_column(ptr, len, 46, 54));
+                mol->atom.type[i] = label_from_str(text_column(ptr, len, 12, 16));
+                pp->resname[i]  = label_from_str(text_column(ptr, len, 17, 21));
+                pp->resid[i]    = (int32_t)parse_int(text_column(ptr, len, 22, 26));
+                pp->chain[i]    = ptr[21];
+                if (pp->element) mol->atom.element[i] = pdb_element(ptr, len);
+                i += 1;
+            }
+        } else {
+            // Residue id, residue name, atom name and atom number (5 columns each), followed by the coordinates in nm (8 columns each)
+            mol->atom.x[i]  = (float)parse_float(text_column(ptr, len, 20, 28)) * 10.0f;
+            mol->atom.y[i]  = (float)parse_float(text_column(ptr, len, 28, 36)) * 10.0f;
+            mol->atom.z[i]  = (float)parse_float(text_column(ptr, len, 36, 44)) * 10.0f;
+            mol->atom.type[i] = label_from_str(text_column(ptr, len, 10, 15));
+            pp->resname[i]  = label_from_str(text_column(ptr, len, 5, 10));
+            pp->resid[i]    = (int32_t)parse_int(text_column(ptr, len, 0, 5));
+            pp->chain[i]    = ' ';
+            i += 1;
+        }
+        ptr = eol + 1;
+    }
+}
+
+static md_unit_cell_t gro_unit_cell(const char* line, size_t len) {
+    char buf[256];
+    len = MIN(len, sizeof(buf) - 1);
+    MEMCPY(buf, line, len);
+    buf[len] = '\0';
+    // v1(x) v2(y) v3(z) v1(y) v1(z) v2(x) v2(z) v3(x) v3(y), in nm
+    double v[9] = {0};
+    const int n = sscanf(buf, "%lf %lf %lf %lf %lf %lf %lf %lf %lf", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8]);
+    if (n < 3) return md_unit_cell_t{};
+    md_unit_cell_t cell = md_util_unit_cell_from_extent(v[0] * 10.0, v[1] * 10.0, v[2] * 10.0);
+    if (n == 9 && (v[3] != 0 || v[4] != 0 || v[5] != 0 || v[6] != 0 || v[7] != 0 || v[8] != 0)) {
+        cell.basis[0][0] = (float)(v[0] * 10.0);
+        cell.basis[0][1] = (float)(v[3] * 10.0);
+        cell.basis[0][2] = (float)(v[4] * 10.0);
+        cell.basis[1][0] = (float)(v[5] * 10.0);
+        cell.basis[1][1] = (float)(v[1] * 10.0);
+        cell.basis[1][2] = (float)(v[6] * 10.0);
+        cell.basis[2][0] = (float)(v[7] * 10.0);
+        cell.basis[2][1] = (float)(v[8] * 10.0);
+        cell.basis[2][2] = (float)(v[2] * 10.0);
+        cell.inv_basis = mat3_inverse(cell.basis);
+        cell.flags = (cell.flags & ~MD_UNIT_CELL_FLAG_ORTHO) | MD_UNIT_CELL_FLAG_TRICLINIC;
+    }
+    return cell;
+}
+
+md_unit_cell_t pdb_unit_cell(const char* line, size_t len) {
+    const double a = parse_float(text_column(line, len, 6, 15));
+    const double b = parse_float(text_column(line, len, 15, 24));
+    const double c = parse_float(text_column(line, len, 24, 33));
+    // A unit cell of 1 x 1 x 1 is used by convention when there is none
+    if (a <= 1.0 && b <= 1.0 && c <= 1.0) return md_unit_cell_t{};
+    const double deg_to_rad = 3.14159265358979323846 / 180.0;
+    const double alpha = parse_float(text_column(line, len, 33, 40));
+    const double beta  = parse_float(text_column(line, len, 40, 47));
+    const double gamma = parse_float(text_column(line, len, 47, 54));
+    return unit_cell_from_lengths_and_cosines(a, b, c, cos(alpha * deg_to_rad), cos(beta * deg_to_rad), cos(gamma * deg_to_rad));
+}
+
+static bool parse_text_parallel(md_molecule_t* mol, str_t filename, int format, md_allocator_i* alloc) {
+    md_file_o* file = md_file_open(filename, MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Could not open file '%.*s'.", (int)filename.len, filename.ptr);
+        return false;
+    }
+    md_allocator_i* temp_alloc = md_get_heap_allocator();
+    const size_t size = md_file_size(file);
+    char* buf = (char*)md_alloc(temp_alloc, size);
+    const bool read_ok = md_file_read(file, buf, size) == size;
+    md_file_close(file);
+    if (!read_ok) {
+        MD_LOG_ERROR("Failed to read file '%.*s'.", (int)filename.len, filename.ptr);
+        md_free(temp_alloc, buf, size);
+        return false;
+    }
+
+    ParallelParse pp = {};
+    pp.format = format;
+    const char* beg = buf;
+    const char* end = buf + size;
+    md_unit_cell_t unit_cell = {};
+
+    if (format == TEXT_FORMAT_GRO) {
+        // Title and number of atoms, the box is given by the last line
+        const char* eol = find_line_end(beg, end);
+        const char* num_eol = eol < end ? find_line_end(eol + 1, end) : end;
+        if (num_eol == end) {
+            MD_LOG_ERROR("Invalid gro file '%.*s'.", (int)filename.len, filename.ptr);
+            md_free(temp_alloc, buf, size);
+            return false;
+        }
+        pp.max_atoms = (size_t)MAX(0, parse_int(str_trim(str_t{eol + 1, (size_t)(num_eol - eol - 1)})));
+        beg = num_eol + 1;
+        const char* last = end;
+        while (last > beg && (last[-1] == '\n' || last[-1] == '\r' || last[-1] == ' ')) --last;
+        const char* box = last;
+        while (box > beg && box[-1] != '\n') --box;
+        unit_cell = gro_unit_cell(box, last - box);
+        end = box;
+
+        // The coordinates are read from fixed 8 column fields, files written with a higher precision have wider fields
+        const char* line_end = find_line_end(beg, end);
+        const char* p0 = beg + 20 < line_end ? (const char*)memchr(beg + 20, '.', line_end - beg - 20) : NULL;
+        const char* p1 = p0 ? (const char*)memchr(p0 + 1, '.', line_end - p0 - 1) : NULL;
+        if (!p1 || p1 - p0 != 8) {
+            MD_LOG_DEBUG("File '%.*s' has non-standard coordinate fields, using the serial loader.", (int)filename.len, filename.ptr);
+            md_free(temp_alloc, buf, size);
+            return false;
+        }
+    }
+
+    // Line aligned chunks
+    const size_t num_chunks = MAX((size_t)1, task_system::pool_num_threads() * PARALLEL_PARSE_CHUNKS_PER_THREAD);
+    pp.chunks = (ParseChunk*)md_alloc(temp_alloc, sizeof(ParseChunk) * num_chunks);
+    MEMSET(pp.chunks, 0, sizeof(ParseChunk) * num_chunks);
+    const char* ptr = beg;
+    for (size_t i = 0; i < num_chunks; ++i) {
+        const char* chunk_end = (i == num_chunks - 1) ? end : beg + (size_t)(end - beg) * (i + 1) / num_chunks;
+        chunk_end = MAX(chunk_end, ptr);
+        if (chunk_end < end) {
+            chunk_end = find_line_end(chunk_end, end);
+            chunk_end = MIN(chunk_end + 1, end);
+        }
+        pp.chunks[i].beg = ptr;
+        pp.chunks[i].end = chunk_end;
+        ptr = chunk_end;
+    }
+
+    task_system::ID count_task = task_system::pool_enqueue(STR_LIT("##Parse Count"), 0, (uint32_t)num_chunks, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        ParallelParse* pp = (ParallelParse*)user_data;
+        for (uint32_t i = range_beg; i < range_end; ++i) {
+            parse_count_chunk(pp, &pp->chunks[i]);
+        }
+    }, &pp);
+    task_system::task_wait_for(count_task);
+
+    size_t num_atoms = 0;
+    size_t num_lines = 0;
+    const char* cryst1 = NULL;
+    const char* serial_only = NULL;
+    bool stop = false;
+    for (size_t i = 0; i < num_chunks; ++i) {
+        ParseChunk* chunk = &pp.chunks[i];
+        if (!serial_only) serial_only = chunk->serial_only;
+        if (stop) {
+            // Atoms after the end of the first model
+            if (chunk->num_atoms && !serial_only) serial_only = "multiple models";
+            chunk->num_atoms = 0;
+            continue;
+        }
+        pp.element |= chunk->element;
+        if (format == TEXT_FORMAT_GRO) {
+            // Only the first max_atoms lines are atoms
+            chunk->num_atoms = MIN(chunk->num_lines, pp.max_atoms - MIN(pp.max_atoms, num_lines));
+        }
+        chunk->line_offset = num_lines;
+        chunk->atom_offset = num_atoms;
+        num_lines += chunk->num_lines;
+        num_atoms += chunk->num_atoms;
+        if (!cryst1) cryst1 = chunk->cryst1;
+        stop = chunk->stop;
+    }
+    if (cryst1) {
+        unit_cell = pdb_unit_cell(cryst1, find_line_end(cryst1, buf + size) - cryst1);
+    }
+
+    // Anything which the serial loader might read differently is left to it, so both paths give the same molecule
+    if (serial_only) {
+        MD_LOG_DEBUG("File '%.*s' has %s, using the serial loader.", (int)filename.len, filename.ptr, serial_only);
+        md_free(temp_alloc, pp.chunks, sizeof(ParseChunk) * num_chunks);
+        md_free(temp_alloc, buf, size);
+        return false;
+    }
+
+    if (num_atoms == 0 || (format == TEXT_FORMAT_GRO && num_atoms != pp.max_atoms)) {
+        MD_LOG_ERROR("Failed to parse atoms of file '%.*s'.", (int)filename.len, filename.ptr);
+        md_free(temp_alloc, pp.chunks, sizeof(ParseChunk) * num_chunks);
+        md_free(temp_alloc, buf, size);
+        return false;
+    }
+
+    MEMSET(mol, 0, sizeof(md_molecule_t));
+    mol->atom.count = num_atoms;
+    mol->unit_cell  = unit_cell;
+    md_array_resize(mol->atom.x, num_atoms, alloc);
+    md_array_resize(mol->atom.y, num_atoms, alloc);
+    md_array_resize(mol->atom.z, num_atoms, alloc);
+    md_array_resize(mol->atom.type, num_atoms, alloc);
+    if (pp.element) {
+        md_array_resize(mol->atom.element, num_atoms, alloc);
+    }
+    pp.mol     = mol;
+    pp.resname = (md_label_t*)md_alloc(temp_alloc, sizeof(md_label_t) * num_atoms);
+    pp.resid   = (int32_t*)md_alloc(temp_alloc, sizeof(int32_t) * num_atoms);
+    pp.chain   = (char*)md_alloc(temp_alloc, num_atoms);
+
+    task_system::ID parse_task = task_system::pool_enqueue(STR_LIT("##Parse Chunks"), 0, (uint32_t)num_chunks, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        ParallelParse* pp = (ParallelParse*)user_data;
+        for (uint32_t i = range_beg; i < range_end; ++i) {
+            parse_chunk(pp, &pp->chunks[i]);
+        }
+    }, &pp);
+    task_system::task_wait_for(parse_task);
+
+    // Residues and chains are formed from consecutive atoms with the same residue id, name and chain id
+    md_array_resize(mol->atom.res_idx, num_atoms, alloc);
+    bool has_chains = false;
+    for (size_t i = 0; i < num_atoms; ++i) {
+        if (pp.chain[i] != ' ') {
+            has_chains = true;
+            break;
+        }
+    }
+    if (has_chains) {
+        md_array_resize(mol->atom.chain_idx, num_atoms, alloc);
+    }
+    for (size_t i = 0; i < num_atoms; ++i) {
+        const bool new_chain = i == 0 || pp.chain[i] != pp.chain[i - 1];
+        const bool new_res   = new_chain || pp.resid[i] != pp.resid[i - 1] || memcmp(&pp.resname[i], &pp.resname[i - 1], sizeof(md_label_t)) != 0;
+        if (new_res) {
+            md_range_t range = {(int32_t)i, (int32_t)i + 1};
+            md_array_push(mol->residue.name, pp.resname[i], alloc);
+            md_array_push(mol->residue.id, (md_residue_id_t)pp.resid[i], alloc);
+            md_array_push(mol->residue.atom_range, range, alloc);
+            mol->residue.count += 1;
+        } else {
+            mol->residue.atom_range[mol->residue.count - 1].end = (int32_t)i + 1;
+        }
+        mol->atom.res_idx[i] = (int32_t)mol->residue.count - 1;
+
+        if (has_chains) {
+            if (pp.chain[i] == ' ') {
+                mol->atom.chain_idx[i] = -1;
+                continue;
+            }
+            if (new_chain) {
+                md_range_t range = {(int32_t)i, (int32_t)i + 1};
+                md_array_push(mol->chain.id, label_from_str(str_t{&pp.chain[i], 1}), alloc);
+                md_array_push(mol->chain.atom_range, range, alloc);
+                mol->chain.count += 1;
+            } else {
+                mol->chain.atom_range[mol->chain.count - 1].end = (int32_t)i + 1;
+            }
+            mol->atom.chain_idx[i] = (int32_t)mol->chain.count - 1;
+        }
+    }
+
+    md_free(temp_alloc, pp.resname, sizeof(md_label_t) * num_atoms);
+    md_free(temp_alloc, pp.resid, sizeof(int32_t) * num_atoms);
+    md_free(temp_alloc, pp.chain, num_atoms);
+    md_free(temp_alloc, pp.chunks, sizeof(ParseChunk) * num_chunks);
+    md_free(temp_alloc, buf, size);
+    return true;
+}
+
+namespace load {
+
+namespace mol {
+
+static int text_format_from_loader(md_molecule_loader_i* loader) {
+    if (loader && loader == loader_from_ext(STR_LIT("pdb"))) return TEXT_FORMAT_PDB;
+    if (loader && loader == loader_from_ext(STR_LIT("gro"))) return TEXT_FORMAT_GRO;
+    return -1;
+}
+
+bool init_from_file_parallel(md_molecule_t* mol, str_t filename, md_molecule_loader_i* loader, md_allocator_i* alloc) {
+    ASSERT(mol);
+    ASSERT(alloc);
+
+    const int format = text_format_from_loader(loader);
+    if (format == -1) return false;
+
+    md_file_o* file = md_file_open(filename, MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) return false;
+    const size_t size = md_file_size(file);
+    md_file_close(file);
+    if (size < PARALLEL_PARSE_MIN_BYTES) return false;
+
+    return parse_text_parallel(mol, filename, format, alloc);
+}
+
+static inline bool label_eq(md_label_t a, md_label_t b) {
+    return a.len == b.len && memcmp(a.buf, b.buf, a.len) == 0;
+}
+
+// Compares the molecule of the parallel parser against that of the serial loader, logs the first difference
+static bool compare_parsed(const md_molecule_t* par, const md_molecule_t* ser, str_t filename) {
+    #define PARSE_MISMATCH(fmt, ...) { MD_LOG_ERROR("Parallel parse of '%.*s' differs from the loader: " fmt, (int)filename.len, filename.ptr, ##__VA_ARGS__); return false; }
+    if (par->atom.count != ser->atom.count) PARSE_MISMATCH("%zu atoms, expected %zu", par->atom.count, ser->atom.count);
+    for (size_t i = 0; i < par->atom.count; ++i) {
+        // The coordinates are printed with 3 decimals, both parsers should round to the same float
+        if (fabsf(par->atom.x[i] - ser->atom.x[i]) > 1.0e-4f || fabsf(par->atom.y[i] - ser->atom.y[i]) > 1.0e-4f || fabsf(par->atom.z[i] - ser->atom.z[i]) > 1.0e-4f) {
+            PARSE_MISMATCH("coordinates of atom %zu", i);
+        }
+        if (!label_eq(par->atom.type[i], ser->atom.type[i])) PARSE_MISMATCH("name of atom %zu", i);
+        if (par->atom.element && ser->atom.element && par->atom.element[i] != ser->atom.element[i]) PARSE_MISMATCH("element of atom %zu", i);
+        if (par->atom.res_idx && ser->atom.res_idx && par->atom.res_idx[i] != ser->atom.res_idx[i]) PARSE_MISMATCH("residue of atom %zu", i);
+    }
+    if (par->residue.count != ser->residue.count) PARSE_MISMATCH("%zu residues, expected %zu", par->residue.count, ser->residue.count);
+    for (size_t i = 0; i < par->residue.count; ++i) {
+        if (par->residue.id[i] != ser->residue.id[i]) PARSE_MISMATCH("id of residue %zu", i);
+        if (!label_eq(par->residue.name[i], ser->residue.name[i])) PARSE_MISMATCH("name of residue %zu", i);
+        if (par->residue.atom_range[i].beg != ser->residue.atom_range[i].beg || par->residue.atom_range[i].end != ser->residue.atom_range[i].end) PARSE_MISMATCH("atoms of residue %zu", i);
+    }
+    if (par->chain.count != ser->chain.count) PARSE_MISMATCH("%zu chains, expected %zu", par->chain.count, ser->chain.count);
+    for (size_t i = 0; i < par->chain.count; ++i) {
+        if (!label_eq(par->chain.id[i], ser->chain.id[i])) PARSE_MISMATCH("id of chain %zu", i);
+        if (par->chain.atom_range[i].beg != ser->chain.atom_range[i].beg || par->chain.atom_range[i].end != ser->chain.atom_range[i].end) PARSE_MISMATCH("atoms of chain %zu", i);
+    }
+    if (memcmp(&par->unit_cell.basis, &ser->unit_cell.basis, sizeof(par->unit_cell.basis)) != 0) PARSE_MISMATCH("unit cell");
+    #undef PARSE_MISMATCH
+    return true;
+}
+
+bool verify_parse(str_t filename) {
+    str_t ext = {};
+    md_molecule_loader_i* loader = extract_ext(&ext, filename) ? loader_from_ext(ext) : NULL;
+    const int format = text_format_from_loader(loader);
+    if (format == -1) {
+        MD_LOG_ERROR("Parse verification of '%.*s': only pdb and gro files are parsed in parallel.", (int)filename.len, filename.ptr);
+        return false;
+    }
+    md_allocator_i* ser_arena = md_arena_allocator_create(md_get_heap_allocator(), MEGABYTES(64));
+    md_allocator_i* par_arena = md_arena_allocator_create(md_get_heap_allocator(), MEGABYTES(64));
+    md_molecule_t ser = {};
+    md_molecule_t par = {};
+
+    bool result = false;
+    if (!loader->init_from_file(&ser, filename, NULL, ser_arena)) {
+        MD_LOG_ERROR("Parse verification of '%.*s': the loader failed.", (int)filename.len, filename.ptr);
+    } else if (!parse_text_parallel(&par, filename, format, par_arena)) {
+        // The size threshold of init_from_file_parallel does not apply here, small files exercise the same code
+        MD_LOG_INFO("Parse verification of '%.*s': the file is left to the loader.", (int)filename.len, filename.ptr);
+        result = true;
+    } else if (compare_parsed(&par, &ser, filename)) {
+        MD_LOG_INFO("Parse verification of '%.*s': %zu atoms, identical to the loader.", (int)filename.len, filename.ptr, par.atom.count);
+        result = true;
+    }
+
+    md_arena_allocator_destroy(ser_arena);
+    md_arena_allocator_destroy(par_arena);
+    return result;
+}
+
+void benchmark_parse(size_t num_atoms) {
+    md_molecule_loader_i* loader = loader_from_ext(STR_LIT("gro"));
+    if (!loader || num_atoms == 0) return;
+
+    char path[1024];
+    scratch_file_path(path, sizeof(path), "viamd_parse_benchmark.gro");
+
+    // Synthetic system of water molecules on a grid
+    md_file_o* file = md_file_open(str_from_cstr(path), MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Could not create benchmark file '%s'.", path);
+        return;
+    }
+    md_allocator_i* temp_alloc = md_get_heap_allocator();
+    const size_t buf_cap = MEGABYTES(1);
+    char* buf = (char*)md_alloc(temp_alloc, buf_cap);
+    size_t len = snprintf(buf, buf_cap, "Parse benchmark\n%zu\n", num_atoms);
+    const char* names[3] = {"OW", "HW1", "HW2"};
+    const size_t dim = (size_t)ceil(cbrt((double)(num_atoms + 2) / 3.0));
+    for (size_t i = 0; i < num_atoms; ++i) {
+        const size_t res = i / 3;
+        const float x = (float)(res % dim) * 0.31f + (float)(i % 3) * 0.01f;
+        const float y = (float)((res / dim) % dim) * 0.31f;
+        const float z = (float)(res / (dim * dim)) * 0.31f;
+        len += snprintf(buf + len, buf_cap - len, "%5d%-5s%5s%5d%8.3f%8.3f%8.3f\n", (int)((res + 1) % 100000), "SOL", names[i % 3], (int)((i + 1) % 100000), x, y, z);
+        if (buf_cap - len < 128) {
+            md_file_write(file, buf, len);
+            len = 0;
+        }
+    }
+    len += snprintf(buf + len, buf_cap - len, "%10.5f%10.5f%10.5f\n", dim * 0.31f, dim * 0.31f, dim * 0.31f);
+    md_file_write(file, buf, len);
+    const size_t file_size = md_file_size(file);
+    md_file_close(file);
+    md_free(temp_alloc, buf, buf_cap);
+
+    const str_t filename = str_from_cstr(path);
+    md_allocator_i* ser_arena = md_arena_allocator_create(temp_alloc, MEGABYTES(64));
+    md_allocator_i* par_arena = md_arena_allocator_create(temp_alloc, MEGABYTES(64));
+    md_molecule_t ser = {};
+    md_molecule_t par = {};
+
+    md_timestamp_t t0 = md_time_current();
+    const bool serial_ok = loader->init_from_file(&ser, filename, NULL, ser_arena);
+    const double serial_time = md_time_as_seconds(md_time_current() - t0);
+
+    t0 = md_time_current();
+    const bool parallel_ok = parse_text_parallel(&par, filename, TEXT_FORMAT_GRO, par_arena);
+    const double parallel_time = md_time_as_seconds(md_time_current() - t0);
+
+    // The parallel result has to be identical for the timings to mean anything
+    const bool equal = serial_ok && parallel_ok && compare_parsed(&par, &ser, filename);
+    md_arena_allocator_destroy(ser_arena);
+    md_arena_allocator_destroy(par_arena);
+    remove(path);
+
+    if (!equal) {
+        MD_LOG_ERROR("Parse benchmark failed (serial: %zu atoms, parallel: %zu atoms).", ser.atom.count, par.atom.count);
+        return;
+    }
+    const double mb = (double)file_size / MEGABYTES(1);
+    MD_LOG_INFO("Parse benchmark, %zu atoms (%.1f MB), %zu threads:", num_atoms, mb, task_system::pool_num_threads());
+    MD_LOG_INFO("  Serial:   %.3f s, %.1f MB/s", serial_time, mb / serial_time);
+    MD_LOG_INFO("  Parallel: %.3f s, %.1f MB/s (%.2fx)", parallel_time, mb / parallel_time, serial_time / parallel_time);
+}
+
+}  // namespace mol
+
+}  // namespace load
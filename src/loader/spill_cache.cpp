@@ -0,0 +1,153 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SPILL_SLOT_ALIGNMENT 4096
+
+SpillSettings spill_settings = {};
+
+// Path of a scratch file in the spill directory, or the temp directory if there is none
+void scratch_file_path(char* buf, size_t cap, const char* name) {
+    const char* dir = spill_settings.dir[0] ? spill_settings.dir : getenv("TMPDIR");
+    if (!dir) dir = getenv("TEMP");
+    if (!dir) dir = ".";
+    snprintf(buf, cap, "%s/%s", dir, name);
+}
+
+SpillCache* spill_cache_create(uint64_t key, size_t num_atoms, size_t num_frames, md_allocator_i* alloc) {
+    if (spill_settings.dir[0] == '\0' || spill_settings.max_bytes == 0) return NULL;
+
+    const size_t data_bytes = ALIGN_TO(sizeof(md_trajectory_frame_header_t), 64) + num_atoms * 3 * sizeof(float);
+    const size_t slot_bytes = ALIGN_TO(data_bytes, SPILL_SLOT_ALIGNMENT);
+    const size_t num_slots  = MIN(num_frames, spill_settings.max_bytes / slot_bytes);
+    if (num_slots == 0) {
+        MD_LOG_INFO("Frame spill size limit is too small to hold a single frame, disabling spill cache");
+        return NULL;
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/viamd_spill_%llx.bin", spill_settings.dir, (unsigned long long)key);
+
+    SpillCache* spill = (SpillCache*)md_alloc(alloc, sizeof(SpillCache));
+    MEMSET(spill, 0, sizeof(SpillCache));
+    spill->file = MappedFile();
+    if (!mapped_file_create(&spill->file, str_from_cstr(path), num_slots * slot_bytes)) {
+        MD_LOG_ERROR("Failed to create frame spill file '%s' (insufficient disk space?), disabling spill cache", path);
+        md_free(alloc, spill, sizeof(SpillCache));
+        return NULL;
+    }
+
+    spill->num_atoms  = num_atoms;
+    spill->num_slots  = num_slots;
+    spill->slot_bytes = slot_bytes;
+    spill->slot_frame = (int64_t*)md_alloc(alloc, sizeof(int64_t) * num_slots);
+    for (size_t i = 0; i < num_slots; ++i) {
+        spill->slot_frame[i] = -1;
+    }
+    for (size_t i = 0; i < SPILL_NUM_LOCKS; ++i) {
+        spill->locks[i] = md_mutex_create();
+    }
+
+    MD_LOG_DEBUG("Initialized frame spill cache with %i frames in '%s'.", (int)num_slots, path);
+    return spill;
+}
+
+void spill_cache_free(SpillCache* spill, md_allocator_i* alloc) {
+    if (!spill) return;
+    mapped_file_close(&spill->file);
+    for (size_t i = 0; i < SPILL_NUM_LOCKS; ++i) {
+        md_mutex_destroy(&spill->locks[i]);
+    }
+    md_free(alloc, spill->slot_frame, sizeof(int64_t) * spill->num_slots);
+    md_free(alloc, spill, sizeof(SpillCache));
+}
+
+void spill_cache_clear(SpillCache* spill) {
+    if (!spill) return;
+    for (size_t i = 0; i < spill->num_slots; ++i) {
+        md_mutex_t* lock = &spill->locks[i % SPILL_NUM_LOCKS];
+        md_mutex_lock(lock);
+        spill->slot_frame[i] = -1;
+        md_mutex_unlock(lock);
+    }
+}
+
+static inline void spill_slot_ptrs(const SpillCache* spill, size_t slot, md_trajectory_frame_header_t** header, float** x, float** y, float** z) {
+    char* base = (char*)spill->file.ptr + slot * spill->slot_bytes;
+    float* coords = (float*)(base + ALIGN_TO(sizeof(md_trajectory_frame_header_t), 64));
+    *header = (md_trajectory_frame_header_t*)base;
+    *x = coords + spill->num_atoms * 0;
+    *y = coords + spill->num_atoms * 1;
+    *z = coords + spill->num_atoms * 2;
+}
+
+bool spill_cache_read(SpillCache* spill, int64_t idx, md_trajectory_frame_header_t* out_header, float* out_x, float* out_y, float* out_z) {
+    if (!spill) return false;
+    const size_t slot = (size_t)idx % spill->num_slots;
+    md_mutex_t* lock = &spill->locks[slot % SPILL_NUM_LOCKS];
+
+    bool result = false;
+    md_mutex_lock(lock);
+    if (spill->slot_frame[slot] == idx) {
+        md_trajectory_frame_header_t* header;
+        float *x, *y, *z;
+        spill_slot_ptrs(spill, slot, &header, &x, &y, &z);
+        const size_t num_bytes = spill->num_atoms * sizeof(float);
+        *out_header = *header;
+        MEMCPY(out_x, x, num_bytes);
+        MEMCPY(out_y, y, num_bytes);
+        MEMCPY(out_z, z, num_bytes);
+        result = true;
+    }
+    md_mutex_unlock(lock);
+    return result;
+}
+
+void spill_cache_write(SpillCache* spill, int64_t idx, const md_trajectory_frame_header_t* in_header, const float* in_x, const float* in_y, const float* in_z) {
+    if (!spill) return;
+    const size_t slot = (size_t)idx % spill->num_slots;
+    md_mutex_t* lock = &spill->locks[slot % SPILL_NUM_LOCKS];
+
+    md_mutex_lock(lock);
+    if (spill->slot_frame[slot] != idx) {
+        md_trajectory_frame_header_t* header;
+        float *x, *y, *z;
+        spill_slot_ptrs(spill, slot, &header, &x, &y, &z);
+        const size_t num_bytes = spill->num_atoms * sizeof(float);
+        *header = *in_header;
+        MEMCPY(x, in_x, num_bytes);
+        MEMCPY(y, in_y, num_bytes);
+        MEMCPY(z, in_z, num_bytes);
+        spill->slot_frame[slot] = idx;
+    }
+    md_mutex_unlock(lock);
+}
+
+bool spill_cache_contains(SpillCache* spill, int64_t idx) {
+    if (!spill) return false;
+    const size_t slot = (size_t)idx % spill->num_slots;
+    md_mutex_t* lock = &spill->locks[slot % SPILL_NUM_LOCKS];
+    md_mutex_lock(lock);
+    const bool result = spill->slot_frame[slot] == idx;
+    md_mutex_unlock(lock);
+    return result;
+}
+
+namespace load {
+
+namespace traj {
+
+void set_spill_settings(str_t scratch_dir, size_t max_bytes) {
+    size_t len = MIN(scratch_dir.len, sizeof(spill_settings.dir) - 1);
+    MEMCPY(spill_settings.dir, scratch_dir.ptr, len);
+    spill_settings.dir[len] = '\0';
+    spill_settings.max_bytes = max_bytes;
+}
+
+}  // namespace traj
+
+}  // namespace load
@@ -0,0 +1,891 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <core/md_parse.h>
+#include <core/md_hash.h>
+#include <md_pdb.h>
+#include <md_xyz.h>
+#include <md_lammps.h>
+#include <md_util.h>
+
+#include <stdio.h>
+
+// Text trajectories smaller than this are indexed by the serial scan of their loader
+#define PARALLEL_INDEX_MIN_BYTES MEGABYTES(64)
+#define PARALLEL_INDEX_CHUNK_BYTES MEGABYTES(64)
+// Text trajectories are indexed in consecutive windows of the file, each of which is indexed in parallel.
+// The frames of the first window are available while the rest of the file is indexed (index_remaining).
+#define PARALLEL_INDEX_WINDOW_BYTES MEGABYTES(512)
+// Bytes at the head and tail of a text trajectory which are hashed to key its index
+#define INDEX_HASH_BYTES MEGABYTES(1)
+// Frames at the head of a text trajectory which are checked against the loader of the format (text_verify), along with the last frame
+#define INDEX_PROBE_FRAMES 1
+
+#define INDEX_MAGIC "VIAMDIDX"
+#define INDEX_VERSION 2
+#define INDEX_EXT ".vidx"
+
+// Text trajectories (lammpstrj, xyz, xmol, arc and multi-model pdb) indexed in parallel
+// The memory mapped file is split into byte ranges which are scanned on the thread pool. LAMMPS and pdb frames begin with a keyword
+// (ITEM: TIMESTEP, MODEL) at the start of a line, which is found with memchr. xyz and arc frames have a fixed number of lines, so the
+// newlines of every range are counted first and the frame starts are located by a second pass. The ranges are then stitched in order.
+// Only the frame offsets are found this way. The atom count of every xyz and arc frame is checked. The first and last frames are
+// compared with what the loader of the format reads from them (text_verify), and if anything differs the file is left to that loader.
+// The index is stored next to the file (<file>.vidx), keyed by its size, modification time and a hash of its head and tail.
+// Frames are parsed straight out of the mapping.
+
+struct IndexHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint64_t file_size;
+    int64_t  file_mtime;
+    uint64_t file_hash;
+    uint64_t num_atoms;
+    uint64_t num_frames;
+    uint64_t lines_per_frame;
+};
+
+struct IndexChunk {
+    size_t beg;
+    size_t end;
+    size_t num_lines;               // Newlines within the range
+    size_t line_offset;             // Newlines before the range
+    md_array(int64_t) starts;       // Frame starts within the range
+};
+
+struct ParallelIndex {
+    const char* buf;
+    size_t size;
+    str_t  keyword;
+    size_t lines_per_frame;
+    IndexChunk* chunks;
+};
+
+// Next whitespace separated token of the line, empty at the end of the line
+static inline str_t line_token(const char** ptr, const char* end) {
+    const char* p = *ptr;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    const char* beg = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') ++p;
+    *ptr = p;
+    return str_t{beg, (size_t)(p - beg)};
+}
+
+// Returns the line at ptr and advances ptr past it
+static inline str_t next_text_line(const char** ptr, const char* end) {
+    const char* beg = *ptr;
+    const char* eol = find_line_end(beg, end);
+    *ptr = eol < end ? eol + 1 : end;
+    return str_t{beg, (size_t)(eol - beg)};
+}
+
+static void index_keyword_chunk(ParallelIndex* pi, IndexChunk* chunk) {
+    const char* buf = pi->buf;
+    const char first = pi->keyword.ptr[0];
+    size_t pos = chunk->beg;
+    while (pos < chunk->end) {
+        const char* hit = (const char*)memchr(buf + pos, first, chunk->end - pos);
+        if (!hit) break;
+        const size_t off = (size_t)(hit - buf);
+        if ((off == 0 || buf[off - 1] == '\n') && off + pi->keyword.len <= pi->size && memcmp(hit, pi->keyword.ptr, pi->keyword.len) == 0) {
+            md_array_push(chunk->starts, (int64_t)off, md_get_heap_allocator());
+        }
+        pos = off + 1;
+    }
+}
+
+static void index_count_lines(ParallelIndex* pi, IndexChunk* chunk) {
+    const char* ptr = pi->buf + chunk->beg;
+    const char* end = pi->buf + chunk->end;
+    size_t num_lines = 0;
+    while ((ptr = (const char*)memchr(ptr, '\n', end - ptr)) != NULL) {
+        num_lines += 1;
+        ptr += 1;
+    }
+    chunk->num_lines = num_lines;
+}
+
+static void index_line_chunk(ParallelIndex* pi, IndexChunk* chunk) {
+    const char* ptr = pi->buf + chunk->beg;
+    const char* end = pi->buf + chunk->end;
+    size_t line = chunk->line_offset;
+    while ((ptr = (const char*)memchr(ptr, '\n', end - ptr)) != NULL) {
+        ptr += 1;
+        line += 1;
+        const size_t off = (size_t)(ptr - pi->buf);
+        if (line % pi->lines_per_frame == 0 && off < pi->size) {
+            md_array_push(chunk->starts, (int64_t)off, md_get_heap_allocator());
+        }
+    }
+}
+
+// Frame starts of the file, in order
+static md_array(int64_t) index_text_parallel(const char* buf, size_t size, str_t keyword, size_t lines_per_frame, size_t* total_lines, md_allocator_i* alloc) {
+    md_allocator_i* temp_alloc = md_get_heap_allocator();
+    ParallelIndex pi = {};
+    pi.buf = buf;
+    pi.size = size;
+    pi.keyword = keyword;
+    pi.lines_per_frame = lines_per_frame;
+
+    const size_t num_chunks = MAX(MAX((size_t)1, task_system::pool_num_threads() * PARALLEL_PARSE_CHUNKS_PER_THREAD), size / PARALLEL_INDEX_CHUNK_BYTES);
+    pi.chunks = (IndexChunk*)md_alloc(temp_alloc, sizeof(IndexChunk) * num_chunks);
+    MEMSET(pi.chunks, 0, sizeof(IndexChunk) * num_chunks);
+    for (size_t i = 0; i < num_chunks; ++i) {
+        pi.chunks[i].beg = size * i / num_chunks;
+        pi.chunks[i].end = size * (i + 1) / num_chunks;
+    }
+    if (lines_per_frame) {
+        task_system::ID count_task = task_system::pool_enqueue(STR_LIT("##Index Count"), 0, (uint32_t)num_chunks, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+            ParallelIndex* pi = (ParallelIndex*)user_data;
+            for (uint32_t i = range_beg; i < range_end; ++i) {
+                index_count_lines(pi, &pi->chunks[i]);
+            }
+        }, &pi);
+        task_system::task_wait_for(count_task);
+
+        size_t num_lines = 0;
+        for (size_t i = 0; i < num_chunks; ++i) {
+            pi.chunks[i].line_offset = num_lines;
+            num_lines += pi.chunks[i].num_lines;
+        }
+        // The last line may not be terminated
+        *total_lines = num_lines + ((size > 0 && buf[size - 1] != '\n') ? 1 : 0);
+    }
+
+    task_system::ID index_task = task_system::pool_enqueue(STR_LIT("##Index Chunks"), 0, (uint32_t)num_chunks, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        ParallelIndex* pi = (ParallelIndex*)user_data;
+        for (uint32_t i = range_beg; i < range_end; ++i) {
+            if (pi->lines_per_frame) {
+                index_line_chunk(pi, &pi->chunks[i]);
+            } else {
+                index_keyword_chunk(pi, &pi->chunks[i]);
+            }
+        }
+    }, &pi);
+    task_system::task_wait_for(index_task);
+
+    md_array(int64_t) starts = 0;
+    if (lines_per_frame) {
+        md_array_push(starts, 0, alloc);
+    }
+    for (size_t i = 0; i < num_chunks; ++i) {
+        md_array_push_array(starts, pi.chunks[i].starts, md_array_size(pi.chunks[i].starts), alloc);
+        md_array_free(pi.chunks[i].starts, temp_alloc);
+    }
+    md_free(temp_alloc, pi.chunks, sizeof(IndexChunk) * num_chunks);
+    return starts;
+}
+
+// Unit cell of a LAMMPS box given by its bounds and tilt factors
+static md_unit_cell_t lammps_unit_cell(const double lo[3], const double hi[3], const double tilt[3], bool triclinic) {
+    const double lx = hi[0] - lo[0];
+    const double ly = hi[1] - lo[1];
+    const double lz = hi[2] - lo[2];
+    if (!triclinic || (tilt[0] == 0 && tilt[1] == 0 && tilt[2] == 0)) {
+        return md_util_unit_cell_from_extent(lx, ly, lz);
+    }
+    // Cell vectors a = (lx, 0, 0), b = (xy, ly, 0), c = (xz, yz, lz)
+    const double xy = tilt[0], xz = tilt[1], yz = tilt[2];
+    const double a = lx;
+    const double b = sqrt(ly * ly + xy * xy);
+    const double c = sqrt(lz * lz + xz * xz + yz * yz);
+    return unit_cell_from_lengths_and_cosines(a, b, c, (xy * xz + ly * yz) / (b * c), xz / c, xy / b);
+}
+
+static bool lammps_decode_frame(const char* ptr, const char* end, size_t num_atoms, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    double  step = 0;
+    int64_t count = -1;
+    double  lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0}, tilt[3] = {0, 0, 0};
+    bool    has_box = false, triclinic = false, scaled = false;
+    int     col_id = -1, col[3] = {-1, -1, -1}, num_cols = 0;
+
+    bool atoms = false;
+    while (ptr < end && !atoms) {
+        const str_t line = next_text_line(&ptr, end);
+        if (str_begins_with(line, STR_LIT("ITEM: TIMESTEP"))) {
+            step = parse_float(str_trim(next_text_line(&ptr, end)));
+        } else if (str_begins_with(line, STR_LIT("ITEM: NUMBER OF ATOMS"))) {
+            count = parse_int(str_trim(next_text_line(&ptr, end)));
+        } else if (str_begins_with(line, STR_LIT("ITEM: BOX BOUNDS"))) {
+            // Triclinic boxes are given by their bounding box and the tilt factors xy xz yz
+            const char* q = line.ptr + (sizeof("ITEM: BOX BOUNDS") - 1);
+            str_t tok;
+            while ((tok = line_token(&q, line.ptr + line.len)).len > 0) {
+                if (str_eq(tok, STR_LIT("xy"))) triclinic = true;
+            }
+            double bound_lo[3], bound_hi[3];
+            for (int i = 0; i < 3; ++i) {
+                const str_t bounds = next_text_line(&ptr, end);
+                const char* p = bounds.ptr;
+                const char* e = bounds.ptr + bounds.len;
+                bound_lo[i] = parse_float(line_token(&p, e));
+                bound_hi[i] = parse_float(line_token(&p, e));
+                if (triclinic) tilt[i] = parse_float(line_token(&p, e));
+            }
+            const double xy = tilt[0], xz = tilt[1], yz = tilt[2];
+            lo[0] = bound_lo[0] - (triclinic ? MIN(MIN(0.0, xy), MIN(xz, xy + xz)) : 0.0);
+            hi[0] = bound_hi[0] - (triclinic ? MAX(MAX(0.0, xy), MAX(xz, xy + xz)) : 0.0);
+            lo[1] = bound_lo[1] - (triclinic ? MIN(0.0, yz) : 0.0);
+            hi[1] = bound_hi[1] - (triclinic ? MAX(0.0, yz) : 0.0);
+            lo[2] = bound_lo[2];
+            hi[2] = bound_hi[2];
+            has_box = true;
+        } else if (str_begins_with(line, STR_LIT("ITEM: ATOMS"))) {
+            const char* p = line.ptr + (sizeof("ITEM: ATOMS") - 1);
+            const char* e = line.ptr + line.len;
+            str_t tok;
+            while ((tok = line_token(&p, e)).len > 0) {
+                if      (str_eq(tok, STR_LIT("id"))) col_id = num_cols;
+                else if (str_eq(tok, STR_LIT("x"))   || str_eq(tok, STR_LIT("xu")))  col[0] = num_cols;
+                else if (str_eq(tok, STR_LIT("y"))   || str_eq(tok, STR_LIT("yu")))  col[1] = num_cols;
+                else if (str_eq(tok, STR_LIT("z"))   || str_eq(tok, STR_LIT("zu")))  col[2] = num_cols;
+                else if (str_eq(tok, STR_LIT("xs"))  || str_eq(tok, STR_LIT("xsu"))) { col[0] = num_cols; scaled = true; }
+                else if (str_eq(tok, STR_LIT("ys"))  || str_eq(tok, STR_LIT("ysu"))) col[1] = num_cols;
+                else if (str_eq(tok, STR_LIT("zs"))  || str_eq(tok, STR_LIT("zsu"))) col[2] = num_cols;
+                num_cols += 1;
+            }
+            atoms = true;
+        }
+    }
+    if (!atoms || count != (int64_t)num_atoms || col[0] < 0 || col[1] < 0 || col[2] < 0 || num_cols > 64) return false;
+
+    if (header) {
+        MEMSET(header, 0, sizeof(md_trajectory_frame_header_t));
+        header->num_atoms = num_atoms;
+        header->timestamp = step;
+        if (has_box) {
+            header->unit_cell = lammps_unit_cell(lo, hi, tilt, triclinic);
+        }
+    }
+    if (!(x && y && z)) return true;
+
+    str_t tok[64];
+    for (size_t i = 0; i < num_atoms; ++i) {
+        if (ptr >= end) return false;
+        const str_t line = next_text_line(&ptr, end);
+        const char* p = line.ptr;
+        const char* e = line.ptr + line.len;
+        int n = 0;
+        while (n < num_cols && (tok[n] = line_token(&p, e)).len > 0) ++n;
+        if (n < num_cols) return false;
+
+        // Atoms are not necessarily written in order
+        size_t idx = i;
+        if (col_id >= 0) {
+            const int64_t id = parse_int(tok[col_id]);
+            if (1 <= id && id <= (int64_t)num_atoms) idx = (size_t)(id - 1);
+        }
+        double v[3] = {parse_float(tok[col[0]]), parse_float(tok[col[1]]), parse_float(tok[col[2]])};
+        if (scaled) {
+            const double s[3] = {v[0], v[1], v[2]};
+            v[0] = lo[0] + s[0] * (hi[0] - lo[0]) + s[1] * tilt[0] + s[2] * tilt[1];
+            v[1] = lo[1] + s[1] * (hi[1] - lo[1]) + s[2] * tilt[2];
+            v[2] = lo[2] + s[2] * (hi[2] - lo[2]);
+        }
+        x[idx] = (float)v[0];
+        y[idx] = (float)v[1];
+        z[idx] = (float)v[2];
+    }
+    return true;
+}
+
+static bool xyz_decode_frame(const char* ptr, const char* end, size_t num_atoms, bool arc, bool arc_box, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    // xyz: atom count and comment, arc: atom count and title followed by an optional box line
+    md_unit_cell_t cell = {};
+    next_text_line(&ptr, end);
+    if (!arc) {
+        next_text_line(&ptr, end);
+    } else if (arc_box) {
+        const str_t line = next_text_line(&ptr, end);
+        const char* p = line.ptr;
+        const char* e = line.ptr + line.len;
+        double v[6];
+        for (int i = 0; i < 6; ++i) v[i] = parse_float(line_token(&p, e));
+        const double deg_to_rad = 3.14159265358979323846 / 180.0;
+        cell = unit_cell_from_lengths_and_cosines(v[0], v[1], v[2], cos(v[3] * deg_to_rad), cos(v[4] * deg_to_rad), cos(v[5] * deg_to_rad));
+    }
+
+    if (header) {
+        MEMSET(header, 0, sizeof(md_trajectory_frame_header_t));
+        header->num_atoms = num_atoms;
+        header->unit_cell = cell;
+    }
+    if (!(x && y && z)) return true;
+
+    for (size_t i = 0; i < num_atoms; ++i) {
+        if (ptr >= end) return false;
+        const str_t line = next_text_line(&ptr, end);
+        const char* p = line.ptr;
+        const char* e = line.ptr + line.len;
+        if (arc) line_token(&p, e);     // Index
+        line_token(&p, e);              // Element
+        const str_t tx = line_token(&p, e);
+        const str_t ty = line_token(&p, e);
+        const str_t tz = line_token(&p, e);
+        if (!tz.len) return false;
+        x[i] = (float)parse_float(tx);
+        y[i] = (float)parse_float(ty);
+        z[i] = (float)parse_float(tz);
+    }
+    return true;
+}
+
+static bool pdb_decode_frame(const char* ptr, const char* end, size_t num_atoms, const md_unit_cell_t* default_cell, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    md_unit_cell_t cell = *default_cell;
+    size_t i = 0;
+    while (ptr < end) {
+        const str_t line = next_text_line(&ptr, end);
+        if (pdb_atom_record(line.ptr, line.len)) {
+            if (i < num_atoms && x && y && z) {
+                x[i] = (float)parse_float(text_column(line.ptr, line.len, 30, 38));
+                y[i] = (float)parse_float(text_column(line.ptr, line.len, 38, 46));
+                z[i] = (float)parse_float(text_column(line.ptr, line.len, 46, 54));
+            }
+            i += 1;
+        } else if (str_begins_with(line, STR_LIT("CRYST1"))) {
+            cell = pdb_unit_cell(line.ptr, line.len);
+        } else if (str_begins_with(line, STR_LIT("ENDMDL"))) {
+            break;
+        }
+    }
+    if (i != num_atoms) return false;
+    if (header) {
+        MEMSET(header, 0, sizeof(md_trajectory_frame_header_t));
+        header->num_atoms = num_atoms;
+        header->unit_cell = cell;
+    }
+    return true;
+}
+
+static bool text_decode_frame(const TextTrajectory* text, const char* beg, const char* end, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    switch (text->format) {
+    case TEXT_TRAJ_LAMMPS: return lammps_decode_frame(beg, end, text->num_atoms, header, x, y, z);
+    case TEXT_TRAJ_XYZ:    return xyz_decode_frame(beg, end, text->num_atoms, false, false, header, x, y, z);
+    case TEXT_TRAJ_ARC:    return xyz_decode_frame(beg, end, text->num_atoms, true, text->lines_per_frame == text->num_atoms + 2, header, x, y, z);
+    case TEXT_TRAJ_PDB:    return pdb_decode_frame(beg, end, text->num_atoms, &text->unit_cell, header, x, y, z);
+    default: return false;
+    }
+}
+
+static bool text_get_header(struct md_trajectory_o* inst, md_trajectory_header_t* header) {
+    TextTrajectory* text = (TextTrajectory*)inst;
+    MEMSET(header, 0, sizeof(md_trajectory_header_t));
+    header->num_frames  = text->num_frames;
+    header->num_atoms   = text->num_atoms;
+    header->frame_times = text->frame_times;
+    return true;
+}
+
+static bool text_load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    TextTrajectory* text = (TextTrajectory*)inst;
+    ASSERT(0 <= idx && idx < (int64_t)text->num_frames);
+    const char* buf = (const char*)text->file.ptr;
+    if (!text_decode_frame(text, buf + text->offsets[idx], buf + text->offsets[idx + 1], header, x, y, z)) return false;
+    if (header) {
+        header->index     = idx;
+        header->timestamp = text->frame_times[idx];
+    }
+    return true;
+}
+
+// The raw frame data is the text of the frame, which is also how appended frames are handed over in follow mode
+static size_t text_fetch_frame_data(struct md_trajectory_o* inst, int64_t idx, void* data_ptr) {
+    TextTrajectory* text = (TextTrajectory*)inst;
+    ASSERT(0 <= idx && idx < (int64_t)text->num_frames);
+    const size_t size = (size_t)(text->offsets[idx + 1] - text->offsets[idx]);
+    if (data_ptr) {
+        MEMCPY(data_ptr, (const char*)text->file.ptr + text->offsets[idx], size);
+    }
+    return size;
+}
+
+static bool text_decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, size_t data_size, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    TextTrajectory* text = (TextTrajectory*)inst;
+    return text_decode_frame(text, (const char*)data_ptr, (const char*)data_ptr + data_size, header, x, y, z);
+}
+
+static void text_free(TextTrajectory* text) {
+    md_allocator_i* alloc = text->alloc;
+    ASSERT(!task_system::task_is_running(text->index_task));
+    mapped_file_close(&text->file);
+    md_mutex_destroy(&text->pending_mutex);
+    md_array_free(text->offsets, alloc);
+    md_array_free(text->frame_times, alloc);
+    md_array_free(text->pending_offsets, alloc);
+    md_array_free(text->pending_times, alloc);
+    md_free(alloc, text, sizeof(TextTrajectory));
+}
+
+static void text_destroy(md_trajectory_i* traj) {
+    md_allocator_i* alloc = ((TextTrajectory*)traj->inst)->alloc;
+    text_free((TextTrajectory*)traj->inst);
+    md_free(alloc, traj, sizeof(md_trajectory_i));
+}
+
+md_trajectory_loader_i* text_loader() {
+    // Text trajectories are created through create_internal_trajectory, which picks the format from the loader of the file type
+    static md_trajectory_loader_i loader = {};
+    loader.destroy = text_destroy;
+    return &loader;
+}
+
+static bool index_file_key(const TextTrajectory* text, str_t filename, uint64_t* size, int64_t* mtime, uint64_t* hash) {
+    if (!file_stat(filename, size, mtime)) return false;
+    const size_t n = MIN(text->file.size, INDEX_HASH_BYTES);
+    uint64_t h = md_hash64(text->file.ptr, n, *size);
+    *hash = md_hash64((const char*)text->file.ptr + text->file.size - n, n, h);
+    return true;
+}
+
+static bool index_read(TextTrajectory* text, str_t filename) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%.*s" INDEX_EXT, (int)filename.len, filename.ptr);
+    md_file_o* file = md_file_open(str_from_cstr(path), MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) return false;
+
+    IndexHeader header;
+    uint64_t size, hash;
+    int64_t  mtime;
+    bool valid = md_file_read(file, &header, sizeof(header)) == sizeof(header) &&
+        memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0 && header.version == INDEX_VERSION && header.format == (uint32_t)text->format &&
+        index_file_key(text, filename, &size, &mtime, &hash) && header.file_size == size && header.file_mtime == mtime && header.file_hash == hash &&
+        header.num_frames > 0;
+    if (valid) {
+        md_array_resize(text->offsets, header.num_frames + 1, text->alloc);
+        md_array_resize(text->frame_times, header.num_frames, text->alloc);
+        valid = md_file_read(file, text->offsets, sizeof(int64_t) * (header.num_frames + 1)) == sizeof(int64_t) * (header.num_frames + 1) &&
+                md_file_read(file, text->frame_times, sizeof(double) * header.num_frames) == sizeof(double) * header.num_frames &&
+                text->offsets[header.num_frames] <= (int64_t)text->file.size;
+    }
+    md_file_close(file);
+
+    if (!valid) {
+        md_array_shrink(text->offsets, 0);
+        md_array_shrink(text->frame_times, 0);
+        return false;
+    }
+    text->num_atoms = header.num_atoms;
+    text->num_frames = header.num_frames;
+    text->lines_per_frame = header.lines_per_frame;
+    return true;
+}
+
+static void index_write(const TextTrajectory* text, str_t filename, const int64_t* offsets, const double* frame_times, size_t num_frames) {
+    IndexHeader header = {};
+    MEMCPY(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.format = (uint32_t)text->format;
+    header.num_atoms = text->num_atoms;
+    header.num_frames = num_frames;
+    header.lines_per_frame = text->lines_per_frame;
+    if (!index_file_key(text, filename, &header.file_size, &header.file_mtime, &header.file_hash)) return;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%.*s" INDEX_EXT, (int)filename.len, filename.ptr);
+    md_file_o* file = md_file_open(str_from_cstr(path), MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_DEBUG("Could not write frame index '%s'.", path);
+        return;
+    }
+    const bool result = md_file_write(file, &header, sizeof(header)) == sizeof(header) &&
+        md_file_write(file, offsets, sizeof(int64_t) * (num_frames + 1)) == sizeof(int64_t) * (num_frames + 1) &&
+        md_file_write(file, frame_times, sizeof(double) * num_frames) == sizeof(double) * num_frames;
+    md_file_close(file);
+    if (!result) {
+        remove(path);
+    }
+}
+
+// Time of the frame which starts at offset, frames of formats without times are numbered
+static double text_frame_time(const TextTrajectory* text, int64_t offset, size_t idx) {
+    if (text->format != TEXT_TRAJ_LAMMPS) return (double)idx;
+    const char* end = (const char*)text->file.ptr + text->file.size;
+    const char* p = (const char*)text->file.ptr + offset;
+    next_text_line(&p, end);
+    return parse_float(str_trim(next_text_line(&p, end)));
+}
+
+// Indexes the window of the file which starts at beg (the start of a frame), the window grows until it holds a complete frame.
+// Appends the starts of the complete frames to starts and returns the end of the last one, beg if there is none. eof is set if the window reached the end of the file.
+static int64_t text_index_window(const TextTrajectory* text, int64_t beg, md_array(int64_t)* starts, bool* eof, md_allocator_i* alloc) {
+    const char* buf = (const char*)text->file.ptr;
+    const int64_t size = (int64_t)text->file.size;
+    md_allocator_i* temp_alloc = md_get_heap_allocator();
+
+    int64_t window = PARALLEL_INDEX_WINDOW_BYTES;
+    *eof = beg >= size;
+    while (!*eof) {
+        int64_t end = size;
+        if (beg + window < size) {
+            // No line is split between windows
+            end = (int64_t)(find_line_end(buf + beg + window, buf + size) - buf);
+            end = MIN(end + 1, size);
+        }
+        *eof = end == size;
+
+        size_t total_lines = 0;
+        md_array(int64_t) local = index_text_parallel(buf + beg, (size_t)(end - beg), text->keyword, text->lines_per_frame, &total_lines, temp_alloc);
+        size_t num_frames = md_array_size(local);
+        int64_t last_end = end;
+        if (text->lines_per_frame) {
+            // Only complete frames
+            num_frames = MIN(num_frames, total_lines / text->lines_per_frame);
+            if (num_frames < md_array_size(local)) last_end = beg + local[num_frames];
+        } else if (!*eof) {
+            // The last frame may continue in the next window
+            if (num_frames > 0) {
+                num_frames -= 1;
+                last_end = beg + local[num_frames];
+            }
+        } else if (text->format == TEXT_TRAJ_LAMMPS && num_frames > 0) {
+            // The last frame may still be being written
+            double time;
+            const int64_t last_beg = beg + local[num_frames - 1];
+            const int64_t frame_size = lammps_frame_size(buf + last_beg, (size_t)(size - last_beg), &time);
+            if (frame_size > 0) {
+                last_end = last_beg + frame_size;
+            } else {
+                num_frames -= 1;
+                last_end = last_beg;
+            }
+        }
+
+        if (text->lines_per_frame) {
+            // Frames are located by their number of lines, which only holds as long as every frame has the same number of atoms
+            for (size_t i = 0; i < num_frames; ++i) {
+                const char* p = buf + beg + local[i];
+                const str_t line = next_text_line(&p, buf + size);
+                p = line.ptr;
+                if (parse_int(line_token(&p, line.ptr + line.len)) != (int64_t)text->num_atoms) {
+                    MD_LOG_ERROR("The frame at byte %lld of '%s' does not have %i atoms, the trajectory ends before it.", (long long)(beg + local[i]), text->path, (int)text->num_atoms);
+                    num_frames = i;
+                    last_end = beg + local[i];
+                    *eof = true;
+                    break;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < num_frames; ++i) {
+            md_array_push(*starts, beg + local[i], alloc);
+        }
+        md_array_free(local, temp_alloc);
+        if (num_frames > 0) return last_end;
+        window *= 2;
+    }
+    return beg;
+}
+
+// Indexes the frames of the mapped file, returns false if the file is not understood or progress was cancelled.
+// If progressive, only the first window of the file is indexed and the rest is left to text_index_remaining (index_complete is false).
+static bool text_index(TextTrajectory* text, bool progressive, load::traj::PrepareProgress* progress) {
+    const char* buf = (const char*)text->file.ptr;
+    const size_t size = text->file.size;
+    const char* end = buf + size;
+    md_allocator_i* alloc = text->alloc;
+
+    const char* ptr = buf;
+    if (text->format == TEXT_TRAJ_LAMMPS) {
+        text->keyword = STR_LIT("ITEM: TIMESTEP");
+        const char* p = buf;
+        while (p < end) {
+            const str_t line = next_text_line(&p, end);
+            if (str_begins_with(line, STR_LIT("ITEM: NUMBER OF ATOMS"))) {
+                text->num_atoms = (size_t)MAX(0, parse_int(str_trim(next_text_line(&p, end))));
+                break;
+            }
+        }
+    } else if (text->format == TEXT_TRAJ_PDB) {
+        text->keyword = STR_LIT("MODEL ");
+    } else {
+        const str_t count_line = next_text_line(&ptr, end);
+        const char* p = count_line.ptr;
+        text->num_atoms = (size_t)MAX(0, parse_int(line_token(&p, count_line.ptr + count_line.len)));
+        text->lines_per_frame = text->num_atoms + 2;
+        if (text->format == TEXT_TRAJ_ARC) {
+            // The title may be followed by a box line of six numbers, which an atom line (index, element, ...) never is
+            const str_t line = next_text_line(&ptr, end);
+            const char* q = line.ptr;
+            const char* e = line.ptr + line.len;
+            int num_tok = 0;
+            bool numeric = true;
+            str_t tok;
+            while ((tok = line_token(&q, e)).len > 0) {
+                num_tok += 1;
+                numeric = numeric && (('0' <= tok.ptr[0] && tok.ptr[0] <= '9') || tok.ptr[0] == '-' || tok.ptr[0] == '.');
+            }
+            text->lines_per_frame = (num_tok == 6 && numeric) ? text->num_atoms + 2 : text->num_atoms + 1;
+        }
+    }
+
+    // Progress is reported in megabytes of the file
+    if (progress) progress->total = (uint32_t)(size / MEGABYTES(1) + 1);
+    md_array(int64_t) offsets = 0;
+    int64_t last_end = 0;
+    bool eof = false;
+    while (!eof) {
+        last_end = text_index_window(text, last_end, &offsets, &eof, alloc);
+        if (progress) progress->completed = (uint32_t)(last_end / MEGABYTES(1));
+        if (progressive || (progress && progress->cancel)) break;
+    }
+    const size_t num_frames = md_array_size(offsets);
+
+    if (text->format == TEXT_TRAJ_PDB && num_frames > 0) {
+        // A CRYST1 record before the first model applies to all models
+        const char* p = buf;
+        const char* first = buf + offsets[0];
+        while (p < first) {
+            const str_t line = next_text_line(&p, first);
+            if (str_begins_with(line, STR_LIT("CRYST1"))) {
+                text->unit_cell = pdb_unit_cell(line.ptr, line.len);
+            }
+        }
+        const char* frame_end = num_frames > 1 ? buf + offsets[1] : buf + last_end;
+        const char* q = first;
+        while (q < frame_end) {
+            const str_t line = next_text_line(&q, frame_end);
+            if (pdb_atom_record(line.ptr, line.len)) text->num_atoms += 1;
+            else if (str_begins_with(line, STR_LIT("ENDMDL"))) break;
+        }
+    }
+
+    if (num_frames == 0 || text->num_atoms == 0 || (progress && progress->cancel)) {
+        md_array_free(offsets, alloc);
+        return false;
+    }
+
+    md_array_push(offsets, last_end, alloc);
+    text->offsets = offsets;
+    text->num_frames = num_frames;
+    text->index_complete = eof;
+    md_array_resize(text->frame_times, num_frames, alloc);
+    for (size_t i = 0; i < num_frames; ++i) {
+        text->frame_times[i] = text_frame_time(text, offsets[i], i);
+    }
+    return true;
+}
+
+// Indexes the rest of the file window by window and hands the frames of every window over to the loaded trajectory (follow_update).
+// The index file is written once the end of the file has been reached.
+static void text_index_remaining(TextTrajectory* text) {
+    md_allocator_i* temp_alloc = md_get_heap_allocator();
+    load::traj::PrepareProgress* progress = text->index_progress;
+    const md_timestamp_t t0 = md_time_current();
+
+    // The complete index, for writing it to file
+    md_array(int64_t) offsets = 0;
+    md_array(double)  times   = 0;
+    md_array_push_array(offsets, text->offsets, text->num_frames + 1, temp_alloc);
+    md_array_push_array(times, text->frame_times, text->num_frames, temp_alloc);
+
+    md_array(int64_t) starts = 0;
+    int64_t last_end = text->offsets[text->num_frames];
+    bool eof = false;
+    while (!eof && !text->index_cancel && !(progress && progress->cancel)) {
+        md_array_shrink(starts, 0);
+        last_end = text_index_window(text, last_end, &starts, &eof, temp_alloc);
+        const size_t num_new = md_array_size(starts);
+        if (num_new > 0) {
+            // The first start is the end of the previous frame
+            md_array_shrink(offsets, md_array_size(offsets) - 1);
+            md_array_push_array(offsets, starts, num_new, temp_alloc);
+            md_array_push(offsets, last_end, temp_alloc);
+            md_mutex_lock(&text->pending_mutex);
+            for (size_t i = 0; i < num_new; ++i) {
+                const double time = text_frame_time(text, starts[i], md_array_size(times));
+                md_array_push(times, time, temp_alloc);
+                md_array_push(text->pending_times, time, text->alloc);
+                md_array_push(text->pending_offsets, i + 1 < num_new ? starts[i + 1] : last_end, text->alloc);
+            }
+            md_mutex_unlock(&text->pending_mutex);
+        }
+        if (progress) progress->completed = (uint32_t)(last_end / MEGABYTES(1));
+    }
+
+    const size_t num_frames = md_array_size(times);
+    if (eof) {
+        const double seconds = md_time_as_seconds(md_time_current() - t0);
+        MD_LOG_INFO("Indexed the remaining %i frames of '%s' in %.2f s.", (int)(num_frames - text->num_frames), text->path, seconds);
+        if (text->write_index) {
+            index_write(text, str_from_cstr(text->path), offsets, times, num_frames);
+        }
+    }
+    md_array_free(starts, temp_alloc);
+    md_array_free(offsets, temp_alloc);
+    md_array_free(times, temp_alloc);
+}
+
+static inline bool nearly_equal(float a, float b) {
+    return fabsf(a - b) <= 1.0e-3f * MAX(1.0f, fabsf(b));
+}
+
+// Checks the index and the decoders against the loader of the format, which reads the frames differently only if the file is not what they assume.
+// The head of the file up to INDEX_PROBE_FRAMES frames and the last indexed frame are written to a scratch file which is opened with the loader,
+// then it has to find the same number of frames and decode them to the same coordinates and unit cells.
+static bool text_verify(TextTrajectory* text, md_trajectory_loader_i* loader) {
+    const char* buf = (const char*)text->file.ptr;
+    const size_t num_frames = text->num_frames;
+    const size_t num_head = MIN(num_frames, (size_t)INDEX_PROBE_FRAMES);
+    const bool tail = num_frames > num_head;
+
+    char name[64];
+    snprintf(name, sizeof(name), "viamd_index_probe_%p", (void*)text);
+    char path[1024];
+    scratch_file_path(path, sizeof(path), name);
+    md_file_o* file = md_file_open(str_from_cstr(path), MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        MD_LOG_ERROR("Could not create probe file '%s'.", path);
+        return false;
+    }
+    md_file_write(file, buf, (size_t)text->offsets[num_head]);
+    if (tail) {
+        md_file_write(file, buf + text->offsets[num_frames - 1], (size_t)(text->offsets[num_frames] - text->offsets[num_frames - 1]));
+    }
+    md_file_close(file);
+
+    md_allocator_i* temp_alloc = md_get_heap_allocator();
+    md_trajectory_i* probe = loader->create(str_from_cstr(path), temp_alloc, LoadTrajectoryFlag_DisableCacheWrite);
+    bool result = probe && md_trajectory_num_frames(probe) == num_head + tail && (size_t)md_trajectory_num_atoms(probe) == text->num_atoms;
+
+    const size_t num_atoms = text->num_atoms;
+    const size_t bytes = num_atoms * 6 * sizeof(float);
+    float* coords = result ? (float*)md_alloc(temp_alloc, bytes) : NULL;
+    for (size_t i = 0; result && i < num_head + tail; ++i) {
+        float* x = coords;
+        float* y = coords + num_atoms;
+        float* z = coords + num_atoms * 2;
+        float* ref_x = coords + num_atoms * 3;
+        float* ref_y = coords + num_atoms * 4;
+        float* ref_z = coords + num_atoms * 5;
+        md_trajectory_frame_header_t header, ref_header;
+        const size_t idx = i < num_head ? i : num_frames - 1;
+        result = text_load_frame((md_trajectory_o*)text, (int64_t)idx, &header, x, y, z) && md_trajectory_load_frame(probe, (int64_t)i, &ref_header, ref_x, ref_y, ref_z);
+        for (size_t j = 0; result && j < num_atoms; ++j) {
+            result = nearly_equal(x[j], ref_x[j]) && nearly_equal(y[j], ref_y[j]) && nearly_equal(z[j], ref_z[j]);
+        }
+        for (int j = 0; result && j < 9; ++j) {
+            result = nearly_equal(header.unit_cell.basis[j / 3][j % 3], ref_header.unit_cell.basis[j / 3][j % 3]);
+        }
+    }
+
+    if (coords) md_free(temp_alloc, coords, bytes);
+    if (probe) loader->destroy(probe);
+    remove(path);
+    return result;
+}
+
+// Returns NULL if the file should be left to the loader (other formats, small files) or could not be indexed
+md_trajectory_i* text_create(str_t filename, md_trajectory_loader_i* loader, md_allocator_i* alloc, uint32_t flags, load::traj::PrepareProgress* progress) {
+    int format = -1;
+    if (loader == md_lammps_trajectory_loader()) {
+        format = TEXT_TRAJ_LAMMPS;
+    } else if (loader == md_pdb_trajectory_loader()) {
+        format = TEXT_TRAJ_PDB;
+    } else if (loader == md_xyz_trajectory_loader()) {
+        str_t ext;
+        format = (extract_ext(&ext, filename) && str_eq_ignore_case(ext, STR_LIT("arc"))) ? TEXT_TRAJ_ARC : TEXT_TRAJ_XYZ;
+    }
+    if (format == -1) return NULL;
+
+    uint64_t file_size;
+    int64_t  file_mtime;
+    if (!file_stat(filename, &file_size, &file_mtime) || file_size < PARALLEL_INDEX_MIN_BYTES) return NULL;
+
+    TextTrajectory* text = (TextTrajectory*)md_alloc(alloc, sizeof(TextTrajectory));
+    MEMSET(text, 0, sizeof(TextTrajectory));
+    text->file = MappedFile();
+    text->alloc = alloc;
+    text->format = format;
+    text->write_index = !(flags & LoadTrajectoryFlag_DisableCacheWrite);
+    str_copy_to_char_buf(text->path, sizeof(text->path), filename);
+    if (!mapped_file_create(&text->file, filename, 0, MAPPED_FILE_READ)) {
+        md_free(alloc, text, sizeof(TextTrajectory));
+        return NULL;
+    }
+    text->pending_mutex = md_mutex_create();
+
+    const bool cached = index_read(text, filename);
+    if (cached) {
+        text->index_complete = true;
+    } else {
+        const md_timestamp_t t0 = md_time_current();
+        if (!text_index(text, flags & LoadTrajectoryFlag_Progressive, progress)) {
+            text_free(text);
+            return NULL;
+        }
+        const double seconds = md_time_as_seconds(md_time_current() - t0);
+        const double indexed_mb = (double)text->offsets[text->num_frames] / MEGABYTES(1);
+        MD_LOG_INFO("Indexed %i frames of '%.*s' in %.2f s (%.0f MB/s).", (int)text->num_frames, (int)filename.len, filename.ptr, seconds, indexed_mb / MAX(seconds, 1.0e-6));
+        if (!text->index_complete) {
+            MD_LOG_INFO("The remaining %.0f MB of '%.*s' are indexed in the background.", (double)file_size / MEGABYTES(1) - indexed_mb, (int)filename.len, filename.ptr);
+        }
+    }
+
+    if (!text_verify(text, loader)) {
+        MD_LOG_INFO("The parallel index of '%.*s' does not agree with its loader, the loader indexes it instead.", (int)filename.len, filename.ptr);
+        text_free(text);
+        return NULL;
+    }
+    if (!cached && text->index_complete && text->write_index) {
+        index_write(text, filename, text->offsets, text->frame_times, text->num_frames);
+    }
+
+    md_trajectory_i* traj = (md_trajectory_i*)md_alloc(alloc, sizeof(md_trajectory_i));
+    MEMSET(traj, 0, sizeof(md_trajectory_i));
+    traj->inst = (md_trajectory_o*)text;
+    traj->get_header = text_get_header;
+    traj->load_frame = text_load_frame;
+    traj->fetch_frame_data  = text_fetch_frame_data;
+    traj->decode_frame_data = text_decode_frame_data;
+    return traj;
+}
+
+namespace load {
+
+namespace traj {
+
+task_system::ID index_remaining(md_trajectory_i* traj, PrepareProgress* progress) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj || loaded_traj->loader != text_loader()) return task_system::INVALID_ID;
+    TextTrajectory* text = (TextTrajectory*)loaded_traj->traj->inst;
+    if (text->index_complete || text->index_task != task_system::INVALID_ID) return task_system::INVALID_ID;
+
+    const int64_t num_indexed = (int64_t)text->num_frames;
+    if (source_frame(loaded_traj, loaded_traj->num_frames) < num_indexed) {
+        MD_LOG_ERROR("Progressive indexing requires the loaded frame range to extend to the end of the trajectory");
+        return task_system::INVALID_ID;
+    }
+    // The appended frames are read and handed over through the follow state, which only scans the file if follow mode is enabled
+    if (!follow_state_create(loaded_traj, str_from_cstr(text->path), follow_format(loaded_traj), num_indexed, text->offsets[num_indexed])) {
+        return task_system::INVALID_ID;
+    }
+
+    text->index_progress = progress;
+    text->index_task = task_system::pool_enqueue(STR_LIT("Indexing Frames"), [](void* user_data) {
+        text_index_remaining((TextTrajectory*)user_data);
+    }, text);
+    return text->index_task;
+}
+
+bool is_indexing(md_trajectory_i* traj) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj || loaded_traj->loader != text_loader()) return false;
+    TextTrajectory* text = (TextTrajectory*)loaded_traj->traj->inst;
+    if (task_system::task_is_running(text->index_task)) return true;
+    // Frames which have not been handed over yet
+    md_mutex_lock(&text->pending_mutex);
+    const bool pending = md_array_size(text->pending_offsets) > 0;
+    md_mutex_unlock(&text->pending_mutex);
+    return pending;
+}
+
+}  // namespace traj
+
+}  // namespace load
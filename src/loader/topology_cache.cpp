@@ -0,0 +1,214 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <core/md_hash.h>
+#include <md_util.h>
+
+#include <stdio.h>
+
+#define TOPOLOGY_MAGIC "VIAMDTOP"
+// Version 2 could hold bonds from a covalent radius search in place of those of md_util
+#define TOPOLOGY_VERSION 3
+#define TOPOLOGY_EXT ".vtop"
+
+// Topology cache
+// Sidecar file (<file>.vtop) holding a snapshot of a parsed and postprocessed molecule, so large structure files are not parsed again.
+// The snapshot holds the atoms, residues, chains and bonds, which covers the parsing and the bond detection. The remaining topology
+// (connectivity, structures, rings, backbone) is cheap to derive from these and is left to md_util_molecule_postprocess.
+// The snapshot is keyed by the size, modification time and content hash of the file, as well as the postprocess flags.
+
+struct TopologyHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t postprocess_flags;
+    uint64_t file_size;
+    int64_t  file_mtime;
+    uint64_t file_hash;
+    uint64_t atom_count;
+    uint64_t residue_count;
+    uint64_t chain_count;
+    uint64_t bond_count;
+    md_unit_cell_t unit_cell;
+};
+
+// Every field is stored as its element size and count followed by the data (padded to 8 bytes)
+// The element size guards against the layout of the mdlib types changing between versions
+struct TopologyField {
+    uint64_t elem_size;
+    uint64_t count;
+};
+
+#define TOPOLOGY_FIELDS(X)                  \
+    X(atom.x,             atom.count)       \
+    X(atom.y,             atom.count)       \
+    X(atom.z,             atom.count)       \
+    X(atom.radius,        atom.count)       \
+    X(atom.mass,          atom.count)       \
+    X(atom.element,       atom.count)       \
+    X(atom.type,          atom.count)       \
+    X(atom.flags,         atom.count)       \
+    X(atom.res_idx,       atom.count)       \
+    X(atom.chain_idx,     atom.count)       \
+    X(residue.name,       residue.count)    \
+    X(residue.id,         residue.count)    \
+    X(residue.atom_range, residue.count)    \
+    X(chain.id,           chain.count)      \
+    X(chain.atom_range,   chain.count)      \
+    X(bond.pairs,         bond.count)       \
+    X(bond.order,         bond.count)       \
+    X(bond.flags,         bond.count)
+
+static bool topology_file_key(str_t filename, uint64_t* size, int64_t* mtime, uint64_t* hash) {
+    if (!file_stat(filename, size, mtime)) return false;
+
+    md_file_o* file = md_file_open(filename, MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) return false;
+    md_allocator_i* alloc = md_get_heap_allocator();
+    const size_t buf_size = MEGABYTES(4);
+    void* buf = md_alloc(alloc, buf_size);
+    uint64_t h = *size;
+    size_t bytes;
+    while ((bytes = md_file_read(file, buf, buf_size)) > 0) {
+        h = md_hash64(buf, bytes, h);
+    }
+    md_free(alloc, buf, buf_size);
+    md_file_close(file);
+    *hash = h;
+    return true;
+}
+
+static void topology_cache_path(char* buf, size_t cap, str_t filename) {
+    snprintf(buf, cap, "%.*s" TOPOLOGY_EXT, (int)filename.len, filename.ptr);
+}
+
+static bool topology_write(md_file_o* file, const void* ptr, uint64_t elem_size, uint64_t count) {
+    const TopologyField field = {elem_size, count};
+    if (md_file_write(file, &field, sizeof(field)) != sizeof(field)) return false;
+    const size_t bytes = elem_size * count;
+    const uint64_t zero = 0;
+    if (bytes && md_file_write(file, ptr, bytes) != bytes) return false;
+    const size_t pad = ALIGN_TO(bytes, 8) - bytes;
+    return pad == 0 || md_file_write(file, &zero, pad) == pad;
+}
+
+// Returns a pointer to the data of the next field, NULL if the field does not match
+static const void* topology_read(const uint8_t** cur, const uint8_t* end, uint64_t elem_size, uint64_t* count) {
+    if (end - *cur < (int64_t)sizeof(TopologyField)) return NULL;
+    TopologyField field;
+    MEMCPY(&field, *cur, sizeof(field));
+    const uint64_t bytes = field.elem_size * field.count;
+    if (field.elem_size != elem_size || (uint64_t)(end - *cur) - sizeof(field) < ALIGN_TO(bytes, 8)) return NULL;
+    const void* data = *cur + sizeof(field);
+    *cur += sizeof(field) + ALIGN_TO(bytes, 8);
+    *count = field.count;
+    return data;
+}
+
+namespace load {
+
+namespace mol {
+
+bool load_topology_cache(md_molecule_t* mol, str_t filename, uint32_t postprocess_flags, md_allocator_i* alloc) {
+    ASSERT(mol);
+    ASSERT(alloc);
+
+    char path[1024];
+    topology_cache_path(path, sizeof(path), filename);
+    md_file_o* file = md_file_open(str_from_cstr(path), MD_FILE_READ | MD_FILE_BINARY);
+    if (!file) return false;
+
+    // The entire snapshot is read in one go
+    md_allocator_i* temp_alloc = md_get_heap_allocator();
+    const size_t size = md_file_size(file);
+    uint8_t* buf = (uint8_t*)md_alloc(temp_alloc, size);
+    const bool read_ok = md_file_read(file, buf, size) == size;
+    md_file_close(file);
+
+    TopologyHeader header;
+    uint64_t file_size = 0, file_hash = 0;
+    int64_t  file_mtime = 0;
+    bool valid = read_ok && size >= sizeof(header);
+    if (valid) {
+        MEMCPY(&header, buf, sizeof(header));
+        valid = memcmp(header.magic, TOPOLOGY_MAGIC, sizeof(header.magic)) == 0 && header.version == TOPOLOGY_VERSION && header.postprocess_flags == postprocess_flags &&
+            topology_file_key(filename, &file_size, &file_mtime, &file_hash) &&
+            header.file_size == file_size && header.file_mtime == file_mtime && header.file_hash == file_hash;
+    }
+
+    if (valid) {
+        MEMSET(mol, 0, sizeof(md_molecule_t));
+        mol->atom.count    = header.atom_count;
+        mol->residue.count = header.residue_count;
+        mol->chain.count   = header.chain_count;
+        mol->bond.count    = header.bond_count;
+        mol->unit_cell     = header.unit_cell;
+
+        const uint8_t* cur = buf + sizeof(header);
+        const uint8_t* end = buf + size;
+#define X(field, count_field)                                                       \
+        if (valid) {                                                                \
+            uint64_t count = 0;                                                     \
+            const void* data = topology_read(&cur, end, sizeof(*mol->field), &count); \
+            if (!data || (count && count != mol->count_field)) {                    \
+                valid = false;                                                      \
+            } else if (count) {                                                     \
+                md_array_resize(mol->field, count, alloc);                          \
+                MEMCPY(mol->field, data, count * sizeof(*mol->field));              \
+            }                                                                       \
+        }
+        TOPOLOGY_FIELDS(X)
+#undef X
+        if (!valid) {
+            md_molecule_free(mol, alloc);
+            MEMSET(mol, 0, sizeof(md_molecule_t));
+        }
+    }
+    md_free(temp_alloc, buf, size);
+
+    if (valid) {
+        MD_LOG_DEBUG("Loaded topology of '%.*s' from cache '%s'.", (int)filename.len, filename.ptr, path);
+    }
+    return valid;
+}
+
+bool write_topology_cache(const md_molecule_t* mol, str_t filename, uint32_t postprocess_flags) {
+    ASSERT(mol);
+
+    TopologyHeader header = {};
+    MEMCPY(header.magic, TOPOLOGY_MAGIC, sizeof(header.magic));
+    header.version = TOPOLOGY_VERSION;
+    header.postprocess_flags = postprocess_flags;
+    if (!topology_file_key(filename, &header.file_size, &header.file_mtime, &header.file_hash)) return false;
+    header.atom_count    = mol->atom.count;
+    header.residue_count = mol->residue.count;
+    header.chain_count   = mol->chain.count;
+    header.bond_count    = mol->bond.count;
+    header.unit_cell     = mol->unit_cell;
+
+    char path[1024];
+    topology_cache_path(path, sizeof(path), filename);
+    md_file_o* file = md_file_open(str_from_cstr(path), MD_FILE_WRITE | MD_FILE_BINARY);
+    if (!file) {
+        // Most likely a read only folder, which is fine
+        MD_LOG_DEBUG("Could not open '%s' for writing the topology cache.", path);
+        return false;
+    }
+
+    bool result = md_file_write(file, &header, sizeof(header)) == sizeof(header);
+#define X(field, count_field) \
+    result = result && topology_write(file, mol->field, sizeof(*mol->field), mol->field ? mol->count_field : 0);
+    TOPOLOGY_FIELDS(X)
+#undef X
+    md_file_close(file);
+
+    if (!result) {
+        MD_LOG_DEBUG("Failed to write topology cache '%s'.", path);
+        remove(path);
+    }
+    return result;
+}
+
+}  // namespace mol
+
+}  // namespace load
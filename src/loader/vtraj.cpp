@@ -0,0 +1,297 @@
+#include "loader_internal.h"
+
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <core/md_bitfield.h>
+
+#define NATIVE_MAGIC "VIAMDTRJ"
+#define NATIVE_VERSION 1
+#define NATIVE_ALIGNMENT 4096
+
+// VIAMD native trajectory (vtraj)
+// Frames are stored as fixed size, page aligned records of SoA float coordinates, so a frame is located from its index alone
+// and loading it is a copy out of the memory mapped file without any decoding. Opening only maps the file.
+// Layout: [NativeHeader][frame times (double)][record 0][record 1]...
+// Record: [md_trajectory_frame_header_t][x][y][z], every part aligned to 64 bytes
+// The frame header is stored as is, the file is a cache for the machine which wrote it rather than an interchange format.
+struct NativeHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t frame_header_bytes;    // sizeof(md_trajectory_frame_header_t) of the writer
+    uint64_t num_atoms;
+    uint64_t num_frames;
+    uint64_t times_offset;
+    uint64_t frames_offset;
+    uint64_t record_bytes;
+};
+
+struct NativeTrajectory {
+    MappedFile file;
+    const NativeHeader* header;
+    const double* frame_times;
+    size_t coord_offset;            // Offset of x within a record
+    size_t coord_stride;            // Offset between x, y and z within a record
+    md_allocator_i* alloc;
+};
+
+static inline size_t native_coord_offset() {
+    return ALIGN_TO(sizeof(md_trajectory_frame_header_t), 64);
+}
+
+static inline size_t native_coord_stride(size_t num_atoms) {
+    return ALIGN_TO(num_atoms * sizeof(float), 64);
+}
+
+static inline size_t native_record_bytes(size_t num_atoms) {
+    return ALIGN_TO(native_coord_offset() + native_coord_stride(num_atoms) * 3, NATIVE_ALIGNMENT);
+}
+
+static bool native_get_header(struct md_trajectory_o* inst, md_trajectory_header_t* header) {
+    NativeTrajectory* native = (NativeTrajectory*)inst;
+    MEMSET(header, 0, sizeof(md_trajectory_header_t));
+    header->num_frames  = native->header->num_frames;
+    header->num_atoms   = native->header->num_atoms;
+    header->frame_times = native->frame_times;
+    return true;
+}
+
+static bool native_load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    NativeTrajectory* native = (NativeTrajectory*)inst;
+    ASSERT(0 <= idx && idx < (int64_t)native->header->num_frames);
+    const char* record = (const char*)native->file.ptr + native->header->frames_offset + (size_t)idx * native->header->record_bytes;
+    if (header) {
+        MEMCPY(header, record, sizeof(md_trajectory_frame_header_t));
+    }
+    if (x && y && z) {
+        const size_t bytes = native->header->num_atoms * sizeof(float);
+        const char* coords = record + native->coord_offset;
+        MEMCPY(x, coords + native->coord_stride * 0, bytes);
+        MEMCPY(y, coords + native->coord_stride * 1, bytes);
+        MEMCPY(z, coords + native->coord_stride * 2, bytes);
+    }
+    return true;
+}
+
+// There is nothing to decode, so frames are never staged as raw data
+static size_t native_fetch_frame_data(struct md_trajectory_o*, int64_t, void*) {
+    return 0;
+}
+
+static bool native_decode_frame_data(struct md_trajectory_o*, const void*, size_t, md_trajectory_frame_header_t*, float*, float*, float*) {
+    return false;
+}
+
+static md_trajectory_i* native_create(str_t filename, md_allocator_i* alloc, uint32_t flags) {
+    (void)flags;
+    NativeTrajectory* native = (NativeTrajectory*)md_alloc(alloc, sizeof(NativeTrajectory));
+    MEMSET(native, 0, sizeof(NativeTrajectory));
+    native->file = MappedFile();
+    native->alloc = alloc;
+    if (!mapped_file_create(&native->file, filename, 0, MAPPED_FILE_READ)) {
+        MD_LOG_ERROR("Failed to open native trajectory '%.*s'", (int)filename.len, filename.ptr);
+        md_free(alloc, native, sizeof(NativeTrajectory));
+        return NULL;
+    }
+
+    const NativeHeader* header = (const NativeHeader*)native->file.ptr;
+    bool valid = native->file.size >= sizeof(NativeHeader) && memcmp(header->magic, NATIVE_MAGIC, sizeof(header->magic)) == 0;
+    if (valid && (header->version != NATIVE_VERSION || header->frame_header_bytes != sizeof(md_trajectory_frame_header_t))) {
+        MD_LOG_ERROR("Native trajectory was written by an incompatible version");
+        valid = false;
+    }
+    if (valid) {
+        valid = header->record_bytes == native_record_bytes(header->num_atoms) &&
+                header->times_offset + header->num_frames * sizeof(double) <= header->frames_offset &&
+                header->frames_offset + header->num_frames * header->record_bytes <= native->file.size;
+    }
+    if (!valid) {
+        MD_LOG_ERROR("File '%.*s' is not a valid native trajectory", (int)filename.len, filename.ptr);
+        mapped_file_close(&native->file);
+        md_free(alloc, native, sizeof(NativeTrajectory));
+        return NULL;
+    }
+
+    native->header = header;
+    native->frame_times  = (const double*)((const char*)native->file.ptr + header->times_offset);
+    native->coord_offset = native_coord_offset();
+    native->coord_stride = native_coord_stride(header->num_atoms);
+
+    md_trajectory_i* traj = (md_trajectory_i*)md_alloc(alloc, sizeof(md_trajectory_i));
+    MEMSET(traj, 0, sizeof(md_trajectory_i));
+    traj->inst = (md_trajectory_o*)native;
+    traj->get_header = native_get_header;
+    traj->load_frame = native_load_frame;
+    traj->fetch_frame_data  = native_fetch_frame_data;
+    traj->decode_frame_data = native_decode_frame_data;
+    return traj;
+}
+
+static void native_destroy(md_trajectory_i* traj) {
+    NativeTrajectory* native = (NativeTrajectory*)traj->inst;
+    md_allocator_i* alloc = native->alloc;
+    mapped_file_close(&native->file);
+    md_free(alloc, native, sizeof(NativeTrajectory));
+    md_free(alloc, traj, sizeof(md_trajectory_i));
+}
+
+md_trajectory_loader_i* native_loader() {
+    static md_trajectory_loader_i loader = {};
+    loader.create  = native_create;
+    loader.destroy = native_destroy;
+    return &loader;
+}
+
+// Writer, the records are written in place through a writable mapping, so frames can be written in parallel and in any order.
+// The header is written last, a file which was not completely written is never recognized as a native trajectory.
+struct NativeExport {
+    MappedFile file;
+    md_trajectory_i* traj;
+    md_allocator_i*  alloc;
+    md_array(int32_t) indices;      // Atom subset, empty = All atoms
+    size_t src_num_atoms;
+    size_t num_atoms;
+    size_t num_frames;
+    size_t stride;
+    size_t coord_stride;
+    NativeHeader header;
+    std::atomic_size_t num_written;
+    char path[1024];
+};
+
+namespace load {
+
+namespace traj {
+
+NativeExport* export_native_begin(md_trajectory_i* traj, str_t filename, const md_bitfield_t* atom_mask, uint32_t stride) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return NULL;
+    }
+
+    const size_t src_num_atoms = loaded_traj->mol->atom.count;
+    const size_t num_atoms = atom_mask ? md_bitfield_popcount(atom_mask) : src_num_atoms;
+    if (num_atoms == 0) {
+        MD_LOG_ERROR("Cannot export a trajectory of an empty atom subset");
+        return NULL;
+    }
+    stride = MAX(1, stride);
+    const size_t num_frames = (loaded_traj->num_frames + stride - 1) / stride;
+
+    NativeHeader header = {};
+    MEMCPY(header.magic, NATIVE_MAGIC, sizeof(header.magic));
+    header.version = NATIVE_VERSION;
+    header.frame_header_bytes = sizeof(md_trajectory_frame_header_t);
+    header.num_atoms     = num_atoms;
+    header.num_frames    = num_frames;
+    header.times_offset  = ALIGN_TO(sizeof(NativeHeader), 64);
+    header.frames_offset = ALIGN_TO(header.times_offset + num_frames * sizeof(double), NATIVE_ALIGNMENT);
+    header.record_bytes  = native_record_bytes(num_atoms);
+
+    md_allocator_i* alloc = md_get_heap_allocator();
+    NativeExport* exp = (NativeExport*)md_alloc(alloc, sizeof(NativeExport));
+    MEMSET(exp, 0, sizeof(NativeExport));
+    exp->file = MappedFile();
+    const size_t file_size = header.frames_offset + num_frames * header.record_bytes;
+    if (!mapped_file_create(&exp->file, filename, file_size, MAPPED_FILE_WRITE)) {
+        MD_LOG_ERROR("Failed to create native trajectory '%.*s'", (int)filename.len, filename.ptr);
+        md_free(alloc, exp, sizeof(NativeExport));
+        return NULL;
+    }
+
+    exp->traj   = traj;
+    exp->alloc  = alloc;
+    exp->header = header;
+    exp->src_num_atoms = src_num_atoms;
+    exp->num_atoms     = num_atoms;
+    exp->num_frames    = num_frames;
+    exp->stride        = stride;
+    exp->coord_stride  = native_coord_stride(num_atoms);
+    exp->num_written   = 0;
+    str_copy_to_char_buf(exp->path, sizeof(exp->path), filename);
+    if (atom_mask) {
+        md_array_resize(exp->indices, num_atoms, alloc);
+        md_bitfield_iter_extract_indices(exp->indices, num_atoms, md_bitfield_iter_create(atom_mask));
+    }
+
+    md_trajectory_header_t traj_header;
+    md_trajectory_get_header(traj, &traj_header);
+    double* times = (double*)((char*)exp->file.ptr + header.times_offset);
+    for (size_t i = 0; i < num_frames; ++i) {
+        times[i] = traj_header.frame_times ? traj_header.frame_times[i * stride] : (double)(i * stride);
+    }
+
+    return exp;
+}
+
+size_t export_native_num_frames(const NativeExport* exp) {
+    ASSERT(exp);
+    return exp->num_frames;
+}
+
+bool export_native_write(NativeExport* exp, size_t beg, size_t end) {
+    ASSERT(exp);
+
+    float* scratch = NULL;
+    const size_t scratch_bytes = exp->src_num_atoms * 3 * sizeof(float);
+    if (exp->indices) {
+        scratch = (float*)md_alloc(exp->alloc, scratch_bytes);
+    }
+
+    bool result = true;
+    end = MIN(end, exp->num_frames);
+    for (size_t i = beg; i < end && result; ++i) {
+        char* record = (char*)exp->file.ptr + exp->header.frames_offset + i * exp->header.record_bytes;
+        md_trajectory_frame_header_t* header = (md_trajectory_frame_header_t*)record;
+        float* x = (float*)(record + native_coord_offset() + exp->coord_stride * 0);
+        float* y = (float*)(record + native_coord_offset() + exp->coord_stride * 1);
+        float* z = (float*)(record + native_coord_offset() + exp->coord_stride * 2);
+
+        const int64_t frame_idx = (int64_t)(i * exp->stride);
+        if (scratch) {
+            float* src_x = scratch + exp->src_num_atoms * 0;
+            float* src_y = scratch + exp->src_num_atoms * 1;
+            float* src_z = scratch + exp->src_num_atoms * 2;
+            result = md_trajectory_load_frame(exp->traj, frame_idx, header, src_x, src_y, src_z);
+            if (result) {
+                subset_gather(x, src_x, exp->indices, exp->num_atoms);
+                subset_gather(y, src_y, exp->indices, exp->num_atoms);
+                subset_gather(z, src_z, exp->indices, exp->num_atoms);
+                header->num_atoms = exp->num_atoms;
+            }
+        } else {
+            result = md_trajectory_load_frame(exp->traj, frame_idx, header, x, y, z);
+        }
+        if (result) {
+            exp->num_written += 1;
+        }
+    }
+
+    if (scratch) {
+        md_free(exp->alloc, scratch, scratch_bytes);
+    }
+    return result;
+}
+
+bool export_native_end(NativeExport* exp) {
+    ASSERT(exp);
+
+    const bool complete = exp->num_written == exp->num_frames;
+    if (complete) {
+        MEMCPY(exp->file.ptr, &exp->header, sizeof(NativeHeader));
+    }
+    mapped_file_close(&exp->file);
+    if (!complete) {
+        remove(exp->path);
+    }
+
+    md_array_free(exp->indices, exp->alloc);
+    md_free(exp->alloc, exp, sizeof(NativeExport));
+    return complete;
+}
+
+}  // namespace traj
+
+}  // namespace load
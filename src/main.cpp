@@ -64,6 +64,7 @@
 
 #include <stdio.h>
 #include <bitset>
+#include <atomic>
 
 #include <viamd.h>
 #include <serialization_utils.h>
@@ -78,6 +79,11 @@
 #define IR_SEMAPHORE_MAX_COUNT 3
 #define MEASURE_EVALUATION_TIME 1
 #define FRAME_ALLOCATOR_BYTES MEGABYTES(256)
+#define FRAME_STREAM_BATCH_SIZE 4
+#define FOLLOW_POLL_INTERVAL_IN_SECONDS 2.0
+#define INDEX_POLL_INTERVAL_IN_SECONDS 0.5
+#define PREFETCH_LOOKAHEAD_IN_SECONDS 2.0
+#define SCRUB_MAX_FETCHES 2
 
 #define LOG_INFO  MD_LOG_INFO
 #define LOG_DEBUG MD_LOG_DEBUG
@@ -305,6 +311,8 @@ struct LoadParam {
     bool coarse_grained = false;
     const void* mol_loader_arg = NULL;
     LoadTrajectoryFlags traj_loader_flags = 0;
+    LoadMoleculeFlags mol_loader_flags = 0;
+    load::traj::FrameRange traj_range = {};
 };
 
 const str_t* find_in_arr(str_t str, const str_t arr[], size_t len) {
@@ -625,7 +633,8 @@ static void update_display_properties(ApplicationState* data);
 static void update_density_volume(ApplicationState* data);
 static void clear_density_volume(ApplicationState* data);
 
-static void interpolate_atomic_properties(ApplicationState* data);
+static void interpolate_atomic_properties(ApplicationState* data, bool blocking = true);
+static bool scrub_frames_arrived(ApplicationState* data);
 static void update_view_param(ApplicationState* data);
 static void reset_view(ApplicationState* data, bool move_camera = false, bool smooth_transition = false);
 
@@ -664,8 +673,13 @@ static void update_md_buffers(ApplicationState* data);
 
 static void init_molecule_data(ApplicationState* data);
 static void init_trajectory_data(ApplicationState* data);
+static void update_follow_trajectory(ApplicationState* data);
+static void update_prefetch(ApplicationState* data);
 
 static void interrupt_async_tasks(ApplicationState* data);
+static void cancel_open_trajectory(ApplicationState* data);
+
+static task_system::ID pool_enqueue_frame_range(str_t label, md_trajectory_i* traj, uint32_t frame_beg, uint32_t frame_end, task_system::RangeTask task, void* user_data, task_system::Priority priority = task_system::Priority::Normal);
 
 static bool load_dataset_from_file(ApplicationState* data, const LoadParam& param);
 
@@ -677,6 +691,9 @@ static bool export_csv(const float* column_data[], const char* column_labels[],
 
 static void create_screenshot(ApplicationState* data);
 
+static void export_trajectory(ApplicationState* data, str_t filename);
+static bool export_cache_stats(const load::traj::CacheStats& stats, str_t filename);
+
 // Representations
 static Representation* create_representation(ApplicationState* data, RepresentationType type = RepresentationType::SpaceFill,
                                              ColorMapping color_mapping = ColorMapping::Cpk, str_t filter = STR_LIT("all"));
@@ -832,6 +849,9 @@ int main(int argc, char** argv) {
     postprocessing::initialize(data.gbuffer.width, data.gbuffer.height);
     LOG_DEBUG("Initializing volume...");
     volume::initialize();
+    LOG_DEBUG("Initializing profiler...");
+    profiler::initialize();
+    gpu_profiler::initialize();
     LOG_DEBUG("Initializing task system...");
     const size_t num_threads = VIAMD_NUM_WORKER_THREADS == 0 ? md_os_num_processors() : VIAMD_NUM_WORKER_THREADS;
     task_system::initialize(CLAMP(num_threads, 2, (uint32_t)md_os_num_processors()));
@@ -870,16 +890,44 @@ int main(int argc, char** argv) {
             }
         }
         if (argc > 1) {
-            // Assume argv[1..] are files to load
-            // Currently we do not support any command line flags
-            // So anything here which is a file path is assumed to be a file to load
+            // Arguments starting with '--' are flags
+            // Anything else which is a file path is assumed to be a file to load
             for (int i = 1; i < argc; ++i) {
-                str_t path = str_from_cstr(argv[i]);
-                if (md_path_is_valid(path)) {
-					file_queue_push(&data.file_queue, path);
+                str_t arg = str_from_cstr(argv[i]);
+                if (str_begins_with(arg, STR_LIT("--"))) {
+                    const str_t cache_size_flag = STR_LIT("--cache-size=");
+                    const str_t benchmark_parse_flag = STR_LIT("--benchmark-parse=");
+                    const str_t verify_parse_flag = STR_LIT("--verify-parse=");
+                    if (str_begins_with(arg, cache_size_flag)) {
+                        str_t val = str_substr(arg, str_len(cache_size_flag));
+                        if (str_eq_ignore_case(val, STR_LIT("auto"))) {
+                            data.settings.frame_cache.auto_budget = true;
+                            load::traj::set_cache_budget(0);
+                        } else if (is_int(val)) {
+                            data.settings.frame_cache.auto_budget = false;
+                            load::traj::set_cache_budget(MEGABYTES((size_t)MAX(64, parse_int(val))));
+                        } else {
+                            LOG_ERROR("Invalid value for --cache-size: '" STR_FMT "', expected size in MB or 'auto'", STR_ARG(val));
+                        }
+                    } else if (str_eq(arg, STR_LIT("--benchmark-parse")) || str_begins_with(arg, benchmark_parse_flag)) {
+                        // Synthetic file of num_atoms atoms, 5M by default
+                        str_t val = str_begins_with(arg, benchmark_parse_flag) ? str_substr(arg, str_len(benchmark_parse_flag)) : STR_LIT("");
+                        const size_t num_atoms = is_int(val) ? (size_t)MAX(1, parse_int(val)) : 5000000;
+                        load::mol::benchmark_parse(num_atoms);
+                    } else if (str_begins_with(arg, verify_parse_flag)) {
+                        // Compares the parallel parser against the loader on the given pdb or gro file
+                        load::mol::verify_parse(str_substr(arg, str_len(verify_parse_flag)));
+                    } else {
+                        LOG_ERROR("Unrecognized command line flag: '" STR_FMT "'", STR_ARG(arg));
+                    }
+                    continue;
+                }
+                if (md_path_is_valid(arg)) {
+					file_queue_push(&data.file_queue, arg);
 				}
             }
         }
+        data.settings.frame_cache.budget_mb = (int)(load::traj::get_effective_cache_budget() / MEGABYTES(1));
     }
 
 #if EXPERIMENTAL_SDF == 1
@@ -893,6 +941,7 @@ int main(int argc, char** argv) {
     // Main loop
     while (!data.app.window.should_close) {
         application::update(&data.app);
+        gpu_profiler::new_frame();
         
         // This needs to happen first (in imgui events) to enable docking of imgui windows
 #if VIAMD_IMGUI_ENABLE_DOCKSPACE
@@ -957,6 +1006,7 @@ int main(int argc, char** argv) {
                     param.coarse_grained = e.flags & FileFlags_CoarseGrained;
                     param.mol_loader_arg = state.mol_loader_arg;
                     param.traj_loader_flags = (e.flags & FileFlags_DisableCacheWrite) ? LoadTrajectoryFlag_DisableCacheWrite : 0;
+                    param.mol_loader_flags  = (e.flags & FileFlags_DisableCacheWrite) ? LoadMoleculeFlag_DisableCacheWrite : 0;
                     if (load_dataset_from_file(&data, param)) {
                         data.animation = {};
                         if (param.mol_loader) {
@@ -973,6 +1023,9 @@ int main(int argc, char** argv) {
             }
         }
 
+        load::traj::update_cache_budget();
+        update_follow_trajectory(&data);
+
         viamd::event_system_enqueue_event(viamd::EventType_ViamdFrameTick, viamd::EventPayloadType_ApplicationState, &data);
         viamd::event_system_process_event_queue();
 
@@ -1071,49 +1124,33 @@ int main(int argc, char** argv) {
 
         if (data.animation.mode == PlaybackMode::Playing) {
             data.animation.frame += data.app.timing.delta_s * data.animation.fps;
-            data.animation.frame = CLAMP(data.animation.frame, 0.0, max_frame);
-            if (data.animation.frame >= max_frame) {
-                data.animation.mode = PlaybackMode::Stopped;
-                data.animation.frame = max_frame;
-            } else if (data.animation.frame <= 0) {
-                data.animation.mode = PlaybackMode::Stopped;
-                data.animation.frame = 0;
-            }
-
-            if (!task_system::task_is_running(data.tasks.prefetch_frames)) {
-                uint32_t traj_frames = (uint32_t)md_trajectory_num_frames(data.mold.traj);
-                if (traj_frames > 0 && load::traj::num_cache_frames(data.mold.traj) < traj_frames) {
-                    uint32_t frame_beg = 0;
-                    uint32_t frame_end = 0;
-                    // @NOTE: This is certainly something which can be improved upon.
-                    // It prefetches frames in the direction of the animation.
-                    // In a more optimal case, it should never yield until it catches up with the number of frames it expects to have as a buffer.
-                    
-                    if (data.animation.fps > 0) {
-                        frame_beg = CLAMP((uint32_t)data.animation.frame, 0, traj_frames - 1);
-                        frame_end = CLAMP((uint32_t)data.animation.frame + 20, 0, traj_frames);
-                    } else {
-                        frame_beg = CLAMP((uint32_t)data.animation.frame - 20, 0, traj_frames - 1);
-                        frame_end = CLAMP((uint32_t)data.animation.frame, 0, traj_frames);
-                    }
-                    if (frame_beg != frame_end) {
-                        data.tasks.prefetch_frames = task_system::pool_enqueue(STR_LIT("##Prefetch Frames"), frame_beg, frame_end, [](uint32_t frame_beg, uint32_t frame_end, void* user_data) {
-                            ApplicationState* data = (ApplicationState*)user_data;
-                            for (uint32_t i = frame_beg; i < frame_end; ++i) {
-                                md_trajectory_load_frame(data->mold.traj, i, 0, 0, 0, 0);
-                            }
-                        }, &data);
-                    }
+            if (data.animation.loop && max_frame > 0) {
+                data.animation.frame = fmod(data.animation.frame, max_frame);
+                if (data.animation.frame < 0) data.animation.frame += max_frame;
+            } else {
+                data.animation.frame = CLAMP(data.animation.frame, 0.0, max_frame);
+                if (data.animation.frame >= max_frame) {
+                    data.animation.mode = PlaybackMode::Stopped;
+                    data.animation.frame = max_frame;
+                } else if (data.animation.frame <= 0) {
+                    data.animation.mode = PlaybackMode::Stopped;
+                    data.animation.frame = 0;
                 }
             }
         }
 
+        update_prefetch(&data);
+
         {
             static auto prev_frame = data.animation.frame;
             if (data.animation.frame != prev_frame) {
                 time_changed = true;
                 prev_frame = data.animation.frame;
             }
+            else if (data.animation.scrub_pending && data.mold.traj && scrub_frames_arrived(&data)) {
+                // Replace the stand-in frame shown while scrubbing
+                time_changed = true;
+            }
             else {
                 time_changed = false;
             }
@@ -1145,7 +1182,8 @@ int main(int argc, char** argv) {
 
             PUSH_CPU_SECTION("Interpolate Position")
             if (data.mold.traj) {
-                interpolate_atomic_properties(&data);
+                // Playback has its frames prefetched, anything else is scrubbing and must not stall on cache misses
+                interpolate_atomic_properties(&data, data.animation.mode == PlaybackMode::Playing);
             }
             POP_CPU_SECTION()
 
@@ -1318,8 +1356,15 @@ int main(int argc, char** argv) {
                             md_script_ir_free(data.script.eval_ir);
                             data.script.eval_ir = data.script.ir;
                         }
-                        data.script.full_eval = md_script_eval_create(num_frames, data.script.eval_ir, persistent_alloc);
-                        data.script.filt_eval = md_script_eval_create(num_frames, data.script.eval_ir, persistent_alloc);
+                        // A followed trajectory gets room to grow, so appended frames can be evaluated without starting over
+                        // A trajectory which is still being indexed gets room for the frames of the whole file, extrapolated from the part indexed so far
+                        size_t eval_frames = data.files.follow_trajectory ? num_frames * 2 : num_frames;
+                        const load::traj::PrepareProgress* progress = data.files.open_trajectory_progress;
+                        if (progress && load::traj::is_indexing(data.mold.traj) && progress->completed > 0) {
+                            eval_frames = MAX(eval_frames, (size_t)((double)num_frames * progress->total / progress->completed * 1.1) + 1);
+                        }
+                        data.script.full_eval = md_script_eval_create(eval_frames, data.script.eval_ir, persistent_alloc);
+                        data.script.filt_eval = md_script_eval_create(eval_frames, data.script.eval_ir, persistent_alloc);
                     }
 
                     init_display_properties(&data);
@@ -1337,13 +1382,14 @@ int main(int argc, char** argv) {
                         md_script_eval_ir_fingerprint(data.script.full_eval) == md_script_ir_fingerprint(data.script.eval_ir))
                     {
                         data.script.evaluate_full = false;
+                        data.script.eval_num_frames = num_frames;
                         md_script_eval_clear_data(data.script.full_eval);
 
                         if (md_script_ir_property_count(data.script.eval_ir) > 0) {
-                            data.tasks.evaluate_full = task_system::pool_enqueue(STR_LIT("Eval Full"), 0, (uint32_t)num_frames, [](uint32_t frame_beg, uint32_t frame_end, void* user_data) {
+                            data.tasks.evaluate_full = pool_enqueue_frame_range(STR_LIT("Eval Full"), data.mold.traj, 0, (uint32_t)num_frames, [](uint32_t frame_beg, uint32_t frame_end, void* user_data) {
                                 ApplicationState* data = (ApplicationState*)user_data;
                                 md_script_eval_frame_range(data->script.full_eval, data->script.eval_ir, &data->mold.mol, data->mold.traj, frame_beg, frame_end);
-                            }, &data);
+                            }, &data, task_system::Priority::Background);
                             
 #if MEASURE_EVALUATION_TIME
                             uint64_t time = (uint64_t)md_time_current();
@@ -1359,6 +1405,28 @@ int main(int argc, char** argv) {
                 }
             }
 
+            // Frames which have been appended to a followed trajectory, only these are evaluated
+            if (data.script.full_eval && !data.script.eval_init && !data.script.evaluate_full && data.script.eval_num_frames < num_frames &&
+                task_system::task_is_running(data.tasks.evaluate_full) == false &&
+                md_script_ir_valid(data.script.eval_ir) &&
+                md_script_eval_ir_fingerprint(data.script.full_eval) == md_script_ir_fingerprint(data.script.eval_ir))
+            {
+                if (num_frames <= md_script_eval_num_frames_total(data.script.full_eval)) {
+                    const uint32_t append_beg = (uint32_t)data.script.eval_num_frames;
+                    data.script.eval_num_frames = num_frames;
+
+                    if (md_script_ir_property_count(data.script.eval_ir) > 0) {
+                        data.tasks.evaluate_full = pool_enqueue_frame_range(STR_LIT("Eval Appended"), data.mold.traj, append_beg, (uint32_t)num_frames, [](uint32_t frame_beg, uint32_t frame_end, void* user_data) {
+                            ApplicationState* data = (ApplicationState*)user_data;
+                            md_script_eval_frame_range(data->script.full_eval, data->script.eval_ir, &data->mold.mol, data->mold.traj, frame_beg, frame_end);
+                        }, &data, task_system::Priority::Background);
+                    }
+                } else {
+                    // Out of room, start over with a larger evaluation
+                    data.script.eval_init = true;
+                }
+            }
+
             if (data.script.filt_eval && data.script.evaluate_filt && data.timeline.filter.enabled) {
                 if (task_system::task_is_running(data.tasks.evaluate_filt)) {
                     md_script_eval_interrupt(data.script.filt_eval);
@@ -1449,9 +1517,13 @@ int main(int argc, char** argv) {
         }
 
         // Swap buffers
+        PUSH_CPU_SECTION("Swap buffers")
         application::swap_buffers(&data.app);
+        POP_CPU_SECTION()
 
+        PUSH_CPU_SECTION("Execute queued tasks")
         task_system::execute_queued_tasks();
+        POP_CPU_SECTION()
 
         // Reset frame allocator
         md_linear_allocator_reset(frame_alloc);
@@ -1468,8 +1540,12 @@ int main(int argc, char** argv) {
     postprocessing::shutdown();
     LOG_DEBUG("Shutting down volume...");
     volume::shutdown();
+    LOG_DEBUG("Shutting down gpu profiler...");
+    gpu_profiler::shutdown();
     LOG_DEBUG("Shutting down task system...");
     task_system::shutdown();
+    LOG_DEBUG("Shutting down profiler...");
+    profiler::shutdown();
 
     destroy_gbuffer(&data.gbuffer);
     application::shutdown(&data.app);
@@ -2008,7 +2084,96 @@ static void clear_density_volume(ApplicationState* data) {
     data->density_volume.model_mat = {0};
 }
 
-static void interpolate_atomic_properties(ApplicationState* data) {
+// Frames wanted for display while scrubbing are fetched by a pool task which serves the latest request.
+// A decode cannot be interrupted, so a fetch which has been superseded ends after the frame it is decoding and a new fetch takes over right away.
+// At most SCRUB_MAX_FETCHES fetches run at once, so fast scrubbing does not queue up decodes of frames which the cursor has already passed.
+static void request_scrub_fetch(ApplicationState* data) {
+    auto& scrub = data->animation.scrub;
+    if (scrub.served.load() == scrub.generation.load() && task_system::task_is_running(data->tasks.scrub_frames)) return;
+    if (scrub.fetches.fetch_add(1) >= SCRUB_MAX_FETCHES) {
+        scrub.fetches--;
+        return;
+    }
+    // Called every frame while scrubbing, so the fetch is dropped rather than stalling the UI when the pool is saturated
+    const task_system::ID id = task_system::pool_try_enqueue(STR_LIT("##Scrub Frames"), [](void* user_data) {
+        ApplicationState* data = (ApplicationState*)user_data;
+        auto& scrub = data->animation.scrub;
+        defer { scrub.fetches--; };
+        const uint32_t generation = scrub.generation.load();
+        scrub.served = generation;
+        // Bounded, in case the cache cannot hold all of the wanted frames at once
+        for (int iter = 0; iter < 16 && scrub.generation.load() == generation; ++iter) {
+            int64_t idx = -1;
+            for (int i = 0; i < 4; ++i) {
+                const int64_t frame = scrub.wanted[i].load();
+                if (frame != -1 && !load::traj::frame_cached(data->mold.traj, frame)) {
+                    idx = frame;
+                    break;
+                }
+            }
+            if (idx == -1) break;
+            md_trajectory_load_frame(data->mold.traj, idx, 0, 0, 0, 0);
+        }
+    }, data);
+    if (id == task_system::INVALID_ID) {
+        scrub.fetches--;
+        return;
+    }
+    data->tasks.scrub_frames = id;
+}
+
+// Returns true once the frames requested while scrubbing have been fetched
+static bool scrub_frames_arrived(ApplicationState* data) {
+    for (int i = 0; i < 4; ++i) {
+        const int64_t frame = data->animation.scrub.wanted[i].load();
+        if (frame != -1 && !load::traj::frame_cached(data->mold.traj, frame)) {
+            // The fetch task may have finished just before the request was updated
+            request_scrub_fetch(data);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns true if the frames required for interpolation are cached, otherwise they are requested to be fetched in the background
+static bool scrub_frames_ready(ApplicationState* data, const int64_t frames[4], int64_t nearest_frame, InterpolationMode mode) {
+    // Ordered by importance, the nearest frame first
+    const int64_t other_frame = nearest_frame == frames[1] ? frames[2] : frames[1];
+    int64_t wanted[4] = {nearest_frame, -1, -1, -1};
+    if (mode == InterpolationMode::Linear || mode == InterpolationMode::CubicSpline) {
+        wanted[1] = other_frame;
+    }
+    if (mode == InterpolationMode::CubicSpline) {
+        wanted[2] = frames[0];
+        wanted[3] = frames[3];
+    }
+
+    bool ready = true;
+    for (int i = 0; i < 4; ++i) {
+        if (wanted[i] != -1 && !load::traj::frame_cached(data->mold.traj, wanted[i])) {
+            ready = false;
+            break;
+        }
+    }
+    auto& scrub = data->animation.scrub;
+    bool changed = false;
+    for (int i = 0; i < 4; ++i) {
+        const int64_t frame = ready ? -1 : wanted[i];
+        changed |= scrub.wanted[i].exchange(frame) != frame;
+    }
+    if (changed) {
+        // Supersedes the request which is currently being served
+        scrub.generation++;
+    }
+    data->animation.scrub_pending = !ready;
+    if (!ready) {
+        request_scrub_fetch(data);
+    }
+    return ready;
+}
+
+// When not blocking, frames which are not cached are fetched asynchronously and the nearest cached frame is shown until they arrive
+static void interpolate_atomic_properties(ApplicationState* data, bool blocking) {
     ASSERT(data);
     auto& mol = data->mold.mol;
     const auto& traj = data->mold.traj;
@@ -2021,11 +2186,11 @@ static void interpolate_atomic_properties(ApplicationState* data) {
 
     // Scaling factor for cubic spline
     const float s = 1.0f - CLAMP(data->animation.tension, 0.0f, 1.0f);
-    const float t = (float)fractf(time);
+    float t = (float)fractf(time);
     const int64_t frame = (int64_t)time;
-    const int64_t nearest_frame = CLAMP((int64_t)(time + 0.5), 0LL, last_frame);
+    int64_t nearest_frame = CLAMP((int64_t)(time + 0.5), 0LL, last_frame);
 
-    const int64_t frames[4] = {
+    int64_t frames[4] = {
         MAX(0LL, frame - 1),
         MAX(0LL, frame),
         MIN(frame + 1, last_frame),
@@ -2053,7 +2218,16 @@ static void interpolate_atomic_properties(ApplicationState* data) {
     float* dst_y = mol.atom.y;
     float* dst_z = mol.atom.z;
 
-    const InterpolationMode mode = (frames[1] != frames[2]) ? data->animation.interpolation : InterpolationMode::Nearest;
+    InterpolationMode mode = (frames[1] != frames[2]) ? data->animation.interpolation : InterpolationMode::Nearest;
+    if (!blocking && !scrub_frames_ready(data, frames, nearest_frame, mode)) {
+        const int64_t cached_frame = load::traj::nearest_cached_frame(traj, nearest_frame);
+        if (cached_frame == -1) return;
+        frames[0] = frames[1] = frames[2] = frames[3] = cached_frame;
+        nearest_frame = cached_frame;
+        mode = InterpolationMode::Nearest;
+        t = 0.0f;
+    }
+
     switch (mode) {
         case InterpolationMode::Nearest:
         {
@@ -2367,6 +2541,40 @@ static void draw_main_menu(ApplicationState* data) {
                     save_workspace(data, {path_buf, strnlen(path_buf, sizeof(path_buf))});
                 }
             }
+            if (ImGui::BeginMenu("Export Trajectory", data->mold.traj != NULL)) {
+                ImGui::Checkbox("Selection Only", &data->trajectory_export.selection_only);
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Only export the selected atoms, opening the exported trajectory then requires a matching topology");
+                }
+                ImGui::SetNextItemWidth(ImGui::GetFontSize() * 6);
+                if (ImGui::InputInt("Stride", &data->trajectory_export.stride)) {
+                    data->trajectory_export.stride = MAX(1, data->trajectory_export.stride);
+                }
+                const bool exporting = task_system::task_is_running(data->tasks.export_trajectory);
+                if (ImGui::MenuItem("Export (vtraj)", NULL, false, !exporting)) {
+                    if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, STR_LIT("vtraj"))) {
+                        export_trajectory(data, str_from_cstr(path_buf));
+                    }
+                }
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Memory mapped trajectory format which opens instantly and loads frames without decoding them");
+                }
+                ImGui::EndMenu();
+            }
+            ImGui::Separator();
+            bool follow = data->files.follow_trajectory;
+            if (ImGui::MenuItem("Follow Trajectory", NULL, &follow, data->mold.traj != NULL)) {
+                if (follow) {
+                    follow = load::traj::follow_begin(data->mold.traj, str_from_cstr(data->files.trajectory));
+                    data->files.follow_last_poll = 0;
+                } else {
+                    load::traj::follow_end(data->mold.traj);
+                }
+                data->files.follow_trajectory = follow;
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Watch the trajectory file for frames written by a running simulation");
+            }
             ImGui::Separator();
             if (ImGui::MenuItem("Quit", "ALT+F4")) {
                 data->app.window.should_close = true;
@@ -2672,6 +2880,69 @@ static void draw_main_menu(ApplicationState* data) {
             ImGui::Checkbox("Keep Representations", &data->settings.keep_representations);
             ImGui::SetItemTooltip("Keep representations when loading new topology (Does not apply for workspaces)\n");
 
+            if (ImGui::BeginMenu("Frame Cache")) {
+                const int max_budget_mb = (int)(md_os_physical_ram() / MEGABYTES(1));
+                if (ImGui::Checkbox("Automatic Budget", &data->settings.frame_cache.auto_budget)) {
+                    load::traj::set_cache_budget(data->settings.frame_cache.auto_budget ? 0 : MEGABYTES((size_t)data->settings.frame_cache.budget_mb));
+                }
+                ImGui::SetItemTooltip("Let the frame cache follow the available system memory, it shrinks when other parts of the application (e.g. script evaluation) allocate heavily");
+
+                if (data->settings.frame_cache.auto_budget) {
+                    data->settings.frame_cache.budget_mb = (int)(load::traj::get_effective_cache_budget() / MEGABYTES(1));
+                    ImGui::PushDisabled();
+                }
+                ImGui::SliderInt("Budget (MB)", &data->settings.frame_cache.budget_mb, 64, max_budget_mb, "%d", ImGuiSliderFlags_Logarithmic);
+                // Only apply once the user is done editing, resizing the cache discards its content
+                if (ImGui::IsItemDeactivatedAfterEdit()) {
+                    load::traj::set_cache_budget(MEGABYTES((size_t)data->settings.frame_cache.budget_mb));
+                }
+                if (data->settings.frame_cache.auto_budget) {
+                    ImGui::PopDisabled();
+                }
+                ImGui::SetItemTooltip("Memory budget for decoded trajectory frames, can also be set with the command line flag --cache-size=<MB|auto>");
+
+                bool compression_changed = ImGui::Checkbox("Compress Frames", &data->settings.frame_cache.compress);
+                ImGui::SetItemTooltip("Frames which do not fit within the budget are kept quantized and compressed in memory (roughly 3x smaller)");
+                const float precisions[] = {0.001f, 0.01f, 0.1f};
+                const char* precision_labels[] = {"0.001 Å", "0.01 Å (xtc)", "0.1 Å"};
+                int precision_idx = 1;
+                for (int i = 0; i < (int)ARRAY_SIZE(precisions); ++i) {
+                    if (data->settings.frame_cache.precision == precisions[i]) precision_idx = i;
+                }
+                if (!data->settings.frame_cache.compress) ImGui::PushDisabled();
+                if (ImGui::Combo("Precision", &precision_idx, precision_labels, (int)ARRAY_SIZE(precision_labels))) {
+                    data->settings.frame_cache.precision = precisions[precision_idx];
+                    compression_changed = true;
+                }
+                if (!data->settings.frame_cache.compress) ImGui::PopDisabled();
+                if (compression_changed) {
+                    load::traj::set_cache_compression(data->settings.frame_cache.compress, data->settings.frame_cache.precision);
+                }
+                ImGui::EndMenu();
+            }
+
+            if (ImGui::BeginMenu("Frame Spill Cache")) {
+                bool changed = false;
+                changed |= ImGui::InputText("Scratch Folder", data->settings.frame_spill.dir, sizeof(data->settings.frame_spill.dir));
+                ImGui::SameLine();
+                if (ImGui::Button("...")) {
+                    char path_buf[1024] = "";
+                    if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Open | application::FileDialogFlag_Dir)) {
+                        str_copy_to_char_buf(data->settings.frame_spill.dir, sizeof(data->settings.frame_spill.dir), str_from_cstr(path_buf));
+                        changed = true;
+                    }
+                }
+                changed |= ImGui::InputInt("Size Limit (MB)", &data->settings.frame_spill.size_limit_mb, 1024, 8192);
+                data->settings.frame_spill.size_limit_mb = MAX(0, data->settings.frame_spill.size_limit_mb);
+                ImGui::SetItemTooltip("Decoded frames which do not fit in memory are spilled to a memory mapped file in the scratch folder.\n"
+                                      "Use a folder on a local fast disk. An empty folder disables spilling.\n"
+                                      "Applies to trajectories opened after the change.");
+                if (changed) {
+                    load::traj::set_spill_settings(str_from_cstr(data->settings.frame_spill.dir), MEGABYTES((size_t)data->settings.frame_spill.size_limit_mb));
+                }
+                ImGui::EndMenu();
+            }
+
             // Font
             ImFont* font_current = ImGui::GetFont();
             if (ImGui::BeginCombo("Font", font_current->GetDebugName()))
@@ -2899,6 +3170,15 @@ void draw_load_dataset_window(ApplicationState* data) {
         }
 
         md_trajectory_loader_i* traj_loader = load::traj::loader_from_ext(cur_ext);
+        if (state.path_is_valid && traj_loader) {
+            ImGui::InputDouble("Begin Time", &state.traj_beg_time);
+            ImGui::SetItemTooltip("Only load frames from this time and onward (in the time unit of the trajectory, ps for xtc and trr)");
+            ImGui::InputDouble("End Time", &state.traj_end_time);
+            ImGui::SetItemTooltip("Only load frames up to this time, if it is not greater than the begin time all remaining frames are loaded");
+            ImGui::InputInt("Stride", &state.traj_stride);
+            ImGui::SetItemTooltip("Only load every n:th frame");
+            state.traj_stride = MAX(1, state.traj_stride);
+        }
 
         enum Action {
             Action_None,
@@ -2926,6 +3206,9 @@ void draw_load_dataset_window(ApplicationState* data) {
             param.mol_loader = mol_loader;
             param.traj_loader = traj_loader;
             param.coarse_grained = state.coarse_grained;
+            param.traj_range.beg_time = state.traj_beg_time;
+            param.traj_range.end_time = state.traj_end_time;
+            param.traj_range.stride   = (uint32_t)state.traj_stride;
 
             md_lammps_molecule_loader_arg_t lammps_arg = {};
             if (mol_loader == md_lammps_molecule_api()) {
@@ -3002,17 +3285,29 @@ void apply_atom_elem_mappings(ApplicationState* data) {
     }
     md_molecule_t* mol = &data->mold.mol;
     
-    
-    md_array_free(mol->bond.pairs, data->mold.mol_alloc);
-    md_array_free(mol->bond.order, data->mold.mol_alloc);
-    md_array_free(mol->bond.flags, data->mold.mol_alloc);
+    // Bonds which are still being computed are based on the previous elements
+    data->tasks.compute_bonds = task_system::INVALID_ID;
+
+    if (data->mold.topology_alloc) {
+        // The topology was computed on the thread pool and is held by its own allocator
+        md_arena_allocator_destroy(data->mold.topology_alloc);
+        data->mold.topology_alloc = nullptr;
+        MEMSET(&mol->bond, 0, sizeof(mol->bond));
+        MEMSET(&mol->conn, 0, sizeof(mol->conn));
+        MEMSET(&mol->structures, 0, sizeof(mol->structures));
+        MEMSET(&mol->rings, 0, sizeof(mol->rings));
+    } else {
+        md_array_free(mol->bond.pairs, data->mold.mol_alloc);
+        md_array_free(mol->bond.order, data->mold.mol_alloc);
+        md_array_free(mol->bond.flags, data->mold.mol_alloc);
 
-    md_array_free(mol->conn.index, data->mold.mol_alloc);
-    md_array_free(mol->conn.order, data->mold.mol_alloc);
-    md_array_free(mol->conn.flags, data->mold.mol_alloc);
+        md_array_free(mol->conn.index, data->mold.mol_alloc);
+        md_array_free(mol->conn.order, data->mold.mol_alloc);
+        md_array_free(mol->conn.flags, data->mold.mol_alloc);
 
-    md_index_data_free(&mol->structures, data->mold.mol_alloc);
-    md_index_data_free(&mol->rings, data->mold.mol_alloc);
+        md_index_data_free(&mol->structures, data->mold.mol_alloc);
+        md_index_data_free(&mol->rings, data->mold.mol_alloc);
+    }
     
     md_util_molecule_postprocess(mol, data->mold.mol_alloc, MD_UTIL_POSTPROCESS_BOND_BIT | MD_UTIL_POSTPROCESS_CONNECTIVITY_BIT | MD_UTIL_POSTPROCESS_STRUCTURE_BIT);
     data->mold.dirty_buffers |= MolBit_DirtyBonds;
@@ -3616,7 +3911,6 @@ void draw_context_popup(ApplicationState* data) {
 
                     if (apply) {
                         load::traj::set_recenter_target(data->mold.traj, &mask);
-                        load::traj::clear_cache(data->mold.traj);
                         interpolate_atomic_properties(data);
                         data->mold.dirty_buffers |= MolBit_DirtyPosition;
                         update_md_buffers(data);
@@ -3829,6 +4123,11 @@ static void draw_animation_window(ApplicationState* data) {
             data->animation.mode = PlaybackMode::Stopped;
             data->animation.frame = 0.0;
         }
+        ImGui::SameLine();
+        ImGui::Checkbox("Loop", &data->animation.loop);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Wrap around at the ends of the trajectory");
+        }
         ImGui::PopItemWidth();
     }
     ImGui::End();
@@ -4270,8 +4569,25 @@ static void draw_async_task_window(ApplicationState* data) {
 
             if (!label || label[0] == '\0' || (label[0] == '#' && label[1] == '#')) continue;
 
-            snprintf(buf, sizeof(buf), "%.*s %.1f%%", (int)label.len, label.ptr, fract * 100.f);
-            ImGui::ProgressBar(fract, ImVec2(ImGui::GetContentRegionAvail().x - (size + pad),0), buf);
+            const ImVec2 bar_size = ImVec2(ImGui::GetContentRegionAvail().x - (size + pad), 0);
+            const load::traj::PrepareProgress* open_progress = (id == data->tasks.open_trajectory) ? data->files.open_trajectory_progress : NULL;
+            const bool compute_bonds = (id == data->tasks.compute_bonds);
+            if ((open_progress && open_progress->total == 0) || compute_bonds) {
+                // The loader indexes the file on its own and md_util does not report how far it has come, so just show that it is alive
+                const md_timestamp_t start = compute_bonds ? data->mold.compute_bonds_start : data->files.open_trajectory_start;
+                const double elapsed = md_time_as_seconds(md_time_current() - start);
+                snprintf(buf, sizeof(buf), "%.*s %.1fs", (int)label.len, label.ptr, elapsed);
+                ImGui::IndeterminateProgressBar(bar_size, buf);
+            } else {
+                if (open_progress) {
+                    const uint32_t total = open_progress->total;
+                    fract = total > 0 ? (float)MIN(open_progress->completed.load(), total) / (float)total : 0.0f;
+                }
+                snprintf(buf, sizeof(buf), "%.*s %.1f%%", (int)label.len, label.ptr, fract * 100.f);
+                ImGui::ProgressBar(fract, bar_size, buf);
+            }
+            // The bonds cannot be computed in any other way once the job is running, so it is not cancellable
+            if (compute_bonds) continue;
             ImGui::SameLine();
             if (ImGui::DeleteButton((const char*)ICON_FA_XMARK, ImVec2(size, size))) {
                 task_system::task_interrupt(id);
@@ -4281,6 +4597,9 @@ static void draw_async_task_window(ApplicationState* data) {
                 else if(id == data->tasks.evaluate_filt) {
                     md_script_eval_interrupt(data->script.filt_eval);
                 }
+                else if (id == data->tasks.open_trajectory) {
+                    cancel_open_trajectory(data);
+                }
             }
         }
 
@@ -6391,6 +6710,92 @@ static void draw_debug_window(ApplicationState* data) {
             }
         }
 
+        load::traj::CacheStats cache_stats;
+        if (data->mold.traj && load::traj::get_cache_stats(data->mold.traj, &cache_stats)) {
+            const size_t total = cache_stats.mem_hits + cache_stats.packed_hits + cache_stats.disk_hits + cache_stats.misses + cache_stats.direct_loads;
+            const double scl = total ? 100.0 / (double)total : 0.0;
+            const double ratio = cache_stats.packed_bytes ? (double)(cache_stats.packed_frames * cache_stats.frame_bytes) / (double)cache_stats.packed_bytes : 0.0;
+            ImGui::Text("Frame Cache:");
+            ImGui::Text("  Memory: %9zu frames, %12zu hits (%.1f%%)", cache_stats.mem_frames, cache_stats.mem_hits, cache_stats.mem_hits * scl);
+            ImGui::Text("  Packed: %9zu frames, %12zu hits (%.1f%%), %.1f MB, ratio %.2f", cache_stats.packed_frames, cache_stats.packed_hits, cache_stats.packed_hits * scl, (double)cache_stats.packed_bytes / MEGABYTES(1), ratio);
+            ImGui::Text("  Disk:   %9zu frames, %12zu hits (%.1f%%)", cache_stats.disk_frames, cache_stats.disk_hits, cache_stats.disk_hits * scl);
+            ImGui::Text("  Miss:                    %12zu      (%.1f%%)", cache_stats.misses, cache_stats.misses * scl);
+            if (cache_stats.direct_loads > 0) {
+                ImGui::Text("  Direct:                  %12zu      (%.1f%%) memory mapped", cache_stats.direct_loads, cache_stats.direct_loads * scl);
+            }
+            if (cache_stats.fetched > 0) {
+                ImGui::Text("  Read:   %9zu frames, %.2f ms per frame", cache_stats.fetched, cache_stats.fetch_time * 1000.0 / (double)cache_stats.fetched);
+            }
+            if (cache_stats.decoded > 0) {
+                ImGui::Text("  Decode: %9zu frames, %.2f ms per frame", cache_stats.decoded, cache_stats.decode_time * 1000.0 / (double)cache_stats.decoded);
+            }
+            ImGui::Text("  Evictions: %zu, Read: %.1f MB", cache_stats.evictions, (double)cache_stats.bytes_read / MEGABYTES(1));
+            if (cache_stats.loads > 0) {
+                ImGui::Text("  Load:   %9zu calls,  %.3f ms per call, recenter %.3f ms per call", cache_stats.loads,
+                    cache_stats.load_time * 1000.0 / (double)cache_stats.loads, cache_stats.recenter_time * 1000.0 / (double)cache_stats.loads);
+            }
+            float load_hist[CACHE_HISTOGRAM_NUM_BUCKETS];
+            float decode_hist[CACHE_HISTOGRAM_NUM_BUCKETS];
+            for (int i = 0; i < CACHE_HISTOGRAM_NUM_BUCKETS; ++i) {
+                load_hist[i]   = (float)cache_stats.load_histogram[i];
+                decode_hist[i] = (float)cache_stats.decode_histogram[i];
+            }
+            ImGui::PlotHistogram("Load latency (log2 us)", load_hist, CACHE_HISTOGRAM_NUM_BUCKETS, 0, NULL, 0.0f, FLT_MAX, ImVec2(0, 40));
+            ImGui::PlotHistogram("Decode latency (log2 us)", decode_hist, CACHE_HISTOGRAM_NUM_BUCKETS, 0, NULL, 0.0f, FLT_MAX, ImVec2(0, 40));
+            if (ImGui::Button("Dump Cache Stats")) {
+                char path_buf[2048] = "";
+                if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, STR_LIT("txt"))) {
+                    export_cache_stats(cache_stats, str_from_cstr(path_buf));
+                }
+            }
+        }
+
+        ImGui::Text("Profiler:");
+        bool recording = profiler::is_recording();
+        if (ImGui::Checkbox("Record", &recording)) {
+            profiler::set_recording(recording);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Clear")) {
+            profiler::clear();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Export Chrome Trace")) {
+            char path_buf[2048] = "";
+            if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, STR_LIT("json"))) {
+                profiler::export_chrome_trace(str_from_cstr(path_buf));
+            }
+        }
+
+        bool gpu_timers = gpu_profiler::is_enabled();
+        if (ImGui::Checkbox("GPU Timers", &gpu_timers)) {
+            gpu_profiler::set_enabled(gpu_timers);
+        }
+        ImGui::SetItemTooltip("Time the GPU passes, the timings are also part of the exported trace while recording");
+
+        gpu_profiler::FrameStats gpu_stats;
+        if (gpu_profiler::get_frame_stats(&gpu_stats)) {
+            ImGui::Text("GPU Frame: %.3f ms", gpu_stats.total_ms);
+            ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit;
+            if (ImGui::BeginTable("##gpu_sections", 3, flags)) {
+                ImGui::TableSetupColumn("Pass", ImGuiTableColumnFlags_WidthStretch);
+                ImGui::TableSetupColumn("Last (ms)");
+                ImGui::TableSetupColumn("Avg (ms)");
+                ImGui::TableHeadersRow();
+                for (uint32_t i = 0; i < gpu_stats.num_sections; ++i) {
+                    const gpu_profiler::SectionStats& sec = gpu_stats.sections[i];
+                    ImGui::TableNextRow();
+                    ImGui::TableSetColumnIndex(0);
+                    ImGui::Text("%*s%s", (int)sec.depth * 2, "", sec.label);
+                    ImGui::TableSetColumnIndex(1);
+                    ImGui::Text("%.3f", sec.time_ms);
+                    ImGui::TableSetColumnIndex(2);
+                    ImGui::Text("%.3f", sec.avg_ms);
+                }
+                ImGui::EndTable();
+            }
+        }
+
         ImGuiID active = ImGui::GetActiveID();
         ImGuiID hover  = ImGui::GetHoveredID();
         ImGui::Text("Active ID: %u, Hover ID: %u", active, hover);
@@ -6560,6 +6965,45 @@ static void draw_script_editor_window(ApplicationState* data) {
     ImGui::End();
 }
 
+// Plain text key value pairs, one per line, followed by the latency histograms
+static bool export_cache_stats(const load::traj::CacheStats& stats, str_t filename) {
+    md_file_o* file = md_file_open(filename, MD_FILE_WRITE);
+    if (!file) {
+        LOG_ERROR("Failed to open file '" STR_FMT "' to write data.", STR_ARG(filename));
+        return false;
+    }
+
+    md_file_printf(file, "# VIAMD frame cache statistics\n");
+    md_file_printf(file, "mem_frames %zu\n",    stats.mem_frames);
+    md_file_printf(file, "packed_frames %zu\n", stats.packed_frames);
+    md_file_printf(file, "packed_bytes %zu\n",  stats.packed_bytes);
+    md_file_printf(file, "disk_frames %zu\n",   stats.disk_frames);
+    md_file_printf(file, "frame_bytes %zu\n",   stats.frame_bytes);
+    md_file_printf(file, "mem_hits %zu\n",      stats.mem_hits);
+    md_file_printf(file, "packed_hits %zu\n",   stats.packed_hits);
+    md_file_printf(file, "disk_hits %zu\n",     stats.disk_hits);
+    md_file_printf(file, "misses %zu\n",        stats.misses);
+    md_file_printf(file, "direct_loads %zu\n",  stats.direct_loads);
+    md_file_printf(file, "evictions %zu\n",     stats.evictions);
+    md_file_printf(file, "bytes_read %zu\n",    stats.bytes_read);
+    md_file_printf(file, "fetched %zu\n",       stats.fetched);
+    md_file_printf(file, "fetch_time_s %.6f\n",   stats.fetch_time);
+    md_file_printf(file, "decoded %zu\n",       stats.decoded);
+    md_file_printf(file, "decode_time_s %.6f\n",   stats.decode_time);
+    md_file_printf(file, "loads %zu\n",         stats.loads);
+    md_file_printf(file, "load_time_s %.6f\n",     stats.load_time);
+    md_file_printf(file, "recenter_time_s %.6f\n", stats.recenter_time);
+
+    md_file_printf(file, "# bucket upper_bound_us load_count decode_count\n");
+    for (int i = 0; i < CACHE_HISTOGRAM_NUM_BUCKETS; ++i) {
+        md_file_printf(file, "%2i %10.0f %12zu %12zu\n", i, pow(2.0, i), stats.load_histogram[i], stats.decode_histogram[i]);
+    }
+
+    md_file_close(file);
+    LOG_SUCCESS("Successfully exported cache stats to '%.*s'", (int)filename.len, filename.ptr);
+    return true;
+}
+
 static bool export_xvg(const float* column_data[], const char* column_labels[], size_t num_columns, size_t num_rows, str_t filename) {
     ASSERT(column_data);
     ASSERT(column_labels);
@@ -6638,6 +7082,60 @@ static bool export_csv(const float* column_data[], const char* column_labels[],
     return true;
 }
 
+struct ExportTrajectoryTask {
+    NativeExport* exp;
+    char path[1024];
+};
+
+// Frames are loaded and written in parallel by a pool task, the file is finalized once every frame has been written
+static void export_trajectory(ApplicationState* data, str_t filename) {
+    ASSERT(data);
+    if (!data->mold.traj) return;
+
+    char path[1024];
+    str_t ext;
+    if (extract_ext(&ext, filename) && str_eq_cstr_ignore_case(ext, "vtraj")) {
+        snprintf(path, sizeof(path), "%.*s", (int)filename.len, filename.ptr);
+    } else {
+        snprintf(path, sizeof(path), "%.*s.vtraj", (int)filename.len, filename.ptr);
+    }
+
+    const md_bitfield_t* mask = NULL;
+    if (data->trajectory_export.selection_only) {
+        if (md_bitfield_popcount(&data->selection.selection_mask) == 0) {
+            LOG_ERROR("Export Trajectory: The selection is empty");
+            return;
+        }
+        mask = &data->selection.selection_mask;
+    }
+
+    NativeExport* exp = load::traj::export_native_begin(data->mold.traj, str_from_cstr(path), mask, (uint32_t)data->trajectory_export.stride);
+    if (!exp) {
+        LOG_ERROR("Export Trajectory: Failed to create '%s'", path);
+        return;
+    }
+
+    ExportTrajectoryTask* task = (ExportTrajectoryTask*)md_alloc(persistent_alloc, sizeof(ExportTrajectoryTask));
+    task->exp = exp;
+    snprintf(task->path, sizeof(task->path), "%s", path);
+
+    const uint32_t num_frames = (uint32_t)load::traj::export_native_num_frames(exp);
+    data->tasks.export_trajectory = task_system::pool_enqueue(STR_LIT("Export Trajectory"), 0, num_frames, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        NativeExport* exp = (NativeExport*)user_data;
+        load::traj::export_native_write(exp, range_beg, range_end);
+    }, exp);
+
+    task_system::main_enqueue(STR_LIT("##Export Trajectory Complete"), [](void* user_data) {
+        ExportTrajectoryTask* task = (ExportTrajectoryTask*)user_data;
+        if (load::traj::export_native_end(task->exp)) {
+            LOG_SUCCESS("Successfully exported trajectory to '%s'", task->path);
+        } else {
+            LOG_ERROR("Export Trajectory: Not every frame of '%s' was written, the file was removed", task->path);
+        }
+        md_free(persistent_alloc, task, sizeof(ExportTrajectoryTask));
+    }, task, data->tasks.export_trajectory);
+}
+
 static bool export_cube(const ApplicationState& data, const md_script_property_data_t* prop_data, const md_script_vis_payload_o* vis_payload, str_t filename) {
     // @NOTE: First we need to extract some meta data for the cube format, we need the atom indices/bits for any SDF
     // And the origin + extent of the volume in spatial coordinates (Ångström)
@@ -7086,15 +7584,41 @@ static void interrupt_async_tasks(ApplicationState* data) {
 }
 
 // #trajectorydata
+static void close_backbone_view(ApplicationState* data) {
+    auto& view = data->trajectory_data.backbone_view;
+    if (view.traj) {
+        load::traj::close(view.traj);
+        view.traj = nullptr;
+    }
+    if (view.alloc) {
+        md_arena_allocator_destroy(view.alloc);
+        view.alloc = nullptr;
+    }
+    view.mol = {};
+    view.num_frames = 0;
+}
+
 static void free_trajectory_data(ApplicationState* data) {
     ASSERT(data);
     interrupt_async_tasks(data);
 
+    // The view reads from the trajectory and has to be closed first
+    close_backbone_view(data);
     if (data->mold.traj) {
         load::traj::close(data->mold.traj);
         data->mold.traj = nullptr;
     }
+    data->animation.prefetch = {};
     data->files.trajectory[0] = '\0';
+    data->files.traj_beg_time = 0;
+    data->files.traj_end_time = 0;
+    data->files.traj_stride   = 1;
+    data->files.follow_trajectory = false;
+    data->animation.scrub_pending = false;
+    for (int i = 0; i < 4; ++i) {
+        data->animation.scrub.wanted[i] = -1;
+    }
+    data->animation.scrub.generation++;
     
     data->mold.mol.unit_cell = {};
     md_array_free(data->timeline.x_values,  persistent_alloc);
@@ -7104,6 +7628,77 @@ static void free_trajectory_data(ApplicationState* data) {
     md_array_free(data->trajectory_data.secondary_structure.data, persistent_alloc);
 }
 
+// Opens a view of the residues which form the backbone, the view is only kept if it is smaller than the full system and yields the same backbone
+static void open_backbone_view(ApplicationState* data) {
+    const md_molecule_t& mol = data->mold.mol;
+    if (!data->mold.traj || mol.backbone.count == 0 || !mol.backbone.residue_idx) return;
+
+    md_bitfield_t mask = {};
+    md_bitfield_init(&mask, frame_alloc);
+    for (size_t i = 0; i < mol.backbone.count; ++i) {
+        const md_range_t range = md_residue_atom_range(mol.residue, mol.backbone.residue_idx[i]);
+        md_bitfield_set_range(&mask, range.beg, range.end);
+    }
+    if (md_bitfield_popcount(&mask) == mol.atom.count) return;
+
+    auto& view = data->trajectory_data.backbone_view;
+    view.alloc = md_arena_allocator_create(persistent_alloc, MEGABYTES(1));
+    view.traj  = load::traj::open_view(data->mold.traj, &mask, &view.mol, view.alloc, persistent_alloc);
+    if (!view.traj || view.mol.backbone.count != mol.backbone.count) {
+        LOG_DEBUG("Backbone view does not match the backbone of the molecule, computing from the full trajectory");
+        close_backbone_view(data);
+        return;
+    }
+    view.num_frames = md_trajectory_num_frames(view.traj);
+}
+
+// Computes the backbone angles and secondary structure of the frames [frame_beg, frame_end)
+static void launch_backbone_computations(ApplicationState* data, uint32_t frame_beg, uint32_t frame_end) {
+    if (!data->trajectory_data.backbone_view.traj) {
+        open_backbone_view(data);
+    }
+    // Frames appended in follow mode are not part of the view
+    const auto& view = data->trajectory_data.backbone_view;
+    md_trajectory_i* traj = view.traj && frame_end <= view.num_frames ? view.traj : data->mold.traj;
+
+    data->tasks.backbone_computations = pool_enqueue_frame_range(STR_LIT("Backbone Operations"), traj, frame_beg, frame_end, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+        ApplicationState* data = (ApplicationState*)user_data;
+        const auto& view = data->trajectory_data.backbone_view;
+        const bool use_view = view.traj && range_end <= view.num_frames;
+        md_trajectory_i* traj = use_view ? view.traj : data->mold.traj;
+
+        // Create copy here of molecule since we use the full structure as input
+        md_molecule_t mol = use_view ? view.mol : data->mold.mol;
+
+        const size_t stride = ALIGN_TO(mol.atom.count, 8);
+        const size_t bytes = stride * sizeof(float) * 3;
+        float* coords = (float*)md_alloc(md_get_heap_allocator(), bytes);
+        defer { md_free(md_get_heap_allocator(), coords, bytes); };
+        // Overwrite the coordinate section, since we will load trajectory frame data into these
+        mol.atom.x = coords + stride * 0;
+        mol.atom.y = coords + stride * 1;
+        mol.atom.z = coords + stride * 2;
+
+        for (uint32_t frame_idx = range_beg; frame_idx < range_end; ++frame_idx) {
+            md_trajectory_load_frame(traj, frame_idx, NULL, mol.atom.x, mol.atom.y, mol.atom.z);
+            md_util_backbone_angles_compute(data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frame_idx, data->trajectory_data.backbone_angles.stride, &mol);
+            md_util_backbone_secondary_structure_compute(data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frame_idx, data->trajectory_data.secondary_structure.stride, &mol);
+        }
+    }, data);
+
+    task_system::main_enqueue(STR_LIT("Update Trajectory Data"), [](void* user_data) {
+        ApplicationState* data = (ApplicationState*)user_data;
+        data->trajectory_data.backbone_angles.fingerprint = generate_fingerprint();
+        data->trajectory_data.secondary_structure.fingerprint = generate_fingerprint();
+        
+        interpolate_atomic_properties(data);
+        update_md_buffers(data);
+        md_gl_molecule_zero_velocity(&data->mold.gl_mol); // Do this explicitly to update the previous position to avoid motion blur trails
+        update_all_representations(data);
+
+    }, data, data->tasks.backbone_computations);
+}
+
 static void init_trajectory_data(ApplicationState* data) {
     size_t num_frames = md_trajectory_num_frames(data->mold.traj);
     if (num_frames > 0) {
@@ -7147,40 +7742,7 @@ static void init_trajectory_data(ApplicationState* data) {
 
             // Launch work to compute the values
             task_system::task_interrupt_and_wait_for(data->tasks.backbone_computations);
-
-            data->tasks.backbone_computations = task_system::pool_enqueue(STR_LIT("Backbone Operations"), 0, (uint32_t)num_frames, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
-                ApplicationState* data = (ApplicationState*)user_data;
-                
-                // Create copy here of molecule since we use the full structure as input
-                md_molecule_t mol = data->mold.mol;
-
-                const size_t stride = ALIGN_TO(mol.atom.count, 8);
-                const size_t bytes = stride * sizeof(float) * 3;
-                float* coords = (float*)md_alloc(md_get_heap_allocator(), bytes);
-                defer { md_free(md_get_heap_allocator(), coords, bytes); };
-                // Overwrite the coordinate section, since we will load trajectory frame data into these
-                mol.atom.x = coords + stride * 0;
-                mol.atom.y = coords + stride * 1;
-                mol.atom.z = coords + stride * 2;
-
-                for (uint32_t frame_idx = range_beg; frame_idx < range_end; ++frame_idx) {
-                    md_trajectory_load_frame(data->mold.traj, frame_idx, NULL, mol.atom.x, mol.atom.y, mol.atom.z);
-                    md_util_backbone_angles_compute(data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frame_idx, data->trajectory_data.backbone_angles.stride, &mol);
-                    md_util_backbone_secondary_structure_compute(data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frame_idx, data->trajectory_data.secondary_structure.stride, &mol);
-                }
-            }, data);
-
-            task_system::main_enqueue(STR_LIT("Update Trajectory Data"), [](void* user_data) {
-                ApplicationState* data = (ApplicationState*)user_data;
-                data->trajectory_data.backbone_angles.fingerprint = generate_fingerprint();
-                data->trajectory_data.secondary_structure.fingerprint = generate_fingerprint();
-                
-                interpolate_atomic_properties(data);
-                update_md_buffers(data);
-                md_gl_molecule_zero_velocity(&data->mold.gl_mol); // Do this explicitly to update the previous position to avoid motion blur trails
-                update_all_representations(data);
-
-            }, data, data->tasks.backbone_computations);
+            launch_backbone_computations(data, 0, (uint32_t)num_frames);
         }
 
         data->mold.dirty_buffers |= MolBit_DirtyPosition;
@@ -7192,29 +7754,320 @@ static void init_trajectory_data(ApplicationState* data) {
     }
 }
 
-static bool load_trajectory_data(ApplicationState* data, str_t filename, md_trajectory_loader_i* loader, LoadTrajectoryFlags flags) {
-    md_trajectory_i* traj = load::traj::open_file(filename, loader, &data->mold.mol, persistent_alloc, flags);
-    if (traj) {
+struct PrefetchTask {
+    md_trajectory_i* traj;
+    uint32_t first;         // Frame of the first step
+    uint32_t num_frames;    // Steps wrap around at this frame count when looping
+    bool reverse;
+    bool loop;
+};
+
+static inline uint32_t prefetch_step(uint32_t frame, uint32_t steps, uint32_t num_frames, bool reverse, bool loop) {
+    if (loop) {
+        steps %= num_frames;
+        return reverse ? (frame + num_frames - steps) % num_frames : (frame + steps) % num_frames;
+    }
+    return reverse ? frame - steps : frame + steps;
+}
+
+// Keeps PREFETCH_LOOKAHEAD_IN_SECONDS of playback decoded ahead of the playhead
+// The window is re-targeted every frame: it is extended from its frontier as soon as the playhead moves, without waiting for earlier ranges to finish.
+// Ranges which fall behind the playhead are cancelled, and a seek or change of direction cancels the whole window.
+static void update_prefetch(ApplicationState* data) {
+    ASSERT(data);
+    md_trajectory_i* traj = data->mold.traj;
+    if (!traj) return;
+
+    const bool playing = data->animation.mode == PlaybackMode::Playing;
+    load::traj::set_playhead(traj, data->animation.frame, playing ? data->animation.fps : 0.0);
+    if (!playing) return;
+
+    const uint32_t num_frames = (uint32_t)md_trajectory_num_frames(traj);
+    load::traj::CacheStats stats;
+    if (num_frames == 0 || !load::traj::get_cache_stats(traj, &stats)) return;
+
+    const double fps = fabs(data->animation.fps);
+    double lookahead = fps * PREFETCH_LOOKAHEAD_IN_SECONDS;
+    if (stats.decoded > 0 && stats.decode_time > 0.0) {
+        // If decoding cannot keep up with playback the buffer drains, a deeper buffer postpones the stall
+        const double throughput = (double)stats.decoded / stats.decode_time * (double)task_system::pool_num_threads();
+        if (throughput < fps) {
+            lookahead *= fps / throughput;
+        }
+    }
+    // Prefetched frames which are evicted from memory are still served by the spill tier
+    // Leave room in memory for the frames around the playhead which are used for interpolation
+    const size_t capacity = MAX(stats.mem_frames > 8 ? stats.mem_frames - 4 : stats.mem_frames / 2, stats.disk_frames);
+    const uint32_t count = (uint32_t)CLAMP(lookahead, 1.0, (double)MAX(capacity, 1));
+
+    auto& prefetch = data->animation.prefetch;
+    const uint32_t playhead = MIN((uint32_t)data->animation.frame, num_frames - 1);
+    const bool reverse = data->animation.fps < 0;
+    const bool loop = data->animation.loop;
+
+    // Steps from the anchor to the playhead, UINT32_MAX if the playhead is behind the anchor
+    uint32_t dist = UINT32_MAX;
+    if (reverse == prefetch.reverse && loop == prefetch.loop && (!loop || num_frames == prefetch.num_frames)) {
+        if (!reverse && playhead >= prefetch.anchor) {
+            dist = playhead - prefetch.anchor;
+        } else if (reverse && playhead <= prefetch.anchor) {
+            dist = prefetch.anchor - playhead;
+        } else if (loop) {
+            dist = reverse ? prefetch.anchor + num_frames - playhead : playhead + num_frames - prefetch.anchor;
+        }
+    }
+
+    if (dist > prefetch.ahead) {
+        // Seek, change of direction or the playhead overtook the frontier: nothing requested so far is ahead of it
+        for (auto& task : prefetch.tasks) {
+            task_system::task_interrupt(task.id);
+            task = {};
+        }
+        prefetch.ahead = 0;
+        dist = 0;
+    }
+
+    // Move the anchor to the playhead and cancel the ranges which are now entirely behind it
+    prefetch.anchor = playhead;
+    prefetch.ahead -= dist;
+    prefetch.num_frames = num_frames;
+    prefetch.reverse = reverse;
+    prefetch.loop = loop;
+    for (auto& task : prefetch.tasks) {
+        if (task.id == task_system::INVALID_ID) continue;
+        if (!task_system::task_is_running(task.id)) {
+            task = {};
+        } else if (task.end <= dist) {
+            task_system::task_interrupt(task.id);
+            task = {};
+        } else {
+            task.end -= dist;
+        }
+    }
+
+    // When looping the window continues across the wrap point, otherwise it ends at the first or last frame
+    const uint32_t max_steps = loop ? num_frames : (reverse ? playhead + 1 : num_frames - playhead);
+    const uint32_t target = MIN(count + 1, max_steps);
+    if (target <= prefetch.ahead) return;
+
+    // Extend in batches rather than by the one or two frames the playhead moves per rendered frame
+    const uint32_t batch = MAX(count / 4, 1);
+    if (prefetch.ahead > 0 && target - prefetch.ahead < batch && target < max_steps) return;
+
+    int slot = -1;
+    for (int i = 0; i < (int)ARRAY_SIZE(prefetch.tasks); ++i) {
+        if (prefetch.tasks[i].id == task_system::INVALID_ID) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == -1) return;
+
+    // The range is copied into the payload, the window is free to move on while the task is running
+    PrefetchTask* payload = (PrefetchTask*)md_alloc(md_get_heap_allocator(), sizeof(PrefetchTask));
+    payload->traj = traj;
+    payload->first = prefetch_step(playhead, prefetch.ahead, num_frames, reverse, loop);
+    payload->num_frames = num_frames;
+    payload->reverse = reverse;
+    payload->loop = loop;
+
+    // Called every frame during playback, if the pool is saturated the range is retried on a later frame
+    const task_system::ID id = task_system::pool_try_enqueue(STR_LIT("##Prefetch Frames"), 0, target - prefetch.ahead, [](uint32_t range_beg, uint32_t range_end, void* user_data, task_system::Token* token) {
+        const PrefetchTask* task = (const PrefetchTask*)user_data;
+        // Frames closest to the playhead first
+        for (uint32_t i = range_beg; i < range_end && !task_system::token_cancelled(token); ++i) {
+            const uint32_t frame = prefetch_step(task->first, i, task->num_frames, task->reverse, task->loop);
+            md_trajectory_load_frame(task->traj, frame, 0, 0, 0, 0);
+        }
+    }, payload);
+    if (id == task_system::INVALID_ID) {
+        md_free(md_get_heap_allocator(), payload, sizeof(PrefetchTask));
+        return;
+    }
+
+    task_system::pool_enqueue(STR_LIT("##End Prefetch"), [](void* user_data) {
+        md_free(md_get_heap_allocator(), user_data, sizeof(PrefetchTask));
+    }, payload, id);
+
+    prefetch.tasks[slot].id = id;
+    prefetch.tasks[slot].end = target;
+    prefetch.ahead = target;
+}
+
+// Adds the frames which have been appended to a followed trajectory since the last poll
+// The frames of a trajectory which is still being indexed are appended in the same way
+static void update_follow_trajectory(ApplicationState* data) {
+    ASSERT(data);
+    if (!data->mold.traj) return;
+    const bool indexing = load::traj::is_indexing(data->mold.traj);
+    if (!data->files.follow_trajectory && !indexing) return;
+
+    const md_timestamp_t now = md_time_current();
+    const double interval = indexing ? INDEX_POLL_INTERVAL_IN_SECONDS : FOLLOW_POLL_INTERVAL_IN_SECONDS;
+    if (md_time_as_seconds(now - data->files.follow_last_poll) < interval) return;
+    // The per frame backbone data is reallocated when frames are added
+    if (task_system::task_is_running(data->tasks.backbone_computations)) return;
+    data->files.follow_last_poll = now;
+
+    const size_t old_num_frames = md_array_size(data->timeline.x_values);
+    if (load::traj::follow_update(data->mold.traj) == 0) return;
+
+    const size_t num_frames = md_trajectory_num_frames(data->mold.traj);
+    md_trajectory_header_t header;
+    md_trajectory_get_header(data->mold.traj, &header);
+
+    // Keep following the end of the trajectory if the view or the filter is at the end
+    const bool view_at_end   = old_num_frames > 0 && data->timeline.view_range.end_x >= data->timeline.x_values[old_num_frames - 1];
+    const bool filter_at_end = old_num_frames > 0 && data->timeline.filter.end_frame >= (double)(old_num_frames - 1);
+
+    md_array_resize(data->timeline.x_values, num_frames, persistent_alloc);
+    for (size_t i = old_num_frames; i < num_frames; ++i) {
+        data->timeline.x_values[i] = (float)header.frame_times[i];
+    }
+    if (view_at_end) {
+        data->timeline.view_range.end_x = header.frame_times[num_frames - 1];
+    }
+    if (filter_at_end) {
+        data->timeline.filter.end_frame = (double)(num_frames - 1);
+        data->script.evaluate_filt = true;
+    }
+
+    if (data->mold.mol.backbone.count > 0) {
+        const size_t count = data->mold.mol.backbone.count * num_frames;
+        md_array_resize(data->trajectory_data.secondary_structure.data, count, persistent_alloc);
+        for (size_t i = data->trajectory_data.secondary_structure.count; i < count; ++i) {
+            data->trajectory_data.secondary_structure.data[i] = MD_SECONDARY_STRUCTURE_COIL;
+        }
+        md_array_resize(data->trajectory_data.backbone_angles.data, count, persistent_alloc);
+        MEMSET(data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.count, 0, (count - data->trajectory_data.backbone_angles.count) * sizeof(md_backbone_angles_t));
+        data->trajectory_data.secondary_structure.count = count;
+        data->trajectory_data.backbone_angles.count = count;
+
+        launch_backbone_computations(data, (uint32_t)old_num_frames, (uint32_t)num_frames);
+    }
+
+    LOG_DEBUG("Appended %i frames to the followed trajectory", (int)(num_frames - old_num_frames));
+}
+
+struct OpenTrajectoryTask {
+    ApplicationState* data;
+    task_system::ID id;
+    char path[1024];
+    md_trajectory_loader_i* loader;
+    LoadTrajectoryFlags flags;
+    load::traj::FrameRange range;
+    bool optional;  // Do not report failure (e.g. a pdb file which may or may not contain a trajectory)
+    load::traj::PrepareProgress progress;
+};
+
+// Stops the trajectory which is being opened, a trajectory which is being indexed keeps the frames which have been indexed so far
+static void cancel_open_trajectory(ApplicationState* data) {
+    if (data->files.open_trajectory_progress) {
+        data->files.open_trajectory_progress->cancel = true;
+    }
+    data->tasks.open_trajectory = task_system::INVALID_ID;
+    data->files.open_trajectory_progress = NULL;
+}
+
+// Opens the trajectory asynchronously, the loader indexes the file within a pool task and the trajectory replaces the current one once done.
+// Until then, the current trajectory (if any) remains in use. Large text trajectories replace it once the beginning of the file has been indexed,
+// the rest of the file is then indexed in the background and its frames are appended as they are indexed (update_follow_trajectory).
+static bool load_trajectory_data(ApplicationState* data, str_t filename, md_trajectory_loader_i* loader, LoadTrajectoryFlags flags, const load::traj::FrameRange& range, bool optional) {
+    cancel_open_trajectory(data);
+    // Frames can only be appended to a range which extends to the end of the file
+    if (range.beg_time <= 0 && range.end_time <= range.beg_time) {
+        flags |= LoadTrajectoryFlag_Progressive;
+    }
+
+    md_allocator_i* alloc = md_get_heap_allocator();
+    OpenTrajectoryTask* task = new (md_alloc(alloc, sizeof(OpenTrajectoryTask))) OpenTrajectoryTask();
+    task->data = data;
+    str_copy_to_char_buf(task->path, sizeof(task->path), filename);
+    task->loader = loader;
+    task->flags = flags;
+    task->range = range;
+    task->optional = optional;
+
+    // The prepared trajectory is handed from the pool task to the main thread, where it replaces the current trajectory
+    task_system::ID id = task_system::pool_enqueue_with_result<load::traj::PreparedTrajectory*>(STR_LIT("Opening Trajectory"), [](load::traj::PreparedTrajectory** prepared, void* user_data) {
+        OpenTrajectoryTask* task = (OpenTrajectoryTask*)user_data;
+        // The heap allocator is used since this is not executed on the main thread
+        *prepared = load::traj::prepare_file(str_from_cstr(task->path), task->loader, md_get_heap_allocator(), task->flags, &task->progress);
+    }, [](load::traj::PreparedTrajectory** prepared, void* user_data) {
+        OpenTrajectoryTask* task = (OpenTrajectoryTask*)user_data;
+        ApplicationState* data = task->data;
+        bool indexing = false;
+        defer { if (!indexing) md_free(md_get_heap_allocator(), task, sizeof(OpenTrajectoryTask)); };
+
+        // Superseded by another open, or cancelled
+        if (task->id != data->tasks.open_trajectory) {
+            load::traj::discard_prepared(*prepared);
+            return;
+        }
+        data->tasks.open_trajectory = task_system::INVALID_ID;
+        data->files.open_trajectory_progress = NULL;
+
+        md_trajectory_i* traj = *prepared ? load::traj::finalize_file(*prepared, &data->mold.mol, &task->range) : NULL;
+        if (!traj) {
+            if (!task->optional) {
+                LOG_ERROR("Failed to open trajectory from file '%s'", task->path);
+            }
+            return;
+        }
+
         free_trajectory_data(data);
         data->mold.traj = traj;
-        str_copy_to_char_buf(data->files.trajectory, sizeof(data->files.trajectory), filename);
+        str_copy_to_char_buf(data->files.trajectory, sizeof(data->files.trajectory), str_from_cstr(task->path));
+        data->files.traj_beg_time = task->range.beg_time;
+        data->files.traj_end_time = task->range.end_time;
+        data->files.traj_stride   = (int)task->range.stride;
         init_trajectory_data(data);
-        data->animation.frame = 0;
-        return true;
-    }
-
-    return false;
+        // The frame may have been set (e.g. by a workspace) while the trajectory was opening
+        data->animation.frame = CLAMP(data->animation.frame, 0.0, (double)(md_trajectory_num_frames(traj) - 1));
+        LOG_SUCCESS("Successfully opened trajectory from file '%s'", task->path);
+
+        // The task keeps reporting through the same progress while the rest of the file is indexed
+        const task_system::ID index_id = load::traj::index_remaining(traj, &task->progress);
+        if (index_id != task_system::INVALID_ID) {
+            indexing = true;
+            task->id = index_id;
+            data->tasks.open_trajectory = index_id;
+            data->files.open_trajectory_progress = &task->progress;
+            task_system::main_enqueue(STR_LIT("##Trajectory Indexed"), [](void* user_data) {
+                OpenTrajectoryTask* task = (OpenTrajectoryTask*)user_data;
+                ApplicationState* data = task->data;
+                if (task->id == data->tasks.open_trajectory) {
+                    data->tasks.open_trajectory = task_system::INVALID_ID;
+                    data->files.open_trajectory_progress = NULL;
+                }
+                md_free(md_get_heap_allocator(), task, sizeof(OpenTrajectoryTask));
+            }, task, index_id);
+        }
+    }, task);
+
+    task->id = id;
+    data->tasks.open_trajectory = id;
+    data->files.open_trajectory_start = md_time_current();
+    data->files.open_trajectory_progress = &task->progress;
+    return id != task_system::INVALID_ID;
 }
 
 // #moleculedata
 static void free_molecule_data(ApplicationState* data) {
     ASSERT(data);
     interrupt_async_tasks(data);
+    // A trajectory which is still being opened was meant for this molecule, as were bonds which are still being computed
+    cancel_open_trajectory(data);
+    data->tasks.compute_bonds = task_system::INVALID_ID;
 
     clear_dataset_items(data);
 
     //md_molecule_free(&data->mold.mol, persistent_alloc);
     md_arena_allocator_reset(data->mold.mol_alloc);
+    if (data->mold.topology_alloc) {
+        md_arena_allocator_destroy(data->mold.topology_alloc);
+        data->mold.topology_alloc = nullptr;
+    }
     MEMSET(&data->mold.mol, 0, sizeof(data->mold.mol));
 
     md_gl_molecule_free(&data->mold.gl_mol);
@@ -7280,6 +8133,54 @@ static void init_molecule_data(ApplicationState* data) {
     init_dataset_items(data);
 }
 
+struct FrameRangeTask {
+    load::traj::FrameStream* stream;
+    task_system::RangeTask task;
+    void* user_data;
+};
+
+// Range task over the frames of a trajectory, where the frames are handed out in file order through a frame stream rather than as contiguous partitions.
+// This way the trajectory is read sequentially by one thread while the decoding is spread over the pool.
+// Falls back to contiguous partitions if the trajectory does not support streaming.
+// The frames are processed in small batches, between which the task can be cancelled and reports its progress.
+static task_system::ID pool_enqueue_frame_range(str_t label, md_trajectory_i* traj, uint32_t frame_beg, uint32_t frame_end, task_system::RangeTask task, void* user_data, task_system::Priority priority) {
+    FrameRangeTask* range_task = (FrameRangeTask*)md_alloc(md_get_heap_allocator(), sizeof(FrameRangeTask));
+    range_task->stream = load::traj::stream_begin(traj, frame_beg, frame_end);
+    range_task->task = task;
+    range_task->user_data = user_data;
+
+    task_system::ID id = task_system::pool_enqueue(label, frame_beg, frame_end, [](uint32_t range_beg, uint32_t range_end, void* user_data, task_system::Token* token) {
+        FrameRangeTask* range_task = (FrameRangeTask*)user_data;
+        if (range_task->stream) {
+            // Process as many frames as the partition covers, but take them from the stream
+            size_t remaining = range_end - range_beg;
+            size_t beg, end;
+            while (remaining > 0 && !task_system::token_cancelled(token) && load::traj::stream_next(range_task->stream, MIN(remaining, FRAME_STREAM_BATCH_SIZE), &beg, &end)) {
+                range_task->task((uint32_t)beg, (uint32_t)end, range_task->user_data);
+                load::traj::stream_release(range_task->stream, beg, end);
+                task_system::token_progress(token, (uint32_t)(end - beg));
+                remaining -= end - beg;
+            }
+        } else {
+            for (uint32_t beg = range_beg; beg < range_end && !task_system::token_cancelled(token); beg += FRAME_STREAM_BATCH_SIZE) {
+                const uint32_t end = MIN(beg + FRAME_STREAM_BATCH_SIZE, range_end);
+                range_task->task(beg, end, range_task->user_data);
+                task_system::token_progress(token, end - beg);
+            }
+        }
+    }, range_task, 0, priority);
+
+    task_system::pool_enqueue(STR_LIT("##End Frame Stream"), [](void* user_data) {
+        FrameRangeTask* range_task = (FrameRangeTask*)user_data;
+        if (range_task->stream) {
+            load::traj::stream_end(range_task->stream);
+        }
+        md_free(md_get_heap_allocator(), range_task, sizeof(FrameRangeTask));
+    }, range_task, id, priority);
+
+    return id;
+}
+
 static void launch_prefetch_job(ApplicationState* data) {
     const uint32_t num_frames = MIN((uint32_t)md_trajectory_num_frames(data->mold.traj), (uint32_t)load::traj::num_cache_frames(data->mold.traj));
     if (!num_frames) return;
@@ -7291,7 +8192,7 @@ static void launch_prefetch_job(ApplicationState* data) {
             md_trajectory_frame_header_t header;
             md_trajectory_load_frame(data->mold.traj, i, &header, 0, 0, 0);
         }
-    }, data);
+    }, data, 0, task_system::Priority::Background);
 
     task_system::main_enqueue(STR_LIT("Prefetch Complete"), [](void* user_data) {
         ApplicationState* data = (ApplicationState*)user_data;
@@ -7301,6 +8202,58 @@ static void launch_prefetch_job(ApplicationState* data) {
     }, data, data->tasks.prefetch_frames);
 }
 
+// Bonds were added to the molecule after it was initialized
+static void update_molecule_bonds(ApplicationState* data) {
+    // The bond buffer of the gl molecule is sized when it is initialized
+    md_gl_molecule_free(&data->mold.gl_mol);
+    md_gl_molecule_init(&data->mold.gl_mol, &data->mold.mol);
+    data->mold.dirty_buffers |= MolBit_DirtyPosition | MolBit_DirtySecondaryStructure | MolBit_DirtyFlags | MolBit_DirtyBonds;
+    update_all_representations(data);
+    data->script.compile_ir = true;
+}
+
+struct ComputeBondsTask {
+    ApplicationState* data;
+    BondJob* job;
+    task_system::ID id;
+    uint32_t postprocess_flags;
+    bool write_cache;
+    char path[1024];
+};
+
+// The bonds, connectivity and structures of large molecules are computed on the thread pool once the molecule has been loaded, it is shown without bonds until then.
+// The job cannot be interrupted, so it is waited for before the molecule is freed (interrupt_async_tasks).
+static void launch_compute_bonds(ComputeBondsTask* task) {
+    ApplicationState* data = task->data;
+    task->id = load::mol::launch_bond_job(task->job);
+    data->tasks.compute_bonds = task->id;
+    data->mold.compute_bonds_start = md_time_current();
+
+    task_system::main_enqueue(STR_LIT("##Compute Bonds Complete"), [](void* user_data) {
+        ComputeBondsTask* task = (ComputeBondsTask*)user_data;
+        ApplicationState* data = task->data;
+        defer {
+            load::mol::free_bond_job(task->job);
+            md_free(md_get_heap_allocator(), task, sizeof(ComputeBondsTask));
+        };
+
+        // Superseded by another molecule or by a change of the elements
+        if (task->id != data->tasks.compute_bonds || !load::mol::bond_job_complete(task->job)) {
+            return;
+        }
+        data->tasks.compute_bonds = task_system::INVALID_ID;
+
+        md_molecule_t* mol = &data->mold.mol;
+        ASSERT(data->mold.topology_alloc == nullptr);
+        data->mold.topology_alloc = load::mol::finish_bond_job(task->job, mol);
+        if (task->write_cache) {
+            load::mol::write_topology_cache(mol, str_from_cstr(task->path), task->postprocess_flags);
+        }
+        update_molecule_bonds(data);
+        LOG_INFO("Computed %zu bonds", (size_t)mol->bond.count);
+    }, task, task->id);
+}
+
 static bool load_dataset_from_file(ApplicationState* data, const LoadParam& param) {
     ASSERT(data);
 
@@ -7311,17 +8264,51 @@ static bool load_dataset_from_file(ApplicationState* data, const LoadParam& para
             free_trajectory_data(data);
             free_molecule_data(data);
 
-            if (!param.mol_loader->init_from_file(&data->mold.mol, path_to_file, param.mol_loader_arg, data->mold.mol_alloc)) {
-                LOG_ERROR("Failed to load molecular data from file '" STR_FMT "'", STR_ARG(path_to_file));
-                return false;
+            // @NOTE: If the dataset is coarse-grained, then postprocessing must be aware
+            md_util_postprocess_flags_t flags = param.coarse_grained ? MD_UTIL_POSTPROCESS_COARSE_GRAINED : MD_UTIL_POSTPROCESS_ALL;
+            // Loader arguments come from the load dialogue (e.g. the LAMMPS atom format) and are not part of the key of the topology cache
+            const bool use_topology_cache = param.mol_loader_arg == NULL;
+            if (use_topology_cache && load::mol::load_topology_cache(&data->mold.mol, path_to_file, flags, data->mold.mol_alloc)) {
+                // Bonds are part of the snapshot, the remaining topology is derived from them
+                md_util_molecule_postprocess(&data->mold.mol, data->mold.mol_alloc, (md_util_postprocess_flags_t)(flags & ~MD_UTIL_POSTPROCESS_BOND_BIT));
+            } else {
+                const bool parallel = param.mol_loader_arg == NULL && load::mol::init_from_file_parallel(&data->mold.mol, path_to_file, param.mol_loader, data->mold.mol_alloc);
+                if (!parallel && !param.mol_loader->init_from_file(&data->mold.mol, path_to_file, param.mol_loader_arg, data->mold.mol_alloc)) {
+                    LOG_ERROR("Failed to load molecular data from file '" STR_FMT "'", STR_ARG(path_to_file));
+                    return false;
+                }
+                const bool write_cache = use_topology_cache && !(param.mol_loader_flags & LoadMoleculeFlag_DisableCacheWrite);
+                const md_util_postprocess_flags_t bond_flags = (md_util_postprocess_flags_t)(MD_UTIL_POSTPROCESS_BOND_BIT | MD_UTIL_POSTPROCESS_CONNECTIVITY_BIT | MD_UTIL_POSTPROCESS_STRUCTURE_BIT);
+                BondJob* bond_job = NULL;
+                if (!param.coarse_grained && data->mold.mol.atom.count >= PARALLEL_BONDS_MIN_ATOMS) {
+                    // Elements, radii and residues are needed to decide on the bonds
+                    md_util_molecule_postprocess(&data->mold.mol, data->mold.mol_alloc, (md_util_postprocess_flags_t)(flags & ~bond_flags));
+                    bond_job = load::mol::create_bond_job(&data->mold.mol, flags & bond_flags);
+                    if (!bond_job) {
+                        md_util_molecule_postprocess(&data->mold.mol, data->mold.mol_alloc, bond_flags);
+                    }
+                } else {
+                    md_util_molecule_postprocess(&data->mold.mol, data->mold.mol_alloc, flags);
+                }
+
+                if (bond_job) {
+                    // The topology cache is written once the bonds are known
+                    ComputeBondsTask* task = (ComputeBondsTask*)md_alloc(md_get_heap_allocator(), sizeof(ComputeBondsTask));
+                    MEMSET(task, 0, sizeof(ComputeBondsTask));
+                    task->data = data;
+                    task->job  = bond_job;
+                    task->postprocess_flags = flags;
+                    task->write_cache = write_cache;
+                    str_copy_to_char_buf(task->path, sizeof(task->path), path_to_file);
+                    launch_compute_bonds(task);
+                } else if (write_cache) {
+                    load::mol::write_topology_cache(&data->mold.mol, path_to_file, flags);
+                }
             }
             LOG_SUCCESS("Successfully loaded molecular data from file '" STR_FMT "'", STR_ARG(path_to_file));
 
             str_copy_to_char_buf(data->files.molecule, sizeof(data->files.molecule), path_to_file);
             data->files.coarse_grained = param.coarse_grained;
-            // @NOTE: If the dataset is coarse-grained, then postprocessing must be aware
-            md_util_postprocess_flags_t flags = param.coarse_grained ? MD_UTIL_POSTPROCESS_COARSE_GRAINED : MD_UTIL_POSTPROCESS_ALL;
-            md_util_molecule_postprocess(&data->mold.mol, data->mold.mol_alloc, flags);
             init_molecule_data(data);
 
             // @NOTE: Some files contain both atomic coordinates and trajectory
@@ -7339,17 +8326,13 @@ static bool load_dataset_from_file(ApplicationState* data, const LoadParam& para
             }
             interrupt_async_tasks(data);
 
-            bool success = load_trajectory_data(data, path_to_file, param.traj_loader, param.traj_loader_flags);
-            if (success) {
-                LOG_SUCCESS("Successfully opened trajectory from file '" STR_FMT "'", STR_ARG(path_to_file));
+            // Don't record failure as an error if the file also contained the molecule, as the trajectory may be optional (In case of PDB for example)
+            const bool optional = param.mol_loader != NULL;
+            bool success = load_trajectory_data(data, path_to_file, param.traj_loader, param.traj_loader_flags, param.traj_range, optional);
+            if (success || optional) {
                 return true;
-            } else {
-                if (param.mol_loader && param.traj_loader) {
-					// Don't record this as an error, as the trajectory may be optional (In case of PDB for example)
-                    return true;
-                }
-                LOG_ERROR("Failed to opened trajectory from file '" STR_FMT "'", STR_ARG(path_to_file));
             }
+            LOG_ERROR("Failed to opened trajectory from file '" STR_FMT "'", STR_ARG(path_to_file));
         }
     }
 
@@ -7377,6 +8360,7 @@ static void load_workspace(ApplicationState* data, str_t filename) {
     str_t new_molecule_file   = {};
     str_t new_trajectory_file = {};
     bool  new_coarse_grained  = false;
+    load::traj::FrameRange new_traj_range = {};
     double new_frame = 0;
 
     str_t folder = {};
@@ -7411,6 +8395,14 @@ static void load_workspace(ApplicationState* data, str_t filename) {
                     }
                 } else if (str_eq(ident, STR_LIT("CoarseGrained"))) {
                     viamd::extract_bool(new_coarse_grained, arg);
+                } else if (str_eq(ident, STR_LIT("TrajectoryBeginTime"))) {
+                    viamd::extract_dbl(new_traj_range.beg_time, arg);
+                } else if (str_eq(ident, STR_LIT("TrajectoryEndTime"))) {
+                    viamd::extract_dbl(new_traj_range.end_time, arg);
+                } else if (str_eq(ident, STR_LIT("TrajectoryStride"))) {
+                    int stride;
+                    viamd::extract_int(stride, arg);
+                    new_traj_range.stride = (uint32_t)MAX(1, stride);
                 }
             }
         } else if (str_eq(section, STR_LIT("Animation"))) {
@@ -7424,6 +8416,8 @@ static void load_workspace(ApplicationState* data, str_t filename) {
                     int mode;
                     viamd::extract_int(mode, arg);
                     data->animation.interpolation = (InterpolationMode)mode;
+                } else if (str_eq(ident, STR_LIT("Loop"))) {
+                    viamd::extract_bool(data->animation.loop, arg);
                 }
             }
         } else if (str_eq(section, STR_LIT("RenderSettings"))) {
@@ -7567,9 +8561,9 @@ static void load_workspace(ApplicationState* data, str_t filename) {
         param.mol_loader = 0;
         param.traj_loader = loader_state.traj_loader;
         param.file_path = new_trajectory_file;
-        if (load_dataset_from_file(data, param)) {
-            str_copy_to_char_buf(data->files.trajectory, sizeof(data->files.trajectory), new_trajectory_file);
-        }
+        param.traj_range = new_traj_range;
+        // The trajectory is opened asynchronously and data->files.trajectory is set once it is done
+        load_dataset_from_file(data, param);
         data->animation.frame = new_frame;
     } else {
         data->files.trajectory[0] = '\0';
@@ -7602,11 +8596,17 @@ static void save_workspace(ApplicationState* data, str_t filename) {
     viamd::write_str(state, STR_LIT("MoleculeFile"), mol_file);
     viamd::write_str(state, STR_LIT("TrajectoryFile"), traj_file);
     viamd::write_int(state, STR_LIT("CoarseGrained"), data->files.coarse_grained);
+    if (data->files.traj_beg_time != 0 || data->files.traj_end_time != 0 || data->files.traj_stride > 1) {
+        viamd::write_dbl(state, STR_LIT("TrajectoryBeginTime"), data->files.traj_beg_time);
+        viamd::write_dbl(state, STR_LIT("TrajectoryEndTime"), data->files.traj_end_time);
+        viamd::write_int(state, STR_LIT("TrajectoryStride"), data->files.traj_stride);
+    }
 
     viamd::write_section_header(state, STR_LIT("Animation"));
     viamd::write_dbl(state, STR_LIT("Frame"), data->animation.frame);
     viamd::write_flt(state, STR_LIT("Fps"), data->animation.fps);
     viamd::write_int(state, STR_LIT("Interpolation"), (int)data->animation.interpolation);
+    viamd::write_bool(state, STR_LIT("Loop"), data->animation.loop);
 
     viamd::write_section_header(state, STR_LIT("RenderSettings"));
     viamd::write_bool(state, STR_LIT("SsaoEnabled"), data->visuals.ssao.enabled);
@@ -0,0 +1,277 @@
+#include "profiler.h"
+
+#include <core/md_common.h>
+#include <core/md_log.h>
+#include <core/md_allocator.h>
+#include <core/md_array.h>
+#include <core/md_os.h>
+
+#include <string.h>
+#include <new>
+#include <atomic>
+
+namespace profiler {
+
+// Number of events per thread, when full the oldest events are overwritten
+constexpr uint32_t RING_SIZE  = 16384;
+constexpr uint32_t LABEL_SIZE = 40;
+
+enum EventType : uint32_t {
+    EventType_SectionBegin,
+    EventType_SectionEnd,
+    EventType_TaskEnqueue,
+    EventType_TaskBegin,
+    EventType_TaskEnd,
+    EventType_GpuSectionBegin,
+    EventType_GpuSectionEnd,
+};
+
+struct EventData {
+    md_timestamp_t time;
+    uint64_t id;
+    int64_t  latency;
+    uint32_t type;
+    uint32_t worker;
+    char     label[LABEL_SIZE];     // Copied, since the memory of the task labels is reused
+};
+
+// Slot of the ring. seq is 2 * (idx + 1) once event idx has been written to the slot and odd while it is being written,
+// so a reader can tell a complete event from one which is being overwritten (or has been since it was read).
+struct Event {
+    std::atomic_uint64_t seq;
+    EventData data;
+};
+
+// Only written by its owning thread, the write index is atomic so the ring can be read while recording
+// Buffers are never freed (see shutdown)
+struct ThreadBuffer {
+    Event* events = 0;
+    std::atomic_uint64_t write_idx = 0;
+    std::atomic_uint64_t clear_idx = 0;     // Events before this have been cleared
+    uint32_t thread_idx = 0;
+    bool main_thread = false;
+    bool gpu = false;                   // Pseudo-thread for the GPU sections, written by the main thread
+};
+
+static std::atomic_bool recording = false;
+static md_mutex_t buffer_mutex;
+static md_array(ThreadBuffer*) buffers = 0;
+static md_timestamp_t epoch = 0;
+static ThreadBuffer* gpu_buffer = 0;
+static thread_local ThreadBuffer* thread_buffer = 0;
+static thread_local bool is_main_thread = false;
+
+static ThreadBuffer* create_buffer(bool main_thread, bool gpu) {
+    md_allocator_i* alloc = md_get_heap_allocator();
+    ThreadBuffer* buf = new (md_alloc(alloc, sizeof(ThreadBuffer))) ThreadBuffer();
+    buf->events = (Event*)md_alloc(alloc, sizeof(Event) * RING_SIZE);
+    for (uint32_t i = 0; i < RING_SIZE; ++i) {
+        new (&buf->events[i]) Event();
+    }
+    buf->main_thread = main_thread;
+    buf->gpu = gpu;
+
+    md_mutex_lock(&buffer_mutex);
+    buf->thread_idx = (uint32_t)md_array_size(buffers);
+    md_array_push(buffers, buf, alloc);
+    md_mutex_unlock(&buffer_mutex);
+
+    return buf;
+}
+
+static ThreadBuffer* get_thread_buffer() {
+    if (!thread_buffer) {
+        thread_buffer = create_buffer(is_main_thread, false);
+    }
+    return thread_buffer;
+}
+
+static inline void record(ThreadBuffer* buf, md_timestamp_t time, uint32_t type, uint64_t id, const char* label, size_t label_len, uint32_t worker = 0, int64_t latency = 0) {
+    const uint64_t idx = buf->write_idx.load(std::memory_order_relaxed);
+    Event* slot = &buf->events[idx % RING_SIZE];
+    slot->seq.store(2 * idx + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    EventData* ev = &slot->data;
+    ev->time = time;
+    ev->id = id;
+    ev->latency = latency;
+    ev->type = type;
+    ev->worker = worker;
+    const size_t len = MIN(label_len, LABEL_SIZE - 1);
+    if (len) MEMCPY(ev->label, label, len);
+    ev->label[len] = '\0';
+    slot->seq.store(2 * (idx + 1), std::memory_order_release);
+    buf->write_idx.store(idx + 1, std::memory_order_release);
+}
+
+// Copies event idx out of the ring, returns false if the slot does not hold it in full (not yet written, being overwritten or overwritten)
+static inline bool read_event(const ThreadBuffer* buf, uint64_t idx, EventData* ev) {
+    const Event* slot = &buf->events[idx % RING_SIZE];
+    const uint64_t seq = slot->seq.load(std::memory_order_acquire);
+    if (seq != 2 * (idx + 1)) return false;
+    MEMCPY(ev, &slot->data, sizeof(EventData));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->seq.load(std::memory_order_relaxed) == seq;
+}
+
+// Expected to be called from the main thread
+void initialize() {
+    is_main_thread = true;
+    buffer_mutex = md_mutex_create();
+    epoch = md_time_current();
+}
+
+// Only stops the recording. The buffers and their mutex are kept, since a thread which checked is_recording just before may still be
+// recording an event, and threads which are not joined (detached or outside of the task system) keep their thread_local buffer pointers.
+void shutdown() {
+    recording.store(false, std::memory_order_release);
+}
+
+bool is_recording() {
+    return recording.load(std::memory_order_acquire);
+}
+
+void set_recording(bool enable) {
+    recording.store(enable, std::memory_order_release);
+}
+
+// An event which is being written while clearing is at or past write_idx, and thus kept
+void clear() {
+    md_mutex_lock(&buffer_mutex);
+    for (size_t i = 0; i < md_array_size(buffers); ++i) {
+        buffers[i]->clear_idx = buffers[i]->write_idx.load();
+    }
+    md_mutex_unlock(&buffer_mutex);
+    epoch = md_time_current();
+}
+
+void push_section(const char* label) {
+    if (!is_recording()) return;
+    record(get_thread_buffer(), md_time_current(), EventType_SectionBegin, 0, label, strlen(label));
+}
+
+void pop_section() {
+    if (!is_recording()) return;
+    record(get_thread_buffer(), md_time_current(), EventType_SectionEnd, 0, 0, 0);
+}
+
+void task_enqueue(uint64_t id, str_t label) {
+    if (!is_recording()) return;
+    record(get_thread_buffer(), md_time_current(), EventType_TaskEnqueue, id, label.ptr, label.len);
+}
+
+void task_begin(uint64_t id, str_t label, uint32_t worker, int64_t ready_time) {
+    if (!is_recording()) return;
+    const md_timestamp_t time = md_time_current();
+    record(get_thread_buffer(), time, EventType_TaskBegin, id, label.ptr, label.len, worker, time - ready_time);
+}
+
+void task_end(uint64_t id) {
+    if (!is_recording()) return;
+    record(get_thread_buffer(), md_time_current(), EventType_TaskEnd, id, 0, 0);
+}
+
+void gpu_section_begin(const char* label, int64_t time) {
+    if (!is_recording()) return;
+    if (!gpu_buffer) gpu_buffer = create_buffer(false, true);
+    record(gpu_buffer, time, EventType_GpuSectionBegin, 0, label, strlen(label));
+}
+
+void gpu_section_end(int64_t time) {
+    if (!is_recording()) return;
+    if (!gpu_buffer) gpu_buffer = create_buffer(false, true);
+    record(gpu_buffer, time, EventType_GpuSectionEnd, 0, 0, 0);
+}
+
+// Writes the label as a JSON string (without quotes)
+static void write_json_str(md_file_o* file, const char* str) {
+    char buf[LABEL_SIZE * 2];
+    size_t len = 0;
+    for (const char* c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            buf[len++] = '\\';
+            buf[len++] = *c;
+        } else if ((unsigned char)*c >= 0x20) {
+            buf[len++] = *c;
+        }
+    }
+    md_file_write(file, buf, len);
+}
+
+static inline double to_us(md_timestamp_t time) {
+    return md_time_as_seconds(time - epoch) * 1.0e6;
+}
+
+bool export_chrome_trace(str_t filename) {
+    md_file_o* file = md_file_open(filename, MD_FILE_WRITE);
+    if (!file) {
+        MD_LOG_ERROR("Failed to open file '" STR_FMT "' to write trace.", STR_ARG(filename));
+        return false;
+    }
+
+    md_file_printf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    md_file_printf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"VIAMD\"}}");
+
+    md_mutex_lock(&buffer_mutex);
+    for (size_t i = 0; i < md_array_size(buffers); ++i) {
+        const ThreadBuffer* buf = buffers[i];
+        const uint32_t tid = buf->thread_idx;
+        if (buf->main_thread) {
+            md_file_printf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"Main Thread\"}}", tid);
+        } else if (buf->gpu) {
+            md_file_printf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}", tid);
+        } else {
+            md_file_printf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}", tid, tid);
+        }
+
+        // Events which are overwritten while exporting are skipped (read_event)
+        const uint64_t end = buf->write_idx.load(std::memory_order_acquire);
+        const uint64_t beg = MAX(buf->clear_idx.load(), end > RING_SIZE ? end - RING_SIZE : 0);
+        for (uint64_t j = beg; j < end; ++j) {
+            EventData ev;
+            if (!read_event(buf, j, &ev)) continue;
+            const double ts = to_us(ev.time);
+            switch (ev.type) {
+            case EventType_SectionBegin:
+                md_file_printf(file, ",\n{\"name\":\"");
+                write_json_str(file, ev.label);
+                md_file_printf(file, "\",\"cat\":\"cpu\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", ts, tid);
+                break;
+            case EventType_SectionEnd:
+                md_file_printf(file, ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", ts, tid);
+                break;
+            case EventType_TaskEnqueue:
+                md_file_printf(file, ",\n{\"name\":\"Enqueue ");
+                write_json_str(file, ev.label);
+                md_file_printf(file, "\",\"cat\":\"task\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":0,\"tid\":%u,\"args\":{\"id\":\"%llx\"}}", ts, tid, (unsigned long long)ev.id);
+                break;
+            case EventType_TaskBegin:
+                md_file_printf(file, ",\n{\"name\":\"");
+                write_json_str(file, ev.label);
+                md_file_printf(file, "\",\"cat\":\"task\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":0,\"tid\":%u,\"args\":{\"id\":\"%llx\",\"worker\":%u,\"latency_us\":%.3f}}",
+                    ts, tid, (unsigned long long)ev.id, ev.worker, md_time_as_seconds(ev.latency) * 1.0e6);
+                break;
+            case EventType_TaskEnd:
+                md_file_printf(file, ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", ts, tid);
+                break;
+            case EventType_GpuSectionBegin:
+                md_file_printf(file, ",\n{\"name\":\"");
+                write_json_str(file, ev.label);
+                md_file_printf(file, "\",\"cat\":\"gpu\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", ts, tid);
+                break;
+            case EventType_GpuSectionEnd:
+                md_file_printf(file, ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", ts, tid);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    md_mutex_unlock(&buffer_mutex);
+
+    md_file_printf(file, "\n]}\n");
+    md_file_close(file);
+    return true;
+}
+
+}  // namespace profiler
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <core/md_str.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Low overhead profiler which records timestamped events into per-thread ring buffers.
+// Nothing is recorded (and nothing is allocated) until recording is enabled, after which the oldest events of a thread
+// are overwritten once its ring buffer is full. The events can be exported as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+
+namespace profiler {
+
+void initialize();
+// Stops recording, the recorded events and the buffers of the threads are kept until the process exits
+void shutdown();
+
+bool is_recording();
+void set_recording(bool enable);
+
+// Discards all recorded events
+void clear();
+
+// Scoped CPU sections on the calling thread, sections have to be popped in the reverse order they were pushed
+// Use through the PUSH_CPU_SECTION / POP_CPU_SECTION macros
+void push_section(const char* label);
+void pop_section();
+
+// Task events, called by the task system
+// The latency of a task is measured from its ready time (md_time_current() when its dependencies had completed) until it begins
+void task_enqueue(uint64_t id, str_t label);
+void task_begin(uint64_t id, str_t label, uint32_t worker, int64_t ready_time);
+void task_end(uint64_t id);
+
+// GPU sections, called by the GPU profiler once the timestamps of a frame have been read back
+// The times are given in the clock of md_time_current() and the sections are exported on a separate GPU track
+void gpu_section_begin(const char* label, int64_t time);
+void gpu_section_end(int64_t time);
+
+// Writes the recorded events in the Chrome trace event format (JSON)
+bool export_chrome_trace(str_t filename);
+
+}  // namespace profiler
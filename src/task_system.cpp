@@ -3,6 +3,7 @@
 #endif
 
 #include "task_system.h"
+#include "profiler.h"
 #include <TaskScheduler.h>
 #include <core/md_common.h>
 #include <core/md_log.h>
@@ -11,7 +12,8 @@
 #include <core/md_os.h>
 
 #include <string.h>
-#include <atomic_queue.h>
+#include <atomic>
+#include <thread>
 
 // Blatantly stolen from ImGui (thanks Omar!)
 struct NewDummy {};
@@ -21,79 +23,153 @@ inline void  operator delete(void*, NewDummy, void*)   {} // This is only requir
 
 namespace task_system {
 
-constexpr uint32_t MAX_TASKS = 256;
+// Tasks are allocated in blocks which never move (the scheduler holds pointers to the tasks) and are never freed before shutdown.
+// Blocks are added on demand up to MAX_BLOCKS, after which pool_enqueue waits for a slot and pool_try_enqueue fails.
+constexpr uint32_t BLOCK_SIZE = 256;
+constexpr uint32_t MAX_BLOCKS = 256;
+constexpr uint32_t MAX_TASKS  = BLOCK_SIZE * MAX_BLOCKS;
 constexpr uint32_t LABEL_SIZE = 64;
+constexpr uint32_t NUM_LANES  = 3;
 
-static inline ID generate_id(uint32_t slot_idx) {
-    return (md_time_current() << 8) | (slot_idx & (MAX_TASKS - 1));
+// The partitions of range tasks in the background lane are executed in this many chunks, between which the task yields to pending work of higher lanes
+constexpr uint32_t YIELD_CHUNKS = 8;
+constexpr uint32_t BACKGROUND_LANE = (uint32_t)Priority::Background;
+
+// ID = [generation (32 bits)][main bit][slot index (31 bits)]
+// The generation of a slot is incremented every time the slot is reused, so a stale ID never matches the task which took over its slot.
+constexpr uint64_t ID_MAIN_BIT   = 0x80000000ULL;
+constexpr uint64_t ID_SLOT_MASK  = 0x7FFFFFFFULL;
+
+static inline ID make_id(uint32_t generation, uint32_t slot_idx, bool main) {
+    return ((uint64_t)generation << 32) | (main ? ID_MAIN_BIT : 0) | (slot_idx & ID_SLOT_MASK);
 }
 
 static inline uint32_t get_slot_idx(ID id) {
-    return (uint32_t)(id & (MAX_TASKS - 1));
+    return (uint32_t)(id & ID_SLOT_MASK);
+}
+
+static inline uint32_t get_generation(ID id) {
+    return (uint32_t)(id >> 32);
 }
 
-namespace main {
-    static atomic_queue::AtomicQueue<uint32_t, MAX_TASKS, 0xFFFFFFFF> free_slots;
-    static atomic_queue::AtomicQueue<uint32_t, MAX_TASKS, 0xFFFFFFFF> queued_slots;
+static inline bool is_main_id(ID id) {
+    return (id & ID_MAIN_BIT) != 0;
 }
 
-namespace pool {
-    static atomic_queue::AtomicQueue<uint32_t, MAX_TASKS, 0xFFFFFFFF> free_slots;
-    static atomic_queue::AtomicQueue<uint32_t, MAX_TASKS, 0xFFFFFFFF> queued_slots;
+static void release_pool_slot(uint32_t slot_idx);
+static void release_main_slot(uint32_t slot_idx);
+static void yield_to_higher_lanes(uint32_t lane);
+
+// Dependency state of a task, the dependencies are tracked here rather than by the scheduler since a task may have any number of them,
+// and the dependencies may already be running (or completed) when the task is enqueued.
+// Everything but the pending count is protected by graph_mutex.
+struct GraphNode {
+    std::atomic_uint32_t pending = 0;       // Dependencies which have not yet completed
+    std::atomic_bool     finished = true;   // Tasks which depend on this one from now on do not wait for it
+    md_array(ID)         successors = 0;    // Tasks which wait for this one
+    md_array(ID)         dependencies = 0;  // Pool tasks this one waits for, to be able to wait for the whole chain
+};
+
+static md_mutex_t graph_mutex;
+
+static void finish_node(GraphNode* node);
+
+// Number of pool tasks per lane which have been handed to the scheduler and not yet completed
+static std::atomic_uint32_t lane_pending[NUM_LANES];
+
+static inline enki::TaskPriority enki_priority(uint32_t lane) {
+    static_assert(enki::TASK_PRIORITY_NUM >= NUM_LANES, "enkiTS needs at least one task priority per lane");
+    return (enki::TaskPriority)lane;
 }
 
 class PoolTask : public enki::ITaskSet {
 public:
     PoolTask() = default;
-    PoolTask(uint32_t set_beg_, uint32_t set_end_, RangeTask set_func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, enki::ICompletable* dependency = 0)
-        : ITaskSet(set_end_-set_beg_), m_set_func(set_func_), m_user_data(user_data_), m_range_offset(set_beg_), m_set_completed(0), m_interrupt(false), m_id(id) {
+    PoolTask(uint32_t set_beg_, uint32_t set_end_, RangeTask set_func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, uint32_t lane = 1)
+        : ITaskSet(set_end_-set_beg_), m_set_func(set_func_), m_user_data(user_data_), m_range_offset(set_beg_), m_set_completed(0), m_interrupt(false), m_submitted(false), m_lane(lane), m_pipe_lane(lane), m_id(id) {
+        m_Priority = enki_priority(lane);
         size_t len = MIN(lbl_.len, LABEL_SIZE-1);
         m_label = {strncpy(m_buf, lbl_.ptr, len), len};
-        if (dependency) {
-            SetDependency(m_dependency, dependency);
-        }
     }
 
-    PoolTask(Task func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, enki::ICompletable* dependency = 0)
-        : ITaskSet(1), m_func(func_), m_user_data(user_data_), m_set_completed(0), m_interrupt(false), m_id(id) {
+    PoolTask(Task func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, uint32_t lane = 1)
+        : ITaskSet(1), m_func(func_), m_user_data(user_data_), m_set_completed(0), m_interrupt(false), m_submitted(false), m_lane(lane), m_pipe_lane(lane), m_id(id) {
+        m_Priority = enki_priority(lane);
         size_t len = MIN(lbl_.len, LABEL_SIZE-1);
         m_label = {strncpy(m_buf, lbl_.ptr, len), len};
-        if (dependency) {
-            SetDependency(m_dependency, dependency);
-        }
     }
 
     virtual ~PoolTask() {}
 
     virtual void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) final {
-        (void)threadnum;
+        // The slot may be reused once the last part of the range has completed, so the id is kept for the end event
+        const ID id = m_id;
+        profiler::task_begin(id, m_label, threadnum, m_ready_time);
+        uint32_t beg = range.start;
         if (!m_interrupt) {
-            if (m_set_func)
-                m_set_func(m_range_offset + range.start, m_range_offset + range.end, m_user_data);
+            if (m_set_func || m_token_func) {
+                const uint32_t range_ext = range.end - range.start;
+                const uint32_t chunk_ext = m_lane == BACKGROUND_LANE ? MAX(1, (range_ext + YIELD_CHUNKS - 1) / YIELD_CHUNKS) : range_ext;
+                while (beg < range.end && !m_interrupt) {
+                    if (beg != range.start && m_lane == BACKGROUND_LANE) {
+                        yield_to_higher_lanes(m_lane);
+                    }
+                    const uint32_t end = MIN(beg + chunk_ext, range.end);
+                    Token token = {&m_interrupt, &m_progress, 0};
+                    if (m_token_func)
+                        m_token_func(m_range_offset + beg, m_range_offset + end, m_user_data, &token);
+                    else
+                        m_set_func(m_range_offset + beg, m_range_offset + end, m_user_data);
+                    complete_range(end - beg, token.reported);
+                    beg = end;
+                }
+            }
             else if (m_func)
                 m_func(m_user_data);
         }
-       
-        uint32_t range_ext = (range.end - range.start);
 
-        // This should be protected with a mutex or something to ensure that only a single thread does this
+        // Whatever remains of the partition (everything for single tasks and interrupted partitions)
+        if (beg < range.end) {
+            complete_range(range.end - beg);
+        }
+        profiler::task_end(id);
+    }
+
+    void complete_range(uint32_t range_ext, uint32_t reported = 0) {
+        if (reported < range_ext) {
+            m_progress += range_ext - reported;
+        }
+
         uint32_t set_size = m_set_completed += range_ext;
         if (set_size == m_SetSize) {
-            pool::free_slots.push(get_slot_idx(m_id));
+            lane_pending[m_pipe_lane] -= 1;
+            Finish();
         }
     }
 
+    void Finish() {
+        finish_node(&m_node);
+        release_pool_slot(get_slot_idx(m_id));
+    }
+
+    // Queued, waiting for dependencies or executing
     bool Running() {
-        return !GetIsComplete();
+        return !m_node.finished;
     }
 
-    RangeTask  m_set_func = nullptr;  // either of these two are executed
+    RangeTask  m_set_func = nullptr;  // either of these three are executed
+    CancellableRangeTask m_token_func = nullptr;
     Task       m_func     = nullptr;
     void*      m_user_data = nullptr;
     uint32_t   m_range_offset = 0;
     std::atomic_uint32_t m_set_completed = 0;
+    std::atomic_uint32_t m_progress = 0;    // Completed items, including those reported from within a partition
     std::atomic_bool m_interrupt = false;
-    enki::Dependency m_dependency;
+    std::atomic_bool m_submitted = false;   // Handed to the scheduler
+    std::atomic_uint32_t m_lane = 1;        // Current lane, raised to the interactive lane when the task is waited for
+    uint32_t   m_pipe_lane = 1;             // Lane in which the task was handed to the scheduler
+    md_timestamp_t m_ready_time = 0;        // When the last dependency completed, for measuring latency
+    GraphNode  m_node;
     char m_buf[LABEL_SIZE];
     str_t m_label = {};
     ID m_id = INVALID_ID;
@@ -102,103 +178,371 @@ public:
 class MainTask : public enki::IPinnedTask {
 public:
     MainTask() = default;
-    MainTask(Task func, void* user_data, str_t lbl = {}, ID id = INVALID_ID, enki::ICompletable* dependency = 0) :
+    MainTask(Task func, void* user_data, str_t lbl = {}, ID id = INVALID_ID) :
         IPinnedTask(0), m_function(func), m_user_data(user_data), m_id(id) {
         size_t len = MIN(lbl.len, LABEL_SIZE-1);
         m_label = {strncpy(m_buf, lbl.ptr, len), len};
-        if (dependency) {
-            SetDependency(m_dependency, dependency);
-        }
     }
     virtual void Execute() final {
+        const ID id = m_id;
+        profiler::task_begin(id, m_label, 0, m_ready_time);
         m_function(m_user_data);
-        main::free_slots.push(get_slot_idx(m_id));
+        profiler::task_end(id);
+        finish_node(&m_node);
+        release_main_slot(get_slot_idx(m_id));
     }
 
     Task m_function = nullptr;
     void* m_user_data = nullptr;
-    enki::Dependency m_dependency;
+    md_timestamp_t m_ready_time = 0;
+    GraphNode m_node;
     char m_buf[LABEL_SIZE];
     str_t m_label = {};
     ID m_id = INVALID_ID;
 };
 
-namespace main {
-    static MainTask task_data[MAX_TASKS];
+// Growable storage of tasks of one kind
+// The free slots form a FIFO ring, so a released slot is reused as late as possible. The scheduler may still touch a task for a
+// moment after it has released its slot, a slot whose task is not yet complete is therefore skipped when it comes up for reuse.
+template <typename T>
+struct TaskStorage {
+    struct Block {
+        T tasks[BLOCK_SIZE];
+        std::atomic_uint32_t generation[BLOCK_SIZE];   // Written under the mutex, read without it when looking up a task by id
+    };
+
+    std::atomic<Block*>  blocks[MAX_BLOCKS];
+    std::atomic_uint32_t num_blocks;
+
+    md_mutex_t mutex;               // Protects the free ring and the queued tasks
+    uint32_t*  free_ring;           // MAX_TASKS entries
+    uint32_t   free_head;
+    uint32_t   free_count;
+    md_array(ID) queued;            // Tasks whose dependencies have completed, waiting to be handed to the scheduler
+                                    // Full ids, a queued task may be started and completed elsewhere (task_wait_for) and its slot reused
+};
+
+static TaskStorage<PoolTask> pool_storage;
+static TaskStorage<MainTask> main_storage;
+
+template <typename T>
+static inline T* slot_task(TaskStorage<T>& storage, uint32_t slot_idx, std::atomic_uint32_t** generation = NULL) {
+    const uint32_t block_idx = slot_idx / BLOCK_SIZE;
+    if (block_idx >= storage.num_blocks) return NULL;
+    typename TaskStorage<T>::Block* block = storage.blocks[block_idx];
+    if (generation) *generation = &block->generation[slot_idx % BLOCK_SIZE];
+    return &block->tasks[slot_idx % BLOCK_SIZE];
 }
 
-namespace pool {
-    static PoolTask task_data[MAX_TASKS];
+template <typename T>
+static void storage_init(TaskStorage<T>& storage) {
+    storage.mutex = md_mutex_create();
+    storage.free_ring = (uint32_t*)md_alloc(md_get_heap_allocator(), sizeof(uint32_t) * MAX_TASKS);
+    storage.free_head = 0;
+    storage.free_count = 0;
+    storage.num_blocks = 0;
 }
 
-static inline enki::ICompletable* get_task(ID id) {
-    if (id != INVALID_ID) {
-        uint32_t slot_idx = get_slot_idx(id);
-        PoolTask* ptask = &pool::task_data[slot_idx];
-        MainTask* mtask = &main::task_data[slot_idx];
-        if (ptask->m_id == id)       return ptask;
-        else if (mtask->m_id == id)  return mtask;
+template <typename T>
+static void storage_free(TaskStorage<T>& storage) {
+    md_allocator_i* alloc = md_get_heap_allocator();
+    for (uint32_t i = 0; i < storage.num_blocks; ++i) {
+        typename TaskStorage<T>::Block* block = storage.blocks[i];
+        for (uint32_t j = 0; j < BLOCK_SIZE; ++j) {
+            block->tasks[j].~T();
+        }
+        md_free(alloc, block, sizeof(typename TaskStorage<T>::Block));
+        storage.blocks[i] = NULL;
     }
-    return NULL;
+    storage.num_blocks = 0;
+    md_free(alloc, storage.free_ring, sizeof(uint32_t) * MAX_TASKS);
+    storage.free_ring = NULL;
+    md_array_free(storage.queued, alloc);
+    md_mutex_destroy(&storage.mutex);
+}
+
+// Must be called with the mutex held
+template <typename T>
+static inline void free_ring_push(TaskStorage<T>& storage, uint32_t slot_idx) {
+    storage.free_ring[(storage.free_head + storage.free_count) % MAX_TASKS] = slot_idx;
+    storage.free_count += 1;
+}
+
+template <typename T>
+static void storage_release(TaskStorage<T>& storage, uint32_t slot_idx) {
+    md_mutex_lock(&storage.mutex);
+    free_ring_push(storage, slot_idx);
+    md_mutex_unlock(&storage.mutex);
+}
+
+// Returns false if all slots are taken and the storage cannot grow, then a blocking caller has to wait for a task to complete
+template <typename T>
+static bool storage_alloc(TaskStorage<T>& storage, uint32_t* out_slot, uint32_t* out_generation) {
+    md_mutex_lock(&storage.mutex);
+    for (uint32_t n = storage.free_count; n > 0; --n) {
+        const uint32_t slot_idx = storage.free_ring[storage.free_head];
+        storage.free_head = (storage.free_head + 1) % MAX_TASKS;
+        storage.free_count -= 1;
+        std::atomic_uint32_t* generation;
+        T* task = slot_task(storage, slot_idx, &generation);
+        if (!task->GetIsComplete()) {
+            free_ring_push(storage, slot_idx);
+            continue;
+        }
+        *out_slot = slot_idx;
+        *out_generation = generation->fetch_add(1) + 1;
+        md_mutex_unlock(&storage.mutex);
+        return true;
+    }
+
+    const uint32_t block_idx = storage.num_blocks;
+    if (block_idx == MAX_BLOCKS) {
+        md_mutex_unlock(&storage.mutex);
+        return false;
+    }
+    typename TaskStorage<T>::Block* block = (typename TaskStorage<T>::Block*)md_alloc(md_get_heap_allocator(), sizeof(typename TaskStorage<T>::Block));
+    for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+        PLACEMENT_NEW(&block->tasks[i]) T();
+        block->generation[i] = 0;
+    }
+    storage.blocks[block_idx] = block;
+    storage.num_blocks = block_idx + 1;
+    for (uint32_t i = 1; i < BLOCK_SIZE; ++i) {
+        free_ring_push(storage, block_idx * BLOCK_SIZE + i);
+    }
+    block->generation[0] = 1;
+    *out_slot = block_idx * BLOCK_SIZE;
+    *out_generation = 1;
+    md_mutex_unlock(&storage.mutex);
+    return true;
+}
+
+template <typename T>
+static void storage_queue(TaskStorage<T>& storage, ID id) {
+    md_mutex_lock(&storage.mutex);
+    md_array_push(storage.queued, id, md_get_heap_allocator());
+    md_mutex_unlock(&storage.mutex);
+}
+
+static void release_pool_slot(uint32_t slot_idx) {
+    storage_release(pool_storage, slot_idx);
+}
+
+static void release_main_slot(uint32_t slot_idx) {
+    storage_release(main_storage, slot_idx);
+}
+
+// The id stored in a task is rewritten when its slot is reused, so it is not safe to read from other threads.
+// The generation of the slot is what tells whether the id still refers to the task in it.
+template <typename T>
+static inline T* find_task(TaskStorage<T>& storage, ID id) {
+    std::atomic_uint32_t* generation;
+    T* task = slot_task(storage, get_slot_idx(id), &generation);
+    return (task && generation->load() == get_generation(id)) ? task : NULL;
+}
+
+static inline PoolTask* find_pool_task(ID id) {
+    if (id == INVALID_ID || is_main_id(id)) return NULL;
+    return find_task(pool_storage, id);
+}
+
+static inline MainTask* find_main_task(ID id) {
+    if (id == INVALID_ID || !is_main_id(id)) return NULL;
+    return find_task(main_storage, id);
+}
+
+static inline GraphNode* find_node(ID id) {
+    if (is_main_id(id)) {
+        MainTask* task = find_main_task(id);
+        return task ? &task->m_node : NULL;
+    }
+    PoolTask* task = find_pool_task(id);
+    return task ? &task->m_node : NULL;
 }
 
 static enki::TaskScheduler ts{};
 
+// Hands the task to the scheduler unless it already has been
+static inline void submit_pool_task(PoolTask* task) {
+    if (!task->m_submitted.exchange(true)) {
+        if (task->m_SetSize == 0) {
+            // Empty range, there is nothing to execute
+            task->Finish();
+            return;
+        }
+        const uint32_t lane = task->m_lane;
+        task->m_pipe_lane = lane;
+        task->m_Priority = enki_priority(lane);
+        lane_pending[lane] += 1;
+        ts.AddTaskSetToPipe(task);
+    }
+}
+
+// Only background tasks yield and the partition executed in their place is of a higher lane, which does not yield in turn.
+// The guard makes sure that yields never nest, so the stack of a worker cannot pile up.
+static void yield_to_higher_lanes(uint32_t lane) {
+    static thread_local bool yielding = false;
+    if (yielding) return;
+    for (uint32_t i = 0; i < lane; ++i) {
+        if (lane_pending[i] > 0) {
+            // Executes at most one partition of a higher lane on the calling thread
+            yielding = true;
+            ts.WaitforTask(NULL, enki_priority(lane - 1));
+            yielding = false;
+            return;
+        }
+    }
+}
+
+// Must be called with graph_mutex held
+// Registers the task as a successor of all its dependencies which have not yet finished, the pending count is left one above the
+// number of dependencies it waits for, so it is not started by a dependency before it has been fully set up.
+static void init_node(GraphNode* node, ID id, const ID* dependencies, size_t num_dependencies) {
+    md_allocator_i* alloc = md_get_heap_allocator();
+    node->pending = 1;
+    node->finished = false;
+    for (size_t i = 0; i < num_dependencies; ++i) {
+        GraphNode* dep = find_node(dependencies[i]);
+        if (dep && !dep->finished) {
+            md_array_push(dep->successors, id, alloc);
+            node->pending += 1;
+            if (!is_main_id(dependencies[i])) {
+                md_array_push(node->dependencies, dependencies[i], alloc);
+            }
+        }
+    }
+}
+
+// Called when one of the dependencies of a task has finished, returns true if that was the last one
+static bool release_dependency(GraphNode* node) {
+    return (node->pending -= 1) == 0;
+}
+
+static void finish_node(GraphNode* node) {
+    md_allocator_i* alloc = md_get_heap_allocator();
+    md_mutex_lock(&graph_mutex);
+    node->finished = true;
+    md_array(ID) successors = node->successors;
+    node->successors = 0;
+    md_array_free(node->dependencies, alloc);
+    node->dependencies = 0;
+    md_mutex_unlock(&graph_mutex);
+
+    // The successors cannot finish (and have their slots reused) before this releases them
+    for (size_t i = 0; i < md_array_size(successors); ++i) {
+        const ID id = successors[i];
+        if (is_main_id(id)) {
+            MainTask* task = find_main_task(id);
+            if (task && release_dependency(&task->m_node)) {
+                task->m_ready_time = md_time_current();
+                storage_queue(main_storage, id);
+            }
+        } else {
+            PoolTask* task = find_pool_task(id);
+            if (task && release_dependency(&task->m_node)) {
+                // Handed over right away, so the stages of a graph do not have to wait for execute_queued_tasks
+                task->m_ready_time = md_time_current();
+                submit_pool_task(task);
+            }
+        }
+    }
+    md_array_free(successors, alloc);
+}
+
 void initialize(size_t num_threads = 0) {
     ts.Initialize((uint32_t)num_threads);
-    for (uint32_t i = 0; i < MAX_TASKS; i++) {
-        pool::free_slots.push(i);
-        main::free_slots.push(i);
-    }
+    graph_mutex = md_mutex_create();
+    storage_init(pool_storage);
+    storage_init(main_storage);
 }
 
-void shutdown() { ts.WaitforAllAndShutdown(); }
+void shutdown() {
+    ts.WaitforAllAndShutdown();
+    storage_free(pool_storage);
+    storage_free(main_storage);
+    md_mutex_destroy(&graph_mutex);
+}
 
 void execute_queued_tasks() {
-    while (!pool::queued_slots.was_empty()) {
-        uint32_t idx = pool::queued_slots.pop();
-        ts.AddTaskSetToPipe(&pool::task_data[idx]);
+    md_allocator_i* alloc = md_get_heap_allocator();
+    md_array(ID) queued = 0;
+
+    md_mutex_lock(&pool_storage.mutex);
+    queued = pool_storage.queued;
+    pool_storage.queued = 0;
+    md_mutex_unlock(&pool_storage.mutex);
+    for (size_t i = 0; i < md_array_size(queued); ++i) {
+        // The task may have completed since it was queued (submitted by task_wait_for), then its slot may hold another task by now
+        PoolTask* task = find_pool_task(queued[i]);
+        if (task && task->m_node.pending == 0) {
+            submit_pool_task(task);
+        }
     }
-    while (!main::queued_slots.was_empty()) {
-        uint32_t idx = main::queued_slots.pop();
-        ts.AddPinnedTask(&main::task_data[idx]);
+    md_array_free(queued, alloc);
+
+    md_mutex_lock(&main_storage.mutex);
+    queued = main_storage.queued;
+    main_storage.queued = 0;
+    md_mutex_unlock(&main_storage.mutex);
+    for (size_t i = 0; i < md_array_size(queued); ++i) {
+        MainTask* task = find_main_task(queued[i]);
+        if (task && task->m_node.pending == 0) {
+            ts.AddPinnedTask(task);
+        }
     }
+    md_array_free(queued, alloc);
+
     ts.RunPinnedTasks();
 }
 
-ID main_enqueue(str_t label, Task func, void* user_data, ID dependency) {
-    using namespace main;
-    uint32_t idx = free_slots.pop();
-
-    ID id = generate_id(idx);
-    MainTask* Task = &task_data[idx];
-    enki::ICompletable* dep_task = get_task(dependency);
-    PLACEMENT_NEW(Task) MainTask(func, user_data, label, id, dep_task);
+ID main_enqueue(str_t label, Task func, void* user_data, const ID* dependencies, size_t num_dependencies) {
+    uint32_t idx, generation;
+    while (!storage_alloc(main_storage, &idx, &generation)) {
+        std::this_thread::yield();
+    }
 
-    if (!dep_task) {
-        queued_slots.push(idx);
+    ID id = make_id(generation, idx, true);
+    MainTask* Task = slot_task(main_storage, idx);
+    md_mutex_lock(&graph_mutex);
+    PLACEMENT_NEW(Task) MainTask(func, user_data, label, id);
+    init_node(&Task->m_node, id, dependencies, num_dependencies);
+    md_mutex_unlock(&graph_mutex);
+    profiler::task_enqueue(id, label);
+
+    if (release_dependency(&Task->m_node)) {
+        Task->m_ready_time = md_time_current();
+        storage_queue(main_storage, id);
     }
     
     return id;
 }
 
+ID main_enqueue(str_t label, Task func, void* user_data, ID dependency) {
+    return main_enqueue(label, func, user_data, &dependency, dependency != INVALID_ID ? 1 : 0);
+}
+
 size_t pool_num_threads() { return ts.GetNumTaskThreads(); }
 
 ID* pool_running_tasks(md_allocator_i* alloc) {
     ASSERT(alloc);
     ID* arr = 0;
-    for (uint32_t i = 0; i < MAX_TASKS; ++i) {
-        if (pool::task_data[i].Running()) {
-            md_array_push(arr, pool::task_data[i].m_id, alloc);
+    const uint32_t num_slots = pool_storage.num_blocks * BLOCK_SIZE;
+    for (uint32_t i = 0; i < num_slots; ++i) {
+        std::atomic_uint32_t* generation;
+        PoolTask* task = slot_task(pool_storage, i, &generation);
+        if (task->Running()) {
+            md_array_push(arr, make_id(generation->load(), i, false), alloc);
         }
     }
     return arr;
 }
 
 void pool_interrupt_running_tasks() {
-    for (uint32_t i = 0; i < MAX_TASKS; ++i) {
-        if (pool::task_data[i].Running()) {
-            pool::task_data[i].m_interrupt = true;
+    const uint32_t num_slots = pool_storage.num_blocks * BLOCK_SIZE;
+    for (uint32_t i = 0; i < num_slots; ++i) {
+        PoolTask* task = slot_task(pool_storage, i);
+        if (task->Running()) {
+            task->m_interrupt = true;
         }
     }
 }
@@ -207,80 +551,161 @@ void pool_wait_for_completion() {
     ts.WaitforAll();
 }
 
-ID pool_enqueue(str_t label, Task func, void* user_data, ID dependency) {
-    using namespace pool;
-
-    uint32_t slot_idx = free_slots.pop();
-
-    ID id = generate_id(slot_idx);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    enki::ICompletable* dep_task = get_task(dependency);
-    PLACEMENT_NEW(Task) PoolTask(func, user_data, label, id, dep_task);
+// Allocates a pool task slot, waits for one if blocking and the storage is exhausted
+static bool pool_alloc(uint32_t* slot_idx, uint32_t* generation, bool blocking) {
+    while (!storage_alloc(pool_storage, slot_idx, generation)) {
+        if (!blocking) return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
 
-    if (!dep_task) {
-        queued_slots.push(slot_idx);
+static ID pool_init_task(uint32_t slot_idx, uint32_t generation, str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, CancellableRangeTask token_func, Task func, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority) {
+    ID id = make_id(generation, slot_idx, false);
+    PoolTask* task = slot_task(pool_storage, slot_idx);
+    const uint32_t lane = (uint32_t)priority;
+    md_mutex_lock(&graph_mutex);
+    if (range_func || token_func) {
+        PLACEMENT_NEW(task) PoolTask(range_beg, range_end, range_func, user_data, label, id, lane);
+        task->m_token_func = token_func;
+    } else {
+        PLACEMENT_NEW(task) PoolTask(func, user_data, label, id, lane);
+    }
+    init_node(&task->m_node, id, dependencies, num_dependencies);
+    md_mutex_unlock(&graph_mutex);
+    profiler::task_enqueue(id, label);
+
+    // Otherwise handed to the scheduler as soon as the last dependency completes
+    if (release_dependency(&task->m_node)) {
+        task->m_ready_time = md_time_current();
+        storage_queue(pool_storage, id);
     }
 
     return id;
 }
 
-ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, void* user_data, ID dependency) {
-    using namespace pool;
+ID pool_enqueue(str_t label, Task func, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority) {
+    uint32_t slot_idx, generation;
+    pool_alloc(&slot_idx, &generation, true);
+    return pool_init_task(slot_idx, generation, label, 0, 0, NULL, NULL, func, user_data, dependencies, num_dependencies, priority);
+}
 
-    uint32_t slot_idx = free_slots.pop();
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority) {
+    uint32_t slot_idx, generation;
+    pool_alloc(&slot_idx, &generation, true);
+    return pool_init_task(slot_idx, generation, label, range_beg, range_end, range_func, NULL, NULL, user_data, dependencies, num_dependencies, priority);
+}
 
-    ID id = generate_id(slot_idx);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    enki::ICompletable* dep_task = get_task(dependency);
-    PLACEMENT_NEW(Task) PoolTask(range_beg, range_end, range_func, user_data, label, id, dep_task);
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, CancellableRangeTask token_func, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority) {
+    uint32_t slot_idx, generation;
+    pool_alloc(&slot_idx, &generation, true);
+    return pool_init_task(slot_idx, generation, label, range_beg, range_end, NULL, token_func, NULL, user_data, dependencies, num_dependencies, priority);
+}
 
-    if (!dep_task) {
-        queued_slots.push(slot_idx);
-    }
+ID pool_enqueue(str_t label, Task func, void* user_data, ID dependency, Priority priority) {
+    return pool_enqueue(label, func, user_data, &dependency, dependency != INVALID_ID ? 1 : 0, priority);
+}
 
-    return id;
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, void* user_data, ID dependency, Priority priority) {
+    return pool_enqueue(label, range_beg, range_end, range_func, user_data, &dependency, dependency != INVALID_ID ? 1 : 0, priority);
+}
+
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, CancellableRangeTask token_func, void* user_data, ID dependency, Priority priority) {
+    return pool_enqueue(label, range_beg, range_end, token_func, user_data, &dependency, dependency != INVALID_ID ? 1 : 0, priority);
+}
+
+ID pool_try_enqueue(str_t label, Task func, void* user_data, ID dependency, Priority priority) {
+    uint32_t slot_idx, generation;
+    if (!pool_alloc(&slot_idx, &generation, false)) return INVALID_ID;
+    return pool_init_task(slot_idx, generation, label, 0, 0, NULL, NULL, func, user_data, &dependency, dependency != INVALID_ID ? 1 : 0, priority);
+}
+
+ID pool_try_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, void* user_data, ID dependency, Priority priority) {
+    uint32_t slot_idx, generation;
+    if (!pool_alloc(&slot_idx, &generation, false)) return INVALID_ID;
+    return pool_init_task(slot_idx, generation, label, range_beg, range_end, range_func, NULL, NULL, user_data, &dependency, dependency != INVALID_ID ? 1 : 0, priority);
+}
+
+ID pool_try_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, CancellableRangeTask token_func, void* user_data, ID dependency, Priority priority) {
+    uint32_t slot_idx, generation;
+    if (!pool_alloc(&slot_idx, &generation, false)) return INVALID_ID;
+    return pool_init_task(slot_idx, generation, label, range_beg, range_end, NULL, token_func, NULL, user_data, &dependency, dependency != INVALID_ID ? 1 : 0, priority);
+}
+
+void* payload_alloc(size_t size) {
+    void* ptr = md_alloc(md_get_heap_allocator(), size);
+    MEMSET(ptr, 0, size);
+    return ptr;
+}
+
+void payload_free(void* ptr, size_t size) {
+    md_free(md_get_heap_allocator(), ptr, size);
 }
 
 bool task_is_running(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    return Task->m_id == id ? Task->Running() : false;
+    PoolTask* Task = find_pool_task(id);
+    return Task ? Task->Running() : false;
 }
 
 str_t task_label(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    return Task->m_id == id ? Task->m_label : str_t{};
+    PoolTask* Task = find_pool_task(id);
+    return Task ? Task->m_label : str_t{};
 }
 
 float task_fraction_complete(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    return Task->m_id == id ? (float)Task->m_set_completed / (float)Task->m_SetSize : 0.f;
+    PoolTask* Task = find_pool_task(id);
+    return Task ? MIN(1.f, (float)Task->m_progress / (float)Task->m_SetSize) : 0.f;
+}
+
+// Waits for the dependencies of the task first, the last one to complete hands the task to the scheduler
+// Dependencies on main tasks are completed by the main thread, a worker waits for them while the main thread must not (it would never return)
+static void wait_for_pool_task(PoolTask* task) {
+    // A task which is still queued would never complete while the calling thread waits for it
+    task->m_lane = 0;
+
+    md_allocator_i* alloc = md_get_heap_allocator();
+    md_array(ID) dependencies = 0;
+    md_mutex_lock(&graph_mutex);
+    md_array_push_array(dependencies, task->m_node.dependencies, md_array_size(task->m_node.dependencies), alloc);
+    md_mutex_unlock(&graph_mutex);
+    for (size_t i = 0; i < md_array_size(dependencies); ++i) {
+        task_wait_for(dependencies[i]);
+    }
+    md_array_free(dependencies, alloc);
+
+    if (task->m_node.pending != 0) {
+        if (ts.GetThreadNum() == 0) {
+            ASSERT(false && "Waiting on the main thread for a task which depends on a main task");
+            MD_LOG_ERROR("Cannot wait for task '%.*s' on the main thread, it depends on a task of the main thread", (int)task->m_label.len, task->m_label.ptr);
+            return;
+        }
+        while (task->m_node.pending != 0) {
+            std::this_thread::yield();
+        }
+    }
+    submit_pool_task(task);
+    ts.WaitforTask(task);
 }
 
 void task_wait_for(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    if (Task->m_id == id && Task->Running()) {
-        ts.WaitforTask(Task);
+    PoolTask* Task = find_pool_task(id);
+    if (Task && Task->Running()) {
+        wait_for_pool_task(Task);
     }
 }
 
 void task_interrupt(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    if (Task->m_id == id) {
+    PoolTask* Task = find_pool_task(id);
+    if (Task) {
         Task->m_interrupt = true;
     }
 }
 
 void task_interrupt_and_wait_for(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    if (Task->m_id == id && Task->Running()) {
+    PoolTask* Task = find_pool_task(id);
+    if (Task && Task->Running()) {
         Task->m_interrupt = true;
-        ts.WaitforTask(Task);
+        wait_for_pool_task(Task);
     }
 }
 
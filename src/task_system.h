@@ -4,6 +4,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <atomic>
 //#include <functional>
 
 struct md_allocator_i;
@@ -19,6 +20,32 @@ constexpr ID INVALID_ID = 0;
 using Task = void (*)(void* user_data);
 using RangeTask = void (*)(uint32_t range_beg, uint32_t range_end, void* user_data);
 
+// Handed to cancellable range tasks, long running loops poll it for cancellation and report the items they complete.
+// Items of the range which are not reported are accounted for when the callback returns.
+struct Token {
+    const std::atomic_bool* interrupt;
+    std::atomic_uint32_t*   progress;
+    uint32_t                reported;
+};
+
+using CancellableRangeTask = void (*)(uint32_t range_beg, uint32_t range_end, void* user_data, Token* token);
+
+static inline bool token_cancelled(const Token* token) {
+    return token->interrupt->load(std::memory_order_relaxed);
+}
+
+static inline void token_progress(Token* token, uint32_t count = 1) {
+    token->reported += count;
+    token->progress->fetch_add(count, std::memory_order_relaxed);
+}
+
+// Priority lanes of the thread-pool, workers always pick work from the highest lane available.
+// Range tasks of the background lane yield to pending work of higher lanes between chunks of their range.
+// Interactive: Work the user is actively waiting for (orbital volumes, density maps etc.)
+// Normal:      Default
+// Background:  Long running work which may be starved (full evaluation, prefetching)
+enum class Priority { Interactive, Normal, Background };
+
 /*
 typedef void (*Task) (void* user_data);
 typedef void (*RangeTask)(uint32_t range_beg, uint32_t range_end, void *user_data);
@@ -40,8 +67,90 @@ void execute_task(ID);
 ID main_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0);
 
 // This is to generate tasks for the thread-pool (async operations)
-ID pool_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0);
-ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask task, void* user_data = 0, ID dependency = 0);
+ID pool_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0, Priority priority = Priority::Normal);
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask task, void* user_data = 0, ID dependency = 0, Priority priority = Priority::Normal);
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, CancellableRangeTask task, void* user_data = 0, ID dependency = 0, Priority priority = Priority::Normal);
+
+// Task graphs
+// A task may depend on any number of tasks (fan-in) and any number of tasks may depend on the same task (fan-out), so whole graphs are
+// built by enqueueing their nodes in order with the ids of the nodes they depend on. A task starts once all of its dependencies have completed,
+// dependencies which have already completed (and invalid ids) are ignored. Pool tasks are handed to the scheduler as soon as their last
+// dependency completes, so the stages of a graph overlap rather than waiting for the next call to execute_queued_tasks.
+ID main_enqueue(str_t label, Task task, void* user_data, const ID* dependencies, size_t num_dependencies);
+ID pool_enqueue(str_t label, Task task, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority = Priority::Normal);
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask task, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority = Priority::Normal);
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, CancellableRangeTask task, void* user_data, const ID* dependencies, size_t num_dependencies, Priority priority = Priority::Normal);
+
+// Zero initialized memory for the results handed between tasks
+void* payload_alloc(size_t size);
+void  payload_free(void* ptr, size_t size);
+
+// Pool task which produces a result of type T, which is then handed to a continuation on the main thread (e.g. to upload it to the GPU).
+// The continuation always runs, the result is zero initialized if the task was interrupted before it ran. T is expected to be a plain type.
+// Returns the id of the pool task.
+template <typename T>
+ID pool_enqueue_with_result(str_t label, void (*task)(T* result, void* user_data), void (*continuation)(T* result, void* user_data), void* user_data = 0, const ID* dependencies = 0, size_t num_dependencies = 0, Priority priority = Priority::Normal) {
+    struct Payload {
+        T result;
+        void (*task)(T* result, void* user_data);
+        void (*continuation)(T* result, void* user_data);
+        void* user_data;
+    };
+
+    Payload* payload = (Payload*)payload_alloc(sizeof(Payload));
+    payload->task = task;
+    payload->continuation = continuation;
+    payload->user_data = user_data;
+
+    ID id = pool_enqueue(label, [](void* data) {
+        Payload* payload = (Payload*)data;
+        payload->task(&payload->result, payload->user_data);
+    }, payload, dependencies, num_dependencies, priority);
+
+    main_enqueue(label, [](void* data) {
+        Payload* payload = (Payload*)data;
+        payload->continuation(&payload->result, payload->user_data);
+        payload_free(payload, sizeof(Payload));
+    }, payload, &id, 1);
+
+    return id;
+}
+
+// Range variant of pool_enqueue_with_result, the continuation runs once all partitions have completed.
+// The partitions share the result, so each partition is expected to write its own part of it or to use atomic members.
+template <typename T>
+ID pool_enqueue_with_result(str_t label, uint32_t range_beg, uint32_t range_end, void (*task)(uint32_t range_beg, uint32_t range_end, T* result, void* user_data, Token* token), void (*continuation)(T* result, void* user_data), void* user_data = 0, const ID* dependencies = 0, size_t num_dependencies = 0, Priority priority = Priority::Normal) {
+    struct Payload {
+        T result;
+        void (*task)(uint32_t range_beg, uint32_t range_end, T* result, void* user_data, Token* token);
+        void (*continuation)(T* result, void* user_data);
+        void* user_data;
+    };
+
+    Payload* payload = (Payload*)payload_alloc(sizeof(Payload));
+    payload->task = task;
+    payload->continuation = continuation;
+    payload->user_data = user_data;
+
+    ID id = pool_enqueue(label, range_beg, range_end, [](uint32_t range_beg, uint32_t range_end, void* data, Token* token) {
+        Payload* payload = (Payload*)data;
+        payload->task(range_beg, range_end, &payload->result, payload->user_data, token);
+    }, payload, dependencies, num_dependencies, priority);
+
+    main_enqueue(label, [](void* data) {
+        Payload* payload = (Payload*)data;
+        payload->continuation(&payload->result, payload->user_data);
+        payload_free(payload, sizeof(Payload));
+    }, payload, &id, 1);
+
+    return id;
+}
+
+// Same as pool_enqueue, but never blocks the calling thread.
+// Returns INVALID_ID if the task storage is exhausted, pool_enqueue would then wait for a running task to complete.
+ID pool_try_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0, Priority priority = Priority::Normal);
+ID pool_try_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask task, void* user_data = 0, ID dependency = 0, Priority priority = Priority::Normal);
+ID pool_try_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, CancellableRangeTask task, void* user_data = 0, ID dependency = 0, Priority priority = Priority::Normal);
 
 size_t pool_num_threads();
 
@@ -55,11 +164,15 @@ void pool_wait_for_completion();
 ID*  pool_running_tasks(md_allocator_i* alloc);
 
 // These are safe to call with an invalid id, in such case, they will just return some 'zero' default value
+// A task counts as running from the moment it is enqueued until it has completed
 bool  task_is_running(ID);
 str_t task_label(ID);
 float task_fraction_complete(ID);
 
 // These are safe to call with an invalid id, and in such case, they do nothing
+// Waiting for a task which has not yet been handed to the scheduler submits it right away, after waiting for the pool tasks it depends on
+// Waiting for a task raises it to the interactive lane, a task should therefore never wait for a task of a lower lane from within itself
+// The main thread cannot wait for a task which depends on a main task that has not yet run (asserts), the pool threads can
 void task_wait_for(ID);
 void task_interrupt(ID);
 void task_interrupt_and_wait_for(ID);
@@ -12,22 +12,27 @@
 #include <gfx/camera_utils.h>
 #include <gfx/view_param.h>
 #include <gfx/postprocessing_utils.h>
+#include <gfx/gpu_profiler.h>
 #include <task_system.h>
+#include <profiler.h>
 
 #include <implot.h>
 
 #include <stdint.h>
 #include <stddef.h>
+#include <atomic>
+
+namespace load {
+namespace traj {
+struct PrepareProgress;
+}
+}
 
 #define JITTER_SEQUENCE_SIZE 8
 
 // For cpu profiling
-#define PUSH_CPU_SECTION(lbl) {};
-#define POP_CPU_SECTION() {};
-
-// For gpu profiling
-#define PUSH_GPU_SECTION(lbl) { if (glPushDebugGroup) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, GL_KHR_debug, -1, lbl); }
-#define POP_GPU_SECTION()     { if (glPopDebugGroup) glPopDebugGroup(); }
+#define PUSH_CPU_SECTION(lbl) { profiler::push_section(lbl); }
+#define POP_CPU_SECTION()     { profiler::pop_section(); }
 
 enum class PlaybackMode { Stopped, Playing };
 enum class InterpolationMode { Nearest, Linear, CubicSpline };
@@ -120,6 +125,9 @@ struct LoadDatasetWindowState {
     bool atom_format_valid = false;
     int  loader_idx = -1;
     int  atom_format_idx = -1;
+    double traj_beg_time = 0;
+    double traj_end_time = 0;
+    int    traj_stride = 1;
 };
 
 // Hint flags for operations to be performed for the files
@@ -291,6 +299,18 @@ struct ApplicationState {
         char workspace[1024]  = {0};
 
         bool coarse_grained = false;
+
+        // Subset of the trajectory frames which was loaded
+        double traj_beg_time = 0;
+        double traj_end_time = 0;
+        int    traj_stride = 1;
+
+        md_timestamp_t open_trajectory_start = 0;
+        load::traj::PrepareProgress* open_trajectory_progress = NULL;    // Owned by the open task
+
+        // Follow mode, poll the trajectory for frames appended by a running simulation
+        bool follow_trajectory = false;
+        md_timestamp_t follow_last_poll = 0;
     } files;
 
     // The idea for the file load queue is to fill it with files that are dropped onto the application
@@ -324,6 +344,8 @@ struct ApplicationState {
     // --- MDLIB DATA ---
     struct {
         md_allocator_i*     mol_alloc = nullptr;
+        md_allocator_i*     topology_alloc = nullptr;    // Bonds, connectivity and structures computed on the thread pool
+        md_timestamp_t      compute_bonds_start = 0;
         md_gl_shaders_t     gl_shaders = {};
         md_gl_shaders_t     gl_shaders_lean_and_mean = {};
         md_gl_molecule_t    gl_mol = {};
@@ -347,8 +369,12 @@ struct ApplicationState {
     struct {
         task_system::ID backbone_computations = task_system::INVALID_ID;
         task_system::ID prefetch_frames = task_system::INVALID_ID;
+        task_system::ID scrub_frames = task_system::INVALID_ID;
         task_system::ID evaluate_full = task_system::INVALID_ID;
         task_system::ID evaluate_filt = task_system::INVALID_ID;
+        task_system::ID open_trajectory = task_system::INVALID_ID;
+        task_system::ID compute_bonds = task_system::INVALID_ID;
+        task_system::ID export_trajectory = task_system::INVALID_ID;
     } tasks;
 
     // --- ATOM SELECTION ---
@@ -418,6 +444,32 @@ struct ApplicationState {
         InterpolationMode interpolation = InterpolationMode::CubicSpline;
         PlaybackMode mode = PlaybackMode::Stopped;
 
+        bool loop = false;  // Playback wraps around at the ends of the trajectory
+
+        // Rolling prefetch window, counted in steps along the playback direction from the anchor frame
+        // The anchor follows the playhead and the window is extended as it moves, ranges which fall behind it are cancelled
+        struct {
+            uint32_t anchor = 0;
+            uint32_t ahead = 0;         // Steps from the anchor which have been requested
+            uint32_t num_frames = 0;    // Number of frames the steps wrap around at when looping
+            bool reverse = false;
+            bool loop = false;
+            struct {
+                task_system::ID id = task_system::INVALID_ID;
+                uint32_t end = 0;       // Steps from the anchor where the range of the task ends
+            } tasks[8];
+        } prefetch;
+
+        bool scrub_pending = false;     // A stand-in frame is shown while the frames for the current time are fetched
+
+        // Frames wanted for display while scrubbing, ordered by importance (-1 = None)
+        struct {
+            std::atomic_int64_t  wanted[4] = {{-1}, {-1}, {-1}, {-1}};
+            std::atomic_uint32_t generation = {0};  // Incremented when the wanted frames change
+            std::atomic_uint32_t served = {0};      // Generation which the latest fetch serves
+            std::atomic_int32_t  fetches = {0};     // Fetches in flight
+        } scrub;
+
         bool show_window = true;
     } animation;
 
@@ -615,8 +667,26 @@ struct ApplicationState {
         bool unwrap_structures = false;
     } operations;
 
+    // Export to the native trajectory format (vtraj)
+    struct {
+        bool selection_only = false;
+        int  stride = 1;
+    } trajectory_export;
+
     struct {
         bool keep_representations = false;
+
+        struct {
+            bool  auto_budget = false;
+            int   budget_mb = 0;
+            bool  compress = false;
+            float precision = 0.01f;
+        } frame_cache;
+
+        struct {
+            char dir[1024] = "";
+            int  size_limit_mb = 16384;
+        } frame_spill;
     } settings;
 
     struct {
@@ -632,6 +702,13 @@ struct ApplicationState {
             md_backbone_angles_t* data = nullptr;
             uint64_t fingerprint = 0;
         } backbone_angles;
+        // View of the residues which form the backbone, so the backbone computations do not read the full system (solvent etc.) through the cache
+        struct {
+            md_trajectory_i* traj = nullptr;
+            md_molecule_t    mol = {};     // Compacted molecule of the view, its backbone matches the one of the full molecule
+            md_allocator_i*  alloc = nullptr;
+            size_t           num_frames = 0;
+        } backbone_view;
     } trajectory_data;
 
     struct {
@@ -659,6 +736,7 @@ struct ApplicationState {
         bool eval_init = false;
         bool evaluate_full = false;
         bool evaluate_filt = false;
+        size_t eval_num_frames = 0;     // Number of frames which full_eval has been (or is being) evaluated for
         double time_since_last_change = 0.0;
         uint64_t ir_fingerprint = 0;
     } script;